@@ -0,0 +1,69 @@
+//=============================================================================
+// FILE:
+//      bench_checksum.c
+//
+// DESCRIPTION:
+//      Benchmark kernel: Adler-32, Fletcher-16 and an 8-bit additive checksum
+//      over a pseudo-random buffer. Used by utils/run_benchmarks.py to measure
+//      the run-time overhead of the obfuscating passes.
+//
+//      Usage: bench_checksum [iterations]
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUF_SIZE (64 * 1024)
+
+static uint8_t Buf[BUF_SIZE];
+
+static void fill(uint32_t seed) {
+  // Linear congruential generator
+  uint32_t x = seed;
+  for (int i = 0; i < BUF_SIZE; i++) {
+    x = x * 1103515245u + 12345u;
+    Buf[i] = (uint8_t)(x >> 16);
+  }
+}
+
+static uint32_t adler32(const uint8_t *data, int len) {
+  uint32_t a = 1, b = 0;
+  for (int i = 0; i < len; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+}
+
+static uint16_t fletcher16(const uint8_t *data, int len) {
+  uint16_t sum1 = 0, sum2 = 0;
+  for (int i = 0; i < len; i++) {
+    sum1 = (sum1 + data[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (uint16_t)(sum2 << 8) | sum1;
+}
+
+static uint8_t sum8(const uint8_t *data, int len) {
+  uint8_t sum = 0;
+  for (int i = 0; i < len; i++)
+    sum = (uint8_t)(sum + data[i] - (uint8_t)i);
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 500;
+
+  uint32_t result = 0;
+  for (int i = 0; i < iterations; i++) {
+    fill((uint32_t)i);
+    result ^= adler32(Buf, BUF_SIZE);
+    result += fletcher16(Buf, BUF_SIZE);
+    result -= sum8(Buf, BUF_SIZE);
+  }
+
+  printf("checksum: %08x\n", result);
+  return 0;
+}
@@ -0,0 +1,70 @@
+//=============================================================================
+// FILE:
+//      bench_hash.c
+//
+// DESCRIPTION:
+//      Benchmark kernel: FNV-1a and a Murmur3-style mixer over a pseudo-random
+//      buffer. Used by utils/run_benchmarks.py to measure the run-time overhead
+//      of the obfuscating passes.
+//
+//      Usage: bench_hash [iterations]
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUF_SIZE (64 * 1024)
+
+static uint8_t Buf[BUF_SIZE];
+
+static void fill(uint32_t seed) {
+  // xorshift32
+  uint32_t x = seed | 1;
+  for (int i = 0; i < BUF_SIZE; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    Buf[i] = (uint8_t)x;
+  }
+}
+
+static uint32_t fnv1a(const uint8_t *data, int len, uint32_t h) {
+  for (int i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t murmur_mix(const uint8_t *data, int len, uint32_t h) {
+  for (int i = 0; i + 4 <= len; i += 4) {
+    uint32_t k = (uint32_t)data[i] | (uint32_t)data[i + 1] << 8 |
+                 (uint32_t)data[i + 2] << 16 | (uint32_t)data[i + 3] << 24;
+    k *= 0xcc9e2d51u;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1b873593u;
+    h ^= k;
+    h = (h << 13) | (h >> 19);
+    h = h * 5 + 0xe6546b64u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+  fill(42);
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < iterations; i++) {
+    h = fnv1a(Buf, BUF_SIZE, h);
+    h = murmur_mix(Buf, BUF_SIZE, h);
+  }
+
+  printf("checksum: %08x\n", h);
+  return 0;
+}
@@ -0,0 +1,86 @@
+//=============================================================================
+// FILE:
+//      bench_sort.c
+//
+// DESCRIPTION:
+//      Benchmark kernel: quicksort (with an insertion sort cut-off) of
+//      pseudo-random integer arrays. Used by utils/run_benchmarks.py to
+//      measure the run-time overhead of the obfuscating passes.
+//
+//      Usage: bench_sort [iterations]
+//
+// License: MIT
+//=============================================================================
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_ELEMS 8192
+
+static int32_t Data[NUM_ELEMS];
+
+static void insertion_sort(int32_t *a, int lo, int hi) {
+  for (int i = lo + 1; i <= hi; i++) {
+    int32_t v = a[i];
+    int j = i - 1;
+    while (j >= lo && a[j] > v) {
+      a[j + 1] = a[j];
+      j--;
+    }
+    a[j + 1] = v;
+  }
+}
+
+static void quick_sort(int32_t *a, int lo, int hi) {
+  while (hi - lo > 16) {
+    int32_t pivot = a[lo + (hi - lo) / 2];
+    int i = lo, j = hi;
+    while (i <= j) {
+      while (a[i] < pivot)
+        i++;
+      while (a[j] > pivot)
+        j--;
+      if (i <= j) {
+        int32_t t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+        i++;
+        j--;
+      }
+    }
+    // Recurse into the smaller half, iterate over the larger one
+    if (j - lo < hi - i) {
+      quick_sort(a, lo, j);
+      lo = i;
+    } else {
+      quick_sort(a, i, hi);
+      hi = j;
+    }
+  }
+  insertion_sort(a, lo, hi);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 500;
+
+  uint32_t checksum = 0;
+  uint32_t x = 1;
+  for (int i = 0; i < iterations; i++) {
+    for (int k = 0; k < NUM_ELEMS; k++) {
+      x = x * 1664525u + 1013904223u;
+      Data[k] = (int32_t)(x >> 1) - (1 << 30);
+    }
+
+    quick_sort(Data, 0, NUM_ELEMS - 1);
+
+    for (int k = 1; k < NUM_ELEMS; k++)
+      if (Data[k - 1] > Data[k]) {
+        printf("error: array not sorted\n");
+        return 1;
+      }
+    checksum = checksum * 31 + (uint32_t)Data[i % NUM_ELEMS];
+  }
+
+  printf("checksum: %08x\n", checksum);
+  return 0;
+}
@@ -0,0 +1,80 @@
+//=============================================================================
+// FILE:
+//      contention_calls.c
+//
+// DESCRIPTION:
+//      Benchmark kernel: every thread calls a small leaf function of its own
+//      in a tight loop. Used by utils/run_benchmarks.py (the `contention`
+//      suite) to measure how the call counters injected by DynamicCallCounter
+//      scale with the number of threads. Thread N calls `leafN`, so the
+//      counters are never shared between threads (up to 64 threads), but
+//      unless padded, neighbouring counters share a cache line.
+//
+//      Usage: contention_calls [threads] [calls per thread]
+//
+// License: MIT
+//=============================================================================
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 64
+
+#define LEAF(N)                                                                \
+  __attribute__((noinline)) static uint32_t leaf##N(uint32_t x) {             \
+    return x * 2654435761u + N;                                                \
+  }
+#define LEAF8(N)                                                               \
+  LEAF(N##0) LEAF(N##1) LEAF(N##2) LEAF(N##3)                                  \
+  LEAF(N##4) LEAF(N##5) LEAF(N##6) LEAF(N##7)
+LEAF8(1) LEAF8(2) LEAF8(3) LEAF8(4) LEAF8(5) LEAF8(6) LEAF8(7) LEAF8(8)
+
+#define REF8(N)                                                                \
+  leaf##N##0, leaf##N##1, leaf##N##2, leaf##N##3, leaf##N##4, leaf##N##5,      \
+      leaf##N##6, leaf##N##7
+static uint32_t (*const Leaves[MAX_THREADS])(uint32_t) = {
+    REF8(1), REF8(2), REF8(3), REF8(4), REF8(5), REF8(6), REF8(7), REF8(8)};
+
+static long CallsPerThread;
+
+struct Worker {
+  pthread_t Thread;
+  int Id;
+  uint32_t Result;
+};
+
+static void *work(void *arg) {
+  struct Worker *w = (struct Worker *)arg;
+  uint32_t (*leaf)(uint32_t) = Leaves[w->Id];
+  uint32_t x = (uint32_t)w->Id;
+  for (long i = 0; i < CallsPerThread; i++)
+    x = leaf(x);
+  w->Result = x;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int threads = argc > 1 ? atoi(argv[1]) : 1;
+  CallsPerThread = argc > 2 ? atol(argv[2]) : 10000000;
+  if (threads < 1 || threads > MAX_THREADS) {
+    fprintf(stderr, "error: the number of threads must be in [1, %d]\n",
+            MAX_THREADS);
+    return 1;
+  }
+
+  struct Worker workers[MAX_THREADS];
+  for (int i = 0; i < threads; i++) {
+    workers[i].Id = i;
+    pthread_create(&workers[i].Thread, NULL, work, &workers[i]);
+  }
+
+  uint32_t h = 0;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i].Thread, NULL);
+    h ^= workers[i].Result;
+  }
+
+  printf("checksum: %08x\n", h);
+  return 0;
+}
@@ -0,0 +1,126 @@
+//==============================================================================
+// FILE:
+//    BallLarus.h
+//
+// DESCRIPTION:
+//    Declares BallLarusDAG - the Ball-Larus numbering of the acyclic paths in
+//    a function, shared by the PathProfiler pass and the `pathprof` tool.
+//
+//    Every back edge, v -> w, is removed from the CFG and replaced with two
+//    dummy edges: ENTRY -> w and v -> EXIT, where ENTRY and EXIT are virtual
+//    nodes (ENTRY is connected to the entry block, every block without
+//    successors is connected to EXIT). The result is a DAG in which every
+//    path from ENTRY to EXIT corresponds to an acyclic path through the
+//    function, i.e. a path that:
+//      * starts either at the entry block or at a loop header (after a back
+//        edge), and
+//      * ends either at an exit block or at a back edge.
+//    Every edge, e, is then assigned a value, Val(e), so that the sum of the
+//    values along every ENTRY -> EXIT path is unique and in the range
+//    [0, NumPaths). At run-time, that sum is accumulated in a single register
+//    (see PathProfiler.cpp). Given a path ID, decodePath walks the DAG
+//    from ENTRY and at every node picks the edge with the largest value that
+//    does not exceed the remaining ID.
+//
+//    The numbering is deterministic, i.e. it only depends on the input IR.
+//    The hash (see getHash) is used to make sure that a profile and the IR
+//    match.
+//
+//    Reference:
+//      T. Ball, J. R. Larus, "Efficient Path Profiling", MICRO 1996
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_BALL_LARUS_H
+#define LLVM_TUTOR_BALL_LARUS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+
+#include <cstdint>
+#include <vector>
+
+struct BLEdge {
+  enum EdgeKind {
+    // ENTRY -> the entry block
+    FunctionEntry,
+    // An edge from the CFG (that's not a back edge)
+    Normal,
+    // A block without successors -> EXIT
+    FunctionExit,
+    // The dummy ENTRY -> w edge for a back edge v -> w
+    LoopEntry,
+    // The dummy v -> EXIT edge for a back edge v -> w
+    LoopExit,
+  };
+
+  EdgeKind Kind;
+  // The source block, nullptr for ENTRY
+  llvm::BasicBlock *Src;
+  // The destination block, nullptr for EXIT
+  llvm::BasicBlock *Dst;
+  // Ball-Larus edge value
+  uint64_t Val = 0;
+};
+
+// A back edge in the CFG, Src -> Dst
+struct BLBackEdge {
+  llvm::BasicBlock *Src;
+  llvm::BasicBlock *Dst;
+  // Val(Src -> EXIT), i.e. what to add to the path register to end the path
+  uint64_t ExitVal;
+  // Val(ENTRY -> Dst), i.e. the initial value of the path register for the
+  // path that starts at Dst
+  uint64_t EntryVal;
+};
+
+class BallLarusDAG {
+public:
+  // Paths IDs are kept in 64-bit registers, functions with more paths than
+  // this are not supported
+  static constexpr uint64_t MaxPaths = uint64_t(1) << 62;
+
+  explicit BallLarusDAG(llvm::Function &F);
+
+  // False if the number of paths exceeds MaxPaths
+  bool isValid() const { return Valid; }
+  uint64_t getNumPaths() const { return NumPaths; }
+  uint64_t getHash() const { return Hash; }
+
+  // The edges of the DAG
+  llvm::ArrayRef<BLEdge> edges() const { return Edges; }
+  llvm::ArrayRef<BLBackEdge> backEdges() const { return BackEdges; }
+
+  // Maps a path ID back to the sequence of basic blocks. StartsAtLoopHeader
+  // is set if the path starts after a back edge (rather than at the entry
+  // block), EndsWithBackEdge if it ends with a back edge (rather than at an
+  // exit block). Returns false if Id is not a valid path ID.
+  bool decodePath(uint64_t Id, llvm::SmallVectorImpl<llvm::BasicBlock *> &Path,
+                  bool &StartsAtLoopHeader, bool &EndsWithBackEdge) const;
+
+private:
+  // Node 0 is ENTRY, node 1 is EXIT, the reachable blocks follow (in the
+  // layout order)
+  static constexpr unsigned EntryNode = 0;
+  static constexpr unsigned ExitNode = 1;
+
+  std::vector<BLEdge> Edges;
+  std::vector<BLBackEdge> BackEdges;
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> NodeIdx;
+  // The outgoing edges of every node, in the order of increasing values
+  std::vector<llvm::SmallVector<unsigned, 4>> OutEdges;
+  uint64_t NumPaths = 0;
+  uint64_t Hash = 0;
+  bool Valid = true;
+
+  unsigned getSrcNode(const BLEdge &E) const {
+    return E.Src ? NodeIdx.lookup(E.Src) : EntryNode;
+  }
+  unsigned getDstNode(const BLEdge &E) const {
+    return E.Dst ? NodeIdx.lookup(E.Dst) : ExitNode;
+  }
+};
+
+#endif
@@ -0,0 +1,31 @@
+//==============================================================================
+// FILE:
+//    BlockLayout.h
+//
+// DESCRIPTION:
+//    Declares the BlockLayout pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_BLOCK_LAYOUT_H
+#define LLVM_TUTOR_BLOCK_LAYOUT_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct BlockLayout : public llvm::PassInfoMixin<BlockLayout> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
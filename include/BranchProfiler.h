@@ -0,0 +1,47 @@
+//==============================================================================
+// FILE:
+//    BranchProfiler.h
+//
+// DESCRIPTION:
+//    Declares the BranchProfiler pass for the new pass manager and the order
+//    of the counters that it records.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_BRANCH_PROFILER_H
+#define LLVM_TUTOR_BRANCH_PROFILER_H
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time
+#define BRANCH_PROFILER_FILE_ENV_VAR "LLVM_TUTOR_BRANCHPROF_FILE"
+
+// The branches with a counter per successor, i.e. the conditional branches and
+// the switches (with at least one case). The counters of a function are the
+// entry count followed by the counters of every such branch (one per
+// successor, in the order of the successors), in the order of the function.
+inline bool isProfiledBranch(const llvm::Instruction &Term) {
+  return (llvm::isa<llvm::BranchInst>(Term) ||
+          llvm::isa<llvm::SwitchInst>(Term)) &&
+         Term.getNumSuccessors() > 1;
+}
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct BranchProfiler : public llvm::PassInfoMixin<BranchProfiler> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
@@ -0,0 +1,105 @@
+//==============================================================================
+// FILE:
+//    CFGSpanningTree.h
+//
+// DESCRIPTION:
+//    Declares CFGSpanningTree - the counter placement used by the EdgeProfiler
+//    pass (and the tools that read its output).
+//
+//    The CFG of a function is extended with a virtual node, V, with an edge
+//    from V to the entry block and an edge from every exit block (i.e. a block
+//    without successors) to V. Every node of such a graph satisfies the flow
+//    conservation law: the sum of the counts of the incoming edges is equal to
+//    the sum of the counts of the outgoing edges. Hence, given a spanning tree
+//    of the graph, it is sufficient to count the edges that are _not_ in the
+//    tree - the counts for the remaining (tree) edges can be reconstructed.
+//    To minimise the overhead, CFGSpanningTree computes a _maximum_ spanning
+//    tree, where every edge is weighted with its estimated execution
+//    frequency (from BlockFrequencyInfo and BranchProbabilityInfo).
+//
+//    The placement is deterministic, i.e. it only depends on the input IR.
+//    That's what allows reconstructing the full profile offline: load the
+//    (uninstrumented) IR, rebuild the spanning tree and combine it with the
+//    counters. The CFG hash (see getCFGHash) is used to make sure that the IR
+//    and the counters match.
+//
+//    Only blocks reachable from the entry block are taken into account (the
+//    remaining blocks are never executed). Functions with exception handling
+//    or indirect branches are not supported (see isSupported).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_CFG_SPANNING_TREE_H
+#define LLVM_TUTOR_CFG_SPANNING_TREE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/IR/Function.h"
+
+#include <cstdint>
+#include <vector>
+
+struct CFGEdge {
+  // The source block, nullptr for the virtual edge into the entry block
+  llvm::BasicBlock *Src;
+  // The destination block, nullptr for the virtual edges out of exit blocks
+  llvm::BasicBlock *Dst;
+  // The estimated execution frequency
+  uint64_t Weight;
+  // Is this edge part of the spanning tree?
+  bool InTree = false;
+  // The index of the counter for this edge (only for edges not in the tree)
+  unsigned Counter = ~0U;
+};
+
+class CFGSpanningTree {
+public:
+  CFGSpanningTree(llvm::Function &F, llvm::BlockFrequencyInfo &BFI,
+                  llvm::BranchProbabilityInfo &BPI);
+
+  // Can F be instrumented? Functions with EH pads or indirect branches are
+  // not supported (their critical edges can't be split).
+  static bool isSupported(const llvm::Function &F);
+
+  llvm::ArrayRef<CFGEdge> edges() const { return Edges; }
+  // The blocks reachable from the entry block (in the layout order)
+  llvm::ArrayRef<llvm::BasicBlock *> blocks() const { return Blocks; }
+  // The number of edges that need a counter (i.e. that are not in the tree)
+  unsigned getNumCounters() const { return NumCounters; }
+  // A hash of the CFG and of the placement of the counters
+  uint64_t getCFGHash() const { return CFGHash; }
+
+  // A hash of the CFG alone (i.e. the blocks and the edges between them).
+  // Used by the profiles that don't depend on the placement of the counters.
+  static uint64_t getStructuralHash(const llvm::Function &F);
+
+  // Reconstructs the execution counts of all the edges (in the order of
+  // edges()) from the counters of the non-tree edges. Returns false if the
+  // counters don't satisfy the flow conservation law (e.g. because the
+  // program exited from within this function), in which case the
+  // reconstructed counts are only approximate.
+  bool computeEdgeCounts(llvm::ArrayRef<uint64_t> Counters,
+                         std::vector<uint64_t> &EdgeCounts) const;
+
+  // Computes the execution count of every reachable basic block (i.e. the sum
+  // of the counts of its incoming edges).
+  void computeBlockCounts(
+      llvm::ArrayRef<uint64_t> EdgeCounts,
+      llvm::DenseMap<const llvm::BasicBlock *, uint64_t> &BlockCounts) const;
+
+private:
+  std::vector<CFGEdge> Edges;
+  std::vector<llvm::BasicBlock *> Blocks;
+  unsigned NumCounters = 0;
+  uint64_t CFGHash = 0;
+  // Block <--> node index (0 is reserved for the virtual node, i.e.
+  // Blocks[I] is node I + 1)
+  llvm::DenseMap<const llvm::BasicBlock *, unsigned> NodeIdx;
+  unsigned NumNodes = 1;
+
+  unsigned getNode(const llvm::BasicBlock *BB) const;
+};
+
+#endif
@@ -0,0 +1,48 @@
+//==============================================================================
+// FILE:
+//    CounterPromotion.h
+//
+// DESCRIPTION:
+//    Declares the CounterPromotion pass for the new pass manager. Also defines
+//    the helpers that the instrumentation passes use to mark their arrays of
+//    counters as safe to promote.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_COUNTER_PROMOTION_H
+#define LLVM_TUTOR_COUNTER_PROMOTION_H
+
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The metadata attached to the global arrays of counters that are only ever
+// updated with `store (add (load Ptr), Step), Ptr` and only read when the
+// profile is written
+#define PROFILE_COUNTERS_MD "llvm-tutor.counters"
+
+inline void markAsProfileCounters(llvm::GlobalVariable &Counters) {
+  Counters.setMetadata(PROFILE_COUNTERS_MD,
+                       llvm::MDNode::get(Counters.getContext(), {}));
+}
+
+inline bool isProfileCounters(const llvm::Value *V) {
+  auto *GV = llvm::dyn_cast_or_null<llvm::GlobalVariable>(V);
+  return GV && GV->getMetadata(PROFILE_COUNTERS_MD);
+}
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct CounterPromotion : public llvm::PassInfoMixin<CounterPromotion> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
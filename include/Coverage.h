@@ -0,0 +1,35 @@
+//==============================================================================
+// FILE:
+//    Coverage.h
+//
+// DESCRIPTION:
+//    Declares the Coverage pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_COVERAGE_H
+#define LLVM_TUTOR_COVERAGE_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The name of the environment variable that overrides the location of the
+// coverage map at run-time
+#define COVERAGE_FILE_ENV_VAR "LLVM_TUTOR_COVERAGE_FILE"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct Coverage : public llvm::PassInfoMixin<Coverage> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
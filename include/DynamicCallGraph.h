@@ -0,0 +1,41 @@
+//==============================================================================
+// FILE:
+//    DynamicCallGraph.h
+//
+// DESCRIPTION:
+//    Declares the DynamicCallGraph pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_DYNAMIC_CALL_GRAPH_H
+#define LLVM_TUTOR_DYNAMIC_CALL_GRAPH_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time
+#define DYNAMIC_CG_FILE_ENV_VAR "LLVM_TUTOR_CALLGRAPH_FILE"
+
+// The pseudo-nodes of the call graph: the callee of an indirect call that
+// wasn't instrumented (e.g. a function from libc) and the calls that did not
+// fit into the hash table
+#define DYNAMIC_CG_EXTERNAL_NODE "<external>"
+#define DYNAMIC_CG_LOST_NODE "<lost>"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct DynamicCallGraph : public llvm::PassInfoMixin<DynamicCallGraph> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+//==============================================================================
+// FILE:
+//    FunctionTimer.h
+//
+// DESCRIPTION:
+//    Declares the FunctionTimer pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_FUNCTION_TIMER_H
+#define LLVM_TUTOR_FUNCTION_TIMER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The counters recorded for every function (in this order)
+enum FunctionTimerCounter : unsigned {
+  FUNC_TIMER_CALLS = 0,
+  FUNC_TIMER_INCLUSIVE = 1,
+  FUNC_TIMER_EXCLUSIVE = 2,
+  FUNC_TIMER_NUM_COUNTERS = 3
+};
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct FunctionTimer : public llvm::PassInfoMixin<FunctionTimer> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
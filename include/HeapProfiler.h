@@ -0,0 +1,32 @@
+//==============================================================================
+// FILE:
+//    HeapProfiler.h
+//
+// DESCRIPTION:
+//    Declares the HeapProfiler pass for the new pass manager. The interface
+//    with the runtime is described in TutorHeapProf.h.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_HEAP_PROFILER_H
+#define LLVM_TUTOR_HEAP_PROFILER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct HeapProfiler : public llvm::PassInfoMixin<HeapProfiler> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
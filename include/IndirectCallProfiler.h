@@ -0,0 +1,56 @@
+//==============================================================================
+// FILE:
+//    IndirectCallProfiler.h
+//
+// DESCRIPTION:
+//    Declares the IndirectCallProfiler pass for the new pass manager and the
+//    numbering of indirect call sites shared with IndirectCallPromotion.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_INDIRECT_CALL_PROFILER_H
+#define LLVM_TUTOR_INDIRECT_CALL_PROFILER_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time
+#define ICALL_PROF_FILE_ENV_VAR "LLVM_TUTOR_ICALLPROF_FILE"
+
+// The name recorded for the targets that are not defined in (or declared by)
+// the instrumented module
+#define ICALL_PROF_UNKNOWN_TARGET "<unknown>"
+
+// Returns the indirect call sites in F. Within a function, the sites are
+// identified by their position in this list (i.e. in the order in which
+// they appear in F), which is how the profile is matched with the module.
+inline llvm::SmallVector<llvm::CallBase *, 8>
+getIndirectCallSites(llvm::Function &F) {
+  llvm::SmallVector<llvm::CallBase *, 8> Sites;
+  for (llvm::Instruction &I : llvm::instructions(F))
+    if (auto *CB = llvm::dyn_cast<llvm::CallBase>(&I))
+      if (CB->isIndirectCall())
+        Sites.push_back(CB);
+  return Sites;
+}
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct IndirectCallProfiler : public llvm::PassInfoMixin<IndirectCallProfiler> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
@@ -0,0 +1,32 @@
+//==============================================================================
+// FILE:
+//    IndirectCallPromotion.h
+//
+// DESCRIPTION:
+//    Declares the IndirectCallPromotion pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_INDIRECT_CALL_PROMOTION_H
+#define LLVM_TUTOR_INDIRECT_CALL_PROMOTION_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct IndirectCallPromotion
+    : public llvm::PassInfoMixin<IndirectCallPromotion> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
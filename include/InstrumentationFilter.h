@@ -0,0 +1,112 @@
+//==============================================================================
+// FILE:
+//    InstrumentationFilter.h
+//
+// DESCRIPTION:
+//    Declares InstrumentationFilter - selects the functions instrumented by
+//    DynamicCallCounter and InjectFuncCall.
+//
+//    A function is skipped if:
+//      * there's an allow list and the function doesn't match it,
+//      * the function matches the deny list (which takes precedence),
+//      * the function is trivial, i.e. a small leaf function (see below).
+//    The lists are text files with one pattern per line. The patterns are
+//    globs (e.g. `get*`) matched against the whole function name, unless
+//    prefixed with `re:`, in which case they are regular expressions (e.g.
+//    `re:^_ZN.*3get`). Empty lines and lines starting with `#` are ignored.
+//
+//    Small leaf functions (e.g. getters) are often the most frequently called
+//    functions in a program, so instrumenting them costs the most and tells
+//    the least. A function is trivial if it has at most LeafInsts
+//    instructions and every function that it calls is trivial too, as long as
+//    the calls are at most LeafDepth levels deep. With LeafDepth=0 only the
+//    functions that don't call anything qualify. Calls to intrinsics don't
+//    count, calls to declarations and indirect calls do (they may do
+//    anything).
+//
+//    The counts of the instrumented and the skipped functions are kept, so
+//    that the passes can report them (see printSummary).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_INSTRUMENTATION_FILTER_H
+#define LLVM_TUTOR_INSTRUMENTATION_FILTER_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct InstrumentationFilterOptions {
+  // The allow list (empty to allow all the functions)
+  std::string AllowList;
+  // The deny list (empty to deny none)
+  std::string DenyList;
+  // The maximum size of a trivial function (0 to instrument all of them)
+  unsigned LeafInsts = 0;
+  // How deep the calls from a trivial function may go
+  unsigned LeafDepth = 0;
+};
+
+class InstrumentationFilter {
+public:
+  enum class Decision { Instrument, NotAllowed, Denied, Trivial };
+
+  // Reads the lists. Returns an error message on failure (and an empty string
+  // on success).
+  std::string init(const InstrumentationFilterOptions &Opts);
+
+  // Decides whether to instrument F (and counts the decision)
+  Decision classify(const llvm::Function &F);
+  bool shouldInstrument(const llvm::Function &F) {
+    return classify(F) == Decision::Instrument;
+  }
+
+  // Is anything filtered out?
+  bool isActive() const {
+    return !Allow.empty() || !Deny.empty() || Opts.LeafInsts;
+  }
+
+  unsigned getNumInstrumented() const { return NumInstrumented; }
+  unsigned getNumSkipped() const {
+    return NumNotAllowed + NumDenied + NumTrivial;
+  }
+
+  // Prints e.g. "dynamic-cc: instrumented 3 of 5 functions (skipped: 1 not
+  // allowed, 0 denied, 1 trivial)"
+  void printSummary(llvm::raw_ostream &OS, llvm::StringRef PassName) const;
+
+private:
+  // A glob or (with `re:`) a regular expression
+  struct Pattern {
+    std::unique_ptr<llvm::GlobPattern> Glob;
+    std::unique_ptr<llvm::Regex> Re;
+    bool match(llvm::StringRef Name) const;
+  };
+  using PatternList = std::vector<Pattern>;
+
+  static std::string readList(llvm::StringRef Path, PatternList &List);
+  static bool matches(const PatternList &List, llvm::StringRef Name);
+
+  // The height of the static call tree under F if F is trivial (-1
+  // otherwise), memoised
+  int getTrivialHeight(const llvm::Function &F);
+
+  InstrumentationFilterOptions Opts;
+  PatternList Allow;
+  PatternList Deny;
+  llvm::DenseMap<const llvm::Function *, int> TrivialHeights;
+
+  unsigned NumInstrumented = 0;
+  unsigned NumNotAllowed = 0;
+  unsigned NumDenied = 0;
+  unsigned NumTrivial = 0;
+};
+
+#endif
@@ -0,0 +1,81 @@
+//==============================================================================
+// FILE:
+//    InstrumentationUtils.h
+//
+// DESCRIPTION:
+//    Declares the IR building blocks shared by the instrumentation passes that
+//    write text profiles (EdgeProfiler, PathProfiler, DynamicCallGraph, ...):
+//    the constant strings, the counter updates and the function that appends
+//    the profile to a file when the program exits. With these, a pass only has
+//    to describe its table of records and how one record is printed. The
+//    passes that read the profiles back (ProfileUse, IndirectCallPromotion)
+//    report the problems with them through `diagnose`.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_INSTRUMENTATION_UTILS_H
+#define LLVM_TUTOR_INSTRUMENTATION_UTILS_H
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include <cstdint>
+
+// Injects Str as a private, null-terminated constant called Name
+llvm::Constant *createGlobalString(llvm::Module &M, llvm::StringRef Str,
+                                   const llvm::Twine &Name);
+
+// Inserts `++*Ptr` (a 64-bit counter) at the insertion point of Builder
+void incrementCounter(llvm::IRBuilder<> &Builder, llvm::Value *Ptr);
+
+// Inserts `++Counters[Idx]` before InsertPt
+void incrementCounter(llvm::Instruction *InsertPt,
+                      llvm::GlobalVariable *Counters, uint64_t Idx);
+
+// Returns the first instruction where the result of CB is available. For an
+// `invoke`, that's the beginning of the normal destination, which is split
+// (the new block is called `<block>.<Suffix>`) if it's shared with other
+// predecessors.
+llvm::Instruction *getInsertionPointAfterCall(llvm::CallBase &CB,
+                                              const llvm::Twine &Suffix);
+
+// Emits `for (uint64_t Idx = 0; Idx != N; Idx++) Body(Idx);` at the insertion
+// point of Builder (N is an i64 and must not be 0). Body can create new
+// blocks, the loop continues wherever Body leaves the insertion point.
+void emitLoop(llvm::IRBuilder<> &Builder, llvm::Value *N,
+              const llvm::Twine &Name,
+              llvm::function_ref<void(llvm::Value *)> Body);
+
+// Defines `<Prefix>_dump`, i.e. the function that appends a text profile to
+// a file, and calls it when the program exits (from the global destructors).
+// It is equivalent to the following C function:
+// ```
+//    static void <Prefix>_dump() {
+//      const char *Path = getenv(EnvVar);
+//      FILE *File = fopen(Path ? Path : DefaultPath, "a");
+//      if (!File)
+//        return;
+//      PrintProfile(File);
+//      fclose(File);
+//    }
+// ```
+// PrintProfile is called with the builder positioned after `fopen` and with
+// the declaration of `fprintf`. It can create new blocks, `fclose` is
+// inserted wherever it leaves the insertion point.
+llvm::Function *createTextProfileDump(
+    llvm::Module &M, llvm::StringRef Prefix, llvm::StringRef EnvVar,
+    llvm::StringRef DefaultPath,
+    llvm::function_ref<void(llvm::IRBuilder<> &, llvm::FunctionCallee Fprintf,
+                            llvm::Value *File)>
+        PrintProfile);
+
+// Reports Msg about the profile File (empty if there's no file) through the
+// diagnostic handler of M's context
+void diagnose(llvm::Module &M, llvm::StringRef File, const llvm::Twine &Msg,
+              llvm::DiagnosticSeverity Severity);
+
+#endif
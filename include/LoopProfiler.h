@@ -0,0 +1,54 @@
+//==============================================================================
+// FILE:
+//    LoopProfiler.h
+//
+// DESCRIPTION:
+//    Declares the LoopProfiler pass for the new pass manager and the layout of
+//    the trip count histograms that it records.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_LOOP_PROFILER_H
+#define LLVM_TUTOR_LOOP_PROFILER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+#include <cstdint>
+#include <limits>
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time
+#define LOOP_PROFILER_FILE_ENV_VAR "LLVM_TUTOR_LOOPPROF_FILE"
+
+// The # of buckets in the histogram of every loop. Bucket B counts the entries
+// into the loop with [2^B, 2^(B+1)) iterations, the last bucket counts
+// everything from 2^31 iterations up.
+#define LOOP_PROF_NUM_BUCKETS 32
+
+inline uint64_t getTripCountBucketMin(unsigned Bucket) {
+  return uint64_t(1) << Bucket;
+}
+
+inline uint64_t getTripCountBucketMax(unsigned Bucket) {
+  return Bucket + 1 == LOOP_PROF_NUM_BUCKETS
+             ? std::numeric_limits<uint64_t>::max()
+             : (uint64_t(2) << Bucket) - 1;
+}
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct LoopProfiler : public llvm::PassInfoMixin<LoopProfiler> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
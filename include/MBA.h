@@ -0,0 +1,30 @@
+//==============================================================================
+// FILE:
+//    MBA.h
+//
+// DESCRIPTION:
+//    Declares the MBA pass, which applies all Mixed Boolean Arithmetic rewrite
+//    rules in a single traversal.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_MBA_H
+#define LLVM_TUTOR_MBA_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct MBA : public llvm::PassInfoMixin<MBA> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
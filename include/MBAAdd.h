@@ -10,6 +10,8 @@
 #ifndef LLVM_TUTOR_MBA_ADD_H
 #define LLVM_TUTOR_MBA_ADD_H
 
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
@@ -20,7 +22,15 @@
 struct MBAAdd : public llvm::PassInfoMixin<MBAAdd> {
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
-  bool runOnBasicBlock(llvm::BasicBlock &B);
+  // Adds that the loop vectorizer relies on (see isVectorizationCritical) are
+  // left intact.
+  bool runOnBasicBlock(llvm::BasicBlock &B, const llvm::LoopInfo &LI,
+                       llvm::ScalarEvolution &SE);
+
+  // Cold-path-only mode (-mba-add-cold-only). Only blocks that are executed
+  // rarely relative to the function entry are rewritten, and only as long as
+  // the estimated number of extra cycles per call stays within budget.
+  bool runOnColdBlocks(llvm::Function &F, llvm::FunctionAnalysisManager &FAM);
 
   // Without isRequired returning true, this pass will be skipped for functions
   // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
@@ -10,6 +10,8 @@
 #ifndef LLVM_TUTOR_MBA_SUB_H
 #define LLVM_TUTOR_MBA_SUB_H
 
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
@@ -19,7 +21,10 @@
 struct MBASub : public llvm::PassInfoMixin<MBASub> {
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &);
-  bool runOnBasicBlock(llvm::BasicBlock &B);
+  // Subs that the loop vectorizer relies on (see isVectorizationCritical) are
+  // left intact.
+  bool runOnBasicBlock(llvm::BasicBlock &B, const llvm::LoopInfo &LI,
+                       llvm::ScalarEvolution &SE);
 
   // Without isRequired returning true, this pass will be skipped for functions
   // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
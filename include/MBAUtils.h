@@ -0,0 +1,61 @@
+//==============================================================================
+// FILE:
+//    MBAUtils.h
+//
+// DESCRIPTION:
+//    Declares the Mixed Boolean Arithmetic rewrite rules and the helper
+//    functions shared by the MBA passes (MBAAdd, MBASub and MBA).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_MBA_UTILS_H
+#define LLVM_TUTOR_MBA_UTILS_H
+
+#include "PeepholeRewriter.h"
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/Instruction.h"
+
+// Returns the multiplicative inverse of A modulo 2^N, where N is the bit width
+// of A. A has to be odd (even values are not invertible).
+llvm::APInt getMBAMultiplicativeInverse(const llvm::APInt &A);
+
+// Returns true if Inst takes part in a loop recurrence (e.g. an induction
+// variable update or a reduction) or computes an affine function of an
+// induction variable (e.g. an array index). The loop vectorizer needs to
+// recognise such instructions, so obfuscating them would stop the enclosing
+// loop from being vectorized.
+bool isVectorizationCritical(const llvm::Instruction &Inst,
+                             const llvm::LoopInfo &LI,
+                             llvm::ScalarEvolution &SE);
+
+//------------------------------------------------------------------------------
+// MBA rewrite rules
+//------------------------------------------------------------------------------
+// a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * 151 + 111 (for i8, see
+// MBAAdd.cpp for other bit widths)
+bool matchMBAAdd(llvm::Instruction &Inst);
+llvm::Instruction *buildMBAAdd(llvm::IRBuilder<> &Builder,
+                               llvm::Instruction &Inst);
+
+// a - b == (a + ~b) + 1
+bool matchMBASub(llvm::Instruction &Inst);
+llvm::Instruction *buildMBASub(llvm::IRBuilder<> &Builder,
+                               llvm::Instruction &Inst);
+
+// All MBA rules. The position of a rule in this table determines its bit in a
+// RuleMask.
+inline constexpr RewriteRule MBARules[] = {
+    {"mba-add", llvm::Instruction::Add, matchMBAAdd, buildMBAAdd},
+    {"mba-sub", llvm::Instruction::Sub, matchMBASub, buildMBASub},
+};
+inline constexpr RuleMask MBAAddRule = 1 << 0;
+inline constexpr RuleMask MBASubRule = 1 << 1;
+inline constexpr RuleMask AllMBARules = MBAAddRule | MBASubRule;
+
+// Generated at compile time
+inline constexpr DispatchTable MBADispatchTable = buildDispatchTable(MBARules);
+
+#endif
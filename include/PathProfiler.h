@@ -0,0 +1,35 @@
+//==============================================================================
+// FILE:
+//    PathProfiler.h
+//
+// DESCRIPTION:
+//    Declares the PathProfiler pass for the new pass manager.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_PATH_PROFILER_H
+#define LLVM_TUTOR_PATH_PROFILER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time
+#define PATH_PROFILER_FILE_ENV_VAR "LLVM_TUTOR_PATHPROF_FILE"
+
+//------------------------------------------------------------------------------
+// New PM interface
+//------------------------------------------------------------------------------
+struct PathProfiler : public llvm::PassInfoMixin<PathProfiler> {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+  bool runOnModule(llvm::Module &M);
+
+  // Without isRequired returning true, this pass will be skipped for functions
+  // decorated with the optnone LLVM attribute. Note that clang -O0 decorates
+  // all functions with optnone.
+  static bool isRequired() { return true; }
+};
+
+#endif
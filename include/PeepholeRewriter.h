@@ -0,0 +1,76 @@
+//==============================================================================
+// FILE:
+//    PeepholeRewriter.h
+//
+// DESCRIPTION:
+//    Declares a small, declarative peephole rewrite engine. A rewrite is
+//    described by a RewriteRule: the opcode it applies to, a matcher and a
+//    builder for the replacement. A table of rules is turned (at compile time)
+//    into a dispatch table indexed by opcode, so that every instruction is
+//    only tried against the rules that can possibly match it. All the rules
+//    are applied during a single traversal of the input basic block.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_PEEPHOLE_REWRITER_H
+#define LLVM_TUTOR_PEEPHOLE_REWRITER_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instruction.h"
+
+#include <array>
+#include <cstdint>
+
+struct RewriteRule {
+  // The name of the rule (used for debugging output)
+  const char *Name;
+  // The opcode of the instructions that this rule applies to
+  unsigned Opcode;
+  // Returns true if this rule can rewrite Inst
+  bool (*Match)(llvm::Instruction &Inst);
+  // Builds the replacement for Inst. Intermediate values are inserted with
+  // Builder (i.e. right before Inst). The returned instruction must *not* be
+  // inserted - the engine replaces Inst with it.
+  llvm::Instruction *(*Build)(llvm::IRBuilder<> &Builder,
+                              llvm::Instruction &Inst);
+};
+
+// A set of rules from a rule table: bit N is set iff Rules[N] is in the set
+using RuleMask = uint32_t;
+constexpr unsigned MaxRewriteRules = 32;
+
+// Maps every opcode to the set of rules that apply to it
+using DispatchTable = std::array<RuleMask, llvm::Instruction::OtherOpsEnd>;
+
+// Generates the dispatch table for a rule table. Use it to initialise a
+// constexpr variable so that the table is built at compile time.
+template <size_t NumRules>
+constexpr DispatchTable
+buildDispatchTable(const RewriteRule (&Rules)[NumRules]) {
+  static_assert(NumRules <= MaxRewriteRules, "Too many rules for a RuleMask");
+
+  DispatchTable Table{};
+  for (size_t Idx = 0; Idx < NumRules; ++Idx)
+    Table[Rules[Idx].Opcode] |= RuleMask(1) << Idx;
+  return Table;
+}
+
+// Invoked for every match before the corresponding rewrite takes place.
+// Returning false leaves the instruction intact.
+using RewriteFilter =
+    llvm::function_ref<bool(const RewriteRule &, llvm::Instruction &)>;
+
+// Applies the rules from Rules that are enabled in Enabled to every
+// instruction in BB, in a single traversal. At most one rule is applied per
+// instruction (rules earlier in the table take priority) and instructions
+// created by the rules are not visited. Returns the number of rewritten
+// instructions.
+unsigned rewriteBasicBlock(llvm::BasicBlock &BB,
+                           llvm::ArrayRef<RewriteRule> Rules,
+                           const DispatchTable &Table, RuleMask Enabled,
+                           RewriteFilter Filter);
+
+#endif
@@ -0,0 +1,197 @@
+//==============================================================================
+// FILE:
+//    ProfileReader.h
+//
+// DESCRIPTION:
+//    Declares the readers for the profiles written by the instrumented code:
+//      * the text profiles written by EdgeProfiler,
+//      * the coverage maps written by Coverage,
+//      * the text profiles written by IndirectCallProfiler,
+//      * the call graphs written by DynamicCallGraph,
+//      * the trip count histograms written by LoopProfiler,
+//      * the branch counts written by BranchProfiler,
+//      * the allocation site statistics written by the heap profiling
+//        runtime (see TutorHeapProf.h),
+//      * the binary profiles written by DynamicCallCounter (see
+//        TutorProfile.h).
+//    These are shared by the tools that print the profiles and by the
+//    ProfileUse pass. All the readers return an error message on failure (and
+//    an empty string on success).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_PROFILE_READER_H
+#define LLVM_TUTOR_PROFILE_READER_H
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// EdgeProfiler
+//------------------------------------------------------------------------------
+// The profile of one function (summed over all the runs)
+struct EdgeProfile {
+  // `tree` or `blocks` (see -edge-prof-mode)
+  std::string Mode;
+  uint64_t Hash = 0;
+  std::vector<uint64_t> Counters;
+};
+
+// Reads the profile at Path and adds the counters to Profiles. Every line is:
+//    <function> <mode> <CFG hash> <#counters> <counter 0> <counter 1> ...
+std::string readEdgeProfile(llvm::StringRef Path,
+                            llvm::StringMap<EdgeProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// Coverage
+//------------------------------------------------------------------------------
+// The coverage of one function (merged over all the runs)
+struct CoverageProfile {
+  // `function` or `block` (see -coverage-level)
+  std::string Level;
+  uint64_t Hash = 0;
+  // One bit per site (i.e. per basic block, in the order of the function)
+  llvm::BitVector Covered;
+};
+
+// Reads the coverage map at Path and merges it into Profiles. Every line is:
+//    <function> <level> <CFG hash> <#sites> <bitmap>
+std::string readCoverageMap(llvm::StringRef Path,
+                            llvm::StringMap<CoverageProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// IndirectCallProfiler
+//------------------------------------------------------------------------------
+// The targets of one indirect call site (summed over all the runs)
+struct ICallSiteProfile {
+  uint64_t Total = 0;
+  // The number of calls per target, by name. The targets that didn't fit in
+  // the table (and the calls lost to the eviction) are only in Total.
+  llvm::StringMap<uint64_t> Targets;
+};
+
+// The indirect call sites of one function, by position (see
+// getIndirectCallSites)
+struct ICallProfile {
+  uint64_t Hash = 0;
+  std::vector<ICallSiteProfile> Sites;
+};
+
+// Reads the profile at Path and adds the counts to Profiles. Every line is:
+//    <function> <CFG hash> <site> <#calls> <target 1> <count 1> ...
+std::string readICallProfile(llvm::StringRef Path,
+                             llvm::StringMap<ICallProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// DynamicCallGraph
+//------------------------------------------------------------------------------
+// {caller, callee} -> the # of calls (summed over all the runs)
+using CallGraphProfile =
+    std::map<std::pair<std::string, std::string>, uint64_t>;
+
+// Reads the call graph at Path and adds the counts to Graph. Every line is:
+//    <caller> <callee> <count>
+// The calls that did not fit into the hash table are added to Lost instead.
+std::string readCallGraphProfile(llvm::StringRef Path, CallGraphProfile &Graph,
+                                 uint64_t &Lost);
+
+//------------------------------------------------------------------------------
+// LoopProfiler
+//------------------------------------------------------------------------------
+// The trip counts of one loop (summed over all the runs)
+struct LoopTripProfile {
+  uint64_t Iterations = 0;
+  // The # of entries into the loop per trip count bucket (see LoopProfiler.h)
+  std::vector<uint64_t> Buckets;
+};
+
+// The loops of one function, in the preorder of LoopInfo
+struct LoopProfile {
+  uint64_t Hash = 0;
+  std::vector<LoopTripProfile> Loops;
+};
+
+// Reads the profile at Path and adds the counts to Profiles. Every line is:
+//    <function> <CFG hash> <loop> <#iterations> <#buckets> <bucket 0> ...
+std::string readLoopProfile(llvm::StringRef Path,
+                            llvm::StringMap<LoopProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// BranchProfiler
+//------------------------------------------------------------------------------
+// The profile of one function (summed over all the runs). The entry count
+// comes first, see isProfiledBranch for the order of the other counters.
+struct BranchProfile {
+  uint64_t Hash = 0;
+  std::vector<uint64_t> Counters;
+};
+
+// Reads the profile at Path and adds the counters to Profiles. Every line is:
+//    <function> <CFG hash> <#counters> <entry count> <counter 1> ...
+std::string readBranchProfile(llvm::StringRef Path,
+                              llvm::StringMap<BranchProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// HeapProfiler
+//------------------------------------------------------------------------------
+// The statistics of one allocation site (summed over all the runs)
+struct HeapSiteProfile {
+  // See getHeapAllocKindName
+  std::string Kind;
+  // `<file>:<line>` or "-"
+  std::string Location;
+  uint64_t Allocs = 0;
+  uint64_t Frees = 0;
+  uint64_t Bytes = 0;
+  // The histograms (see TutorHeapProf.h)
+  std::vector<uint64_t> Sizes;
+  std::vector<uint64_t> Lifetimes;
+};
+
+// The allocation sites of one function, by index
+struct HeapProfile {
+  uint64_t Hash = 0;
+  std::map<uint32_t, HeapSiteProfile> Sites;
+};
+
+// Reads the profile at Path and adds the statistics to Profiles. Every line
+// is:
+//    <function> <CFG hash> <site> <kind> <location> <#allocations> <#frees>
+//      <#bytes> <#size buckets> <bucket 0> ... <#lifetime buckets> ...
+std::string readHeapProfile(llvm::StringRef Path,
+                            llvm::StringMap<HeapProfile> &Profiles);
+
+//------------------------------------------------------------------------------
+// Binary profiles
+//------------------------------------------------------------------------------
+// The (merged) counters of one function
+struct TutorProfFunction {
+  uint64_t Hash = 0;
+  std::vector<uint64_t> Counters;
+};
+
+// The (merged) contents of one or more profiles
+struct TutorProfData {
+  uint32_t Kind = 0;
+  llvm::StringMap<TutorProfFunction> Functions;
+};
+
+// Adds the counters from Src to Dst. Fails if the profiles are incompatible.
+std::string mergeTutorProfFunction(llvm::StringRef Name,
+                                   TutorProfFunction &Dst,
+                                   const TutorProfFunction &Src);
+std::string mergeTutorProfData(TutorProfData &Dst, TutorProfData &Src);
+
+// Reads the profile at Path and merges it into P. Sets Incomplete if the
+// profile was not written completely.
+std::string readTutorProfile(llvm::StringRef Path, TutorProfData &P,
+                             bool &Incomplete);
+
+#endif
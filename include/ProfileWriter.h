@@ -0,0 +1,86 @@
+//==============================================================================
+// FILE:
+//    ProfileWriter.h
+//
+// DESCRIPTION:
+//    Declares the generator for the code that writes the binary profiles (see
+//    TutorProfile.h) at run-time. Shared by the instrumentation passes that
+//    write binary profiles (DynamicCallCounter and FunctionTimer).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_PROFILE_WRITER_H
+#define LLVM_TUTOR_PROFILE_WRITER_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include <cstdint>
+#include <optional>
+
+// The values of the libc constants that the generated code passes to `open`,
+// `mmap` and `clock_gettime` (and the width of `off_t`, for `ftruncate` and
+// `mmap`). They differ between the OSes (and between some architectures), so
+// they are taken from the target triple of the module rather than from the
+// headers of the host.
+struct TargetLibcConstants {
+  uint32_t ORdWr;
+  uint32_t OCreat;
+  uint32_t OTrunc;
+  uint32_t ProtRead;
+  uint32_t ProtWrite;
+  uint32_t MapShared;
+  uint32_t MapFixed;
+  uint32_t ClockMonotonic;
+  unsigned OffTBits;
+};
+
+// Returns the constants for the target of M (the host if M doesn't have a
+// target triple, like `lli` does), or nothing if the OS isn't supported
+std::optional<TargetLibcConstants>
+getTargetLibcConstants(const llvm::Module &M);
+
+// The counters are moved into the profile file (see createProfileWriter) if
+// they are aligned and padded to this, i.e. if they don't share any pages with
+// other data. That's the largest page size of the supported targets.
+constexpr uint64_t ProfileWriterPageSize = 65536;
+
+// One record per instrumented function. The counters of every function follow
+// the counters of the previous function.
+struct ProfileWriterRecord {
+  llvm::StringRef Name;
+  uint64_t Hash;
+  uint32_t NumCounters;
+};
+
+// Defines `<Prefix>_write_profile`, i.e. the function that writes Counters (an
+// array of integer counters, possibly padded, see `CounterStride`) to a
+// binary profile of the given kind. The profile is written to Path (the first
+// `%p` is replaced with the process ID), unless it's overridden at run-time
+// with TUTOR_PROF_FILE_ENV_VAR. The header, the records and the names are
+// stored in one constant image (`ImageName`).
+//
+// The file is created and mapped into memory by `<Prefix>_open_profile`,
+// which is added to the global constructors. If the counters are alone in
+// their pages (see ProfileWriterPageSize), they are moved into the file, so
+// that a process that crashes still leaves a profile behind (with the counts
+// up to the crash, marked as incomplete). `<Prefix>_write_profile` completes
+// the profile. A forked child shares the file with its parent and only the
+// parent completes it.
+//
+// Libc holds the flags of `open` and `mmap` for the target (see
+// getTargetLibcConstants). FixupCounters is called once the counters are in
+// the mapping of the file (with the builder positioned in the writer and the
+// address of the counters in the file), e.g. to scale the counters.
+llvm::Function *createProfileWriter(
+    llvm::Module &M, const TargetLibcConstants &Libc, uint32_t Kind,
+    llvm::ArrayRef<ProfileWriterRecord> Records, llvm::GlobalVariable *Counters,
+    unsigned CounterSize, llvm::StringRef Path, llvm::StringRef Prefix,
+    llvm::StringRef ImageName,
+    llvm::function_ref<void(llvm::IRBuilder<> &, llvm::Value *)>
+        FixupCounters = nullptr);
+
+#endif
@@ -0,0 +1,155 @@
+//==============================================================================
+// FILE:
+//    TutorHeapProf.h
+//
+// DESCRIPTION:
+//    Describes the interface between the modules instrumented with the
+//    HeapProfiler pass and the heap profiling part of the instrumentation
+//    runtime (runtime/TutorHeapProf.cpp, in libTutorRuntime.a).
+//
+//    Every allocation site (a direct call to malloc, calloc, realloc or one
+//    of the `operator new`s) is described by a constant TutorHeapSite. The
+//    instrumentation reports every allocation, together with its site, right
+//    after the call:
+//    ```
+//      void *Ptr = malloc(Size);
+//      __tutor_heap_alloc(Ptr, Size, &Site);
+//    ```
+//    and every deallocation (a direct call to free or one of the
+//    `operator delete`s) right before it:
+//    ```
+//      __tutor_heap_free(Ptr);
+//      free(Ptr);
+//    ```
+//    `realloc` is reported after the call with __tutor_heap_realloc (the old
+//    block is only gone if the call succeeded).
+//
+//    For every site, the runtime records the # of allocations, the # of
+//    bytes, a histogram of the sizes and a histogram of the lifetimes (the
+//    time between the allocation and the deallocation) of the blocks that
+//    were freed. The deallocations are matched with their sites through a
+//    lock-free table of the live blocks, the statistics are kept in a
+//    lock-free table per thread. Neither takes a lock, so the threads of the
+//    program only contend for the cache lines of the table of live blocks.
+//
+//    Every instrumented module registers itself from a constructor (and
+//    unregisters from a destructor). When the last module is unregistered,
+//    the runtime appends one line per site to the profile (see
+//    TUTOR_HEAP_FILE_ENV_VAR):
+//      <function> <CFG hash> <site> <kind> <location> <#allocations>
+//        <#frees> <#bytes> <#size buckets> <bucket 0> ...
+//        <#lifetime buckets> <bucket 0> ...
+//    where <kind> is one of the TutorHeapAllocKind names and <location> is
+//    `<file>:<line>` (or `-` without debug info). `tutor-heap` reads it.
+//
+//    The table of the live blocks is sized when the first module is
+//    registered (TUTOR_HEAP_LIVE_SLOTS_ENV_VAR, 1M slots by default, the
+//    memory is only allocated when it's used). The blocks that don't fit are
+//    counted, but their lifetimes are not recorded.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_TUTOR_HEAP_PROF_H
+#define LLVM_TUTOR_TUTOR_HEAP_PROF_H
+
+#include <cstdint>
+
+// The name of the environment variable that overrides the location of the
+// profile at run-time ...
+#define TUTOR_HEAP_FILE_ENV_VAR "LLVM_TUTOR_HEAPPROF_FILE"
+// ... and of the one that sets the # of slots in the table of live blocks
+#define TUTOR_HEAP_LIVE_SLOTS_ENV_VAR "LLVM_TUTOR_HEAPPROF_LIVE_SLOTS"
+
+enum TutorHeapAllocKind : uint32_t {
+  TUTOR_HEAP_MALLOC = 0,
+  TUTOR_HEAP_CALLOC = 1,
+  TUTOR_HEAP_REALLOC = 2,
+  TUTOR_HEAP_NEW = 3,
+  TUTOR_HEAP_NEW_ARRAY = 4,
+};
+
+constexpr uint32_t TUTOR_HEAP_NUM_KINDS = 5;
+
+// The names of the kinds in the profile
+inline const char *getHeapAllocKindName(uint32_t Kind) {
+  static const char *const Names[TUTOR_HEAP_NUM_KINDS] = {
+      "malloc", "calloc", "realloc", "new", "new[]"};
+  return Kind < TUTOR_HEAP_NUM_KINDS ? Names[Kind] : "unknown";
+}
+
+// One allocation site
+struct TutorHeapSite {
+  // The function that contains the site
+  const char *Function;
+  // The hash of the function, i.e. of its CFG (see
+  // CFGSpanningTree::getStructuralHash)
+  uint64_t Hash;
+  // The index of the site within the function (in the order of the
+  // function)
+  uint32_t Index;
+  // See TutorHeapAllocKind
+  uint32_t Kind;
+  // `<file>:<line>`, or "-" without debug info
+  const char *Location;
+};
+
+//------------------------------------------------------------------------------
+// The histograms
+//------------------------------------------------------------------------------
+// The sizes are bucketed by powers of two: bucket 0 holds 0 and 1 byte, bucket
+// N holds (2^(N-1), 2^N] bytes and the last bucket holds everything above
+// 4 MiB.
+constexpr unsigned TUTOR_HEAP_NUM_SIZE_BUCKETS = 24;
+
+inline unsigned getHeapSizeBucket(uint64_t Size) {
+  unsigned Bucket = 0;
+  while (Bucket + 1 != TUTOR_HEAP_NUM_SIZE_BUCKETS &&
+         (uint64_t(1) << Bucket) < Size)
+    ++Bucket;
+  return Bucket;
+}
+
+// The largest size in Bucket (or UINT64_MAX for the last one)
+inline uint64_t getHeapSizeBucketMax(unsigned Bucket) {
+  return Bucket + 1 == TUTOR_HEAP_NUM_SIZE_BUCKETS ? UINT64_MAX
+                                                   : uint64_t(1) << Bucket;
+}
+
+// The lifetimes are bucketed by powers of ten: bucket 0 holds everything
+// below 1 us, bucket N everything below 10^N us and the last bucket
+// everything from 1 s up.
+constexpr unsigned TUTOR_HEAP_NUM_LIFETIME_BUCKETS = 8;
+
+inline unsigned getHeapLifetimeBucket(uint64_t Nanoseconds) {
+  unsigned Bucket = 0;
+  for (uint64_t Limit = 1000;
+       Bucket + 1 != TUTOR_HEAP_NUM_LIFETIME_BUCKETS && Nanoseconds >= Limit;
+       Limit *= 10)
+    ++Bucket;
+  return Bucket;
+}
+
+// The upper bound of Bucket in nanoseconds (or UINT64_MAX for the last one)
+inline uint64_t getHeapLifetimeBucketLimit(unsigned Bucket) {
+  if (Bucket + 1 == TUTOR_HEAP_NUM_LIFETIME_BUCKETS)
+    return UINT64_MAX;
+  uint64_t Limit = 1000;
+  for (unsigned Idx = 0; Idx != Bucket; ++Idx)
+    Limit *= 10;
+  return Limit;
+}
+
+extern "C" {
+// DefaultPath is the profile to write unless TUTOR_HEAP_FILE_ENV_VAR is set.
+// The first module decides.
+void __tutor_heap_register(const char *DefaultPath);
+void __tutor_heap_unregister();
+
+// Null pointers are ignored
+void __tutor_heap_alloc(void *Ptr, uint64_t Size, const TutorHeapSite *Site);
+void __tutor_heap_free(void *Ptr);
+void __tutor_heap_realloc(void *OldPtr, void *NewPtr, uint64_t Size,
+                          const TutorHeapSite *Site);
+}
+
+#endif
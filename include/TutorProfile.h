@@ -0,0 +1,90 @@
+//==============================================================================
+// FILE:
+//    TutorProfile.h
+//
+// DESCRIPTION:
+//    Describes the binary profile format written by the instrumented code (see
+//    ProfileWriter.cpp) and read by `tutor-profdata`.
+//
+//    The file is laid out so that it can be written with two `memcpy`s into a
+//    memory mapping of the file:
+//      * a constant image, generated at compile-time, with the header, the
+//        function records and the function names,
+//      * the counters, copied verbatim from memory (i.e. with the width and
+//        the padding used by the instrumentation, see `CounterSize` and
+//        `CounterStride`).
+//    The file is resized before anything is copied and the header is copied
+//    first. A process that crashes while writing the profile therefore leaves
+//    behind a file that can still be read (but with some counters set to 0).
+//    `TUTOR_PROF_FLAG_COMPLETE` is only set once everything has been copied.
+//
+//    All the integers are stored in the byte order of the target. Readers
+//    detect the byte order from the magic number.
+//
+//    The version must be bumped whenever the layout changes.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_TUTOR_PROFILE_H
+#define LLVM_TUTOR_TUTOR_PROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// "TUTRPROF" when read as a little-endian integer
+constexpr uint64_t TUTOR_PROF_MAGIC = 0x464f525052545554ULL;
+constexpr uint32_t TUTOR_PROF_VERSION = 1;
+
+// What do the counters count?
+enum TutorProfKind : uint32_t {
+  // One counter per function: the # of calls (DynamicCallCounter)
+  TUTOR_PROF_KIND_CALL_COUNTS = 1,
+  // Three counters per function: the # of calls, the inclusive and the
+  // exclusive time (FunctionTimer). In cycles of the time-stamp counter ...
+  TUTOR_PROF_KIND_TIME_CYCLES = 2,
+  // ... or in nanoseconds (of CLOCK_MONOTONIC)
+  TUTOR_PROF_KIND_TIME_NS = 3,
+};
+
+// Set once all the counters have been written
+constexpr uint32_t TUTOR_PROF_FLAG_COMPLETE = 1;
+
+struct TutorProfHeader {
+  uint64_t Magic;
+  uint32_t Version;
+  uint32_t Kind;
+  uint32_t Flags;
+  uint32_t NumRecords;
+  // The width of every counter (4 or 8 bytes)
+  uint32_t CounterSize;
+  // The distance between two consecutive counters (>= CounterSize)
+  uint32_t CounterStride;
+  // The offsets (from the beginning of the file) of the sections
+  uint64_t RecordsOffset;
+  uint64_t NamesOffset;
+  uint64_t CountersOffset;
+  uint64_t FileSize;
+};
+static_assert(sizeof(TutorProfHeader) == 64, "Unexpected header layout");
+
+// One record per instrumented function
+struct TutorProfRecord {
+  // The offset of the name (not null-terminated) in the names section
+  uint64_t NameOffset;
+  uint32_t NameSize;
+  uint32_t NumCounters;
+  // The hash of the function, i.e. of its CFG (see
+  // CFGSpanningTree::getStructuralHash)
+  uint64_t Hash;
+  // The index of the first counter of this function
+  uint64_t FirstCounter;
+};
+static_assert(sizeof(TutorProfRecord) == 32, "Unexpected record layout");
+
+constexpr size_t TUTOR_PROF_FLAGS_OFFSET = offsetof(TutorProfHeader, Flags);
+
+// The name of the environment variable that overrides the location of the
+// binary profile at run-time
+#define TUTOR_PROF_FILE_ENV_VAR "LLVM_TUTOR_PROFILE_FILE"
+
+#endif
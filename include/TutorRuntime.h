@@ -0,0 +1,116 @@
+//==============================================================================
+// FILE:
+//    TutorRuntime.h
+//
+// DESCRIPTION:
+//    Describes the interface between the instrumented modules and the
+//    instrumentation runtime (runtime/TutorRuntime.cpp, built as
+//    libTutorRuntime.a).
+//
+//    Without the runtime, every instrumented module prints (or writes) its
+//    own results when the program exits. That's fine for programs built from
+//    one module, but not when many instrumented translation units are linked
+//    together: every one of them prints a separate table (or overwrites the
+//    same profile). With the runtime, every module describes its counters
+//    with a constant TutorRtModule and registers it from a constructor:
+//    ```
+//      static void tutor_rt.register() {
+//        __tutor_rt_register_module(&Descriptor);
+//      }
+//    ```
+//    The matching destructor unregisters it. The runtime keeps track of all
+//    the registered modules and writes the results of all of them, once, when
+//    the last module is unregistered (i.e. when the program exits). A module
+//    that's unregistered earlier (e.g. a shared library that's unloaded) is
+//    copied into the runtime first.
+//
+//    Every module is identified by its ModuleId (the hash of its source file
+//    name) and the functions with local linkage are recorded as
+//    `<source file>:<name>`, so that `static` functions with the same name
+//    in different modules are kept apart. Functions with the same (external)
+//    name are merged, e.g. the inline functions instrumented in every module
+//    that uses them (only one of the copies survives linking).
+//
+//    Long-running processes (e.g. servers) may never exit. The runtime can
+//    also write snapshots of the counters of the registered modules while the
+//    program is running, configured with environment variables that are read
+//    when the first module is registered:
+//      * LLVM_TUTOR_SNAPSHOT_INTERVAL=<seconds> - periodically, from a
+//        background thread,
+//      * LLVM_TUTOR_SNAPSHOT_SIGNAL=<signal> (e.g. SIGUSR2, or a number) -
+//        whenever the process receives the signal,
+//      * LLVM_TUTOR_SNAPSHOT_MODE=cumulative|delta - the counts since the
+//        start of the program (the default) or since the previous snapshot,
+//      * LLVM_TUTOR_SNAPSHOT_FILE=<path> - where to write the snapshots (`%p`
+//        is replaced with the process ID and `%n` with the number of the
+//        snapshot), "snapshot.%p.%n.tutorprof" by default.
+//    The snapshots are binary profiles (see TutorProfile.h), so delta
+//    snapshots add up to the totals with `tutor-profdata merge`. The results
+//    written at exit are always cumulative.
+//
+//    The counters can also be watched live, from another process: with
+//    LLVM_TUTOR_SHM_NAME=<name>, the runtime moves the counters of every
+//    module to a POSIX shared memory segment, which `tutor-top` reads (see
+//    TutorShm.h).
+//
+//    The layout of the structs below is hard-coded in the instrumentation
+//    (see DynamicCallCounter.cpp). TUTOR_RT_VERSION must be bumped whenever
+//    it changes.
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_TUTOR_RUNTIME_H
+#define LLVM_TUTOR_TUTOR_RUNTIME_H
+
+#include <cstdint>
+
+constexpr uint32_t TUTOR_RT_VERSION = 2;
+
+// One instrumented function
+struct TutorRtFunction {
+  // Null-terminated, qualified with the source file name for local functions
+  const char *Name;
+  // The hash of the function, i.e. of its CFG (see
+  // CFGSpanningTree::getStructuralHash)
+  uint64_t Hash;
+};
+
+// One instrumented module
+struct TutorRtModule {
+  uint32_t Version;
+  // What do the counters count? (see TutorProfKind)
+  uint32_t Kind;
+  uint64_t ModuleId;
+  uint32_t NumFunctions;
+  uint32_t NumCountersPerFunction;
+  // The width of every counter (4 or 8 bytes) ...
+  uint32_t CounterSize;
+  // ... and the distance between two consecutive counters (>= CounterSize)
+  uint32_t CounterStride;
+  // Every counter is multiplied by this (e.g. the sampling period)
+  uint64_t Scale;
+  const TutorRtFunction *Functions;
+  const void *Counters;
+  // The binary profile to write (`%p` is replaced with the process ID), or
+  // null to print the results to stdout. The first module with a path
+  // decides. LLVM_TUTOR_PROFILE_FILE overrides it.
+  const char *OutputPath;
+  // The size of the memory reserved for the counters (>= the size of the
+  // counters). If it's a multiple of the page size and the counters are
+  // page-aligned, the runtime may move them to shared memory (see
+  // TutorShm.h).
+  uint64_t CountersSize;
+};
+
+// The environment variables that configure the snapshots (see above)
+#define TUTOR_RT_SNAPSHOT_INTERVAL_ENV_VAR "LLVM_TUTOR_SNAPSHOT_INTERVAL"
+#define TUTOR_RT_SNAPSHOT_SIGNAL_ENV_VAR "LLVM_TUTOR_SNAPSHOT_SIGNAL"
+#define TUTOR_RT_SNAPSHOT_MODE_ENV_VAR "LLVM_TUTOR_SNAPSHOT_MODE"
+#define TUTOR_RT_SNAPSHOT_FILE_ENV_VAR "LLVM_TUTOR_SNAPSHOT_FILE"
+
+extern "C" {
+void __tutor_rt_register_module(const TutorRtModule *M);
+void __tutor_rt_unregister_module(const TutorRtModule *M);
+}
+
+#endif
@@ -0,0 +1,102 @@
+//==============================================================================
+// FILE:
+//    TutorShm.h
+//
+// DESCRIPTION:
+//    Describes the shared memory segment that the instrumentation runtime
+//    (see TutorRuntime.h) exports the counters through, so that they can be
+//    watched while the program is running (e.g. with `tutor-top`).
+//
+//    With LLVM_TUTOR_SHM_NAME=<name> (`%p` is replaced with the process ID),
+//    the runtime creates a POSIX shared memory segment called <name> (see
+//    shm_open) when the first module is registered. Every module that's
+//    registered gets an entry in the module table (see TutorShmHeader), its
+//    function names are copied to the segment and its counters are _moved_
+//    there: the pages that hold the counters are replaced (with
+//    mmap(MAP_FIXED)) by pages of the segment. The instrumented code keeps
+//    incrementing the counters at the same addresses, so exporting them costs
+//    nothing at run-time. For this to work, the counters must be alone in
+//    their pages, i.e. the module must be instrumented with
+//    `-dynamic-cc-shm` (which aligns and pads the counters to
+//    TUTOR_SHM_PAGE_SIZE). The counters of the other modules are not
+//    exported (see TUTOR_SHM_MODULE_NOT_EXPORTED).
+//
+//    Readers map the segment read-only. The runtime fills in every module
+//    entry before it bumps `NumModules` (with release semantics), so the
+//    readers only need an acquire load of `NumModules`. The counters are
+//    updated while they are read, so readers should use (relaxed) atomic
+//    loads. The segment is removed (shm_unlink) when the last module is
+//    unregistered, i.e. when the program exits. Readers that are still
+//    attached keep seeing the final values.
+//
+//    The segment is sized when it's created (LLVM_TUTOR_SHM_SIZE, in MiB,
+//    64 by default). The memory is only allocated when it's used.
+//
+//    All the integers are stored in the byte order of the target (readers
+//    and the program always run on the same machine).
+//
+// License: MIT
+//==============================================================================
+#ifndef LLVM_TUTOR_TUTOR_SHM_H
+#define LLVM_TUTOR_TUTOR_SHM_H
+
+#include <cstdint>
+
+// "TUTORSHM" when read as a little-endian integer
+constexpr uint64_t TUTOR_SHM_MAGIC = 0x4d4853524f545554ULL;
+constexpr uint32_t TUTOR_SHM_VERSION = 1;
+
+// The counters of every module start at a multiple of this (the largest page
+// size in common use) in the segment. `-dynamic-cc-shm` aligns and pads the
+// counters to it.
+constexpr uint64_t TUTOR_SHM_PAGE_SIZE = 65536;
+
+constexpr uint32_t TUTOR_SHM_MAX_MODULES = 1024;
+
+enum TutorShmModuleState : uint32_t {
+  // The counters are in the segment and are being updated
+  TUTOR_SHM_MODULE_LIVE = 1,
+  // The module was unregistered, the counters in the segment are final
+  TUTOR_SHM_MODULE_GONE = 2,
+  // The counters are not in the segment (they share pages with other data)
+  TUTOR_SHM_MODULE_NOT_EXPORTED = 3,
+};
+
+struct TutorShmModule {
+  uint64_t ModuleId;
+  uint32_t State;
+  uint32_t NumFunctions;
+  uint32_t NumCountersPerFunction;
+  // The width of every counter (4 or 8 bytes) ...
+  uint32_t CounterSize;
+  // ... and the distance between two consecutive counters (>= CounterSize)
+  uint32_t CounterStride;
+  uint32_t Reserved;
+  // Every counter is multiplied by this (e.g. the sampling period)
+  uint64_t Scale;
+  // The offsets (from the beginning of the segment) of the function names
+  // (null-terminated, one after another) and of the counters
+  uint64_t NamesOffset;
+  uint64_t CountersOffset;
+};
+static_assert(sizeof(TutorShmModule) == 56, "Unexpected module layout");
+
+struct TutorShmHeader {
+  uint64_t Magic;
+  uint32_t Version;
+  // What do the counters count? (see TutorProfKind)
+  uint32_t Kind;
+  // The size of the segment
+  uint64_t Size;
+  // The process that the counters belong to
+  uint32_t Pid;
+  // The number of valid entries in Modules
+  uint32_t NumModules;
+  TutorShmModule Modules[TUTOR_SHM_MAX_MODULES];
+};
+
+// The environment variables that enable the export (see above)
+#define TUTOR_SHM_NAME_ENV_VAR "LLVM_TUTOR_SHM_NAME"
+#define TUTOR_SHM_SIZE_ENV_VAR "LLVM_TUTOR_SHM_SIZE"
+
+#endif
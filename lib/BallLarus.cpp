@@ -0,0 +1,183 @@
+//==============================================================================
+// FILE:
+//    BallLarus.cpp
+//
+// DESCRIPTION:
+//    The Ball-Larus path numbering (and decoding) shared by PathProfiler and
+//    the `pathprof` tool. See BallLarus.h for an overview.
+//
+// License: MIT
+//==============================================================================
+#include "BallLarus.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/xxhash.h"
+
+#include <utility>
+
+using namespace llvm;
+
+BallLarusDAG::BallLarusDAG(Function &F) {
+  // STEP 1: Number the nodes and find the back edges
+  // ------------------------------------------------
+  // Note that the reachable blocks are numbered in the layout order, and not
+  // in the DFS order, so that the numbering is stable.
+  SmallPtrSet<BasicBlock *, 32> Reachable;
+  for (BasicBlock *BB : depth_first(&F.getEntryBlock()))
+    Reachable.insert(BB);
+  SmallVector<BasicBlock *, 32> Blocks;
+  unsigned NumNodes = ExitNode + 1;
+  for (BasicBlock &BB : F) {
+    if (Reachable.count(&BB)) {
+      Blocks.push_back(&BB);
+      NodeIdx[&BB] = NumNodes++;
+    }
+  }
+
+  SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> Backedges;
+  FindFunctionBackedges(F, Backedges);
+  DenseSet<std::pair<const BasicBlock *, const BasicBlock *>> IsBackedge(
+      Backedges.begin(), Backedges.end());
+  SmallPtrSet<const BasicBlock *, 8> LoopHeaders, Latches;
+  for (auto &BE : Backedges) {
+    Latches.insert(BE.first);
+    LoopHeaders.insert(BE.second);
+  }
+
+  // STEP 2: Collect the edges of the DAG (in a deterministic order)
+  // ---------------------------------------------------------------
+  // All the back edges to one loop header share one ENTRY -> header edge and
+  // all the back edges from one block share one block -> EXIT edge.
+  DenseMap<const BasicBlock *, unsigned> LoopEntryEdge, LoopExitEdge;
+  Edges.push_back({BLEdge::FunctionEntry, nullptr, &F.getEntryBlock()});
+  for (BasicBlock *BB : Blocks) {
+    if (LoopHeaders.count(BB)) {
+      LoopEntryEdge[BB] = Edges.size();
+      Edges.push_back({BLEdge::LoopEntry, nullptr, BB});
+    }
+  }
+
+  for (BasicBlock *BB : Blocks) {
+    if (succ_empty(BB)) {
+      Edges.push_back({BLEdge::FunctionExit, BB, nullptr});
+      continue;
+    }
+
+    // Multiple edges to the same successor (e.g. from a `switch`) are treated
+    // as one
+    SmallPtrSet<BasicBlock *, 8> Visited;
+    for (BasicBlock *Succ : successors(BB)) {
+      if (!Visited.insert(Succ).second)
+        continue;
+      if (IsBackedge.count({BB, Succ})) {
+        BackEdges.push_back({BB, Succ, 0, 0});
+        continue;
+      }
+      Edges.push_back({BLEdge::Normal, BB, Succ});
+    }
+
+    if (Latches.count(BB)) {
+      LoopExitEdge[BB] = Edges.size();
+      Edges.push_back({BLEdge::LoopExit, BB, nullptr});
+    }
+  }
+
+  OutEdges.resize(NumNodes);
+  for (unsigned Idx = 0, E = Edges.size(); Idx != E; ++Idx)
+    OutEdges[getSrcNode(Edges[Idx])].push_back(Idx);
+
+  // STEP 3: Assign the edge values
+  // ------------------------------
+  // Visit the nodes in post-order (i.e. in the reverse topological order),
+  // so that the number of paths from every successor is already known.
+  std::vector<uint64_t> NumPathsFrom(NumNodes, 0);
+  std::vector<bool> Visited(NumNodes, false);
+  SmallVector<std::pair<unsigned, unsigned>, 32> Worklist;
+  Worklist.push_back({EntryNode, 0});
+  Visited[EntryNode] = true;
+  while (!Worklist.empty()) {
+    auto &[Node, NextEdge] = Worklist.back();
+    if (NextEdge != OutEdges[Node].size()) {
+      unsigned Succ = getDstNode(Edges[OutEdges[Node][NextEdge++]]);
+      if (!Visited[Succ]) {
+        Visited[Succ] = true;
+        Worklist.push_back({Succ, 0});
+      }
+      continue;
+    }
+
+    // All the successors have been visited
+    if (Node == ExitNode) {
+      NumPathsFrom[Node] = 1;
+    } else {
+      uint64_t Sum = 0;
+      for (unsigned Idx : OutEdges[Node]) {
+        Edges[Idx].Val = Sum;
+        Sum += NumPathsFrom[getDstNode(Edges[Idx])];
+        if (Sum > MaxPaths) {
+          Valid = false;
+          Sum = MaxPaths;
+        }
+      }
+      NumPathsFrom[Node] = Sum;
+    }
+    Worklist.pop_back();
+  }
+  NumPaths = NumPathsFrom[EntryNode];
+
+  for (BLBackEdge &BE : BackEdges) {
+    BE.ExitVal = Edges[LoopExitEdge.lookup(BE.Src)].Val;
+    BE.EntryVal = Edges[LoopEntryEdge.lookup(BE.Dst)].Val;
+  }
+
+  // STEP 4: Hash the DAG
+  // --------------------
+  std::vector<uint64_t> HashData;
+  HashData.push_back(NumNodes);
+  for (const BLEdge &E : Edges) {
+    HashData.push_back(E.Kind);
+    HashData.push_back((uint64_t(getSrcNode(E)) << 32) | getDstNode(E));
+    HashData.push_back(E.Val);
+  }
+  Hash = xxh3_64bits(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(HashData.data()),
+      HashData.size() * sizeof(uint64_t)));
+}
+
+bool BallLarusDAG::decodePath(uint64_t Id, SmallVectorImpl<BasicBlock *> &Path,
+                              bool &StartsAtLoopHeader,
+                              bool &EndsWithBackEdge) const {
+  Path.clear();
+  StartsAtLoopHeader = EndsWithBackEdge = false;
+  if (!Valid || Id >= NumPaths)
+    return false;
+
+  // At every node, take the edge with the largest value that doesn't exceed
+  // what's left of the path ID
+  uint64_t Remaining = Id;
+  unsigned Node = EntryNode;
+  while (Node != ExitNode) {
+    const BLEdge *Taken = nullptr;
+    for (unsigned Idx : OutEdges[Node]) {
+      if (Edges[Idx].Val > Remaining)
+        break;
+      Taken = &Edges[Idx];
+    }
+    assert(Taken && "The first edge always has the value of 0");
+
+    Remaining -= Taken->Val;
+    if (Taken->Kind == BLEdge::LoopEntry)
+      StartsAtLoopHeader = true;
+    if (Taken->Kind == BLEdge::LoopExit)
+      EndsWithBackEdge = true;
+    if (Taken->Dst)
+      Path.push_back(Taken->Dst);
+    Node = getDstNode(*Taken);
+  }
+
+  return Remaining == 0;
+}
@@ -0,0 +1,395 @@
+//========================================================================
+// FILE:
+//    BlockLayout.cpp
+//
+// DESCRIPTION:
+//    Reorders the basic blocks of every function with a profile so that the
+//    likely successor of every branch is the next block, i.e. so that the hot
+//    paths fall through and the taken branches (which cost a redirect in the
+//    front-end of the CPU, even when predicted correctly) are rare.
+//
+//    The edge counts come from the `!prof` metadata (entry counts and branch
+//    weights, see ProfileUse), i.e. from BlockFrequencyInfo and
+//    BranchProbabilityInfo. The blocks are laid out bottom-up (Pettis &
+//    Hansen, "Profile guided code positioning", PLDI 1990):
+//      * every block starts in a chain of its own,
+//      * the edges are visited from the hottest to the coldest (the edges
+//        that never ran are ignored). If the source ends a chain and the
+//        destination starts another one, the two chains are merged (so the
+//        edge falls through),
+//      * the chain with the entry block goes first, the other chains follow
+//        from the hottest to the coldest (by the count of the first block).
+//        The blocks that never ran end up at the end of the function.
+//
+//    Before the layout, the switches where one case takes at least
+//    `-block-layout-switch-bias`% of the executions are peeled:
+//    ```IR
+//      switch i32 %op, label %default [ i32 0, label %add
+//                                       i32 1, label %sub ... ]
+//    ```
+//    becomes:
+//    ```IR
+//      %switch.hot = icmp eq i32 %op, 0
+//      br i1 %switch.hot, label %add, label %bb.switch
+//    bb.switch:
+//      switch i32 %op, label %default [ i32 1, label %sub ... ]
+//    ```
+//    A compare and a (well predicted, falling through) branch are cheaper
+//    than a jump table or a tree of compares.
+//
+//    The estimated number of taken branches is the total count of the edges
+//    that don't go to the next block. With `-block-layout-report`, it's
+//    printed for every function before and after the transformation. Note
+//    that this is only the layout that codegen starts from:
+//    MachineBlockPlacement (enabled at -O1 and above) makes its own decisions
+//    based on the same profile.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libProfileUse.so `\`
+//        -load-pass-plugin <BUILD_DIR>/lib/libBlockLayout.so `\`
+//        -passes="prof-use,block-layout" `\`
+//        -prof-use-branches=default.branchprof -block-layout-report `\`
+//        <input-llvm-file> -o laid-out.bin
+//
+// License: MIT
+//========================================================================
+#include "BlockLayout.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "block-layout"
+
+STATISTIC(NumLaidOutFunctions, "The # of functions with their blocks moved");
+STATISTIC(NumMovedBlocks, "The # of moved basic blocks");
+STATISTIC(NumPeeledSwitches, "The # of switches with the hot case peeled");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<unsigned> SwitchBias(
+    "block-layout-switch-bias",
+    cl::desc("Peel the hottest case of a switch if it takes at least this "
+             "share (in %) of the executions (over 100 to disable)"),
+    cl::init(80));
+
+static cl::opt<bool> Report(
+    "block-layout-report",
+    cl::desc("Print the estimated # of taken branches in every function"),
+    cl::init(false));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+namespace {
+// The estimated # of taken branches in one function
+struct LayoutRecord {
+  std::string Name;
+  uint64_t TakenBefore = 0;
+  uint64_t TakenAfter = 0;
+  unsigned NumPeeledSwitches = 0;
+};
+
+struct LayoutEdge {
+  BasicBlock *Src;
+  BasicBlock *Dst;
+  uint64_t Count;
+};
+} // namespace
+
+static uint64_t getBlockCount(const BasicBlock *BB,
+                              const BlockFrequencyInfo &BFI) {
+  auto Count = BFI.getBlockProfileCount(BB);
+  return Count ? *Count : 0;
+}
+
+static uint64_t getEdgeCount(const BasicBlock *BB, unsigned SuccNum,
+                             const BlockFrequencyInfo &BFI,
+                             const BranchProbabilityInfo &BPI) {
+  return BPI.getEdgeProbability(BB, SuccNum).scale(getBlockCount(BB, BFI));
+}
+
+// Returns the estimated # of taken branches with the current layout of F.
+// Every edge to a block other than the next one needs a taken branch (if
+// neither successor of a conditional branch is next, one of the two jumps is
+// taken every time).
+static uint64_t getTakenBranches(const Function &F,
+                                 const BlockFrequencyInfo &BFI,
+                                 const BranchProbabilityInfo &BPI) {
+  uint64_t Taken = 0;
+  for (const BasicBlock &BB : F) {
+    const Instruction *Term = BB.getTerminator();
+    const BasicBlock *Next = BB.getNextNode();
+    for (unsigned Succ = 0, E = Term->getNumSuccessors(); Succ != E; ++Succ)
+      if (Term->getSuccessor(Succ) != Next)
+        Taken += getEdgeCount(&BB, Succ, BFI, BPI);
+  }
+  return Taken;
+}
+
+// Peels the hottest case of SI into a guarded branch if it's biased enough.
+// Returns true if SI was peeled.
+static bool peelHotCase(SwitchInst *SI) {
+  if (SI->getNumCases() < 2)
+    return false;
+
+  // STEP 1: Find the hottest successor
+  // ----------------------------------
+  SwitchInstProfUpdateWrapper SIW(*SI);
+  uint64_t Total = 0, HotWeight = 0;
+  unsigned HotSucc = 0;
+  for (unsigned Succ = 0, E = SI->getNumSuccessors(); Succ != E; ++Succ) {
+    auto Weight = SIW.getSuccessorWeight(Succ);
+    if (!Weight)
+      return false;
+    Total += *Weight;
+    if (*Weight > HotWeight) {
+      HotWeight = *Weight;
+      HotSucc = Succ;
+    }
+  }
+
+  // The default destination can't be checked with one compare
+  if (HotSucc == 0 || HotWeight * 100 < SwitchBias * Total)
+    return false;
+
+  // STEP 2: Move the switch to a block of its own
+  // ---------------------------------------------
+  SwitchInst::CaseIt HotCase(SI, HotSucc - 1);
+  BasicBlock *BB = SI->getParent();
+  BasicBlock *HotBB = HotCase->getCaseSuccessor();
+  ConstantInt *HotValue = HotCase->getCaseValue();
+  BasicBlock *SwitchBB = BB->splitBasicBlock(SI, BB->getName() + ".switch");
+
+  // STEP 3: Branch to the hot case first
+  // ------------------------------------
+  BB->getTerminator()->eraseFromParent();
+  IRBuilder<> Builder(BB);
+  Value *IsHot =
+      Builder.CreateICmpEQ(SI->getCondition(), HotValue, "switch.hot");
+  uint64_t Scale = std::max(HotWeight, Total - HotWeight) /
+                       std::numeric_limits<uint32_t>::max() +
+                   1;
+  Builder.CreateCondBr(IsHot, HotBB, SwitchBB,
+                       MDBuilder(BB->getContext())
+                           .createBranchWeights(HotWeight / Scale,
+                                                (Total - HotWeight) / Scale));
+
+  // The new edge from BB brings the same values as the peeled case. Other
+  // cases (or the default) may still go to HotBB from the switch.
+  for (PHINode &PN : HotBB->phis())
+    PN.addIncoming(PN.getIncomingValueForBlock(SwitchBB), BB);
+  SIW.removeCase(HotCase);
+  for (PHINode &PN : HotBB->phis())
+    PN.removeIncomingValue(SwitchBB, /*DeletePHIIfEmpty=*/false);
+
+  LLVM_DEBUG(dbgs() << "Peeled case " << HotValue->getValue() << " in "
+                    << BB->getParent()->getName() << "\n");
+  return true;
+}
+
+// Lays out the blocks of F in chains along the hottest edges. Returns true
+// if any block was moved.
+static bool layoutBlocks(Function &F, const BlockFrequencyInfo &BFI,
+                         const BranchProbabilityInfo &BPI) {
+  BasicBlock *Entry = &F.getEntryBlock();
+
+  // STEP 1: Collect the edges that ran, hottest first
+  // -------------------------------------------------
+  // The entry block can't be moved, so no edge can fall through into it
+  std::vector<LayoutEdge> Edges;
+  for (BasicBlock &BB : F) {
+    Instruction *Term = BB.getTerminator();
+    for (unsigned Succ = 0, E = Term->getNumSuccessors(); Succ != E; ++Succ) {
+      BasicBlock *Dst = Term->getSuccessor(Succ);
+      uint64_t Count = getEdgeCount(&BB, Succ, BFI, BPI);
+      if (Dst != &BB && Dst != Entry && Count)
+        Edges.push_back({&BB, Dst, Count});
+    }
+  }
+  std::stable_sort(Edges.begin(), Edges.end(),
+                   [](const LayoutEdge &A, const LayoutEdge &B) {
+                     return A.Count > B.Count;
+                   });
+
+  // STEP 2: Merge the chains along the edges
+  // ----------------------------------------
+  std::vector<std::vector<BasicBlock *>> Chains;
+  DenseMap<BasicBlock *, unsigned> ChainOf;
+  for (BasicBlock &BB : F) {
+    ChainOf[&BB] = Chains.size();
+    Chains.push_back({&BB});
+  }
+
+  for (const LayoutEdge &Edge : Edges) {
+    unsigned SrcChain = ChainOf[Edge.Src], DstChain = ChainOf[Edge.Dst];
+    if (SrcChain == DstChain || Chains[SrcChain].back() != Edge.Src ||
+        Chains[DstChain].front() != Edge.Dst)
+      continue;
+    for (BasicBlock *BB : Chains[DstChain]) {
+      Chains[SrcChain].push_back(BB);
+      ChainOf[BB] = SrcChain;
+    }
+    Chains[DstChain].clear();
+  }
+
+  // STEP 3: Order the chains
+  // ------------------------
+  // The entry chain first, then the hottest chains (ties keep the original
+  // order)
+  std::vector<std::vector<BasicBlock *> *> Order;
+  for (auto &Chain : Chains)
+    if (!Chain.empty() && Chain.front() != Entry)
+      Order.push_back(&Chain);
+  std::stable_sort(Order.begin(), Order.end(),
+                   [&](const std::vector<BasicBlock *> *A,
+                       const std::vector<BasicBlock *> *B) {
+                     return getBlockCount(A->front(), BFI) >
+                            getBlockCount(B->front(), BFI);
+                   });
+  Order.insert(Order.begin(), &Chains[ChainOf[Entry]]);
+
+  // STEP 4: Move the blocks
+  // -----------------------
+  BasicBlock *Prev = nullptr;
+  unsigned NumMoved = 0;
+  for (const std::vector<BasicBlock *> *Chain : Order)
+    for (BasicBlock *BB : *Chain) {
+      if (Prev && BB->getPrevNode() != Prev) {
+        BB->moveAfter(Prev);
+        NumMoved++;
+      }
+      Prev = BB;
+    }
+
+  NumMovedBlocks += NumMoved;
+  return NumMoved != 0;
+}
+
+static void printReport(ArrayRef<LayoutRecord> Records, raw_ostream &OS) {
+  OS << "=================================================\n";
+  OS << "LLVM-TUTOR: block layout (estimated taken branches)\n";
+  OS << "=================================================\n";
+  const char *NameStr = "FUNCTION", *BeforeStr = "BEFORE",
+             *AfterStr = "AFTER", *ChangeStr = "CHANGE";
+  OS << format("%-20s %-14s %-14s %s\n", NameStr, BeforeStr, AfterStr,
+               ChangeStr);
+  OS << "-------------------------------------------------\n";
+  uint64_t TotalBefore = 0, TotalAfter = 0;
+  auto PrintRow = [&OS](const char *Name, uint64_t Before, uint64_t After) {
+    OS << format("%-20s %-14llu %-14llu %+.1f%%\n", Name,
+                 (unsigned long long)Before, (unsigned long long)After,
+                 Before ? 100.0 * (double(After) - double(Before)) / Before
+                        : 0.0);
+  };
+  for (const LayoutRecord &R : Records) {
+    PrintRow(R.Name.c_str(), R.TakenBefore, R.TakenAfter);
+    if (R.NumPeeledSwitches)
+      OS << "  peeled switches: " << R.NumPeeledSwitches << "\n";
+    TotalBefore += R.TakenBefore;
+    TotalAfter += R.TakenAfter;
+  }
+  OS << "-------------------------------------------------\n";
+  PrintRow("total", TotalBefore, TotalAfter);
+}
+
+//-----------------------------------------------------------------------------
+// BlockLayout implementation
+//-----------------------------------------------------------------------------
+bool BlockLayout::runOnModule(Module &M, ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  bool Changed = false;
+  std::vector<LayoutRecord> Records;
+  for (Function &F : M) {
+    // The functions that never ran are left alone
+    if (F.isDeclaration() || !F.getEntryCount() ||
+        F.getEntryCount()->getCount() == 0)
+      continue;
+
+    LayoutRecord Record;
+    Record.Name = F.getName().str();
+    Record.TakenBefore =
+        getTakenBranches(F, FAM.getResult<BlockFrequencyAnalysis>(F),
+                         FAM.getResult<BranchProbabilityAnalysis>(F));
+
+    // STEP 1: Peel the biased switches
+    // --------------------------------
+    SmallVector<SwitchInst *, 4> Switches;
+    for (BasicBlock &BB : F)
+      if (auto *SI = dyn_cast<SwitchInst>(BB.getTerminator()))
+        Switches.push_back(SI);
+    for (SwitchInst *SI : Switches)
+      if (peelHotCase(SI))
+        Record.NumPeeledSwitches++;
+    if (Record.NumPeeledSwitches) {
+      FAM.invalidate(F, PreservedAnalyses::none());
+      NumPeeledSwitches += Record.NumPeeledSwitches;
+    }
+
+    // STEP 2: Lay out the blocks
+    // --------------------------
+    auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+    auto &BPI = FAM.getResult<BranchProbabilityAnalysis>(F);
+    bool Moved = layoutBlocks(F, BFI, BPI);
+    if (Moved)
+      NumLaidOutFunctions++;
+    Record.TakenAfter = getTakenBranches(F, BFI, BPI);
+
+    // Some analyses depend on the order of the blocks too
+    if (Moved || Record.NumPeeledSwitches) {
+      FAM.invalidate(F, PreservedAnalyses::none());
+      Changed = true;
+    }
+    Records.push_back(std::move(Record));
+  }
+
+  if (Report)
+    printReport(Records, errs());
+
+  return Changed;
+}
+
+PreservedAnalyses BlockLayout::run(llvm::Module &M,
+                                   llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getBlockLayoutPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "block-layout", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "block-layout") {
+                    MPM.addPass(BlockLayout());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getBlockLayoutPluginInfo();
+}
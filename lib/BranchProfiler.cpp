@@ -0,0 +1,283 @@
+//========================================================================
+// FILE:
+//    BranchProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to record how many times every successor of every
+//    conditional branch and `switch` is taken, i.e. how biased the branches
+//    are. Unlike EdgeProfiler, the counts are recorded directly (rather than
+//    reconstructed from a spanning tree), so the profile can be read without
+//    any knowledge of the CFG apart from the order of the branches.
+//
+//    Every function gets the following counters (see BranchProfiler.h):
+//      * the entry count, incremented in the entry block,
+//      * two for every conditional branch: the `true` (taken) and the `false`
+//        (not taken) successor. There's no extra control flow, the counter is
+//        picked with a `select` on the condition,
+//      * one for every successor of every `switch` (the default destination
+//        first, then the cases). Every edge out of the switch is redirected
+//        to a new block that increments the counter (the cases that share a
+//        destination are still counted separately).
+//
+//    All counters are 64-bit wide and stored in one array,
+//    `BranchProfCounters`. When the program exits, the counters are appended
+//    to the profile file (`-branch-prof-output`, which can be overridden at
+//    run-time with the LLVM_TUTOR_BRANCHPROF_FILE environment variable).
+//    There's one line per instrumented function:
+//      <function> <CFG hash> <#counters> <entry count> <counter 1> ...
+//    Use ProfileUse (`-prof-use-branches`) to turn the counts into branch
+//    weights, e.g. for the BlockLayout pass.
+//
+//    Functions with exception handling or indirect branches are skipped.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libBranchProfiler.so `\`
+//        -passes="branch-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//
+// License: MIT
+//========================================================================
+#include "BranchProfiler.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "branch-prof"
+
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumSkippedFunctions, "The # of functions that were not "
+                               "instrumented (unsupported CFG)");
+STATISTIC(NumInstrumentedBranches, "The # of instrumented branches");
+STATISTIC(NumInstrumentedSwitches, "The # of instrumented switches");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string>
+    OutputFile("branch-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " BRANCH_PROFILER_FILE_ENV_VAR ")"),
+               cl::init("default.branchprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Redirects the successor SuccNum of the switch SI to a new block that
+// increments Counters[Idx]
+static void instrumentSwitchEdge(SwitchInst *SI, unsigned SuccNum,
+                                 GlobalVariable *Counters, unsigned Idx) {
+  BasicBlock *Src = SI->getParent();
+  BasicBlock *Dst = SI->getSuccessor(SuccNum);
+  BasicBlock *CounterBB = BasicBlock::Create(
+      Src->getContext(), Src->getName() + ".prof", Src->getParent(), Dst);
+  BranchInst *Br = BranchInst::Create(Dst, CounterBB);
+  incrementCounter(Br, Counters, Idx);
+  SI->setSuccessor(SuccNum, CounterBB);
+
+  // Every edge has its own entry in the PHIs of Dst. Move one of the entries
+  // for Src (the edges that were already redirected have moved theirs).
+  for (PHINode &PN : Dst->phis())
+    PN.setIncomingBlock(PN.getBasicBlockIndex(Src), CounterBB);
+}
+
+//-----------------------------------------------------------------------------
+// BranchProfiler implementation
+//-----------------------------------------------------------------------------
+bool BranchProfiler::runOnModule(Module &M, ModuleAnalysisManager &) {
+  auto &CTX = M.getContext();
+
+  // STEP 1: Count the counters
+  // --------------------------
+  // The array of counters has to exist before the functions are instrumented
+  struct FunctionRecord {
+    Function *F;
+    uint64_t Hash;
+    unsigned FirstCounter;
+    unsigned NumCounters;
+  };
+  std::vector<FunctionRecord> Records;
+  unsigned NumCounters = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    if (!CFGSpanningTree::isSupported(F)) {
+      LLVM_DEBUG(dbgs() << "Skipping: " << F.getName() << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    unsigned FuncCounters = 1;
+    for (BasicBlock &BB : F)
+      if (isProfiledBranch(*BB.getTerminator()))
+        FuncCounters += BB.getTerminator()->getNumSuccessors();
+    Records.push_back({&F, CFGSpanningTree::getStructuralHash(F), NumCounters,
+                       FuncCounters});
+    NumCounters += FuncCounters;
+  }
+
+  if (Records.empty())
+    return false;
+
+  ArrayType *CountersTy =
+      ArrayType::get(Type::getInt64Ty(CTX), NumCounters);
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "BranchProfCounters");
+  Counters->setAlignment(Align(8));
+
+  // STEP 2: Instrument the branches
+  // -------------------------------
+  for (const FunctionRecord &R : Records) {
+    Function &F = *R.F;
+    unsigned Idx = R.FirstCounter;
+    Type *Int64Ty = Type::getInt64Ty(CTX);
+    incrementCounter(&*F.getEntryBlock().getFirstInsertionPt(), Counters,
+                     Idx++);
+
+    // The switches add new blocks, only visit the original ones
+    SmallVector<Instruction *, 16> Branches;
+    for (BasicBlock &BB : F)
+      if (isProfiledBranch(*BB.getTerminator()))
+        Branches.push_back(BB.getTerminator());
+
+    for (Instruction *Term : Branches) {
+      if (auto *Br = dyn_cast<BranchInst>(Term)) {
+        // Counters[Idx] if the branch is taken, Counters[Idx + 1] otherwise
+        IRBuilder<> Builder(Br);
+        Value *CounterIdx = Builder.CreateSelect(
+            Br->getCondition(), ConstantInt::get(Int64Ty, Idx),
+            ConstantInt::get(Int64Ty, Idx + 1), "branch.counter");
+        incrementCounter(Builder, Builder.CreateInBoundsGEP(
+                                      CountersTy, Counters,
+                                      {Builder.getInt64(0), CounterIdx}));
+        NumInstrumentedBranches++;
+      } else {
+        auto *SI = cast<SwitchInst>(Term);
+        for (unsigned Succ = 0, E = SI->getNumSuccessors(); Succ != E; ++Succ)
+          instrumentSwitchEdge(SI, Succ, Counters, Idx + Succ);
+        NumInstrumentedSwitches++;
+      }
+      Idx += Term->getNumSuccessors();
+    }
+
+    assert(Idx == R.FirstCounter + R.NumCounters && "Miscounted counters");
+    LLVM_DEBUG(dbgs() << "Instrumented: " << F.getName() << " ("
+                      << R.NumCounters << " counters)\n");
+    NumInstrumentedFunctions++;
+  }
+
+  // STEP 3: Inject the table of instrumented functions
+  // --------------------------------------------------
+  // One {function name, CFG hash, #counters, counters} record per function
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *RecordTy =
+      StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty, PtrTy});
+
+  std::vector<Constant *> Entries;
+  for (const FunctionRecord &R : Records) {
+    Constant *Name =
+        createGlobalString(M, R.F->getName(), "branchprof.name");
+    Constant *FirstCounter = ConstantExpr::getInBoundsGetElementPtr(
+        CountersTy, Counters,
+        ArrayRef<Constant *>{ConstantInt::get(Int64Ty, 0),
+                             ConstantInt::get(Int64Ty, R.FirstCounter)});
+    Entries.push_back(ConstantStruct::get(
+        RecordTy, {Name, ConstantInt::get(Int64Ty, R.Hash),
+                   ConstantInt::get(Int32Ty, R.NumCounters), FirstCounter}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "BranchProfTable");
+
+  // STEP 4: Define the function that writes the profile
+  // ---------------------------------------------------
+  // See createTextProfileDump. Every record is printed as follows:
+  // ```
+  //    fprintf(File, "%s %llu %u", Table[i].Name, Table[i].Hash,
+  //            Table[i].NumCounters);
+  //    for (uint64_t j = 0; j != Table[i].NumCounters; j++)
+  //      fprintf(File, " %llu", Table[i].Counters[j]);
+  //    fprintf(File, "\n");
+  // ```
+  Constant *RecordFmt =
+      createGlobalString(M, "%s %llu %u", "branchprof.record_fmt");
+  Constant *CounterFmt =
+      createGlobalString(M, " %llu", "branchprof.counter_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "branchprof.newline");
+
+  createTextProfileDump(
+      M, "branchprof", BRANCH_PROFILER_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumRecords = Builder.getInt64(Records.size());
+        emitLoop(Builder, NumRecords, "record", [&](Value *RecordIdx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), RecordIdx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Name = LoadField(0, PtrTy, "name");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *NumCountersVal = LoadField(2, Int32Ty, "num_counters");
+          Value *CountersPtr = LoadField(3, PtrTy, "counters");
+          Builder.CreateCall(Fprintf,
+                             {File, RecordFmt, Name, Hash, NumCountersVal});
+
+          // There's always at least one counter, the entry count
+          Value *NumCounters64 = Builder.CreateZExt(NumCountersVal, Int64Ty);
+          emitLoop(Builder, NumCounters64, "counter", [&](Value *CounterIdx) {
+            Value *Count = Builder.CreateLoad(
+                Int64Ty,
+                Builder.CreateInBoundsGEP(Int64Ty, CountersPtr, CounterIdx),
+                "count");
+            Builder.CreateCall(Fprintf, {File, CounterFmt, Count});
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses BranchProfiler::run(llvm::Module &M,
+                                      llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getBranchProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "branch-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "branch-prof") {
+                    MPM.addPass(BranchProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getBranchProfilerPluginInfo();
+}
@@ -0,0 +1,227 @@
+//==============================================================================
+// FILE:
+//    CFGSpanningTree.cpp
+//
+// DESCRIPTION:
+//    The maximum spanning tree based counter placement (and the profile
+//    reconstruction) shared by EdgeProfiler and the `edgeprof` tool. See
+//    CFGSpanningTree.h for an overview.
+//
+// License: MIT
+//==============================================================================
+#include "CFGSpanningTree.h"
+
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+using namespace llvm;
+
+// The weight of the edges that should always be in the tree
+static constexpr uint64_t MaxWeight = std::numeric_limits<uint64_t>::max();
+
+namespace {
+// A minimal union-find, used to detect cycles while building the tree
+class UnionFind {
+public:
+  explicit UnionFind(unsigned N) : Parent(N) {
+    std::iota(Parent.begin(), Parent.end(), 0);
+  }
+
+  unsigned find(unsigned X) {
+    while (Parent[X] != X)
+      X = Parent[X] = Parent[Parent[X]];
+    return X;
+  }
+
+  // Returns false if A and B were already in the same set
+  bool unite(unsigned A, unsigned B) {
+    A = find(A);
+    B = find(B);
+    if (A == B)
+      return false;
+    Parent[A] = B;
+    return true;
+  }
+
+private:
+  std::vector<unsigned> Parent;
+};
+} // namespace
+
+bool CFGSpanningTree::isSupported(const Function &F) {
+  for (const BasicBlock &BB : F) {
+    if (BB.isEHPad())
+      return false;
+    const Instruction *Term = BB.getTerminator();
+    if (isa<IndirectBrInst>(Term) || isa<CallBrInst>(Term))
+      return false;
+  }
+  return true;
+}
+
+unsigned CFGSpanningTree::getNode(const BasicBlock *BB) const {
+  return BB ? NodeIdx.lookup(BB) : 0;
+}
+
+CFGSpanningTree::CFGSpanningTree(Function &F, BlockFrequencyInfo &BFI,
+                                 BranchProbabilityInfo &BPI) {
+  // STEP 1: Collect the edges (in a deterministic order)
+  // ----------------------------------------------------
+  // Note that the reachable blocks are numbered in the layout order, and not
+  // in the DFS order, so that the numbering is stable.
+  SmallPtrSet<BasicBlock *, 32> Reachable;
+  for (BasicBlock *BB : depth_first(&F.getEntryBlock()))
+    Reachable.insert(BB);
+  for (BasicBlock &BB : F) {
+    if (Reachable.count(&BB)) {
+      Blocks.push_back(&BB);
+      NodeIdx[&BB] = NumNodes++;
+    }
+  }
+
+  Edges.push_back({nullptr, &F.getEntryBlock(), MaxWeight});
+  for (BasicBlock *BB : Blocks) {
+    uint64_t Freq = BFI.getBlockFreq(BB).getFrequency();
+    Instruction *Term = BB->getTerminator();
+    if (Term->getNumSuccessors() == 0) {
+      // Blocks that end with `unreachable` are never left, hence the flow
+      // through them can only be reconstructed (i.e. the exit edge should be
+      // in the tree).
+      Edges.push_back(
+          {BB, nullptr, isa<UnreachableInst>(Term) ? MaxWeight : Freq});
+      continue;
+    }
+
+    // Multiple edges to the same successor (e.g. from a `switch`) are counted
+    // as one
+    SmallPtrSet<BasicBlock *, 8> Visited;
+    for (BasicBlock *Succ : successors(BB)) {
+      if (!Visited.insert(Succ).second)
+        continue;
+      Edges.push_back(
+          {BB, Succ, BPI.getEdgeProbability(BB, Succ).scale(Freq)});
+    }
+  }
+
+  // STEP 2: Build the maximum spanning tree (Kruskal's algorithm)
+  // -------------------------------------------------------------
+  std::vector<unsigned> Order(Edges.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  std::stable_sort(Order.begin(), Order.end(), [this](unsigned A, unsigned B) {
+    return Edges[A].Weight > Edges[B].Weight;
+  });
+
+  UnionFind Components(NumNodes);
+  for (unsigned Idx : Order) {
+    CFGEdge &E = Edges[Idx];
+    E.InTree = Components.unite(getNode(E.Src), getNode(E.Dst));
+  }
+
+  // STEP 3: Number the counters and hash the CFG
+  // --------------------------------------------
+  std::vector<uint64_t> HashData;
+  HashData.push_back(NumNodes);
+  for (CFGEdge &E : Edges) {
+    if (!E.InTree)
+      E.Counter = NumCounters++;
+    HashData.push_back((uint64_t(getNode(E.Src)) << 32) | getNode(E.Dst));
+    HashData.push_back(E.InTree);
+  }
+  CFGHash = xxh3_64bits(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(HashData.data()),
+      HashData.size() * sizeof(uint64_t)));
+}
+
+uint64_t CFGSpanningTree::getStructuralHash(const Function &F) {
+  DenseMap<const BasicBlock *, uint64_t> BlockIdx;
+  uint64_t NumBlocks = 0;
+  for (const BasicBlock &BB : F)
+    BlockIdx[&BB] = NumBlocks++;
+
+  std::vector<uint64_t> HashData;
+  HashData.push_back(NumBlocks);
+  for (const BasicBlock &BB : F) {
+    HashData.push_back(succ_size(&BB));
+    for (const BasicBlock *Succ : successors(&BB))
+      HashData.push_back(BlockIdx.lookup(Succ));
+  }
+  return xxh3_64bits(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(HashData.data()),
+      HashData.size() * sizeof(uint64_t)));
+}
+
+bool CFGSpanningTree::computeEdgeCounts(ArrayRef<uint64_t> Counters,
+                                        std::vector<uint64_t> &EdgeCounts) const {
+  assert(Counters.size() == NumCounters && "Wrong number of counters");
+
+  // The incoming and outgoing edges of every node
+  std::vector<SmallVector<unsigned, 4>> InEdges(NumNodes), OutEdges(NumNodes);
+  std::vector<bool> Known(Edges.size(), false);
+  EdgeCounts.assign(Edges.size(), 0);
+  for (unsigned Idx = 0, E = Edges.size(); Idx != E; ++Idx) {
+    OutEdges[getNode(Edges[Idx].Src)].push_back(Idx);
+    InEdges[getNode(Edges[Idx].Dst)].push_back(Idx);
+    if (!Edges[Idx].InTree) {
+      EdgeCounts[Idx] = Counters[Edges[Idx].Counter];
+      Known[Idx] = true;
+    }
+  }
+
+  // Repeatedly find a node with exactly one unknown edge and solve the flow
+  // conservation equation for it. Since the unknown edges form a tree, there
+  // is always such a node (i.e. a leaf).
+  bool Consistent = true;
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (unsigned Node = 0; Node != NumNodes; ++Node) {
+      uint64_t KnownIn = 0, KnownOut = 0;
+      unsigned NumUnknown = 0, Unknown = 0;
+      bool UnknownIsIn = false;
+      for (unsigned Idx : InEdges[Node]) {
+        if (Known[Idx]) {
+          KnownIn += EdgeCounts[Idx];
+        } else {
+          NumUnknown++;
+          Unknown = Idx;
+          UnknownIsIn = true;
+        }
+      }
+      for (unsigned Idx : OutEdges[Node]) {
+        if (Known[Idx]) {
+          KnownOut += EdgeCounts[Idx];
+        } else {
+          NumUnknown++;
+          Unknown = Idx;
+          UnknownIsIn = false;
+        }
+      }
+      if (NumUnknown != 1)
+        continue;
+
+      uint64_t Total = UnknownIsIn ? KnownOut : KnownIn;
+      uint64_t Partial = UnknownIsIn ? KnownIn : KnownOut;
+      if (Partial > Total)
+        Consistent = false;
+      EdgeCounts[Unknown] = Partial > Total ? 0 : Total - Partial;
+      Known[Unknown] = true;
+      Changed = true;
+    }
+  }
+
+  return Consistent;
+}
+
+void CFGSpanningTree::computeBlockCounts(
+    ArrayRef<uint64_t> EdgeCounts,
+    DenseMap<const BasicBlock *, uint64_t> &BlockCounts) const {
+  for (unsigned Idx = 0, E = Edges.size(); Idx != E; ++Idx)
+    if (Edges[Idx].Dst)
+      BlockCounts[Edges[Idx].Dst] += EdgeCounts[Idx];
+}
@@ -0,0 +1,340 @@
+//========================================================================
+// FILE:
+//    ColdSplitting.cpp
+//
+// DESCRIPTION:
+//    Moves the cold regions of hot functions (error handling, rarely taken
+//    slow paths) into separate functions, so that the hot code is denser and
+//    takes fewer I-cache lines:
+//    ```IR
+//      define i32 @foo(i32 %x) !prof !0 {
+//      entry:
+//        %bad = icmp slt i32 %x, 0
+//        br i1 %bad, label %error, label %ok, !prof !1
+//      error:                              ; never executed
+//        ...
+//    ```
+//    becomes:
+//    ```IR
+//      define i32 @foo(i32 %x) !prof !0 {
+//      entry:
+//        %bad = icmp slt i32 %x, 0
+//        br i1 %bad, label %codeRepl, label %ok, !prof !1
+//        ...
+//      codeRepl:                           ; moved to the end of @foo
+//        call void @foo.cold(i32 %x)
+//        ...
+//      }
+//      define internal void @foo.cold(i32 %x) #0 section ".text.unlikely.foo.cold"
+//    ```
+//    The block counts come from the `!prof` metadata (entry counts and branch
+//    weights, see ProfileUse), i.e. from BlockFrequencyInfo. Only functions
+//    with an entry count are split. A block is cold if its count is at most
+//    `-cold-split-max-count`. Every cold block that's not in a region yet
+//    starts a new region, which also gets the cold blocks that it dominates
+//    (so that the region has a single entry).
+//
+//    Outlining is not free: the hot function needs a call, every value that's
+//    live-in becomes an argument and every value that's live-out is returned
+//    through memory (a store in the cold function and a load in the hot one).
+//    A region with more than one exit also needs a switch on the value
+//    returned by the cold function. A region is split only if its size
+//    exceeds that cost by at least `-cold-split-threshold`. The sizes are
+//    TargetTransformInfo code-size costs (roughly, the # of instructions).
+//
+//    The cold functions are marked with `cold` and `minsize`, and placed in
+//    `.text.unlikely.<function>` sections so that the linker puts them away
+//    from the hot code. The block with the call to the cold function is
+//    moved to the end of the hot function, so that the hot blocks stay
+//    contiguous (with fall-through between them). With `-cold-split-report`
+//    the pass prints how much code was moved out of every function.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libProfileUse.so `\`
+//        -load-pass-plugin <BUILD_DIR>/lib/libColdSplitting.so `\`
+//        -passes="prof-use,cold-split" -prof-use-edges=default.edgeprof `\`
+//        -cold-split-report <input-llvm-file> -o split.bin
+//
+// License: MIT
+//========================================================================
+#include "ColdSplitting.h"
+
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "cold-split"
+
+STATISTIC(NumSplitFunctions, "The # of functions with cold regions split off");
+STATISTIC(NumColdRegions, "The # of cold regions split off");
+STATISTIC(NumRejectedRegions, "The # of cold regions that were not worth it");
+STATISTIC(NumIneligibleRegions, "The # of cold regions that can't be "
+                                "extracted");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<uint64_t>
+    MaxColdCount("cold-split-max-count",
+                 cl::desc("The maximum execution count of a cold block"),
+                 cl::init(0));
+
+static cl::opt<int> Threshold(
+    "cold-split-threshold",
+    cl::desc("The minimum size saved in the hot function (the size of the "
+             "region minus the cost of the call), in code-size units"),
+    cl::init(2));
+
+static cl::opt<bool>
+    Report("cold-split-report",
+           cl::desc("Print how much code was moved out of every function"),
+           cl::init(false));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+namespace {
+// What was split off from one function
+struct SplitRecord {
+  std::string Name;
+  unsigned NumRegions = 0;
+  InstructionCost Size = 0;
+  InstructionCost SizeMoved = 0;
+};
+} // namespace
+
+static InstructionCost getSize(const BasicBlock &BB,
+                               const TargetTransformInfo &TTI) {
+  InstructionCost Size = 0;
+  for (const Instruction &I : BB)
+    Size += TTI.getInstructionCost(&I, TargetTransformInfo::TCK_CodeSize);
+  return Size;
+}
+
+static bool isCold(const BasicBlock &BB, const BlockFrequencyInfo &BFI) {
+  auto Count = BFI.getBlockProfileCount(&BB);
+  return Count && *Count <= MaxColdCount;
+}
+
+// Returns the cold blocks dominated by Header (which is cold), Header first.
+// The blocks that have predecessors outside the region (other than Header)
+// are dropped, so that Header is the only entry.
+static SmallVector<BasicBlock *, 8>
+getColdRegion(BasicBlock *Header, const DominatorTree &DT,
+              const BlockFrequencyInfo &BFI) {
+  SetVector<BasicBlock *> Region;
+  Region.insert(Header);
+  for (unsigned Idx = 0; Idx != Region.size(); ++Idx)
+    for (BasicBlock *Succ : successors(Region[Idx]))
+      if (DT.dominates(Header, Succ) && isCold(*Succ, BFI))
+        Region.insert(Succ);
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (BasicBlock *BB : Region) {
+      if (BB == Header || all_of(predecessors(BB), [&](BasicBlock *Pred) {
+            return Region.contains(Pred);
+          }))
+        continue;
+      Region.remove(BB);
+      Changed = true;
+      break;
+    }
+  }
+  return SmallVector<BasicBlock *, 8>(Region.begin(), Region.end());
+}
+
+// Returns the cost of calling the cold function instead of running the region
+// inline (in code-size units)
+static int getCallPenalty(const CodeExtractor &CE,
+                          ArrayRef<BasicBlock *> Region) {
+  SetVector<Value *> Inputs, Outputs, Sinks;
+  CE.findInputsOutputs(Inputs, Outputs, Sinks);
+
+  SmallPtrSet<BasicBlock *, 4> Exits;
+  for (BasicBlock *BB : Region)
+    for (BasicBlock *Succ : successors(BB))
+      if (!is_contained(Region, Succ))
+        Exits.insert(Succ);
+
+  // The call, the arguments, a store and a load per output and a switch on
+  // the exit (if there's more than one)
+  int Penalty = 1 + Inputs.size() + 2 * Outputs.size();
+  if (Exits.size() > 1)
+    Penalty += Exits.size();
+  return Penalty;
+}
+
+// Splits the cold regions off F. Returns true if anything was split.
+static bool splitFunction(Function &F, FunctionAnalysisManager &FAM,
+                          SplitRecord &Record) {
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+  auto &BPI = FAM.getResult<BranchProbabilityAnalysis>(F);
+  auto &TTI = FAM.getResult<TargetIRAnalysis>(F);
+  auto &AC = FAM.getResult<AssumptionAnalysis>(F);
+
+  // STEP 1: Find the cold regions
+  // -----------------------------
+  // The regions are found before anything is split (splitting changes the
+  // CFG, but not the blocks of the other regions)
+  DominatorTree DT(F);
+  std::vector<SmallVector<BasicBlock *, 8>> Regions;
+  SmallPtrSet<BasicBlock *, 16> InRegion;
+  for (BasicBlock *BB : ReversePostOrderTraversal<Function *>(&F)) {
+    Record.Size += getSize(*BB, TTI);
+    if (BB->isEntryBlock() || InRegion.count(BB) || !isCold(*BB, BFI))
+      continue;
+    SmallVector<BasicBlock *, 8> Region = getColdRegion(BB, DT, BFI);
+    InRegion.insert(Region.begin(), Region.end());
+    Regions.push_back(std::move(Region));
+  }
+
+  // STEP 2: Split off the regions that are worth it
+  // -----------------------------------------------
+  bool Changed = false;
+  for (ArrayRef<BasicBlock *> Region : Regions) {
+    // The dominator tree is stale after every split
+    DominatorTree CurrentDT(F);
+    CodeExtractor CE(Region, &CurrentDT, /*AggregateArgs=*/false, &BFI, &BPI,
+                     &AC, /*AllowVarArgs=*/false, /*AllowAlloca=*/false,
+                     /*AllocationBlock=*/nullptr, /*Suffix=*/"cold");
+    if (!CE.isEligible()) {
+      LLVM_DEBUG(dbgs() << "Can't extract the region at "
+                        << Region.front()->getName() << " in " << F.getName()
+                        << "\n");
+      NumIneligibleRegions++;
+      continue;
+    }
+
+    InstructionCost RegionSize = 0;
+    for (BasicBlock *BB : Region)
+      RegionSize += getSize(*BB, TTI);
+    if (!RegionSize.isValid() ||
+        RegionSize < getCallPenalty(CE, Region) + Threshold) {
+      NumRejectedRegions++;
+      continue;
+    }
+
+    CodeExtractorAnalysisCache CEAC(F);
+    Function *Cold = CE.extractCodeRegion(CEAC);
+    if (!Cold)
+      continue;
+
+    Cold->addFnAttr(Attribute::Cold);
+    Cold->addFnAttr(Attribute::MinSize);
+    Cold->addFnAttr(Attribute::NoInline);
+    Cold->setSection((".text.unlikely." + Cold->getName()).str());
+
+    // Keep the hot blocks together - the call goes to the end
+    for (User *U : Cold->users())
+      if (auto *Call = dyn_cast<CallInst>(U))
+        Call->getParent()->moveAfter(&F.back());
+
+    Record.NumRegions++;
+    Record.SizeMoved += RegionSize;
+    NumColdRegions++;
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+static void printReport(ArrayRef<SplitRecord> Records, raw_ostream &OS) {
+  OS << "=================================================\n";
+  OS << "LLVM-TUTOR: hot/cold splitting\n";
+  OS << "=================================================\n";
+  const char *NameStr = "FUNCTION", *RegionsStr = "#REGIONS",
+             *MovedStr = "SIZE MOVED";
+  OS << format("%-20s %-10s %s\n", NameStr, RegionsStr, MovedStr);
+  OS << "-------------------------------------------------\n";
+  for (const SplitRecord &R : Records) {
+    // Only the regions with a valid size are moved, but TTI may not know the
+    // size of some of the other instructions
+    int64_t Moved = *R.SizeMoved.getValue();
+    if (!R.Size.isValid()) {
+      OS << format("%-20s %-10u %lld (-)\n", R.Name.c_str(), R.NumRegions,
+                   (long long)Moved);
+      continue;
+    }
+    int64_t Size = *R.Size.getValue();
+    OS << format("%-20s %-10u %lld (%.1f%%)\n", R.Name.c_str(), R.NumRegions,
+                 (long long)Moved, Size ? 100.0 * Moved / Size : 0.0);
+  }
+  OS << "-------------------------------------------------\n";
+}
+
+//-----------------------------------------------------------------------------
+// ColdSplitting implementation
+//-----------------------------------------------------------------------------
+bool ColdSplitting::runOnModule(Module &M, ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // The cold functions are added to the module as it's being traversed
+  std::vector<Function *> Functions;
+  for (Function &F : M)
+    if (!F.isDeclaration() && F.getEntryCount() &&
+        F.getEntryCount()->getCount() > MaxColdCount &&
+        !F.hasFnAttribute(Attribute::Cold))
+      Functions.push_back(&F);
+
+  std::vector<SplitRecord> Records;
+  for (Function *F : Functions) {
+    SplitRecord Record;
+    Record.Name = F->getName().str();
+    if (!splitFunction(*F, FAM, Record))
+      continue;
+    FAM.invalidate(*F, PreservedAnalyses::none());
+    Records.push_back(std::move(Record));
+    NumSplitFunctions++;
+  }
+
+  if (Report)
+    printReport(Records, errs());
+
+  return !Records.empty();
+}
+
+PreservedAnalyses ColdSplitting::run(llvm::Module &M,
+                                     llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getColdSplittingPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "cold-split", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "cold-split") {
+                    MPM.addPass(ColdSplitting());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getColdSplittingPluginInfo();
+}
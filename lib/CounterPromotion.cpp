@@ -0,0 +1,295 @@
+//========================================================================
+// FILE:
+//    CounterPromotion.cpp
+//
+// DESCRIPTION:
+//    Promotes the counter updates in loops to registers. The instrumentation
+//    passes (EdgeProfiler, DynamicCallGraph and DynamicCallCounter with plain
+//    counters) update every counter with a load/add/store sequence:
+//    ```IR
+//      %1 = load i64, ptr getelementptr inbounds ([4 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+//      %2 = add i64 1, %1
+//      store i64 %2, ptr getelementptr inbounds ([4 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+//    ```
+//    In a loop, that's a load and a store on every iteration and a
+//    loop-carried dependency through memory, which stops e.g. the loop
+//    vectoriser. Instead, this pass accumulates the increments of every such
+//    counter in a register and adds the sum to the counter in memory once,
+//    when the loop is left:
+//    ```IR
+//      preheader:
+//        br label %header
+//      header:
+//        %delta = phi i64 [ 0, %preheader ], [ %delta.next, %latch ]
+//        ...
+//        %delta.next = add i64 1, %delta
+//        ...
+//      exit:
+//        %3 = load i64, ptr getelementptr inbounds (...)
+//        %4 = add i64 %3, %delta.next
+//        store i64 %4, ptr getelementptr inbounds (...)
+//    ```
+//    The rules:
+//      * Only the counters with a loop-invariant address (i.e. a constant
+//        offset into an array of counters marked with PROFILE_COUNTERS_MD) are
+//        promoted.
+//      * The loops are put into the simplified form first, so that every exit
+//        block is only reachable from inside the loop. The pending increments
+//        are flushed in every exit block, however many there are.
+//      * The counters are read when the profile is written, i.e. when the
+//        program exits. Loops that contain calls that may read memory (e.g.
+//        `exit`) or that may unwind are not promoted, as the pending
+//        increments would be lost.
+//      * Only the increments are kept in registers (not the counter values),
+//        so the counters can still be updated elsewhere in the meantime (e.g.
+//        by a recursive call).
+//      * Loops are processed inside-out. The flush after an inner loop is a
+//        counter update in the outer loop, so it is promoted again. In a loop
+//        nest, the counters are only updated in memory when the outermost loop
+//        is left.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libEdgeProfiler.so `\`
+//        -load-pass-plugin <BUILD_DIR>/lib/libCounterPromotion.so `\`
+//        -passes="edge-prof,promote-counters" <input-llvm-file> `\`
+//        -o instrumented.bin
+//
+// License: MIT
+//========================================================================
+#include "CounterPromotion.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+#include <optional>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "promote-counters"
+
+STATISTIC(NumPromotedCounters, "The # of {loop, counter} pairs promoted");
+STATISTIC(NumPromotedUpdates, "The # of counter updates moved out of memory");
+STATISTIC(NumSkippedLoops, "The # of loops with counters that could not be "
+                           "promoted");
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+namespace {
+// `store (add (load Ptr), Step), Ptr`
+struct CounterUpdate {
+  LoadInst *Load;
+  StoreInst *Store;
+};
+} // namespace
+
+// Returns the counter update that ends with SI (if there's one)
+static std::optional<CounterUpdate> matchCounterUpdate(StoreInst &SI) {
+  auto *Ptr = dyn_cast<Constant>(SI.getPointerOperand());
+  if (!SI.isSimple() || !Ptr || !isProfileCounters(getUnderlyingObject(Ptr)))
+    return std::nullopt;
+
+  auto *Add = dyn_cast<BinaryOperator>(SI.getValueOperand());
+  if (!Add || Add->getOpcode() != Instruction::Add || !Add->hasOneUse())
+    return std::nullopt;
+
+  for (Value *Op : Add->operands()) {
+    auto *Load = dyn_cast<LoadInst>(Op);
+    if (!Load || !Load->isSimple() || Load->getPointerOperand() != Ptr ||
+        !Load->hasOneUse() || Load->getParent() != SI.getParent())
+      continue;
+
+    // Nothing in between may write to memory
+    if (none_of(make_range(std::next(Load->getIterator()), SI.getIterator()),
+                [](Instruction &I) { return I.mayWriteToMemory(); }))
+      return CounterUpdate{Load, &SI};
+  }
+
+  return std::nullopt;
+}
+
+// Returns true if the counters have to be up-to-date in memory before I is
+// executed
+static bool mayObserveCounters(Instruction &I) {
+  if (auto *Load = dyn_cast<LoadInst>(&I))
+    return isProfileCounters(getUnderlyingObject(Load->getPointerOperand()));
+
+  if (I.mayThrow())
+    return true;
+
+  // E.g. llvm.lifetime.start, llvm.dbg.value or `sqrt`
+  auto *Call = dyn_cast<CallBase>(&I);
+  return Call && !Call->onlyAccessesArgMemory() &&
+         !Call->onlyAccessesInaccessibleMemory();
+}
+
+// Promotes the counter updates in L. The pending increments are kept in
+// allocas (appended to Deltas), which are promoted to registers later.
+static bool promoteCounters(Loop &L, SmallVectorImpl<AllocaInst *> &Deltas) {
+  // STEP 1: Collect the counter updates (grouped by counter)
+  // --------------------------------------------------------
+  MapVector<Value *, SmallVector<CounterUpdate, 4>> Updates;
+  SmallPtrSet<Instruction *, 16> UpdateLoads;
+  for (BasicBlock *BB : L.blocks())
+    for (Instruction &I : *BB)
+      if (auto *SI = dyn_cast<StoreInst>(&I))
+        if (auto Update = matchCounterUpdate(*SI)) {
+          Updates[SI->getPointerOperand()].push_back(*Update);
+          UpdateLoads.insert(Update->Load);
+        }
+
+  if (Updates.empty())
+    return false;
+
+  // STEP 2: Check that the loop can be promoted
+  // -------------------------------------------
+  // Every exit block must be dedicated and must be able to hold the flush
+  // (e.g. a block with `catchswitch` can't)
+  BasicBlock *Preheader = L.getLoopPreheader();
+  SmallVector<BasicBlock *, 4> Exits;
+  L.getUniqueExitBlocks(Exits);
+  bool CanPromote =
+      Preheader && L.hasDedicatedExits() && none_of(Exits, [](BasicBlock *BB) {
+        return BB->getFirstInsertionPt() == BB->end();
+      });
+
+  for (BasicBlock *BB : L.blocks())
+    for (Instruction &I : *BB)
+      if (CanPromote && !UpdateLoads.count(&I) && mayObserveCounters(I)) {
+        LLVM_DEBUG(dbgs() << "Not promoting loop " << L.getName()
+                          << ", the counters are observed by: " << I << "\n");
+        CanPromote = false;
+      }
+
+  if (!CanPromote) {
+    NumSkippedLoops++;
+    return false;
+  }
+
+  // STEP 3: Accumulate the increments in the loop, flush them in the exits
+  // -----------------------------------------------------------------------
+  // Take the insertion points before any flushes are added, so that the
+  // counters are flushed in the order of the updates
+  SmallVector<Instruction *, 4> FlushPts;
+  for (BasicBlock *Exit : Exits)
+    FlushPts.push_back(&*Exit->getFirstInsertionPt());
+
+  BasicBlock &Entry = Preheader->getParent()->getEntryBlock();
+  bool Changed = false;
+  for (auto &[Ptr, CounterUpdates] : Updates) {
+    Type *Ty = CounterUpdates.front().Load->getType();
+    if (any_of(CounterUpdates,
+               [Ty](CounterUpdate &U) { return U.Load->getType() != Ty; }))
+      continue;
+
+    IRBuilder<> Builder(&Entry, Entry.getFirstInsertionPt());
+    AllocaInst *Delta = Builder.CreateAlloca(Ty, nullptr, "counter.delta");
+
+    // delta = 0;
+    Builder.SetInsertPoint(Preheader->getTerminator());
+    Builder.CreateStore(Constant::getNullValue(Ty), Delta);
+
+    // delta = delta + Step;
+    for (CounterUpdate &U : CounterUpdates) {
+      U.Load->setOperand(U.Load->getPointerOperandIndex(), Delta);
+      U.Store->setOperand(U.Store->getPointerOperandIndex(), Delta);
+    }
+
+    // *Ptr = *Ptr + delta;
+    for (Instruction *FlushPt : FlushPts) {
+      Builder.SetInsertPoint(FlushPt);
+      Value *Pending = Builder.CreateLoad(Ty, Delta);
+      Value *Count = Builder.CreateLoad(Ty, Ptr);
+      Builder.CreateStore(Builder.CreateAdd(Count, Pending), Ptr);
+    }
+
+    Deltas.push_back(Delta);
+    NumPromotedCounters++;
+    NumPromotedUpdates += CounterUpdates.size();
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+//-----------------------------------------------------------------------------
+// CounterPromotion implementation
+//-----------------------------------------------------------------------------
+PreservedAnalyses CounterPromotion::run(Function &F,
+                                        FunctionAnalysisManager &FAM) {
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+
+  // Nothing to do if there are no counters or no loops
+  if (LI.empty() || none_of(F.getParent()->globals(), [](GlobalVariable &GV) {
+        return isProfileCounters(&GV);
+      }))
+    return PreservedAnalyses::all();
+
+  // Make sure that every loop has a preheader and dedicated exit blocks
+  bool Changed = false;
+  for (Loop *L : LI)
+    Changed |= simplifyLoop(L, &DT, &LI, /*SE=*/nullptr, /*AC=*/nullptr,
+                            /*MSSAU=*/nullptr, /*PreserveLCSSA=*/false);
+
+  // Inner loops first (in the pre-order, every loop comes before its subloops)
+  SmallVector<AllocaInst *, 8> Deltas;
+  SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(Loops))
+    Changed |= promoteCounters(*L, Deltas);
+
+  if (!Deltas.empty())
+    PromoteMemToReg(Deltas, DT);
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  return PA;
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getCounterPromotionPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "promote-counters", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            // E.g. -passes="function(promote-counters)"
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "promote-counters") {
+                    FPM.addPass(CounterPromotion());
+                    return true;
+                  }
+                  return false;
+                });
+            // E.g. -passes="edge-prof,promote-counters"
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "promote-counters") {
+                    MPM.addPass(
+                        createModuleToFunctionPassAdaptor(CounterPromotion()));
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getCounterPromotionPluginInfo();
+}
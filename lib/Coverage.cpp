@@ -0,0 +1,346 @@
+//========================================================================
+// FILE:
+//    Coverage.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to record which functions (or basic blocks) were
+//    executed at least once. Unlike DynamicCallCounter and EdgeProfiler, this
+//    pass doesn't count anything - every instrumented site gets a one-byte
+//    flag that's set the first time the site runs. That's all that's needed
+//    to find dead code, and it's cheap enough to stay enabled in production
+//    (e.g. in canary builds).
+//
+//    All the flags of a module are packed into one array, `CoverageFlags`,
+//    with one byte per site:
+//      * `-coverage-level=function` - one site per function (its entry),
+//      * `-coverage-level=block` - one site per basic block (default).
+//    With `-coverage-update=store` (default), every site sets its flag with a
+//    plain store (relaxed atomic, which is a plain `mov` on every target):
+//    ```IR
+//      store atomic i8 1, ptr getelementptr inbounds ([5 x i8], ptr @CoverageFlags, i64 0, i64 2) monotonic, align 1
+//    ```
+//    That's one instruction, but it dirties the cache line every time the
+//    site runs. In multi-threaded programs, the cores that run the same code
+//    would keep stealing the cache line from one another. With
+//    `-coverage-update=test-and-store`, the flag is only stored if it's not
+//    set yet, i.e. only the first time the site runs:
+//    ```IR
+//      %flag = load atomic i8, ptr getelementptr inbounds (...) monotonic, align 1
+//      %unset = icmp eq i8 %flag, 0
+//      br i1 %unset, label %cov.set, label %cov.cont, !prof !0
+//    ```
+//    after which the cache line can be shared by all the cores.
+//
+//    When the program exits, the flags are appended to the coverage map
+//    (`-coverage-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_COVERAGE_FILE environment variable) as a bitmap, one line per
+//    instrumented function:
+//      <function> <level> <CFG hash> <#sites> <bitmap>
+//    The bitmap is in hex, two digits per 8 sites, the lowest bit first (e.g.
+//    `0d` for sites 0, 2 and 3 out of 5). The sites are the basic blocks in
+//    the order of the uninstrumented function. `tutor-cov` merges the maps
+//    from any number of runs (i.e. ORs the bitmaps) and reports the code that
+//    never ran.
+//
+//    Functions with blocks that can't be instrumented (e.g. `catchswitch`)
+//    are skipped.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libCoverage.so `\`
+//        -passes="coverage" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/tutor-cov <input-llvm-file> default.covmap
+//
+// License: MIT
+//========================================================================
+#include "Coverage.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "coverage"
+
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumSkippedFunctions, "The # of functions that were not "
+                               "instrumented (unsupported CFG)");
+STATISTIC(NumSites, "The # of coverage flags");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+enum class CoverageLevel { Function, Block };
+enum class UpdateKind { Store, TestAndStore };
+
+static cl::opt<CoverageLevel> Level(
+    "coverage-level", cl::desc("What to record"),
+    cl::values(clEnumValN(CoverageLevel::Function, "function",
+                          "the functions that were executed"),
+               clEnumValN(CoverageLevel::Block, "block",
+                          "the basic blocks that were executed (default)")),
+    cl::init(CoverageLevel::Block));
+
+static cl::opt<UpdateKind> Update(
+    "coverage-update", cl::desc("How to set the flags"),
+    cl::values(clEnumValN(UpdateKind::Store, "store",
+                          "always store 1 (default)"),
+               clEnumValN(UpdateKind::TestAndStore, "test-and-store",
+                          "only store 1 if the flag is not set yet (doesn't "
+                          "dirty the cache line once the flag is set)")),
+    cl::init(UpdateKind::Store));
+
+static cl::opt<std::string>
+    OutputFile("coverage-output",
+               cl::desc("The file to append the coverage map to (can be "
+                        "overridden with " COVERAGE_FILE_ENV_VAR ")"),
+               cl::init("default.covmap"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Can every block of F be instrumented?
+static bool isSupported(const Function &F) {
+  for (const BasicBlock &BB : F)
+    if (BB.getFirstInsertionPt() == BB.end())
+      return false;
+  return true;
+}
+
+// Inserts `Flags[Idx] = 1` (or `if (!Flags[Idx]) Flags[Idx] = 1`) at the
+// beginning of BB
+static void setFlag(BasicBlock &BB, GlobalVariable *Flags, unsigned Idx) {
+  BasicBlock::iterator IP = BB.getFirstInsertionPt();
+  // With test-and-store, BB is split below, so insert after the static
+  // allocas (which must stay in the entry block)
+  if (Update == UpdateKind::TestAndStore && BB.isEntryBlock())
+    while (isa<AllocaInst>(IP))
+      ++IP;
+  Instruction *InsertPt = &*IP;
+  IRBuilder<> Builder(InsertPt);
+  Value *Ptr = Builder.CreateConstInBoundsGEP2_64(Flags->getValueType(), Flags,
+                                                  0, Idx);
+
+  if (Update == UpdateKind::TestAndStore) {
+    LoadInst *Flag = Builder.CreateLoad(Builder.getInt8Ty(), Ptr, "cov.flag");
+    Flag->setAtomic(AtomicOrdering::Monotonic);
+    Flag->setAlignment(Align(1));
+    Value *Unset = Builder.CreateIsNull(Flag, "cov.unset");
+    // The flag is only ever set once
+    Instruction *Then = SplitBlockAndInsertIfThen(
+        Unset, InsertPt, /*Unreachable=*/false,
+        MDBuilder(BB.getContext()).createBranchWeights(1, (1U << 20) - 1));
+    Then->getParent()->setName("cov.set");
+    InsertPt->getParent()->setName("cov.cont");
+    Builder.SetInsertPoint(Then);
+  }
+
+  StoreInst *Store = Builder.CreateStore(Builder.getInt8(1), Ptr);
+  Store->setAtomic(AtomicOrdering::Monotonic);
+  Store->setAlignment(Align(1));
+}
+
+namespace {
+// The flags of one instrumented function
+struct FunctionRecord {
+  Function *F;
+  uint64_t Hash;
+  unsigned FirstFlag;
+  unsigned NumFlags;
+};
+} // namespace
+
+//-----------------------------------------------------------------------------
+// Coverage implementation
+//-----------------------------------------------------------------------------
+bool Coverage::runOnModule(Module &M) {
+  auto &CTX = M.getContext();
+
+  // STEP 1: Assign the flags
+  // ------------------------
+  // The hashes must be computed before any function is modified (the
+  // test-and-store updates split the blocks).
+  std::vector<FunctionRecord> Records;
+  unsigned TotalFlags = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    if (!isSupported(F)) {
+      LLVM_DEBUG(dbgs() << "Skipping: " << F.getName() << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    unsigned N = Level == CoverageLevel::Block ? F.size() : 1;
+    Records.push_back(
+        {&F, CFGSpanningTree::getStructuralHash(F), TotalFlags, N});
+    TotalFlags += N;
+  }
+
+  if (Records.empty())
+    return false;
+
+  // STEP 2: Inject the flags
+  // ------------------------
+  // Every block is instrumented before any of them is split, so that the
+  // flags follow the order of the uninstrumented blocks.
+  ArrayType *FlagsTy = ArrayType::get(Type::getInt8Ty(CTX), TotalFlags);
+  auto *Flags = new GlobalVariable(
+      M, FlagsTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(FlagsTy), "CoverageFlags");
+
+  for (const FunctionRecord &R : Records) {
+    SmallVector<BasicBlock *, 32> Blocks;
+    if (Level == CoverageLevel::Block)
+      for (BasicBlock &BB : *R.F)
+        Blocks.push_back(&BB);
+    else
+      Blocks.push_back(&R.F->getEntryBlock());
+
+    for (unsigned Idx = 0, E = Blocks.size(); Idx != E; ++Idx)
+      setFlag(*Blocks[Idx], Flags, R.FirstFlag + Idx);
+
+    LLVM_DEBUG(dbgs() << "Instrumented: " << R.F->getName() << " ("
+                      << R.NumFlags << " sites)\n");
+    NumInstrumentedFunctions++;
+    NumSites += R.NumFlags;
+  }
+
+  // STEP 3: Inject the table of instrumented functions
+  // --------------------------------------------------
+  // One {name, CFG hash, #flags, first flag} record per function
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int8Ty = Type::getInt8Ty(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *RecordTy =
+      StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty, PtrTy});
+
+  std::vector<Constant *> Entries;
+  for (const FunctionRecord &R : Records) {
+    Constant *FirstFlag = ConstantExpr::getInBoundsGetElementPtr(
+        FlagsTy, Flags,
+        ArrayRef<Constant *>{ConstantInt::get(Int64Ty, 0),
+                             ConstantInt::get(Int64Ty, R.FirstFlag)});
+    Entries.push_back(ConstantStruct::get(
+        RecordTy, {createGlobalString(M, R.F->getName(), "coverage.name"),
+                   ConstantInt::get(Int64Ty, R.Hash),
+                   ConstantInt::get(Int32Ty, R.NumFlags), FirstFlag}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "CoverageTable");
+
+  // STEP 4: Define the function that writes the coverage map
+  // --------------------------------------------------------
+  // See createTextProfileDump. Every record is printed as follows:
+  // ```
+  //    fprintf(File, "%s block %llu %u ", Table[i].Name, Table[i].Hash,
+  //            Table[i].NumFlags);
+  //    for (uint64_t j = 0; j != (Table[i].NumFlags + 7) / 8; j++) {
+  //      unsigned Byte = 0;
+  //      for (unsigned Bit = 0; Bit != 8; Bit++)
+  //        if (8 * j + Bit < Table[i].NumFlags)
+  //          Byte |= (Table[i].Flags[8 * j + Bit] != 0) << Bit;
+  //      fprintf(File, "%02x", Byte);
+  //    }
+  //    fprintf(File, "\n");
+  // ```
+  // The loop over the bits is unrolled.
+  StringRef LevelName = Level == CoverageLevel::Block ? "block" : "function";
+  Constant *RecordFmt = createGlobalString(
+      M, ("%s " + LevelName + " %llu %u ").str(), "coverage.record_fmt");
+  Constant *ByteFmt = createGlobalString(M, "%02x", "coverage.byte_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "coverage.newline");
+
+  createTextProfileDump(
+      M, "coverage", COVERAGE_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumRecords = Builder.getInt64(Records.size());
+        emitLoop(Builder, NumRecords, "record", [&](Value *RecordIdx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), RecordIdx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Name = LoadField(0, PtrTy, "name");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *NumFlagsVal = LoadField(2, Int32Ty, "num_flags");
+          Value *FlagsPtr = LoadField(3, PtrTy, "flags");
+          Builder.CreateCall(Fprintf,
+                             {File, RecordFmt, Name, Hash, NumFlagsVal});
+
+          // There's always at least one flag
+          Value *NumFlags64 = Builder.CreateZExt(NumFlagsVal, Int64Ty);
+          Value *NumBytes = Builder.CreateLShr(
+              Builder.CreateAdd(NumFlags64, Builder.getInt64(7)), 3,
+              "num_bytes");
+          emitLoop(Builder, NumBytes, "byte", [&](Value *ByteIdx) {
+            Value *Byte = Builder.getInt32(0);
+            for (unsigned Bit = 0; Bit != 8; ++Bit) {
+              Value *FlagIdx = Builder.CreateOr(
+                  Builder.CreateShl(ByteIdx, 3), Builder.getInt64(Bit));
+              // The flags past the end are not loaded
+              Value *InRange = Builder.CreateICmpULT(FlagIdx, NumFlags64);
+              Value *Flag = Builder.CreateLoad(
+                  Int8Ty,
+                  Builder.CreateInBoundsGEP(
+                      Int8Ty, FlagsPtr,
+                      Builder.CreateSelect(InRange, FlagIdx,
+                                           Builder.getInt64(0))));
+              Value *IsSet =
+                  Builder.CreateAnd(InRange, Builder.CreateIsNotNull(Flag));
+              Byte = Builder.CreateOr(
+                  Byte, Builder.CreateShl(Builder.CreateZExt(IsSet, Int32Ty),
+                                          Bit));
+            }
+            Builder.CreateCall(Fprintf, {File, ByteFmt, Byte});
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses Coverage::run(llvm::Module &M, llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getCoveragePluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "coverage", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "coverage") {
+                    MPM.addPass(Coverage());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getCoveragePluginInfo();
+}
@@ -11,71 +11,515 @@
 //
 //    This pass adds/injects code that will count function calls at
 //    runtime and prints the results when the module exits. More specifically:
-//      1. For every function F _defined_ in M:
-//          * defines a global variable, `i32 CounterFor_F`, initialised with 0
-//          * adds instructions at the beginning of F that increment `CounterFor_F`
-//            every time F executes
-//      2. At the end of the module (after `main`), calls `printf_wrapper` that
-//         prints the global call counters injected by this pass (e.g.
-//         `CounterFor_F`). The definition of `printf_wrapper` is also inserted by
-//         DynamicCallCounter.
+//      1. Defines a global array, `CallCounters`, with one `i32` counter
+//         (initialised with 0) for every function _defined_ in M.
+//      2. For every function F _defined_ in M, adds instructions at the
+//         beginning of F that increment the counter for F every time F
+//         executes.
+//      3. Defines a constant table, `CallCounterTable`, with one {function
+//         name, counter address} record per function.
+//      4. At the end of the module (after `main`), calls `printf_wrapper` that
+//         loops over `CallCounterTable` and prints the call counters. The
+//         definition of `printf_wrapper` is also inserted by
+//         DynamicCallCounter. Its size does not depend on the number of
+//         functions in M.
 //
 //    To illustrate, the following code will be injected at the beginning of
-//    function F (defined in the input module):
+//    function F (defined in the input module), where F is the 3rd function in
+//    the module:
 //    ```IR
-//      %1 = load i32, i32* @CounterFor_F
+//      %1 = load i32, ptr getelementptr inbounds ([4 x i32], ptr @CallCounters, i64 0, i64 2)
 //      %2 = add i32 1, %1
-//      store i32 %2, i32* @CounterFor_F
+//      store i32 %2, ptr getelementptr inbounds ([4 x i32], ptr @CallCounters, i64 0, i64 2)
 //    ```
-//    The following definition of `CounterFor_F` is also added:
+//    The following definition of `CallCounters` is also added:
 //    ```IR
-//      @CounterFor_foo = common global i32 0, align 4
+//      @CallCounters = internal global [4 x i32] zeroinitializer, align 4
 //    ```
 //
 //    This pass will only count calls to functions _defined_ in the input
 //    module. Functions that are only _declared_ (and defined elsewhere) are not
 //    counted.
 //
+//    The counters described above are neither thread-safe nor overflow-proof.
+//    With `-dynamic-cc-counters=atomic` every counter is 64-bit wide and
+//    incremented with a relaxed (i.e. `monotonic`) atomic read-modify-write:
+//    ```IR
+//      %1 = atomicrmw add ptr getelementptr inbounds (...), i64 1 monotonic, align 64
+//    ```
+//    Counters for functions that are called from different threads would
+//    still share a cache line (false sharing), which is why in this mode every
+//    counter is also padded to a cache line of its own:
+//    ```IR
+//      @CallCounters = internal global [4 x { i64, [56 x i8] }] zeroinitializer, align 64
+//    ```
+//    The size of the cache line is controlled with
+//    `-dynamic-cc-cache-line-size` (0 disables the padding).
+//
+//    Even these counters add measurable overhead to very small functions that
+//    are called very often. With `-dynamic-cc-counters=sampled` only roughly
+//    one in `-dynamic-cc-sample-period` calls is recorded. Every thread keeps
+//    a countdown and the code injected into every function only decrements and
+//    tests it:
+//    ```IR
+//      %cd.addr = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cc.countdown)
+//      %cd = load i32, ptr %cd.addr
+//      %cd.next = sub i32 %cd, 1
+//      store i32 %cd.next, ptr %cd.addr
+//      %expired = icmp sle i32 %cd.next, 0
+//      br i1 %expired, label %sample, label %continue, !prof !0
+//    sample:
+//      call void @dynamic_cc_sample(i32 2)
+//    ```
+//    `dynamic_cc_sample` (out-of-line) counts the sample for the function and
+//    restarts the countdown with a random interval (uniformly distributed,
+//    with the mean equal to the period), so that the samples don't alias with
+//    loops that call the same functions periodically. The number of samples
+//    times the period estimates the number of calls. The results (and the
+//    binary profiles) contain the estimates, the printed results also contain
+//    the number of samples and the standard error of every estimate.
+//
+//    Printing the results is convenient, but not when the results from many
+//    runs need to be aggregated. With `-dynamic-cc-output=<file>`, the
+//    counters are written to a binary profile instead (see TutorProfile.h),
+//    which is what `tutor-profdata merge` reads. The file is created and
+//    mapped into memory when the program starts and the counters (aligned and
+//    padded to ProfileWriterPageSize) are moved into it, so a process that
+//    crashes still leaves a (partial) profile behind. See ProfileWriter.h.
+//    The first `%p` in the file name is replaced with the process ID, so that
+//    every run writes its own profile. The LLVM_TUTOR_PROFILE_FILE
+//    environment variable overrides the file name at run-time (verbatim, `%p`
+//    is not expanded).
+//    Every function is recorded with the hash of its CFG (computed before the
+//    instrumentation), so that ProfileUse can detect stale profiles.
+//
+//    Programs built from many instrumented modules need the runtime library
+//    (libTutorRuntime.a, see TutorRuntime.h). With `-dynamic-cc-runtime`,
+//    the module doesn't print (or write) anything itself. Instead, it
+//    registers a table that describes its counters with the runtime, which
+//    writes the results of all the modules once. `static` functions are
+//    recorded as `<source file>:<name>`, so that functions with the same name
+//    in different modules don't share the results.
+//
+//    The runtime can also export the counters through shared memory, so that
+//    they can be watched while the program is running (with `tutor-top`, see
+//    TutorShm.h). With `-dynamic-cc-shm`, the counters are aligned and padded
+//    to TUTOR_SHM_PAGE_SIZE, i.e. they don't share any pages with other data,
+//    so that the runtime can replace the pages that hold them with shared
+//    memory. The code that increments them doesn't change.
+//
+//    Not every function is worth counting. `-dynamic-cc-allowlist=<file>` and
+//    `-dynamic-cc-denylist=<file>` select the functions by name (globs or,
+//    with `re:`, regular expressions) and `-dynamic-cc-skip-leaf-insts=N`
+//    skips the trivial functions, i.e. the leaf functions with at most N
+//    instructions (or, with `-dynamic-cc-skip-leaf-depth=D`, the functions
+//    that only call such functions, at most D levels deep). See
+//    InstrumentationFilter.h. The number of instrumented and skipped
+//    functions is printed to stderr. The skipped functions are not in the
+//    results.
+//
 // USAGE:
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
 //        -passes=-"dynamic-cc" <bitcode-file> -o instrumentend.bin
 //      $ lli instrumented.bin
+//    or, for multi-threaded programs:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-counters=atomic <bitcode-file> `\`
+//        -o instrumentend.bin
+//    or, with sampling:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-counters=sampled `\`
+//        -dynamic-cc-sample-period=1000 <bitcode-file> -o instrumentend.bin
+//    or, without the small leaf functions:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-skip-leaf-insts=8 <bitcode-file> `\`
+//        -o instrumentend.bin
+//    or, for programs built from many modules:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-runtime <bitcode-file> -o a.bc
+//      $ clang a.bc b.bc <BUILD_DIR>/lib/libTutorRuntime.a -o prog
+//    or, to watch the counters live:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-runtime -dynamic-cc-shm `\`
+//        <bitcode-file> -o a.bc
+//      $ clang a.bc <BUILD_DIR>/lib/libTutorRuntime.a -o prog
+//      $ LLVM_TUTOR_SHM_NAME=/prog ./prog &
+//      $ <BUILD_DIR>/bin/tutor-top /prog
+//    or, to aggregate the results from many runs:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes=-"dynamic-cc" -dynamic-cc-output=calls.%p.tutorprof `\`
+//        <bitcode-file> -o instrumentend.bin
+//      $ lli instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/tutor-profdata merge -format=text calls.*.tutorprof
 //
 // License: MIT
 //========================================================================
 #include "DynamicCallCounter.h"
-
+#include "CFGSpanningTree.h"
+#include "CounterPromotion.h"
+#include "InstrumentationFilter.h"
+#include "ProfileWriter.h"
+#include "TutorProfile.h"
+#include "TutorRuntime.h"
+#include "TutorShm.h"
+
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/xxhash.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "dynamic-cc"
 
-Constant *CreateGlobalCounter(Module &M, StringRef GlobalVarName) {
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumSkippedFunctions, "The # of functions skipped by the filters");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+enum class CounterKind { Plain, Atomic, Sampled };
+
+static cl::opt<CounterKind> CounterMode(
+    "dynamic-cc-counters", cl::desc("The kind of call counters to inject"),
+    cl::values(clEnumValN(CounterKind::Plain, "plain",
+                          "32-bit counters, not thread-safe (default)"),
+               clEnumValN(CounterKind::Atomic, "atomic",
+                          "64-bit counters, incremented atomically and "
+                          "padded to a cache line each"),
+               clEnumValN(CounterKind::Sampled, "sampled",
+                          "64-bit counters, only every Nth call (on "
+                          "average) is recorded")),
+    cl::init(CounterKind::Plain));
+
+static cl::opt<unsigned> SamplePeriod(
+    "dynamic-cc-sample-period",
+    cl::desc("With -dynamic-cc-counters=sampled, record one in this many "
+             "calls (on average)"),
+    cl::init(1000));
+
+static cl::opt<unsigned> CacheLineSize(
+    "dynamic-cc-cache-line-size",
+    cl::desc("Pad every atomic counter to this many bytes (0 to disable)"),
+    cl::init(64));
+
+static cl::opt<std::string> OutputFile(
+    "dynamic-cc-output",
+    cl::desc("Write a binary profile to this file instead of printing the "
+             "results (%p is replaced with the process ID, can be "
+             "overridden with " TUTOR_PROF_FILE_ENV_VAR ")"),
+    cl::init(""));
+
+static cl::opt<bool> UseRuntime(
+    "dynamic-cc-runtime",
+    cl::desc("Register the counters with the runtime library "
+             "(libTutorRuntime.a) rather than printing or writing them from "
+             "this module"),
+    cl::init(false));
+
+static cl::opt<bool> ShmExport(
+    "dynamic-cc-shm",
+    cl::desc("With -dynamic-cc-runtime, align and pad the counters so that "
+             "the runtime can export them through shared memory (see "
+             "TutorShm.h)"),
+    cl::init(false));
+
+static cl::opt<std::string> AllowList(
+    "dynamic-cc-allowlist",
+    cl::desc("Only instrument the functions that match the patterns in this "
+             "file"),
+    cl::init(""));
+
+static cl::opt<std::string> DenyList(
+    "dynamic-cc-denylist",
+    cl::desc("Don't instrument the functions that match the patterns in this "
+             "file"),
+    cl::init(""));
+
+static cl::opt<unsigned> SkipLeafInsts(
+    "dynamic-cc-skip-leaf-insts",
+    cl::desc("Don't instrument the leaf functions with at most this many "
+             "instructions (0 to instrument all of them)"),
+    cl::init(0));
+
+static cl::opt<unsigned> SkipLeafDepth(
+    "dynamic-cc-skip-leaf-depth",
+    cl::desc("With -dynamic-cc-skip-leaf-insts, also skip the small functions "
+             "that only call such functions, up to this many levels deep"),
+    cl::init(0));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+static bool useAtomicCounters() { return CounterMode == CounterKind::Atomic; }
+
+static bool useSampling() { return CounterMode == CounterKind::Sampled; }
+
+// The mean sampling interval. The intervals are drawn from [1, 2 * Period - 1]
+// and stored in an i32 countdown, hence the upper limit.
+static uint64_t getSamplePeriod() {
+  return std::clamp<uint64_t>(SamplePeriod, 1, 1 << 30);
+}
+
+// The alignment of the counters. In the atomic mode every counter occupies
+// (at least) a cache line of its own.
+static Align getCounterAlign() {
+  if (useSampling())
+    return Align(8);
+  if (!useAtomicCounters())
+    return Align(4);
+  return Align(std::max(PowerOf2Ceil(CacheLineSize), uint64_t(8)));
+}
+
+// The type of the counters, i.e. i32 or i64 (with padding in the atomic mode).
+// The counter itself is always at offset 0.
+static Type *getCounterTy(LLVMContext &CTX) {
+  if (useSampling())
+    return Type::getInt64Ty(CTX);
+  if (!useAtomicCounters())
+    return Type::getInt32Ty(CTX);
+
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  uint64_t Size = getCounterAlign().value();
+  if (Size <= 8)
+    return Int64Ty;
+  return StructType::get(CTX,
+                         {Int64Ty, ArrayType::get(Type::getInt8Ty(CTX),
+                                                  Size - 8)});
+}
+
+// Creates the storage for all call counters in M, i.e. a zero-initialised
+// array of NumCounters counters, which keeps the counters contiguous in
+// memory. With -dynamic-cc-shm (or -dynamic-cc-output without the runtime),
+// the array is padded to a multiple of TUTOR_SHM_PAGE_SIZE (or
+// ProfileWriterPageSize) and aligned to it.
+static GlobalVariable *CreateCounterArray(Module &M, unsigned NumCounters) {
+  Type *CounterTy = getCounterTy(M.getContext());
+  uint64_t PageSize = 0;
+  if (ShmExport)
+    PageSize = TUTOR_SHM_PAGE_SIZE;
+  else if (!OutputFile.empty() && !UseRuntime)
+    PageSize = ProfileWriterPageSize;
+  if (PageSize) {
+    uint64_t CounterSize = M.getDataLayout().getTypeAllocSize(CounterTy);
+    NumCounters = alignTo(NumCounters * CounterSize, PageSize) / CounterSize;
+  }
+  ArrayType *CountersTy = ArrayType::get(CounterTy, NumCounters);
+
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "CallCounters");
+  Counters->setAlignment(PageSize ? Align(PageSize) : getCounterAlign());
+  // The atomic counters must stay in memory
+  if (CounterMode == CounterKind::Plain)
+    markAsProfileCounters(*Counters);
+
+  return Counters;
+}
+
+// Defines the out-of-line part of the sampling instrumentation, i.e. the
+// function that records a sample for function Idx and restarts the countdown
+// of the current thread. It is equivalent to the following C function:
+// ```
+//    static _Thread_local uint64_t State;
+//    static void dynamic_cc_sample(uint32_t Idx) {
+//      atomic_fetch_add_explicit(&CallCounters[Idx], 1, memory_order_relaxed);
+//      // xorshift64, seeded with the address of the per-thread state
+//      uint64_t X = State ? State : ((uint64_t)&State ^ Seed) | 1;
+//      X ^= X << 13;
+//      X ^= X >> 7;
+//      X ^= X << 17;
+//      State = X;
+//      Countdown = 1 + X % (2 * Period - 1);
+//    }
+// ```
+static Function *createSampler(Module &M, GlobalVariable *Counters,
+                               GlobalVariable *Countdown) {
   auto &CTX = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  uint64_t Period = getSamplePeriod();
+
+  auto *State = new GlobalVariable(
+      M, Int64Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int64Ty, 0), "dynamic_cc.rng", /*InsertBefore=*/nullptr,
+      GlobalValue::GeneralDynamicTLSModel);
+  State->setAlignment(Align(8));
+
+  Function *SamplerF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {Type::getInt32Ty(CTX)},
+                        /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "dynamic_cc_sample", M);
+  SamplerF->addFnAttr(Attribute::Cold);
+  SamplerF->addFnAttr(Attribute::NoInline);
+  SamplerF->getArg(0)->setName("idx");
+
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", SamplerF));
+  Value *Idx = Builder.CreateZExt(SamplerF->getArg(0), Int64Ty);
+  Value *Counter = Builder.CreateInBoundsGEP(
+      Counters->getValueType(), Counters, {Builder.getInt64(0), Idx});
+  Builder.CreateAtomicRMW(AtomicRMWInst::Add, Counter, Builder.getInt64(1),
+                          getCounterAlign(), AtomicOrdering::Monotonic);
+
+  Value *StateAddr = Builder.CreateThreadLocalAddress(State);
+  Value *OldState = Builder.CreateLoad(Int64Ty, StateAddr, "state");
+  Value *Seed = Builder.CreateOr(
+      Builder.CreateXor(Builder.CreatePtrToInt(StateAddr, Int64Ty),
+                        Builder.getInt64(0x9e3779b97f4a7c15ULL)),
+      Builder.getInt64(1), "seed");
+  Value *X = Builder.CreateSelect(Builder.CreateIsNull(OldState), Seed,
+                                  OldState);
+  X = Builder.CreateXor(X, Builder.CreateShl(X, 13));
+  X = Builder.CreateXor(X, Builder.CreateLShr(X, 7));
+  X = Builder.CreateXor(X, Builder.CreateShl(X, 17), "state.next");
+  Builder.CreateStore(X, StateAddr);
+
+  Value *Interval = Builder.CreateAdd(
+      Builder.CreateURem(X, Builder.getInt64(2 * Period - 1)),
+      Builder.getInt64(1), "interval");
+  Builder.CreateStore(Builder.CreateTrunc(Interval, Builder.getInt32Ty()),
+                      Builder.CreateThreadLocalAddress(Countdown));
+  Builder.CreateRetVoid();
 
-  // This will insert a declaration into M
-  Constant *NewGlobalVar =
-      M.getOrInsertGlobal(GlobalVarName, IntegerType::getInt32Ty(CTX));
+  return SamplerF;
+}
+
+// Scales the sample counts in the profile (NumCounters counters at
+// MappedCounters) to the estimated number of calls. It is equivalent to:
+// ```
+//    for (uint64_t I = 0; I != NumCounters; I++)
+//      MappedCounters[I] *= Period;
+// ```
+static void scaleSamples(IRBuilder<> &Builder, Value *MappedCounters,
+                         uint64_t NumCounters) {
+  Type *Int64Ty = Builder.getInt64Ty();
+  BasicBlock *CopyBB = Builder.GetInsertBlock();
+  Function *WriterF = CopyBB->getParent();
+  BasicBlock *ScaleBB = BasicBlock::Create(Builder.getContext(), "scale",
+                                           WriterF, CopyBB->getNextNode());
+  BasicBlock *DoneBB = BasicBlock::Create(Builder.getContext(), "done",
+                                          WriterF, ScaleBB->getNextNode());
+  Builder.CreateBr(ScaleBB);
+
+  Builder.SetInsertPoint(ScaleBB);
+  PHINode *Idx = Builder.CreatePHI(Int64Ty, 2, "idx");
+  Idx->addIncoming(Builder.getInt64(0), CopyBB);
+  Value *Ptr = Builder.CreateInBoundsGEP(Int64Ty, MappedCounters, Idx);
+  Value *Samples = Builder.CreateAlignedLoad(Int64Ty, Ptr, Align(8));
+  Builder.CreateAlignedStore(
+      Builder.CreateMul(Samples, Builder.getInt64(getSamplePeriod())), Ptr,
+      Align(8));
+  Value *NextIdx = Builder.CreateNUWAdd(Idx, Builder.getInt64(1), "idx.next");
+  Idx->addIncoming(NextIdx, ScaleBB);
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextIdx, Builder.getInt64(NumCounters)), DoneBB,
+      ScaleBB);
+
+  Builder.SetInsertPoint(DoneBB);
+}
 
-  // This will change the declaration into definition (and initialise to 0)
-  GlobalVariable *NewGV = M.getNamedGlobal(GlobalVarName);
-  NewGV->setLinkage(GlobalValue::CommonLinkage);
-  NewGV->setAlignment(MaybeAlign(4));
-  NewGV->setInitializer(llvm::ConstantInt::get(CTX, APInt(32, 0)));
+// Returns the name under which F is recorded by the runtime. Functions with
+// local linkage are qualified with the name of the source file.
+static std::string getRuntimeName(const Function &F) {
+  if (!F.hasLocalLinkage())
+    return F.getName().str();
+  return (F.getParent()->getSourceFileName() + ":" + F.getName()).str();
+}
 
-  return NewGlobalVar;
+// Describes the counters of this module (see TutorRuntime.h) and registers
+// them with the runtime. This is equivalent to:
+// ```
+//    static const TutorRtFunction Functions[] = {{"foo", Hash}, ...};
+//    static const TutorRtModule Module = {TUTOR_RT_VERSION, ...};
+//    __attribute__((constructor)) static void tutor_rt.register() {
+//      __tutor_rt_register_module(&Module);
+//    }
+//    __attribute__((destructor)) static void tutor_rt.unregister() {
+//      __tutor_rt_unregister_module(&Module);
+//    }
+// ```
+static void registerWithRuntime(Module &M, ArrayRef<Function *> Functions,
+                                ArrayRef<uint64_t> Hashes,
+                                GlobalVariable *Counters) {
+  auto &CTX = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  IRBuilder<> Builder(CTX);
+
+  // The table of functions
+  StructType *FunctionTy = StructType::get(CTX, {PtrTy, Int64Ty});
+  std::vector<Constant *> Entries;
+  for (unsigned Idx = 0, E = Functions.size(); Idx != E; ++Idx)
+    Entries.push_back(ConstantStruct::get(
+        FunctionTy,
+        {Builder.CreateGlobalStringPtr(getRuntimeName(*Functions[Idx]),
+                                       "tutor_rt.name", /*AddressSpace=*/0,
+                                       &M),
+         ConstantInt::get(Int64Ty, Hashes[Idx])}));
+  ArrayType *FunctionsTy = ArrayType::get(FunctionTy, Entries.size());
+  auto *FunctionsVar = new GlobalVariable(
+      M, FunctionsTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(FunctionsTy, Entries), "tutor_rt.functions");
+
+  // The descriptor of the module
+  Constant *OutputPath =
+      OutputFile.empty()
+          ? ConstantPointerNull::get(PtrTy)
+          : Builder.CreateGlobalStringPtr(OutputFile, "tutor_rt.output",
+                                          /*AddressSpace=*/0, &M);
+  auto *CountersTy = cast<ArrayType>(Counters->getValueType());
+  StructType *ModuleTy = StructType::get(
+      CTX, {Int32Ty, Int32Ty, Int64Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+            Int64Ty, PtrTy, PtrTy, PtrTy, Int64Ty});
+  Constant *ModuleInit = ConstantStruct::get(
+      ModuleTy,
+      {ConstantInt::get(Int32Ty, TUTOR_RT_VERSION),
+       ConstantInt::get(Int32Ty, TUTOR_PROF_KIND_CALL_COUNTS),
+       ConstantInt::get(Int64Ty, xxh3_64bits(M.getSourceFileName())),
+       ConstantInt::get(Int32Ty, Functions.size()),
+       ConstantInt::get(Int32Ty, /*NumCountersPerFunction=*/1),
+       ConstantInt::get(Int32Ty, CounterMode == CounterKind::Plain ? 4 : 8),
+       ConstantInt::get(Int32Ty,
+                        DL.getTypeAllocSize(CountersTy->getElementType())),
+       ConstantInt::get(Int64Ty, useSampling() ? getSamplePeriod() : 1),
+       FunctionsVar, Counters, OutputPath,
+       ConstantInt::get(Int64Ty, DL.getTypeAllocSize(CountersTy))});
+  auto *ModuleVar = new GlobalVariable(M, ModuleTy, /*isConstant=*/true,
+                                       GlobalValue::PrivateLinkage,
+                                       ModuleInit, "tutor_rt.module");
+  ModuleVar->setAlignment(Align(8));
+
+  // The constructor and the destructor
+  FunctionType *HookTy =
+      FunctionType::get(Type::getVoidTy(CTX), {PtrTy}, /*IsVarArgs=*/false);
+  auto CreateHook = [&](StringRef Name, StringRef RuntimeFn) {
+    Function *F = Function::Create(
+        FunctionType::get(Type::getVoidTy(CTX), {}, /*IsVarArgs=*/false),
+        GlobalValue::InternalLinkage, Name, M);
+    Builder.SetInsertPoint(BasicBlock::Create(CTX, "entry", F));
+    Builder.CreateCall(M.getOrInsertFunction(RuntimeFn, HookTy), {ModuleVar});
+    Builder.CreateRetVoid();
+    return F;
+  };
+  appendToGlobalCtors(
+      M, CreateHook("tutor_rt.register", "__tutor_rt_register_module"),
+      /*Priority=*/0);
+  appendToGlobalDtors(
+      M, CreateHook("tutor_rt.unregister", "__tutor_rt_unregister_module"),
+      /*Priority=*/0);
 }
 
 //-----------------------------------------------------------------------------
 // DynamicCallCounter implementation
 //-----------------------------------------------------------------------------
 bool DynamicCallCounter::runOnModule(Module &M) {
-  bool Instrumented = false;
-
   // Function name <--> IR variable that holds the call counter
   llvm::StringMap<Constant *> CallCounterMap;
   // Function name <--> IR variable that holds the function name
@@ -83,40 +527,158 @@ bool DynamicCallCounter::runOnModule(Module &M) {
 
   auto &CTX = M.getContext();
 
+  // Only the runtime knows what to do with the padded counters
+  if (ShmExport && !UseRuntime) {
+    CTX.emitError("dynamic-cc: -dynamic-cc-shm requires -dynamic-cc-runtime");
+    return false;
+  }
+
+  // Select the functions to instrument (before anything is instrumented)
+  InstrumentationFilter Filter;
+  std::string Err = Filter.init(
+      {AllowList, DenyList, SkipLeafInsts.getValue(), SkipLeafDepth.getValue()});
+  if (!Err.empty()) {
+    CTX.emitError("dynamic-cc: " + Err);
+    return false;
+  }
+
+  // The binary profiles are written with the flags of the target OS
+  std::optional<TargetLibcConstants> Libc;
+  if (!OutputFile.empty() && !UseRuntime) {
+    Libc = getTargetLibcConstants(M);
+    if (!Libc) {
+      CTX.emitError("dynamic-cc: -dynamic-cc-output is not supported for " +
+                    Twine(M.getTargetTriple()));
+      return false;
+    }
+  }
+
+  SmallVector<Function *, 32> Functions;
+  for (auto &F : M)
+    if (!F.isDeclaration() && Filter.shouldInstrument(F))
+      Functions.push_back(&F);
+
+  NumInstrumentedFunctions += Filter.getNumInstrumented();
+  NumSkippedFunctions += Filter.getNumSkipped();
+  if (Filter.isActive())
+    Filter.printSummary(errs(), "dynamic-cc");
+
+  // Stop here if there are no function definitions in this module
+  if (Functions.empty())
+    return false;
+
+  // The CFGs of the uninstrumented functions (the sampling code splits the
+  // entry blocks)
+  std::vector<uint64_t> Hashes;
+  for (Function *F : Functions)
+    Hashes.push_back(CFGSpanningTree::getStructuralHash(*F));
+
   // STEP 1: For each function in the module, inject a call-counting code
   // --------------------------------------------------------------------
-  for (auto &F : M) {
-    if (F.isDeclaration())
-      continue;
+  // All counters are stored in one array, `CallCounters[i]` counts the calls
+  // to Functions[i].
+  GlobalVariable *Counters = CreateCounterArray(M, Functions.size());
+  Type *CountersTy = Counters->getValueType();
+
+  // In the sampling mode, `CallCounters[i]` is the number of samples taken
+  // in Functions[i]
+  GlobalVariable *Countdown = nullptr;
+  Function *Sampler = nullptr;
+  if (useSampling()) {
+    Type *Int32Ty = Type::getInt32Ty(CTX);
+    Countdown = new GlobalVariable(
+        M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+        ConstantInt::get(Int32Ty, getSamplePeriod()), "dynamic_cc.countdown",
+        /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+    Countdown->setAlignment(Align(4));
+    Sampler = createSampler(M, Counters, Countdown);
+  }
+
+  for (unsigned Idx = 0, E = Functions.size(); Idx != E; ++Idx) {
+    Function *F = Functions[Idx];
 
     // Get an IR builder. Sets the insertion point to the top of the function
-    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
 
-    // Create a global variable to count the calls to this function
-    std::string CounterName = "CounterFor_" + std::string(F.getName());
-    Constant *Var = CreateGlobalCounter(M, CounterName);
-    CallCounterMap[F.getName()] = Var;
+    // Get the address of the counter for this function
+    Constant *Indices[] = {Builder.getInt64(0), Builder.getInt64(Idx)};
+    Constant *Var =
+        ConstantExpr::getInBoundsGetElementPtr(CountersTy, Counters, Indices);
+    CallCounterMap[F->getName()] = Var;
 
     // Create a global variable to hold the name of this function
-    auto FuncName = Builder.CreateGlobalStringPtr(F.getName());
-    FuncNameMap[F.getName()] = FuncName;
+    auto FuncName = Builder.CreateGlobalStringPtr(F->getName());
+    FuncNameMap[F->getName()] = FuncName;
 
     // Inject instruction to increment the call count each time this function
     // executes
-    LoadInst *Load2 = Builder.CreateLoad(IntegerType::getInt32Ty(CTX), Var);
-    Value *Inc2 = Builder.CreateAdd(Builder.getInt32(1), Load2);
-    Builder.CreateStore(Inc2, Var);
+    if (useAtomicCounters()) {
+      Builder.CreateAtomicRMW(AtomicRMWInst::Add, Var, Builder.getInt64(1),
+                              getCounterAlign(), AtomicOrdering::Monotonic);
+    } else if (useSampling()) {
+      // The entry block is split below, so insert after the static allocas
+      // (which must stay in the entry block)
+      BasicBlock::iterator IP = Builder.GetInsertPoint();
+      while (isa<AllocaInst>(IP))
+        ++IP;
+      Builder.SetInsertPoint(&*IP);
+
+      Value *CountdownAddr = Builder.CreateThreadLocalAddress(Countdown);
+      LoadInst *Old =
+          Builder.CreateLoad(Builder.getInt32Ty(), CountdownAddr, "cd");
+      Value *New = Builder.CreateSub(Old, Builder.getInt32(1), "cd.next");
+      Builder.CreateStore(New, CountdownAddr);
+      Value *Expired =
+          Builder.CreateICmpSLE(New, Builder.getInt32(0), "expired");
+
+      uint64_t Period = getSamplePeriod();
+      Instruction *Then = SplitBlockAndInsertIfThen(
+          Expired, &*IP, /*Unreachable=*/false,
+          MDBuilder(CTX).createBranchWeights(
+              1, std::max<uint64_t>(Period - 1, 1)));
+      Then->getParent()->setName("sample");
+      IP->getParent()->setName("continue");
+      Builder.SetInsertPoint(Then);
+      Builder.CreateCall(Sampler, {Builder.getInt32(Idx)});
+    } else {
+      LoadInst *Load2 = Builder.CreateLoad(IntegerType::getInt32Ty(CTX), Var);
+      Value *Inc2 = Builder.CreateAdd(Builder.getInt32(1), Load2);
+      Builder.CreateStore(Inc2, Var);
+    }
 
     // The following is visible only if you pass -debug on the command line
     // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << " Instrumented: " << F.getName() << "\n");
+    LLVM_DEBUG(dbgs() << " Instrumented: " << F->getName() << "\n");
+  }
 
-    Instrumented = true;
+  // With -dynamic-cc-runtime, the runtime library writes the results (of all
+  // the modules)
+  if (UseRuntime) {
+    registerWithRuntime(M, Functions, Hashes, Counters);
+    return true;
   }
 
-  // Stop here if there are no function definitions in this module
-  if (false == Instrumented)
-    return Instrumented;
+  // With -dynamic-cc-output, the results are written to a binary profile
+  // rather than printed
+  if (!OutputFile.empty()) {
+    SmallVector<ProfileWriterRecord, 32> Records;
+    for (unsigned Idx = 0, E = Functions.size(); Idx != E; ++Idx)
+      Records.push_back({Functions[Idx]->getName(), Hashes[Idx],
+                         /*NumCounters=*/1});
+
+    // The profile contains the estimated number of calls rather than the
+    // number of samples
+    Function *WriterF = createProfileWriter(
+        M, *Libc, TUTOR_PROF_KIND_CALL_COUNTS, Records, Counters,
+        /*CounterSize=*/CounterMode == CounterKind::Plain ? 4 : 8, OutputFile,
+        "dynamic_cc", "CallCounterProfileImage",
+        [&](IRBuilder<> &Builder, Value *MappedCounters) {
+          if (useSampling())
+            scaleSamples(Builder, MappedCounters, Functions.size());
+        });
+    appendToGlobalDtors(M, WriterF, /*Priority=*/0);
+    return true;
+  }
 
   // STEP 2: Inject the declaration of printf
   // ----------------------------------------
@@ -140,8 +702,13 @@ bool DynamicCallCounter::runOnModule(Module &M) {
 
   // STEP 3: Inject a global variable that will hold the printf format string
   // ------------------------------------------------------------------------
-  llvm::Constant *ResultFormatStr =
-      llvm::ConstantDataArray::getString(CTX, "%-20s %-10lu\n");
+  // The counters are always printed as 64-bit values (`unsigned long` is only
+  // 32-bit wide on some platforms, hence `%llu`). In the sampling mode, every
+  // estimate is followed by its (relative) standard error and the number of
+  // samples.
+  llvm::Constant *ResultFormatStr = llvm::ConstantDataArray::getString(
+      CTX, useSampling() ? "%-20s %-10llu +/-%5.1f%%  %llu\n"
+                         : "%-20s %-10llu\n");
 
   Constant *ResultFormatStrVar =
       M.getOrInsertGlobal("ResultFormatStrIR", ResultFormatStr->getType());
@@ -149,9 +716,15 @@ bool DynamicCallCounter::runOnModule(Module &M) {
 
   std::string out = "";
   out += "=================================================\n";
-  out += "LLVM-TUTOR: dynamic analysis results\n";
-  out += "=================================================\n";
-  out += "NAME                 #N DIRECT CALLS\n";
+  if (useSampling()) {
+    out += "LLVM-TUTOR: dynamic analysis results (sampled)\n";
+    out += "=================================================\n";
+    out += "NAME                 ~#N CALLS  ERROR      SAMPLES\n";
+  } else {
+    out += "LLVM-TUTOR: dynamic analysis results\n";
+    out += "=================================================\n";
+    out += "NAME                 #N DIRECT CALLS\n";
+  }
   out += "-------------------------------------------------\n";
 
   llvm::Constant *ResultHeaderStr =
@@ -161,51 +734,136 @@ bool DynamicCallCounter::runOnModule(Module &M) {
       M.getOrInsertGlobal("ResultHeaderStrIR", ResultHeaderStr->getType());
   dyn_cast<GlobalVariable>(ResultHeaderStrVar)->setInitializer(ResultHeaderStr);
 
-  // STEP 4: Define a printf wrapper that will print the results
+  // STEP 4: Inject the table of results
+  // -----------------------------------
+  // One {function name, counter address} record per instrumented function
+  // (in the order in which the results are printed).
+  StructType *RecordTy = StructType::get(CTX, {PrintfArgTy, PrintfArgTy});
+  std::vector<Constant *> Records;
+  for (auto &item : CallCounterMap)
+    Records.push_back(ConstantStruct::get(
+        RecordTy, {FuncNameMap[item.first()], item.second}));
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Records.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Records),
+                                   "CallCounterTable");
+
+  // STEP 5: Define a printf wrapper that will print the results
   // -----------------------------------------------------------
-  // Define `printf_wrapper` that will print the results stored in FuncNameMap
-  // and CallCounterMap.  It is equivalent to the following C++ function:
+  // Define `printf_wrapper` that will print the results stored in
+  // `CallCounterTable`. Regardless of the number of instrumented functions,
+  // this is a single loop equivalent to the following C function:
   // ```
   //    void printf_wrapper() {
-  //      for (auto &item : Functions)
-  //        printf("llvm-tutor): Function %s was called %d times. \n",
-  //        item.name, item.count);
+  //      printf(ResultHeaderStrIR);
+  //      for (uint64_t i = 0; i != NumRecords; i++)
+  //        printf(ResultFormatStrIR, CallCounterTable[i].name,
+  //               (unsigned long long)*CallCounterTable[i].counter);
   //    }
   // ```
-  // (item.name comes from FuncNameMap, item.count comes from
-  // CallCounterMap)
+  // In the sampling mode the loop prints the estimates instead and the total
+  // number of samples is printed at the end.
   FunctionType *PrintfWrapperTy =
       FunctionType::get(llvm::Type::getVoidTy(CTX), {},
                         /*IsVarArgs=*/false);
   Function *PrintfWrapperF = dyn_cast<Function>(
       M.getOrInsertFunction("printf_wrapper", PrintfWrapperTy).getCallee());
 
-  // Create the entry basic block for printf_wrapper ...
-  llvm::BasicBlock *RetBlock =
+  // Create the basic blocks for printf_wrapper ...
+  llvm::BasicBlock *EnterBlock =
       llvm::BasicBlock::Create(CTX, "enter", PrintfWrapperF);
-  IRBuilder<> Builder(RetBlock);
+  llvm::BasicBlock *LoopBlock =
+      llvm::BasicBlock::Create(CTX, "loop", PrintfWrapperF);
+  llvm::BasicBlock *RetBlock =
+      llvm::BasicBlock::Create(CTX, "exit", PrintfWrapperF);
 
-  // ... and start inserting calls to printf
-  // (printf requires i8*, so cast the input strings accordingly)
+  // ... print the header ...
+  IRBuilder<> Builder(EnterBlock);
   llvm::Value *ResultHeaderStrPtr =
       Builder.CreatePointerCast(ResultHeaderStrVar, PrintfArgTy);
   llvm::Value *ResultFormatStrPtr =
       Builder.CreatePointerCast(ResultFormatStrVar, PrintfArgTy);
 
   Builder.CreateCall(Printf, {ResultHeaderStrPtr});
-
-  LoadInst *LoadCounter;
-  for (auto &item : CallCounterMap) {
-    LoadCounter = Builder.CreateLoad(IntegerType::getInt32Ty(CTX), item.second);
-    // LoadCounter = Builder.CreateLoad(item.second);
-    Builder.CreateCall(
-        Printf, {ResultFormatStrPtr, FuncNameMap[item.first()], LoadCounter});
+  Builder.CreateBr(LoopBlock);
+
+  // ... and then loop over the records
+  Builder.SetInsertPoint(LoopBlock);
+  Type *Int64Ty = IntegerType::getInt64Ty(CTX);
+  PHINode *Idx = Builder.CreatePHI(Int64Ty, 2, "idx");
+  Idx->addIncoming(Builder.getInt64(0), EnterBlock);
+
+  Value *NamePtr = Builder.CreateInBoundsGEP(
+      TableTy, Table, {Builder.getInt64(0), Idx, Builder.getInt32(0)});
+  Value *Name = Builder.CreateLoad(PrintfArgTy, NamePtr, "name");
+  Value *CounterPtr = Builder.CreateInBoundsGEP(
+      TableTy, Table, {Builder.getInt64(0), Idx, Builder.getInt32(1)});
+  Value *Counter = Builder.CreateLoad(PrintfArgTy, CounterPtr, "counter");
+
+  Value *Count;
+  if (useAtomicCounters() || useSampling()) {
+    LoadInst *LoadCounter =
+        Builder.CreateAlignedLoad(Int64Ty, Counter, getCounterAlign());
+    LoadCounter->setAtomic(AtomicOrdering::Monotonic);
+    Count = LoadCounter;
+  } else {
+    LoadInst *LoadCounter =
+        Builder.CreateLoad(IntegerType::getInt32Ty(CTX), Counter);
+    Count = Builder.CreateZExt(LoadCounter, Int64Ty);
+  }
+  PHINode *TotalSamples = nullptr;
+  Value *NextTotalSamples = nullptr;
+  if (useSampling()) {
+    // The relative standard error of an estimate based on N samples is
+    // (roughly) 1/sqrt(N). With a period of 1 every call is sampled, i.e. the
+    // estimates are exact.
+    Type *DoubleTy = Builder.getDoubleTy();
+    Value *Estimate =
+        Builder.CreateMul(Count, Builder.getInt64(getSamplePeriod()), "est");
+    Value *StdErr = ConstantFP::get(DoubleTy, 0.0);
+    if (getSamplePeriod() != 1) {
+      StdErr = Builder.CreateFDiv(
+          ConstantFP::get(DoubleTy, 100.0),
+          Builder.CreateUnaryIntrinsic(Intrinsic::sqrt,
+                                       Builder.CreateUIToFP(Count, DoubleTy)));
+      StdErr = Builder.CreateSelect(Builder.CreateIsNull(Count),
+                                    ConstantFP::get(DoubleTy, 100.0), StdErr,
+                                    "err");
+    }
+    Builder.CreateCall(Printf,
+                       {ResultFormatStrPtr, Name, Estimate, StdErr, Count});
+
+    TotalSamples = Builder.CreatePHI(Int64Ty, 2, "samples");
+    TotalSamples->moveBefore(Idx->getNextNode());
+    TotalSamples->addIncoming(Builder.getInt64(0), EnterBlock);
+    NextTotalSamples = Builder.CreateAdd(TotalSamples, Count, "samples.next");
+    TotalSamples->addIncoming(NextTotalSamples, LoopBlock);
+  } else {
+    Builder.CreateCall(Printf, {ResultFormatStrPtr, Name, Count});
   }
 
+  Value *NextIdx = Builder.CreateNUWAdd(Idx, Builder.getInt64(1), "idx.next");
+  Idx->addIncoming(NextIdx, LoopBlock);
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextIdx, Builder.getInt64(Records.size())),
+      RetBlock, LoopBlock);
+
   // Finally, insert return instruction
+  Builder.SetInsertPoint(RetBlock);
+  if (useSampling()) {
+    // Every sample is a call to `dynamic_cc_sample`, i.e. the slow path
+    Value *Footer = Builder.CreateGlobalStringPtr(
+        "-------------------------------------------------\n"
+        "%llu samples (one in %llu calls on average)\n",
+        "ResultFooterStrIR");
+    Builder.CreateCall(Printf, {Footer, NextTotalSamples,
+                                Builder.getInt64(getSamplePeriod())});
+  }
   Builder.CreateRetVoid();
 
-  // STEP 5: Call `printf_wrapper` at the very end of this module
+  // STEP 6: Call `printf_wrapper` at the very end of this module
   // ------------------------------------------------------------
   appendToGlobalDtors(M, PrintfWrapperF, /*Priority=*/0);
 
@@ -0,0 +1,560 @@
+//========================================================================
+// FILE:
+//    DynamicCallGraph.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to collect a weighted, dynamic call graph, i.e. how
+//    many times every function called every other function at run-time.
+//    Unlike DynamicCallCounter, which only counts how many times every
+//    function is entered, this pass records where the calls come from. Unlike
+//    StaticCallCounter, indirect calls are attributed to the functions that
+//    were actually called.
+//
+//    Direct calls: every call site is preceded by an increment of the counter
+//    for its {caller, callee} edge. All the call sites of one edge share the
+//    counter, so the graph is known (apart from the counts) at compile-time.
+//    The counters are 64-bit wide and stored in `DynamicCGCounters`.
+//
+//    Indirect calls: the callee is only known once it is entered. Before an
+//    indirect call, the caller stores its ID in a (thread-local) caller slot:
+//    ```IR
+//      store i32 2, ptr %slot
+//      %r = call i32 %fptr(i32 %x)
+//    ```
+//    Every function that can be called indirectly (i.e. its address is taken
+//    or it is visible outside the module) checks the slot on entry. If it's
+//    set, the slot is cleared and `dynamic_cg_record` counts the {caller,
+//    callee} edge in an open addressing hash table (`-dynamic-cg-hash-size`
+//    slots, edges that don't fit are counted as "lost"):
+//    ```IR
+//      %caller = load i32, ptr %slot
+//      %indirect = icmp ne i32 %caller, 0
+//      br i1 %indirect, label %indirect.call, label %continue
+//    indirect.call:
+//      store i32 0, ptr %slot
+//      call void @dynamic_cg_record(i32 %caller, i32 <callee ID>)
+//    ```
+//    The slot is checked again after the indirect call returns (for an
+//    `invoke`, in its normal destination, and the slot is cleared in its
+//    landing pad). If it's still set, the callee wasn't instrumented (e.g.
+//    it's a function from libc) and the call is counted as a call to the
+//    `<external>` node. Note that if such a callee calls back into the module
+//    (e.g. `qsort`), the first callback is attributed to the indirect call.
+//    Indirect `musttail` and `callbr` calls are not recorded (the slot can't
+//    be checked after them, so it could be left set).
+//
+//    When the program exits, the edges are appended to the profile file
+//    (`-dynamic-cg-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_CALLGRAPH_FILE environment variable). There's one line per
+//    edge that was executed:
+//      <caller> <callee> <count>
+//    The `callgraph` tool sums the counts from multiple runs (and multiple
+//    instrumented modules) and prints the graph.
+//
+//    Calls to intrinsics and inline assembly are not counted. The counters
+//    are not thread-safe (but the caller slot is per thread, so indirect calls
+//    are attributed to the correct callers).
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallGraph.so `\`
+//        -passes="dynamic-cg" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/callgraph default.callgraph
+//
+// License: MIT
+//========================================================================
+#include "DynamicCallGraph.h"
+#include "CounterPromotion.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "dynamic-cg"
+
+STATISTIC(NumDirectCallSites, "The # of instrumented direct call sites");
+STATISTIC(NumIndirectCallSites, "The # of instrumented indirect call sites");
+STATISTIC(NumDirectEdges, "The # of {caller, callee} counters");
+STATISTIC(NumIndirectTargets, "The # of functions that check the caller "
+                              "slot on entry");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<unsigned>
+    HashTableSize("dynamic-cg-hash-size",
+                  cl::desc("The number of slots in the hash table for the "
+                           "indirect calls (rounded up to a power of 2)"),
+                  cl::init(1024));
+
+static cl::opt<std::string>
+    OutputFile("dynamic-cg-output",
+               cl::desc("The file to append the call graph to (can be "
+                        "overridden with " DYNAMIC_CG_FILE_ENV_VAR ")"),
+               cl::init("default.callgraph"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Can F be the target of an indirect call from this module?
+static bool mayBeCalledIndirectly(const Function &F) {
+  return F.hasAddressTaken() || !F.hasLocalLinkage();
+}
+
+// Inserts the following before InsertBefore:
+// ```
+//    if (Slot != 0) {
+//      Caller = Slot;
+//      Slot = 0;
+//      dynamic_cg_record(Caller, CalleeId);
+//    }
+// ```
+static void insertSlotCheck(Instruction *InsertBefore, GlobalVariable *Slot,
+                            Function *RecordF, unsigned CalleeId,
+                            const Twine &Name) {
+  IRBuilder<> Builder(InsertBefore);
+  Value *SlotAddr = Builder.CreateThreadLocalAddress(Slot);
+  Value *Caller = Builder.CreateLoad(Builder.getInt32Ty(), SlotAddr, "caller");
+  Value *IsSet = Builder.CreateIsNotNull(Caller, Name);
+  Instruction *Then =
+      SplitBlockAndInsertIfThen(IsSet, InsertBefore, /*Unreachable=*/false);
+  Then->getParent()->setName(Name + ".call");
+  InsertBefore->getParent()->setName("continue");
+
+  Builder.SetInsertPoint(Then);
+  Builder.CreateStore(Builder.getInt32(0), SlotAddr);
+  Builder.CreateCall(RecordF, {Caller, Builder.getInt32(CalleeId)});
+}
+
+// Defines the function that counts an indirect call in the hash table
+// (Table, with Size {key, count} slots). It is equivalent to the following C
+// function:
+// ```
+//    static void dynamic_cg_record(uint32_t Caller, uint32_t Callee) {
+//      uint64_t Key = (((uint64_t)Caller << 32) | Callee) + 1;
+//      uint64_t Slot = ((Key * 0x9E3779B97F4A7C15) >> 32) & (Size - 1);
+//      for (uint64_t i = 0; i != Size; i++) {
+//        if (Table[2 * Slot] == 0)
+//          Table[2 * Slot] = Key;
+//        if (Table[2 * Slot] == Key) {
+//          Table[2 * Slot + 1]++;
+//          return;
+//        }
+//        Slot = (Slot + 1) & (Size - 1);
+//      }
+//      Lost++;
+//    }
+// ```
+static Function *createRecordFunction(Module &M, GlobalVariable *Table,
+                                      GlobalVariable *Lost, uint64_t Size) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  Function *RecordF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {Int32Ty, Int32Ty},
+                        /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "dynamic_cg_record", M);
+  Argument *Caller = RecordF->getArg(0);
+  Argument *Callee = RecordF->getArg(1);
+  Caller->setName("caller");
+  Callee->setName("callee");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", RecordF);
+  BasicBlock *ProbeBB = BasicBlock::Create(CTX, "probe", RecordF);
+  BasicBlock *EmptyBB = BasicBlock::Create(CTX, "probe.empty", RecordF);
+  BasicBlock *ClaimBB = BasicBlock::Create(CTX, "claim", RecordF);
+  BasicBlock *HitBB = BasicBlock::Create(CTX, "hit", RecordF);
+  BasicBlock *NextBB = BasicBlock::Create(CTX, "probe.next", RecordF);
+  BasicBlock *OverflowBB = BasicBlock::Create(CTX, "overflow", RecordF);
+  Constant *Mask = ConstantInt::get(Int64Ty, Size - 1);
+
+  // entry: hash the edge (Fibonacci hashing)
+  IRBuilder<> Builder(EntryBB);
+  Value *Edge = Builder.CreateOr(
+      Builder.CreateShl(Builder.CreateZExt(Caller, Int64Ty), 32),
+      Builder.CreateZExt(Callee, Int64Ty), "edge");
+  Value *Key = Builder.CreateAdd(Edge, Builder.getInt64(1), "key");
+  Value *Hash = Builder.CreateMul(Key, Builder.getInt64(0x9E3779B97F4A7C15ULL));
+  Value *Start =
+      Builder.CreateAnd(Builder.CreateLShr(Hash, 32), Mask, "start");
+  Builder.CreateBr(ProbeBB);
+
+  // probe: is this the slot for the edge?
+  Builder.SetInsertPoint(ProbeBB);
+  PHINode *Slot = Builder.CreatePHI(Int64Ty, 2, "slot");
+  Slot->addIncoming(Start, EntryBB);
+  PHINode *NumProbes = Builder.CreatePHI(Int64Ty, 2, "n");
+  NumProbes->addIncoming(Builder.getInt64(0), EntryBB);
+  Value *KeyPtr = Builder.CreateInBoundsGEP(
+      Int64Ty, Table, Builder.CreateShl(Slot, 1), "key.ptr");
+  Value *SlotKey = Builder.CreateLoad(Int64Ty, KeyPtr, "slot.key");
+  Builder.CreateCondBr(Builder.CreateICmpEQ(SlotKey, Key), HitBB, EmptyBB);
+
+  // probe.empty: is the slot free?
+  Builder.SetInsertPoint(EmptyBB);
+  Builder.CreateCondBr(Builder.CreateIsNull(SlotKey), ClaimBB, NextBB);
+
+  // claim: take the free slot
+  Builder.SetInsertPoint(ClaimBB);
+  Builder.CreateStore(Key, KeyPtr);
+  Builder.CreateBr(HitBB);
+
+  // hit: increment the counter
+  Builder.SetInsertPoint(HitBB);
+  incrementCounter(Builder, Builder.CreateConstInBoundsGEP1_64(
+                                Int64Ty, KeyPtr, 1, "count.ptr"));
+  Builder.CreateRetVoid();
+
+  // probe.next: try the next slot (linear probing)
+  Builder.SetInsertPoint(NextBB);
+  Value *NextSlot = Builder.CreateAnd(
+      Builder.CreateAdd(Slot, Builder.getInt64(1)), Mask, "slot.next");
+  Slot->addIncoming(NextSlot, NextBB);
+  Value *NextNumProbes =
+      Builder.CreateNUWAdd(NumProbes, Builder.getInt64(1), "n.next");
+  NumProbes->addIncoming(NextNumProbes, NextBB);
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextNumProbes, Builder.getInt64(Size)), OverflowBB,
+      ProbeBB);
+
+  // overflow: the table is full
+  Builder.SetInsertPoint(OverflowBB);
+  incrementCounter(Builder, Lost);
+  Builder.CreateRetVoid();
+
+  return RecordF;
+}
+
+// Emits `if (Count != 0) fprintf(File, Format, Caller, Callee, Count);` at the
+// current insertion point of Builder. GetNames returns {Caller, Callee} (the
+// code that computes them is only executed if Count != 0).
+static void
+emitPrintEdge(IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File,
+              Value *Format, Value *Count,
+              function_ref<std::pair<Value *, Value *>()> GetNames) {
+  Function *F = Builder.GetInsertBlock()->getParent();
+  BasicBlock *PrintBB = BasicBlock::Create(F->getContext(), "print", F);
+  BasicBlock *NextBB = BasicBlock::Create(F->getContext(), "next", F);
+  Builder.CreateCondBr(Builder.CreateIsNotNull(Count), PrintBB, NextBB);
+
+  Builder.SetInsertPoint(PrintBB);
+  auto [Caller, Callee] = GetNames();
+  Builder.CreateCall(Fprintf, {File, Format, Caller, Callee, Count});
+  Builder.CreateBr(NextBB);
+  Builder.SetInsertPoint(NextBB);
+}
+
+//-----------------------------------------------------------------------------
+// DynamicCallGraph implementation
+//-----------------------------------------------------------------------------
+bool DynamicCallGraph::runOnModule(Module &M) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  uint64_t HashSize = PowerOf2Ceil(std::max(HashTableSize.getValue(), 1U));
+
+  // STEP 1: Number the nodes and collect the call sites
+  // ---------------------------------------------------
+  // Node 0 is the `<external>` node, i.e. 0 in the caller slot means "not an
+  // indirect call". The functions defined in M are numbered first, followed
+  // by the functions that are only called directly.
+  MapVector<Function *, unsigned> NodeIds;
+  SmallVector<StringRef, 32> NodeNames = {DYNAMIC_CG_EXTERNAL_NODE};
+  auto GetNodeId = [&](Function *F) {
+    auto [It, Inserted] = NodeIds.insert({F, NodeNames.size()});
+    if (Inserted)
+      NodeNames.push_back(F->getName());
+    return It->second;
+  };
+
+  SmallVector<Function *, 32> Functions;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    Functions.push_back(&F);
+    GetNodeId(&F);
+  }
+
+  if (Functions.empty())
+    return false;
+
+  // {caller, callee} -> the index of the counter for the edge
+  MapVector<std::pair<unsigned, unsigned>, unsigned> DirectEdges;
+  SmallVector<std::pair<CallBase *, unsigned>, 32> DirectCalls;
+  SmallVector<std::pair<CallBase *, unsigned>, 8> IndirectCalls;
+  for (Function *F : Functions) {
+    unsigned CallerId = NodeIds.lookup(F);
+    for (Instruction &I : instructions(F)) {
+      auto *CB = dyn_cast<CallBase>(&I);
+      if (!CB || CB->isInlineAsm())
+        continue;
+
+      Function *Callee = CB->getCalledFunction();
+      if (!Callee) {
+        IndirectCalls.push_back({CB, CallerId});
+        continue;
+      }
+      if (Callee->isIntrinsic())
+        continue;
+
+      auto Edge = std::make_pair(CallerId, GetNodeId(Callee));
+      auto It = DirectEdges.insert({Edge, DirectEdges.size()}).first;
+      DirectCalls.push_back({CB, It->second});
+    }
+  }
+
+  // STEP 2: Inject the global variables
+  // -----------------------------------
+  auto GetElementPtr = [&](GlobalVariable *GV, uint64_t Idx) {
+    Constant *Indices[] = {ConstantInt::get(Int64Ty, 0),
+                           ConstantInt::get(Int64Ty, Idx)};
+    return ConstantExpr::getInBoundsGetElementPtr(GV->getValueType(), GV,
+                                                  Indices);
+  };
+
+  // The names of the nodes
+  std::vector<Constant *> NameConstants;
+  for (StringRef Name : NodeNames)
+    NameConstants.push_back(createGlobalString(M, Name, "dynamic_cg.name"));
+  ArrayType *NamesTy = ArrayType::get(PtrTy, NameConstants.size());
+  auto *Names = new GlobalVariable(M, NamesTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(NamesTy, NameConstants),
+                                   "DynamicCGNames");
+
+  // One counter and one {caller, callee} record per direct edge
+  GlobalVariable *Counters = nullptr;
+  GlobalVariable *Edges = nullptr;
+  if (!DirectEdges.empty()) {
+    ArrayType *CountersTy = ArrayType::get(Int64Ty, DirectEdges.size());
+    Counters = new GlobalVariable(M, CountersTy, /*isConstant=*/false,
+                                  GlobalValue::InternalLinkage,
+                                  Constant::getNullValue(CountersTy),
+                                  "DynamicCGCounters");
+    Counters->setAlignment(Align(8));
+    markAsProfileCounters(*Counters);
+
+    StructType *EdgeTy = StructType::get(CTX, {Int32Ty, Int32Ty});
+    std::vector<Constant *> EdgeConstants;
+    for (auto &[Edge, Idx] : DirectEdges)
+      EdgeConstants.push_back(ConstantStruct::get(
+          EdgeTy, {ConstantInt::get(Int32Ty, Edge.first),
+                   ConstantInt::get(Int32Ty, Edge.second)}));
+    ArrayType *EdgesTy = ArrayType::get(EdgeTy, EdgeConstants.size());
+    Edges = new GlobalVariable(M, EdgesTy, /*isConstant=*/true,
+                               GlobalValue::PrivateLinkage,
+                               ConstantArray::get(EdgesTy, EdgeConstants),
+                               "DynamicCGEdges");
+  }
+
+  // The caller slot, the hash table ({key, count} pairs) and the # of
+  // indirect calls that didn't fit into it
+  GlobalVariable *Slot = nullptr;
+  GlobalVariable *Table = nullptr;
+  GlobalVariable *Lost = nullptr;
+  Function *RecordF = nullptr;
+  if (!IndirectCalls.empty()) {
+    Slot = new GlobalVariable(M, Int32Ty, /*isConstant=*/false,
+                              GlobalValue::InternalLinkage,
+                              ConstantInt::get(Int32Ty, 0), "dynamic_cg.caller",
+                              /*InsertBefore=*/nullptr,
+                              GlobalValue::GeneralDynamicTLSModel);
+    Slot->setAlignment(Align(4));
+
+    ArrayType *TableTy = ArrayType::get(Int64Ty, 2 * HashSize);
+    Table = new GlobalVariable(M, TableTy, /*isConstant=*/false,
+                               GlobalValue::InternalLinkage,
+                               Constant::getNullValue(TableTy),
+                               "DynamicCGIndirect");
+    Table->setAlignment(Align(8));
+
+    Lost = new GlobalVariable(M, Int64Ty, /*isConstant=*/false,
+                              GlobalValue::InternalLinkage,
+                              ConstantInt::get(Int64Ty, 0), "DynamicCGLost");
+    Lost->setAlignment(Align(8));
+
+    RecordF = createRecordFunction(M, Table, Lost, HashSize);
+  }
+
+  // STEP 3: Instrument the call sites
+  // ---------------------------------
+  IRBuilder<> Builder(CTX);
+  for (auto &[CB, Idx] : DirectCalls) {
+    Builder.SetInsertPoint(CB);
+    incrementCounter(Builder, GetElementPtr(Counters, Idx));
+    NumDirectCallSites++;
+  }
+  NumDirectEdges += DirectEdges.size();
+
+  SmallPtrSet<BasicBlock *, 4> ClearedLandingPads;
+  for (auto &[CB, CallerId] : IndirectCalls) {
+    // Nothing can follow a `musttail` call, so the slot couldn't be checked
+    // (or cleared) if the callee is not instrumented. The same goes for
+    // `callbr` (the slot would have to be checked in every destination).
+    // These calls are not recorded.
+    if (CB->isMustTailCall() || isa<CallBrInst>(CB))
+      continue;
+
+    Builder.SetInsertPoint(CB);
+    Builder.CreateStore(Builder.getInt32(CallerId),
+                        Builder.CreateThreadLocalAddress(Slot));
+    NumIndirectCallSites++;
+
+    // An `invoke` is checked in its normal destination. If it throws, the
+    // callee may not have been entered, so the slot is cleared in the
+    // landing pad.
+    insertSlotCheck(getInsertionPointAfterCall(*CB, "dynamic_cg"), Slot,
+                    RecordF, /*CalleeId=*/0, "external");
+    auto *II = dyn_cast<InvokeInst>(CB);
+    if (!II)
+      continue;
+    BasicBlock *UnwindBB = II->getUnwindDest();
+    if (isa<LandingPadInst>(UnwindBB->getFirstNonPHI()) &&
+        ClearedLandingPads.insert(UnwindBB).second) {
+      Builder.SetInsertPoint(&*UnwindBB->getFirstInsertionPt());
+      Builder.CreateStore(Builder.getInt32(0),
+                          Builder.CreateThreadLocalAddress(Slot));
+    }
+  }
+
+  // STEP 4: Instrument the potential targets of the indirect calls
+  // --------------------------------------------------------------
+  if (!IndirectCalls.empty()) {
+    for (Function *F : Functions) {
+      if (!mayBeCalledIndirectly(*F))
+        continue;
+
+      // The entry block is split, so insert after the static allocas (which
+      // must stay in the entry block)
+      BasicBlock::iterator IP = F->getEntryBlock().getFirstInsertionPt();
+      while (isa<AllocaInst>(IP))
+        ++IP;
+      insertSlotCheck(&*IP, Slot, RecordF, NodeIds.lookup(F), "indirect");
+      NumIndirectTargets++;
+    }
+  }
+
+  // STEP 5: Define the function that writes the call graph
+  // ------------------------------------------------------
+  // See createTextProfileDump. The edges are printed as follows:
+  // ```
+  //    for (uint64_t i = 0; i != NumDirectEdges; i++)
+  //      if (Counters[i] != 0)
+  //        fprintf(File, "%s %s %llu\n", Names[Edges[i].Caller],
+  //                Names[Edges[i].Callee], Counters[i]);
+  //    for (uint64_t i = 0; i != HashSize; i++) {
+  //      uint64_t Edge = Table[2 * i] - 1;
+  //      if (Table[2 * i + 1] != 0)
+  //        fprintf(File, "%s %s %llu\n", Names[Edge >> 32],
+  //                Names[(uint32_t)Edge], Table[2 * i + 1]);
+  //    }
+  //    if (Lost != 0)
+  //      fprintf(File, "%s %s %llu\n", "<lost>", "<lost>", Lost);
+  // ```
+  // The loops are only generated if there are direct/indirect calls.
+  Constant *EdgeFmt =
+      createGlobalString(M, "%s %s %llu\n", "dynamic_cg.edge_fmt");
+
+  createTextProfileDump(
+      M, "dynamic_cg", DYNAMIC_CG_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        auto LoadName = [&](Value *NodeId) {
+          Value *Ptr = Builder.CreateInBoundsGEP(
+              NamesTy, Names,
+              {Builder.getInt64(0), Builder.CreateZExt(NodeId, Int64Ty)});
+          return Builder.CreateLoad(PtrTy, Ptr);
+        };
+
+        // The direct calls
+        if (Counters) {
+          Value *NumEdges = Builder.getInt64(DirectEdges.size());
+          emitLoop(Builder, NumEdges, "direct", [&](Value *Idx) {
+            Value *Count = Builder.CreateLoad(
+                Int64Ty,
+                Builder.CreateInBoundsGEP(Counters->getValueType(), Counters,
+                                          {Builder.getInt64(0), Idx}),
+                "count");
+            auto LoadNode = [&](unsigned Field) {
+              Value *Ptr = Builder.CreateInBoundsGEP(
+                  Edges->getValueType(), Edges,
+                  {Builder.getInt64(0), Idx, Builder.getInt32(Field)});
+              return LoadName(Builder.CreateLoad(Int32Ty, Ptr));
+            };
+            emitPrintEdge(Builder, Fprintf, File, EdgeFmt, Count, [&]() {
+              return std::make_pair(LoadNode(0), LoadNode(1));
+            });
+          });
+        }
+
+        // The indirect calls
+        if (Table) {
+          Value *NumSlots = Builder.getInt64(HashSize);
+          emitLoop(Builder, NumSlots, "indirect", [&](Value *Idx) {
+            Value *KeyPtr = Builder.CreateInBoundsGEP(
+                Int64Ty, Table, Builder.CreateShl(Idx, 1), "key.ptr");
+            Value *Count = Builder.CreateLoad(
+                Int64Ty, Builder.CreateConstInBoundsGEP1_64(Int64Ty, KeyPtr, 1),
+                "count");
+            emitPrintEdge(Builder, Fprintf, File, EdgeFmt, Count, [&]() {
+              Value *Edge = Builder.CreateSub(
+                  Builder.CreateLoad(Int64Ty, KeyPtr), Builder.getInt64(1),
+                  "edge");
+              return std::make_pair(
+                  LoadName(Builder.CreateTrunc(Builder.CreateLShr(Edge, 32),
+                                               Int32Ty)),
+                  LoadName(Builder.CreateTrunc(Edge, Int32Ty)));
+            });
+          });
+
+          Constant *LostName =
+              createGlobalString(M, DYNAMIC_CG_LOST_NODE, "dynamic_cg.lost");
+          emitPrintEdge(Builder, Fprintf, File, EdgeFmt,
+                        Builder.CreateLoad(Int64Ty, Lost, "lost"),
+                        [&]() { return std::make_pair(LostName, LostName); });
+        }
+      });
+
+  return true;
+}
+
+PreservedAnalyses DynamicCallGraph::run(llvm::Module &M,
+                                        llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getDynamicCallGraphPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "dynamic-cg", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "dynamic-cg") {
+                    MPM.addPass(DynamicCallGraph());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getDynamicCallGraphPluginInfo();
+}
@@ -0,0 +1,304 @@
+//========================================================================
+// FILE:
+//    EdgeProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to collect basic block and edge execution counts.
+//    Unlike DynamicCallCounter, which only counts function entries, this pass
+//    records how many times every CFG edge is taken.
+//
+//    Counting every edge is expensive. Instead, for every function this pass
+//    computes a maximum spanning tree of the CFG (weighted by the estimated
+//    edge frequencies, see CFGSpanningTree.h) and only instruments the edges
+//    that are _not_ in the tree. As the hottest edges end up in the tree,
+//    they are not instrumented at all. The counts for the tree edges (and for
+//    all basic blocks) are reconstructed offline from the flow conservation
+//    law by the `edgeprof` tool. A counter for an edge is placed:
+//      * at the end of the source block, if the destination is its only
+//        successor,
+//      * at the beginning of the destination block, if the source is its only
+//        predecessor,
+//      * in a new block that splits the edge, otherwise.
+//
+//    With `-edge-prof-mode=blocks`, every basic block gets a counter instead
+//    (i.e. the naive approach). This is useful for comparing the overhead.
+//
+//    All counters are 64-bit wide and stored in one array, `EdgeProfCounters`.
+//    When the program exits, the counters are appended to the profile file
+//    (`-edge-prof-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_EDGEPROF_FILE environment variable). There's one line per
+//    instrumented function:
+//      <function> <mode> <CFG hash> <#counters> <counter 0> <counter 1> ...
+//    Multiple runs (and multiple instrumented modules) append to the same
+//    file, `edgeprof` sums the counters for every function.
+//
+//    Functions with exception handling or indirect branches are skipped.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libEdgeProfiler.so `\`
+//        -passes="edge-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/edgeprof <input-llvm-file> default.edgeprof
+//
+// License: MIT
+//========================================================================
+#include "EdgeProfiler.h"
+#include "CFGSpanningTree.h"
+#include "CounterPromotion.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "edge-prof"
+
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumSkippedFunctions, "The # of functions that were not "
+                               "instrumented (unsupported CFG)");
+STATISTIC(NumCounters, "The # of counters");
+STATISTIC(NumSplitEdges, "The # of edges split to place a counter");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+enum class ProfileMode { Tree, Blocks };
+
+static cl::opt<ProfileMode> Mode(
+    "edge-prof-mode", cl::desc("Where to place the counters"),
+    cl::values(clEnumValN(ProfileMode::Tree, "tree",
+                          "on the edges that are not in the maximum "
+                          "spanning tree of the CFG (default)"),
+               clEnumValN(ProfileMode::Blocks, "blocks",
+                          "in every basic block")),
+    cl::init(ProfileMode::Tree));
+
+static cl::opt<std::string>
+    OutputFile("edge-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " EDGE_PROFILER_FILE_ENV_VAR ")"),
+               cl::init("default.edgeprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Returns the point where the counter for E should be inserted (splits E if
+// required)
+static Instruction *getCounterInsertionPoint(const CFGEdge &E) {
+  // The virtual entry edge
+  if (!E.Src)
+    return &*E.Dst->getFirstInsertionPt();
+
+  // A virtual exit edge or the only successor
+  Instruction *Term = E.Src->getTerminator();
+  if (!E.Dst || E.Src->getUniqueSuccessor())
+    return Term;
+
+  // The only predecessor
+  if (E.Dst->getUniquePredecessor())
+    return &*E.Dst->getFirstInsertionPt();
+
+  // A critical edge. Note that all the edges from E.Src to E.Dst are counted
+  // as one, so all of them are redirected to the new block.
+  unsigned SuccNum = 0;
+  while (Term->getSuccessor(SuccNum) != E.Dst)
+    SuccNum++;
+  BasicBlock *NewBB = SplitCriticalEdge(
+      Term, SuccNum, CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+  assert(NewBB && "Failed to split a critical edge");
+  NumSplitEdges++;
+  return NewBB->getTerminator();
+}
+
+namespace {
+// The counters of one instrumented function
+struct FunctionRecord {
+  Function *F;
+  uint64_t Hash;
+  unsigned FirstCounter;
+  unsigned NumCounters;
+};
+} // namespace
+
+//-----------------------------------------------------------------------------
+// EdgeProfiler implementation
+//-----------------------------------------------------------------------------
+bool EdgeProfiler::runOnModule(Module &M, ModuleAnalysisManager &MAM) {
+  auto &CTX = M.getContext();
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // STEP 1: Compute the placement of the counters
+  // ---------------------------------------------
+  // This must happen before any function is modified (the spanning tree
+  // depends on the analysis results for the uninstrumented code).
+  std::vector<FunctionRecord> Records;
+  std::vector<std::unique_ptr<CFGSpanningTree>> Trees;
+  unsigned TotalCounters = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    if (!CFGSpanningTree::isSupported(F)) {
+      LLVM_DEBUG(dbgs() << "Skipping: " << F.getName() << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    auto Tree = std::make_unique<CFGSpanningTree>(
+        F, FAM.getResult<BlockFrequencyAnalysis>(F),
+        FAM.getResult<BranchProbabilityAnalysis>(F));
+    unsigned N = Mode == ProfileMode::Tree ? Tree->getNumCounters()
+                                           : Tree->blocks().size();
+    assert(N != 0 && "Every function needs at least one counter");
+
+    Records.push_back({&F, Tree->getCFGHash(), TotalCounters, N});
+    Trees.push_back(std::move(Tree));
+    TotalCounters += N;
+  }
+
+  if (Records.empty())
+    return false;
+
+  // STEP 2: Inject the counters
+  // ---------------------------
+  ArrayType *CountersTy = ArrayType::get(Type::getInt64Ty(CTX), TotalCounters);
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "EdgeProfCounters");
+  Counters->setAlignment(Align(8));
+  markAsProfileCounters(*Counters);
+
+  for (unsigned Idx = 0, E = Records.size(); Idx != E; ++Idx) {
+    const FunctionRecord &R = Records[Idx];
+    const CFGSpanningTree &Tree = *Trees[Idx];
+
+    if (Mode == ProfileMode::Blocks) {
+      for (unsigned I = 0, NumBlocks = Tree.blocks().size(); I != NumBlocks;
+           ++I)
+        incrementCounter(&*Tree.blocks()[I]->getFirstInsertionPt(), Counters,
+                         R.FirstCounter + I);
+    } else {
+      for (const CFGEdge &Edge : Tree.edges())
+        if (!Edge.InTree)
+          incrementCounter(getCounterInsertionPoint(Edge), Counters,
+                           R.FirstCounter + Edge.Counter);
+    }
+
+    LLVM_DEBUG(dbgs() << "Instrumented: " << R.F->getName() << " ("
+                      << R.NumCounters << " counters)\n");
+    NumInstrumentedFunctions++;
+    NumCounters += R.NumCounters;
+  }
+
+  // STEP 3: Inject the table of instrumented functions
+  // --------------------------------------------------
+  // One {name, CFG hash, #counters, first counter} record per function
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *RecordTy =
+      StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty, PtrTy});
+
+  std::vector<Constant *> Entries;
+  for (const FunctionRecord &R : Records) {
+    Constant *FirstCounter = ConstantExpr::getInBoundsGetElementPtr(
+        CountersTy, Counters,
+        ArrayRef<Constant *>{ConstantInt::get(Int64Ty, 0),
+                             ConstantInt::get(Int64Ty, R.FirstCounter)});
+    Entries.push_back(ConstantStruct::get(
+        RecordTy, {createGlobalString(M, R.F->getName(), "edgeprof.name"),
+                   ConstantInt::get(Int64Ty, R.Hash),
+                   ConstantInt::get(Int32Ty, R.NumCounters), FirstCounter}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "EdgeProfTable");
+
+  // STEP 4: Define the function that writes the profile
+  // ---------------------------------------------------
+  // See createTextProfileDump. Every record is printed as follows:
+  // ```
+  //    fprintf(File, "%s tree %llu %u", Table[i].Name, Table[i].Hash,
+  //            Table[i].NumCounters);
+  //    for (uint64_t j = 0; j != Table[i].NumCounters; j++)
+  //      fprintf(File, " %llu", Table[i].Counters[j]);
+  //    fprintf(File, "\n");
+  // ```
+  StringRef ModeName = Mode == ProfileMode::Tree ? "tree" : "blocks";
+  Constant *RecordFmt = createGlobalString(
+      M, ("%s " + ModeName + " %llu %u").str(), "edgeprof.record_fmt");
+  Constant *CounterFmt = createGlobalString(M, " %llu", "edgeprof.counter_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "edgeprof.newline");
+
+  createTextProfileDump(
+      M, "edgeprof", EDGE_PROFILER_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumRecords = Builder.getInt64(Records.size());
+        emitLoop(Builder, NumRecords, "record", [&](Value *RecordIdx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), RecordIdx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Name = LoadField(0, PtrTy, "name");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *NumCountersVal = LoadField(2, Int32Ty, "num_counters");
+          Value *CountersPtr = LoadField(3, PtrTy, "counters");
+          Builder.CreateCall(Fprintf,
+                             {File, RecordFmt, Name, Hash, NumCountersVal});
+
+          // There's always at least one counter
+          Value *NumCounters64 = Builder.CreateZExt(NumCountersVal, Int64Ty);
+          emitLoop(Builder, NumCounters64, "counter", [&](Value *CounterIdx) {
+            Value *Count = Builder.CreateLoad(
+                Int64Ty,
+                Builder.CreateInBoundsGEP(Int64Ty, CountersPtr, CounterIdx),
+                "count");
+            Builder.CreateCall(Fprintf, {File, CounterFmt, Count});
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses EdgeProfiler::run(llvm::Module &M,
+                                    llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getEdgeProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "edge-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "edge-prof") {
+                    MPM.addPass(EdgeProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getEdgeProfilerPluginInfo();
+}
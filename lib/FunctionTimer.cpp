@@ -0,0 +1,546 @@
+//========================================================================
+// FILE:
+//    FunctionTimer.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to measure where the time goes. For every function
+//    defined in the module, records:
+//      * the number of calls,
+//      * the inclusive time, i.e. the time spent in the function and in
+//        everything that it called,
+//      * the exclusive time, i.e. the time spent in the function itself.
+//    Call counts (see DynamicCallCounter) don't tell how expensive a function
+//    is, these do.
+//
+//    The time is read from a cheap clock at function entry and at function
+//    exit:
+//      * `-func-timer-clock=cycles` - the time-stamp counter (`rdtsc` on x86,
+//        via `llvm.readcyclecounter`),
+//      * `-func-timer-clock=monotonic` - `clock_gettime(CLOCK_MONOTONIC)`, in
+//        nanoseconds, for the targets without a time-stamp counter that can be
+//        read in user space.
+//    By default, the time-stamp counter is used on x86 and `clock_gettime`
+//    everywhere else.
+//
+//    Every thread keeps a shadow stack (thread-local, with room for
+//    `-func-timer-stack-depth` frames) of the functions that it is executing.
+//    A frame holds the index of the function, the time of entry and the
+//    inclusive time of the callees. The code injected into every function is
+//    a pair of calls:
+//    ```IR
+//      entry:
+//        %frame = call i32 @func_timer_enter(i32 2)
+//        ...
+//        call void @func_timer_exit(i32 %frame)
+//        ret i32 %r
+//    ```
+//    `func_timer_enter` pushes a frame and returns its position on the shadow
+//    stack. `func_timer_exit` pops the frames down to (and including) that
+//    position. For every frame it pops, the inclusive time (now - entry) and
+//    the exclusive time (inclusive - callees) are added to the counters of
+//    the function, and the inclusive time is added to the callees of the
+//    caller.
+//
+//    Functions don't always return normally. A function that is left by
+//    `longjmp` or by an exception that it doesn't catch never calls
+//    `func_timer_exit`. Passing the position of the frame (rather than just
+//    popping the top of the stack) makes this harmless: the frames left behind
+//    are popped (and accounted for) as soon as the control is back in a
+//    function below them. To this end, every landing pad and every return
+//    from `setjmp` (or any other `returns_twice` function) pops the frames
+//    above the frame of the current function:
+//    ```IR
+//      %r = call i32 @setjmp(ptr @buf)
+//      %above = add i32 %frame, 1
+//      call void @func_timer_exit(i32 %above)
+//    ```
+//    Functions that are left with `resume` call `func_timer_exit` first. The
+//    frames that are still on the stack when the program exits (e.g. after a
+//    call to `exit`) are popped before the profile is written.
+//
+//    The counters (`FuncTimerCounters`, three 64-bit counters per function)
+//    are updated atomically, so the results are correct for multi-threaded
+//    programs. They are moved into a binary profile (see TutorProfile.h and
+//    ProfileWriter.h) when the program starts and the profile is completed
+//    when the program exits. It can be read (and merged) with
+//    `tutor-profdata`. The first `%p` in the file name is replaced with the
+//    process ID and the LLVM_TUTOR_PROFILE_FILE environment variable
+//    overrides the file name at run-time.
+//
+//    Limitations:
+//      * The inclusive time of recursive functions is counted for every
+//        activation, i.e. more than once.
+//      * Activations deeper than `-func-timer-stack-depth` are not recorded,
+//        their time is attributed to the deepest recorded caller.
+//      * The instrumentation itself takes time. For tiny functions, the
+//        results are dominated by the overhead of the calls to
+//        `func_timer_enter` and `func_timer_exit`.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libFunctionTimer.so `\`
+//        -passes="func-timer" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/tutor-profdata merge -format=text timing.*.tutorprof
+//
+// License: MIT
+//========================================================================
+#include "FunctionTimer.h"
+#include "CFGSpanningTree.h"
+#include "ProfileWriter.h"
+#include "TutorProfile.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "func-timer"
+
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumInstrumentedExits, "The # of instrumented function exits");
+STATISTIC(NumInstrumentedResumes, "The # of instrumented landing pads and "
+                                  "returns from setjmp");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+enum class ClockKind { Auto, Cycles, Monotonic };
+
+static cl::opt<ClockKind> Clock(
+    "func-timer-clock", cl::desc("The clock to read at function entry/exit"),
+    cl::values(clEnumValN(ClockKind::Auto, "auto",
+                          "cycles on x86, monotonic elsewhere (default)"),
+               clEnumValN(ClockKind::Cycles, "cycles",
+                          "the time-stamp counter (llvm.readcyclecounter)"),
+               clEnumValN(ClockKind::Monotonic, "monotonic",
+                          "clock_gettime(CLOCK_MONOTONIC), in nanoseconds")),
+    cl::init(ClockKind::Auto));
+
+static cl::opt<unsigned> StackDepth(
+    "func-timer-stack-depth",
+    cl::desc("The size of the per-thread shadow stack (deeper activations "
+             "are not recorded)"),
+    cl::init(256));
+
+static cl::opt<std::string> OutputFile(
+    "func-timer-output",
+    cl::desc("The binary profile to write (%p is replaced with the process "
+             "ID, can be overridden with " TUTOR_PROF_FILE_ENV_VAR ")"),
+    cl::init("timing.%p.tutorprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+static bool useCycleCounter(const Module &M) {
+  if (Clock != ClockKind::Auto)
+    return Clock == ClockKind::Cycles;
+  return Triple(M.getTargetTriple()).isX86();
+}
+
+static unsigned getStackDepth() { return std::max(1U, StackDepth.getValue()); }
+
+// A frame of the shadow stack: {entry time, inclusive time of the callees,
+// function index}
+static StructType *getFrameTy(LLVMContext &CTX) {
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  return StructType::get(CTX, {Int64Ty, Int64Ty, Int64Ty});
+}
+
+// Reads the clock (the builder must be inside a function). Libc holds the
+// value of CLOCK_MONOTONIC for the target.
+static Value *readClock(IRBuilder<> &Builder, Module &M,
+                        const TargetLibcConstants &Libc) {
+  if (useCycleCounter(M))
+    return Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {},
+                                   nullptr, "now");
+
+  // `struct timespec` is {time_t, long}, i.e. two pointer-sized integers
+  auto &CTX = M.getContext();
+  Type *LongTy = M.getDataLayout().getIntPtrType(CTX);
+  StructType *TimespecTy = StructType::get(CTX, {LongTy, LongTy});
+  FunctionCallee ClockGettime = M.getOrInsertFunction(
+      "clock_gettime",
+      FunctionType::get(Builder.getInt32Ty(),
+                        {Builder.getInt32Ty(), PointerType::getUnqual(CTX)},
+                        /*IsVarArgs=*/false));
+
+  // The alloca goes into the entry block, so that it's not a dynamic alloca
+  BasicBlock &EntryBB = Builder.GetInsertBlock()->getParent()->getEntryBlock();
+  IRBuilder<> EntryBuilder(&EntryBB, EntryBB.getFirstInsertionPt());
+  Value *Ts = EntryBuilder.CreateAlloca(TimespecTy, nullptr, "ts");
+
+  Builder.CreateCall(ClockGettime,
+                     {Builder.getInt32(Libc.ClockMonotonic), Ts});
+  Value *Sec = Builder.CreateLoad(
+      LongTy, Builder.CreateStructGEP(TimespecTy, Ts, 0), "ts.sec");
+  Value *NSec = Builder.CreateLoad(
+      LongTy, Builder.CreateStructGEP(TimespecTy, Ts, 1), "ts.nsec");
+  Value *Now = Builder.CreateMul(Builder.CreateSExt(Sec, Builder.getInt64Ty()),
+                                 Builder.getInt64(1000000000));
+  return Builder.CreateAdd(Now, Builder.CreateSExt(NSec, Builder.getInt64Ty()),
+                           "now");
+}
+
+// Defines the function that pushes a frame for function Idx. It is
+// equivalent to the following C function:
+// ```
+//    static uint32_t func_timer_enter(uint32_t Idx) {
+//      uint32_t D = Depth++;
+//      if (D < StackDepth)
+//        Stack[D] = (Frame){.Start = now(), .Callees = 0, .Idx = Idx};
+//      return D;
+//    }
+// ```
+static Function *createEnter(Module &M, const TargetLibcConstants &Libc,
+                             GlobalVariable *Stack, GlobalVariable *Depth) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *StackTy = Stack->getValueType();
+  StructType *FrameTy = getFrameTy(CTX);
+
+  Function *EnterF = Function::Create(
+      FunctionType::get(Int32Ty, {Int32Ty}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "func_timer_enter", M);
+  EnterF->addFnAttr(Attribute::NoInline);
+  EnterF->addFnAttr(Attribute::NoUnwind);
+  EnterF->getArg(0)->setName("idx");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", EnterF);
+  BasicBlock *PushBB = BasicBlock::Create(CTX, "push", EnterF);
+  BasicBlock *ExitBB = BasicBlock::Create(CTX, "exit", EnterF);
+
+  // entry: reserve the frame
+  IRBuilder<> Builder(EntryBB);
+  Value *DepthAddr = Builder.CreateThreadLocalAddress(Depth);
+  Value *D = Builder.CreateLoad(Int32Ty, DepthAddr, "depth");
+  Builder.CreateStore(Builder.CreateAdd(D, Builder.getInt32(1)), DepthAddr);
+  Builder.CreateCondBr(
+      Builder.CreateICmpULT(D, Builder.getInt32(getStackDepth())), PushBB,
+      ExitBB);
+
+  // push: fill the frame in (the clock is read last, so that the time spent
+  // here is not counted)
+  Builder.SetInsertPoint(PushBB);
+  Value *Frame = Builder.CreateInBoundsGEP(
+      StackTy, Builder.CreateThreadLocalAddress(Stack),
+      {Builder.getInt64(0), Builder.CreateZExt(D, Builder.getInt64Ty())},
+      "frame");
+  Builder.CreateStore(
+      Builder.CreateZExt(EnterF->getArg(0), Builder.getInt64Ty()),
+      Builder.CreateStructGEP(FrameTy, Frame, 2));
+  Builder.CreateStore(Builder.getInt64(0),
+                      Builder.CreateStructGEP(FrameTy, Frame, 1));
+  Builder.CreateStore(readClock(Builder, M, Libc),
+                      Builder.CreateStructGEP(FrameTy, Frame, 0));
+  Builder.CreateBr(ExitBB);
+
+  Builder.SetInsertPoint(ExitBB);
+  Builder.CreateRet(D);
+
+  return EnterF;
+}
+
+// Defines the function that pops the frames down to (and including) the frame
+// at position Frame. It is equivalent to the following C function:
+// ```
+//    static void func_timer_exit(uint32_t Frame) {
+//      uint64_t Now = now();
+//      uint32_t D = Depth;
+//      while (D > Frame) {
+//        D--;
+//        if (D >= StackDepth)
+//          continue;
+//        uint64_t Inclusive = Now - Stack[D].Start;
+//        uint64_t *C = &Counters[3 * Stack[D].Idx];
+//        atomic_fetch_add_explicit(&C[0], 1, memory_order_relaxed);
+//        atomic_fetch_add_explicit(&C[1], Inclusive, memory_order_relaxed);
+//        atomic_fetch_add_explicit(&C[2], Inclusive - Stack[D].Callees,
+//                                  memory_order_relaxed);
+//        if (D != 0)
+//          Stack[D - 1].Callees += Inclusive;
+//      }
+//      Depth = D;
+//    }
+// ```
+static Function *createExit(Module &M, const TargetLibcConstants &Libc,
+                            GlobalVariable *Stack, GlobalVariable *Depth,
+                            GlobalVariable *Counters) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  Type *StackTy = Stack->getValueType();
+  Type *CountersTy = Counters->getValueType();
+  StructType *FrameTy = getFrameTy(CTX);
+
+  Function *ExitF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {Int32Ty}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "func_timer_exit", M);
+  ExitF->addFnAttr(Attribute::NoInline);
+  ExitF->addFnAttr(Attribute::NoUnwind);
+  Argument *Target = ExitF->getArg(0);
+  Target->setName("frame");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", ExitF);
+  BasicBlock *CondBB = BasicBlock::Create(CTX, "cond", ExitF);
+  BasicBlock *NextBB = BasicBlock::Create(CTX, "next", ExitF);
+  BasicBlock *PopBB = BasicBlock::Create(CTX, "pop", ExitF);
+  BasicBlock *CallerBB = BasicBlock::Create(CTX, "caller", ExitF);
+  BasicBlock *DoneBB = BasicBlock::Create(CTX, "done", ExitF);
+
+  // entry: read the clock first, so that the time spent here is not counted
+  IRBuilder<> Builder(EntryBB);
+  Value *Now = readClock(Builder, M, Libc);
+  Value *DepthAddr = Builder.CreateThreadLocalAddress(Depth);
+  Value *StackAddr = Builder.CreateThreadLocalAddress(Stack);
+  Value *D0 = Builder.CreateLoad(Int32Ty, DepthAddr, "depth");
+  Builder.CreateBr(CondBB);
+
+  // cond: are there any frames left to pop?
+  Builder.SetInsertPoint(CondBB);
+  PHINode *D = Builder.CreatePHI(Int32Ty, 4, "d");
+  D->addIncoming(D0, EntryBB);
+  Builder.CreateCondBr(Builder.CreateICmpUGT(D, Target), NextBB, DoneBB);
+
+  // next: the frames that didn't fit on the stack have nothing to pop
+  Builder.SetInsertPoint(NextBB);
+  Value *DNext = Builder.CreateSub(D, Builder.getInt32(1), "d.next");
+  D->addIncoming(DNext, NextBB);
+  Builder.CreateCondBr(
+      Builder.CreateICmpULT(DNext, Builder.getInt32(getStackDepth())), PopBB,
+      CondBB);
+
+  // pop: update the counters of the function
+  Builder.SetInsertPoint(PopBB);
+  D->addIncoming(DNext, PopBB);
+  Value *Frame = Builder.CreateInBoundsGEP(
+      StackTy, StackAddr,
+      {Builder.getInt64(0), Builder.CreateZExt(DNext, Int64Ty)}, "frame");
+  Value *Start = Builder.CreateLoad(
+      Int64Ty, Builder.CreateStructGEP(FrameTy, Frame, 0), "start");
+  Value *Callees = Builder.CreateLoad(
+      Int64Ty, Builder.CreateStructGEP(FrameTy, Frame, 1), "callees");
+  Value *Idx = Builder.CreateLoad(
+      Int64Ty, Builder.CreateStructGEP(FrameTy, Frame, 2), "idx");
+  Value *Inclusive = Builder.CreateSub(Now, Start, "inclusive");
+  Value *Exclusive = Builder.CreateSub(Inclusive, Callees, "exclusive");
+
+  Value *First =
+      Builder.CreateMul(Idx, Builder.getInt64(FUNC_TIMER_NUM_COUNTERS));
+  auto AddToCounter = [&](unsigned Counter, Value *V) {
+    Value *Ptr = Builder.CreateInBoundsGEP(
+        CountersTy, Counters,
+        {Builder.getInt64(0),
+         Builder.CreateAdd(First, Builder.getInt64(Counter))});
+    Builder.CreateAtomicRMW(AtomicRMWInst::Add, Ptr, V, Align(8),
+                            AtomicOrdering::Monotonic);
+  };
+  AddToCounter(FUNC_TIMER_CALLS, Builder.getInt64(1));
+  AddToCounter(FUNC_TIMER_INCLUSIVE, Inclusive);
+  AddToCounter(FUNC_TIMER_EXCLUSIVE, Exclusive);
+  Builder.CreateCondBr(Builder.CreateIsNull(DNext), CondBB, CallerBB);
+
+  // caller: the time spent here is not exclusive to the caller
+  Builder.SetInsertPoint(CallerBB);
+  D->addIncoming(DNext, CallerBB);
+  Value *CallerCallees = Builder.CreateStructGEP(
+      FrameTy,
+      Builder.CreateInBoundsGEP(
+          StackTy, StackAddr,
+          {Builder.getInt64(0),
+           Builder.CreateZExt(Builder.CreateSub(DNext, Builder.getInt32(1)),
+                              Int64Ty)}),
+      1);
+  Builder.CreateStore(
+      Builder.CreateAdd(Builder.CreateLoad(Int64Ty, CallerCallees), Inclusive),
+      CallerCallees);
+  Builder.CreateBr(CondBB);
+
+  // done: D == Frame (unless the stack was already popped past Frame)
+  Builder.SetInsertPoint(DoneBB);
+  Builder.CreateStore(D, DepthAddr);
+  Builder.CreateRetVoid();
+
+  return ExitF;
+}
+
+//-----------------------------------------------------------------------------
+// FunctionTimer implementation
+//-----------------------------------------------------------------------------
+bool FunctionTimer::runOnModule(Module &M) {
+  auto &CTX = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+
+  SmallVector<Function *, 32> Functions;
+  for (auto &F : M)
+    if (!F.isDeclaration() && !F.hasFnAttribute(Attribute::Naked))
+      Functions.push_back(&F);
+
+  // Stop here if there are no function definitions in this module
+  if (Functions.empty())
+    return false;
+
+  // The clock and the profile writer use the libc constants of the target OS
+  std::optional<TargetLibcConstants> Libc = getTargetLibcConstants(M);
+  if (!Libc) {
+    CTX.emitError("func-timer: the instrumentation is not supported for " +
+                  Twine(M.getTargetTriple()));
+    return false;
+  }
+
+  // The CFGs of the uninstrumented functions
+  SmallVector<ProfileWriterRecord, 32> Records;
+  for (Function *F : Functions)
+    Records.push_back({F->getName(), CFGSpanningTree::getStructuralHash(*F),
+                       FUNC_TIMER_NUM_COUNTERS});
+
+  // STEP 1: Define the counters, the shadow stack and the runtime functions
+  // -----------------------------------------------------------------------
+  // The counters are alone in their pages, so that they can be moved into
+  // the profile file (see ProfileWriter.h)
+  uint64_t NumCounters = FUNC_TIMER_NUM_COUNTERS * Functions.size();
+  ArrayType *CountersTy = ArrayType::get(
+      Int64Ty, alignTo(NumCounters * 8, ProfileWriterPageSize) / 8);
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "FuncTimerCounters");
+  Counters->setAlignment(Align(ProfileWriterPageSize));
+
+  ArrayType *StackTy = ArrayType::get(getFrameTy(CTX), getStackDepth());
+  auto *Stack = new GlobalVariable(
+      M, StackTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(StackTy), "func_timer.stack",
+      /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+  Stack->setAlignment(Align(8));
+  auto *Depth = new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Ty, 0), "func_timer.depth",
+      /*InsertBefore=*/nullptr, GlobalValue::GeneralDynamicTLSModel);
+  Depth->setAlignment(Align(4));
+
+  Function *EnterF = createEnter(M, *Libc, Stack, Depth);
+  Function *ExitF = createExit(M, *Libc, Stack, Depth, Counters);
+
+  // STEP 2: Instrument the entry and the exits of every function
+  // ------------------------------------------------------------
+  for (unsigned Idx = 0, E = Functions.size(); Idx != E; ++Idx) {
+    Function *F = Functions[Idx];
+
+    // Collect the exits and the points where the control returns to F after
+    // a non-local jump (i.e. the landing pads and the returns from `setjmp`)
+    // before any code is injected
+    SmallVector<Instruction *, 4> Exits;
+    SmallVector<Instruction *, 4> Resumes;
+    for (BasicBlock &BB : *F) {
+      if (BB.isEHPad())
+        Resumes.push_back(BB.getFirstNonPHI());
+      for (Instruction &I : BB)
+        if (auto *CI = dyn_cast<CallInst>(&I))
+          if (CI->hasFnAttr(Attribute::ReturnsTwice))
+            Resumes.push_back(CI);
+
+      Instruction *Term = BB.getTerminator();
+      if (!isa<ReturnInst>(Term) && !isa<ResumeInst>(Term))
+        continue;
+      // Nothing may be inserted between a `musttail` call and the `ret`
+      if (CallInst *MustTail = BB.getTerminatingMustTailCall())
+        Term = MustTail;
+      Exits.push_back(Term);
+    }
+
+    IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
+    Value *Frame =
+        Builder.CreateCall(EnterF, {Builder.getInt32(Idx)}, "frame");
+
+    // F is being left: pop its frame (and anything left above it)
+    for (Instruction *Exit : Exits) {
+      Builder.SetInsertPoint(Exit);
+      Builder.CreateCall(ExitF, {Frame});
+    }
+
+    // F is running again: pop the frames of the functions that were left
+    // without returning, i.e. everything above the frame of F
+    for (Instruction *Resume : Resumes) {
+      // `catchswitch` can't be followed by anything else
+      if (isa<CatchSwitchInst>(Resume))
+        continue;
+      Builder.SetInsertPoint(Resume->getNextNode());
+      Value *Above = Builder.CreateAdd(Frame, Builder.getInt32(1));
+      // The calls inside a funclet must name the funclet
+      SmallVector<OperandBundleDef, 1> Bundles;
+      if (auto *Pad = dyn_cast<FuncletPadInst>(Resume))
+        Bundles.emplace_back("funclet", Pad);
+      Builder.CreateCall(ExitF, {Above}, Bundles);
+    }
+
+    NumInstrumentedFunctions++;
+    NumInstrumentedExits += Exits.size();
+    NumInstrumentedResumes += Resumes.size();
+    LLVM_DEBUG(dbgs() << " Instrumented: " << F->getName() << "\n");
+  }
+
+  // STEP 3: Write the profile when the program exits
+  // ------------------------------------------------
+  // The frames that are still on the stack (e.g. when `exit` is called) are
+  // popped first, i.e. `func_timer_finish` is equivalent to:
+  // ```
+  //    static void func_timer_finish() {
+  //      func_timer_exit(0);
+  //      func_timer_write_profile();
+  //    }
+  // ```
+  Function *WriterF = createProfileWriter(
+      M, *Libc,
+      useCycleCounter(M) ? TUTOR_PROF_KIND_TIME_CYCLES
+                         : TUTOR_PROF_KIND_TIME_NS,
+      Records, Counters, /*CounterSize=*/8, OutputFile, "func_timer",
+      "FuncTimerProfileImage");
+
+  Function *FinishF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "func_timer_finish", M);
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", FinishF));
+  Builder.CreateCall(ExitF, {Builder.getInt32(0)});
+  Builder.CreateCall(WriterF, {});
+  Builder.CreateRetVoid();
+  appendToGlobalDtors(M, FinishF, /*Priority=*/0);
+
+  return true;
+}
+
+PreservedAnalyses FunctionTimer::run(llvm::Module &M,
+                                     llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getFunctionTimerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "func-timer", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "func-timer") {
+                    MPM.addPass(FunctionTimer());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getFunctionTimerPluginInfo();
+}
@@ -0,0 +1,320 @@
+//========================================================================
+// FILE:
+//    HeapProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to record, for every heap allocation site, how many
+//    blocks it allocates, how big they are and how long they live (from the
+//    allocation to the deallocation). The statistics are collected by the
+//    runtime library (libTutorRuntime.a, see TutorHeapProf.h), which writes
+//    them when the program exits. Use `tutor-heap` to find the sites that
+//    allocate many small, short-lived blocks, i.e. the candidates for a pool
+//    (or for the stack).
+//
+//    Every direct call to one of the allocation functions is a site:
+//      * malloc, calloc (the size is the product of the arguments), realloc,
+//      * the replaceable `operator new` and `operator new[]`, including the
+//        `nothrow` and the aligned versions (the Itanium ABI with a 64-bit
+//        size_t, i.e. `_Znwm` and `_Znam`).
+//    Every site gets a constant descriptor (function, CFG hash, index within
+//    the function, kind and, with debug info, `<file>:<line>`) and the call
+//    is followed by `__tutor_heap_alloc(Ptr, Size, &Site)`. For an `invoke`,
+//    the hook goes to the normal destination (the block is allocated only if
+//    no exception is thrown). Every direct call to free or to one of the
+//    `operator delete`s is preceded by `__tutor_heap_free(Ptr)` (before the
+//    call, as afterwards another thread may already own the address).
+//    realloc is reported after the call, with `__tutor_heap_realloc`.
+//
+//    The calls are wrapped at the call site (rather than replacing malloc and
+//    friends), so that the program still uses its own allocator and the
+//    blocks allocated by code that's not instrumented (e.g. libraries) are
+//    simply ignored. Indirect calls are not instrumented.
+//
+//    Every instrumented module registers itself with the runtime from a
+//    constructor and unregisters from a destructor. The profile is appended
+//    to `-heap-prof-output` (overridden at run-time with the
+//    LLVM_TUTOR_HEAPPROF_FILE environment variable) once the last module is
+//    unregistered.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libHeapProfiler.so `\`
+//        -passes="heap-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli -extra-archive=<BUILD_DIR>/lib/libTutorRuntime.a instrumented.bin
+//      $ <BUILD_DIR>/bin/tutor-heap default.heapprof
+//
+// License: MIT
+//========================================================================
+#include "HeapProfiler.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+#include "TutorHeapProf.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "heap-prof"
+
+STATISTIC(NumAllocSites, "The # of instrumented allocation sites");
+STATISTIC(NumFreeSites, "The # of instrumented deallocation sites");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string>
+    OutputFile("heap-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " TUTOR_HEAP_FILE_ENV_VAR ")"),
+               cl::init("default.heapprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Returns the kind of the allocation function called Name, or -1 if it's not
+// one
+static int getAllocKind(StringRef Name) {
+  return StringSwitch<int>(Name)
+      .Case("malloc", TUTOR_HEAP_MALLOC)
+      .Case("calloc", TUTOR_HEAP_CALLOC)
+      .Case("realloc", TUTOR_HEAP_REALLOC)
+      .Cases("_Znwm", "_ZnwmRKSt9nothrow_t", "_ZnwmSt11align_val_t",
+             "_ZnwmSt11align_val_tRKSt9nothrow_t", TUTOR_HEAP_NEW)
+      .Cases("_Znam", "_ZnamRKSt9nothrow_t", "_ZnamSt11align_val_t",
+             "_ZnamSt11align_val_tRKSt9nothrow_t", TUTOR_HEAP_NEW_ARRAY)
+      .Default(-1);
+}
+
+// The deallocation functions (the pointer is always the first argument)
+static bool isFreeFunction(StringRef Name) {
+  return StringSwitch<bool>(Name)
+      .Case("free", true)
+      .Cases("_ZdlPv", "_ZdlPvm", "_ZdlPvRKSt9nothrow_t",
+             "_ZdlPvSt11align_val_t", "_ZdlPvmSt11align_val_t",
+             "_ZdlPvSt11align_val_tRKSt9nothrow_t", true)
+      .Cases("_ZdaPv", "_ZdaPvm", "_ZdaPvRKSt9nothrow_t",
+             "_ZdaPvSt11align_val_t", "_ZdaPvmSt11align_val_t",
+             "_ZdaPvSt11align_val_tRKSt9nothrow_t", true)
+      .Default(false);
+}
+
+// Checks that the call matches the signature expected for Kind, i.e. that it
+// returns a pointer and that the size arguments are 64-bit integers
+static bool hasAllocSignature(const CallBase &CB, int Kind) {
+  if (!CB.getType()->isPointerTy())
+    return false;
+  unsigned FirstSize = Kind == TUTOR_HEAP_REALLOC ? 1 : 0;
+  unsigned NumSizes = Kind == TUTOR_HEAP_CALLOC ? 2 : 1;
+  if (CB.arg_size() < FirstSize + NumSizes)
+    return false;
+  if (Kind == TUTOR_HEAP_REALLOC &&
+      !CB.getArgOperand(0)->getType()->isPointerTy())
+    return false;
+  for (unsigned Idx = FirstSize; Idx != FirstSize + NumSizes; ++Idx)
+    if (!CB.getArgOperand(Idx)->getType()->isIntegerTy(64))
+      return false;
+  return true;
+}
+
+// `<file>:<line>` of the call, or "-" without debug info. The profile is
+// split at spaces, so there are none.
+static std::string getLocation(const CallBase &CB) {
+  const DebugLoc &DL = CB.getDebugLoc();
+  if (!DL)
+    return "-";
+  std::string Loc =
+      (sys::path::filename(DL->getFilename()) + ":" + Twine(DL.getLine()))
+          .str();
+  std::replace(Loc.begin(), Loc.end(), ' ', '_');
+  return Loc;
+}
+
+//-----------------------------------------------------------------------------
+// HeapProfiler implementation
+//-----------------------------------------------------------------------------
+bool HeapProfiler::runOnModule(Module &M, ModuleAnalysisManager &) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *VoidTy = Type::getVoidTy(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+
+  // STEP 1: Find the allocation and the deallocation sites
+  // ------------------------------------------------------
+  struct FunctionSites {
+    Function *F;
+    SmallVector<std::pair<CallBase *, int>, 8> Allocs;
+    SmallVector<CallBase *, 8> Frees;
+  };
+  std::vector<FunctionSites> Sites;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    FunctionSites FS{&F, {}, {}};
+    for (Instruction &I : instructions(F)) {
+      auto *CB = dyn_cast<CallBase>(&I);
+      Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+      if (!Callee)
+        continue;
+
+      int Kind = getAllocKind(Callee->getName());
+      // Nothing can follow a musttail call (apart from the `ret`)
+      if (Kind >= 0 && hasAllocSignature(*CB, Kind) && !CB->isMustTailCall())
+        FS.Allocs.push_back({CB, Kind});
+      else if (isFreeFunction(Callee->getName()) && CB->arg_size() &&
+               CB->getArgOperand(0)->getType()->isPointerTy())
+        FS.Frees.push_back(CB);
+    }
+    if (!FS.Allocs.empty() || !FS.Frees.empty())
+      Sites.push_back(std::move(FS));
+  }
+
+  if (Sites.empty())
+    return false;
+
+  // STEP 2: Inject the declarations of the runtime hooks
+  // ----------------------------------------------------
+  FunctionCallee AllocHook = M.getOrInsertFunction(
+      "__tutor_heap_alloc",
+      FunctionType::get(VoidTy, {PtrTy, Int64Ty, PtrTy}, /*IsVarArgs=*/false));
+  FunctionCallee FreeHook = M.getOrInsertFunction(
+      "__tutor_heap_free",
+      FunctionType::get(VoidTy, {PtrTy}, /*IsVarArgs=*/false));
+  FunctionCallee ReallocHook = M.getOrInsertFunction(
+      "__tutor_heap_realloc",
+      FunctionType::get(VoidTy, {PtrTy, PtrTy, Int64Ty, PtrTy},
+                        /*IsVarArgs=*/false));
+
+  // STEP 3: Instrument the sites
+  // ----------------------------
+  // Every site is described by a TutorHeapSite:
+  //    { ptr Function, i64 Hash, i32 Index, i32 Kind, ptr Location }
+  StructType *SiteTy =
+      StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty, Int32Ty, PtrTy});
+  StringMap<Constant *> Locations;
+  for (FunctionSites &FS : Sites) {
+    Function &F = *FS.F;
+    // Before the invokes get their blocks
+    uint64_t Hash = CFGSpanningTree::getStructuralHash(F);
+    Constant *Name = FS.Allocs.empty()
+                         ? nullptr
+                         : createGlobalString(M, F.getName(), "heapprof.name");
+
+    for (unsigned Idx = 0, E = FS.Allocs.size(); Idx != E; ++Idx) {
+      CallBase *CB = FS.Allocs[Idx].first;
+      int Kind = FS.Allocs[Idx].second;
+      std::string Loc = getLocation(*CB);
+      Constant *&Location = Locations[Loc];
+      if (!Location)
+        Location = createGlobalString(M, Loc, "heapprof.location");
+      auto *Site = new GlobalVariable(
+          M, SiteTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+          ConstantStruct::get(SiteTy,
+                              {Name, ConstantInt::get(Int64Ty, Hash),
+                               ConstantInt::get(Int32Ty, Idx),
+                               ConstantInt::get(Int32Ty, Kind), Location}),
+          "heapprof.site");
+      Site->setAlignment(Align(8));
+
+      IRBuilder<> Builder(getInsertionPointAfterCall(*CB, "heapprof"));
+      if (Kind == TUTOR_HEAP_REALLOC) {
+        Builder.CreateCall(ReallocHook, {CB->getArgOperand(0), CB,
+                                         CB->getArgOperand(1), Site});
+      } else {
+        Value *Size = CB->getArgOperand(0);
+        if (Kind == TUTOR_HEAP_CALLOC)
+          Size = Builder.CreateMul(Size, CB->getArgOperand(1), "heapprof.size");
+        Builder.CreateCall(AllocHook, {CB, Size, Site});
+      }
+      NumAllocSites++;
+    }
+
+    for (CallBase *CB : FS.Frees) {
+      IRBuilder<> Builder(CB);
+      Builder.CreateCall(FreeHook, {CB->getArgOperand(0)});
+      NumFreeSites++;
+    }
+
+    LLVM_DEBUG(dbgs() << "Instrumented: " << F.getName() << " ("
+                      << FS.Allocs.size() << " allocation sites, "
+                      << FS.Frees.size() << " deallocation sites)\n");
+  }
+
+  // STEP 4: Register this module with the runtime
+  // ---------------------------------------------
+  // It is equivalent to the following C code:
+  // ```
+  //    __attribute__((constructor)) static void heapprof.register() {
+  //      __tutor_heap_register("default.heapprof");
+  //    }
+  //    __attribute__((destructor)) static void heapprof.unregister() {
+  //      __tutor_heap_unregister();
+  //    }
+  // ```
+  Constant *DefaultPath =
+      createGlobalString(M, OutputFile, "heapprof.default_path");
+  Function *RegisterF = Function::Create(
+      FunctionType::get(VoidTy, {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "heapprof.register", M);
+  IRBuilder<> Builder(BasicBlock::Create(CTX, "entry", RegisterF));
+  Builder.CreateCall(
+      M.getOrInsertFunction("__tutor_heap_register",
+                            FunctionType::get(VoidTy, {PtrTy}, false)),
+      {DefaultPath});
+  Builder.CreateRetVoid();
+
+  Function *UnregisterF = Function::Create(
+      FunctionType::get(VoidTy, {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "heapprof.unregister", M);
+  Builder.SetInsertPoint(BasicBlock::Create(CTX, "entry", UnregisterF));
+  Builder.CreateCall(M.getOrInsertFunction(
+      "__tutor_heap_unregister", FunctionType::get(VoidTy, {}, false)));
+  Builder.CreateRetVoid();
+
+  appendToGlobalCtors(M, RegisterF, /*Priority=*/0);
+  appendToGlobalDtors(M, UnregisterF, /*Priority=*/0);
+
+  return true;
+}
+
+PreservedAnalyses HeapProfiler::run(llvm::Module &M,
+                                    llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getHeapProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "heap-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "heap-prof") {
+                    MPM.addPass(HeapProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getHeapProfilerPluginInfo();
+}
@@ -0,0 +1,512 @@
+//========================================================================
+// FILE:
+//    IndirectCallProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to record the targets of every indirect call site
+//    (value profiling). StaticCallCounter can't see the targets of indirect
+//    calls and DynamicCallGraph only attributes them to the callers. This
+//    pass records, for every indirect call site, the functions that were
+//    actually called and how many times. The profile is used by
+//    IndirectCallPromotion to turn the hot indirect calls into direct calls.
+//
+//    Every site gets a small table with room for `-icall-prof-targets` {target,
+//    count} slots (and the total number of calls). Before an indirect call,
+//    the called pointer is recorded:
+//    ```IR
+//      call void @icallprof_record(i32 3, ptr %fptr)
+//      %r = call i32 %fptr(i32 %x)
+//    ```
+//    `icallprof_record` looks the target up in the table of the site. If it's
+//    not there and there are no free slots left, the least frequent target
+//    loses a call instead and is replaced once it has no calls left (as in
+//    the value profiler of LLVM). The frequent targets stay in the table and
+//    the counts are never overestimated. The total is exact.
+//
+//    When the program exits, the tables are appended to the profile file
+//    (`-icall-prof-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_ICALLPROF_FILE environment variable). There's one line per
+//    site (<#calls> is 0 for the sites that were never executed):
+//      <function> <CFG hash> <site> <#calls> <target 1> <count 1> ...
+//    where <site> is the position of the site in the function (see
+//    getIndirectCallSites). The addresses of the targets are mapped back to
+//    names using the table of the functions that may be called indirectly
+//    (i.e. the functions with the address taken and the functions visible
+//    outside the module). The targets that are not in the table (e.g. from
+//    other modules) are recorded as `<unknown>`.
+//
+//    The tables are not thread-safe.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libIndirectCallProfiler.so `\`
+//        -passes="icall-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ cat default.icallprof
+//
+// License: MIT
+//========================================================================
+#include "IndirectCallProfiler.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "icall-prof"
+
+STATISTIC(NumInstrumentedSites, "The # of instrumented indirect call sites");
+STATISTIC(NumKnownTargets, "The # of functions that may be called "
+                           "indirectly");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<unsigned>
+    NumTargets("icall-prof-targets",
+               cl::desc("The number of targets recorded per call site"),
+               cl::init(4));
+
+static cl::opt<std::string>
+    OutputFile("icall-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " ICALL_PROF_FILE_ENV_VAR ")"),
+               cl::init("default.icallprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+namespace {
+// The indirect call sites of one function
+struct FunctionRecord {
+  Function *F;
+  uint64_t Hash;
+  SmallVector<CallBase *, 8> Sites;
+};
+} // namespace
+
+static unsigned getNumTargets() { return std::max(1U, NumTargets.getValue()); }
+
+// The table of a site: {#calls, [NumTargets x {target, count}]}
+static StructType *getSiteTy(LLVMContext &CTX) {
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *SlotTy = StructType::get(CTX, {PointerType::getUnqual(CTX),
+                                             Int64Ty});
+  return StructType::get(CTX,
+                         {Int64Ty, ArrayType::get(SlotTy, getNumTargets())});
+}
+
+// Defines the function that records a call from site Idx to Target. It is
+// equivalent to the following C function:
+// ```
+//    static void icallprof_record(uint32_t Idx, void *Target) {
+//      Site *S = &ICallProfSites[Idx];
+//      S->Total++;
+//      uint32_t Min = 0;
+//      for (uint32_t I = 0; I != NumTargets; I++) {
+//        if (S->Slots[I].Target == Target) {
+//          S->Slots[I].Count++;
+//          return;
+//        }
+//        if (!S->Slots[I].Target) {
+//          S->Slots[I] = (Slot){Target, 1};
+//          return;
+//        }
+//        if (S->Slots[I].Count < S->Slots[Min].Count)
+//          Min = I;
+//      }
+//      // No room: the least frequent target loses a call
+//      if (--S->Slots[Min].Count == 0)
+//        S->Slots[Min] = (Slot){Target, 1};
+//    }
+// ```
+static Function *createRecord(Module &M, GlobalVariable *Sites) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  Type *SitesTy = Sites->getValueType();
+
+  Function *RecordF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {Int32Ty, PtrTy},
+                        /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "icallprof_record", M);
+  RecordF->addFnAttr(Attribute::NoInline);
+  RecordF->addFnAttr(Attribute::NoUnwind);
+  Argument *Idx = RecordF->getArg(0);
+  Argument *Target = RecordF->getArg(1);
+  Idx->setName("idx");
+  Target->setName("target");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", RecordF);
+  BasicBlock *LoopBB = BasicBlock::Create(CTX, "loop", RecordF);
+  BasicBlock *HitBB = BasicBlock::Create(CTX, "hit", RecordF);
+  BasicBlock *CheckEmptyBB = BasicBlock::Create(CTX, "check.empty", RecordF);
+  BasicBlock *ClaimBB = BasicBlock::Create(CTX, "claim", RecordF);
+  BasicBlock *LatchBB = BasicBlock::Create(CTX, "loop.latch", RecordF);
+  BasicBlock *EvictBB = BasicBlock::Create(CTX, "evict", RecordF);
+
+  // entry: count the call
+  IRBuilder<> Builder(EntryBB);
+  Value *Idx64 = Builder.CreateZExt(Idx, Int64Ty);
+  Value *TotalPtr = Builder.CreateInBoundsGEP(
+      SitesTy, Sites, {Builder.getInt64(0), Idx64, Builder.getInt32(0)});
+  Builder.CreateStore(
+      Builder.CreateAdd(Builder.CreateLoad(Int64Ty, TotalPtr, "total"),
+                        Builder.getInt64(1)),
+      TotalPtr);
+  Builder.CreateBr(LoopBB);
+
+  auto GetSlotField = [&](Value *Slot, unsigned Field) {
+    return Builder.CreateInBoundsGEP(SitesTy, Sites,
+                                     {Builder.getInt64(0), Idx64,
+                                      Builder.getInt32(1), Slot,
+                                      Builder.getInt32(Field)});
+  };
+
+  // loop: look for Target (or a free slot)
+  Builder.SetInsertPoint(LoopBB);
+  PHINode *I = Builder.CreatePHI(Int64Ty, 2, "i");
+  PHINode *Min = Builder.CreatePHI(Int64Ty, 2, "min");
+  I->addIncoming(Builder.getInt64(0), EntryBB);
+  Min->addIncoming(Builder.getInt64(0), EntryBB);
+  Value *TargetPtr = GetSlotField(I, 0);
+  Value *CountPtr = GetSlotField(I, 1);
+  Value *SlotTarget = Builder.CreateLoad(PtrTy, TargetPtr, "slot.target");
+  Builder.CreateCondBr(Builder.CreateICmpEQ(SlotTarget, Target), HitBB,
+                       CheckEmptyBB);
+
+  // hit: Target is in the table already
+  Builder.SetInsertPoint(HitBB);
+  Builder.CreateStore(
+      Builder.CreateAdd(Builder.CreateLoad(Int64Ty, CountPtr),
+                        Builder.getInt64(1)),
+      CountPtr);
+  Builder.CreateRetVoid();
+
+  // check.empty: the slots are filled in order, so Target is not in the table
+  Builder.SetInsertPoint(CheckEmptyBB);
+  Builder.CreateCondBr(Builder.CreateIsNull(SlotTarget), ClaimBB, LatchBB);
+
+  // claim: take the free slot
+  Builder.SetInsertPoint(ClaimBB);
+  Builder.CreateStore(Target, TargetPtr);
+  Builder.CreateStore(Builder.getInt64(1), CountPtr);
+  Builder.CreateRetVoid();
+
+  // loop.latch: keep track of the least frequent target
+  Builder.SetInsertPoint(LatchBB);
+  Value *Count = Builder.CreateLoad(Int64Ty, CountPtr, "count");
+  Value *MinCount = Builder.CreateLoad(Int64Ty, GetSlotField(Min, 1),
+                                       "min.count");
+  Value *NextMin = Builder.CreateSelect(
+      Builder.CreateICmpULT(Count, MinCount), I, Min, "min.next");
+  Value *NextI = Builder.CreateNUWAdd(I, Builder.getInt64(1), "i.next");
+  I->addIncoming(NextI, LatchBB);
+  Min->addIncoming(NextMin, LatchBB);
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextI, Builder.getInt64(getNumTargets())), EvictBB,
+      LoopBB);
+
+  // evict: the least frequent target loses a call (and the slot once it
+  // has no calls left)
+  Builder.SetInsertPoint(EvictBB);
+  Value *MinTargetPtr = GetSlotField(NextMin, 0);
+  Value *MinCountPtr = GetSlotField(NextMin, 1);
+  Value *Decremented = Builder.CreateSub(
+      Builder.CreateLoad(Int64Ty, MinCountPtr), Builder.getInt64(1), "dec");
+  Value *Evicted = Builder.CreateIsNull(Decremented, "evicted");
+  Builder.CreateStore(
+      Builder.CreateSelect(Evicted, Target,
+                           Builder.CreateLoad(PtrTy, MinTargetPtr)),
+      MinTargetPtr);
+  Builder.CreateStore(
+      Builder.CreateSelect(Evicted, Builder.getInt64(1), Decremented),
+      MinCountPtr);
+  Builder.CreateRetVoid();
+
+  return RecordF;
+}
+
+// Defines the function that maps the address of a function to its name. It
+// is equivalent to the following C function:
+// ```
+//    static const char *icallprof_lookup(void *Target) {
+//      for (uint64_t I = 0; I != NumTargets; I++)
+//        if (ICallProfTargets[I].Fn == Target)
+//          return ICallProfTargets[I].Name;
+//      return "<unknown>";
+//    }
+// ```
+static Function *createLookup(Module &M, ArrayRef<Function *> Targets) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+
+  StructType *EntryTy = StructType::get(CTX, {PtrTy, PtrTy});
+  std::vector<Constant *> Entries;
+  for (Function *F : Targets)
+    Entries.push_back(ConstantStruct::get(
+        EntryTy, {F, createGlobalString(M, F->getName(), "icallprof.name")}));
+  ArrayType *TableTy = ArrayType::get(EntryTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "ICallProfTargets");
+  Constant *Unknown =
+      createGlobalString(M, ICALL_PROF_UNKNOWN_TARGET, "icallprof.unknown");
+
+  Function *LookupF = Function::Create(
+      FunctionType::get(PtrTy, {PtrTy}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "icallprof_lookup", M);
+  Argument *Target = LookupF->getArg(0);
+  Target->setName("target");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", LookupF);
+  BasicBlock *UnknownBB = BasicBlock::Create(CTX, "unknown", LookupF);
+  IRBuilder<> Builder(EntryBB);
+  if (Targets.empty()) {
+    Builder.CreateBr(UnknownBB);
+  } else {
+    BasicBlock *LoopBB = BasicBlock::Create(CTX, "loop", LookupF, UnknownBB);
+    BasicBlock *FoundBB = BasicBlock::Create(CTX, "found", LookupF, UnknownBB);
+    BasicBlock *LatchBB =
+        BasicBlock::Create(CTX, "loop.latch", LookupF, UnknownBB);
+    Builder.CreateBr(LoopBB);
+
+    // loop: compare the addresses
+    Builder.SetInsertPoint(LoopBB);
+    PHINode *I = Builder.CreatePHI(Int64Ty, 2, "i");
+    I->addIncoming(Builder.getInt64(0), EntryBB);
+    Value *Fn = Builder.CreateLoad(
+        PtrTy,
+        Builder.CreateInBoundsGEP(
+            TableTy, Table,
+            {Builder.getInt64(0), I, Builder.getInt32(0)}),
+        "fn");
+    Builder.CreateCondBr(Builder.CreateICmpEQ(Fn, Target), FoundBB, LatchBB);
+
+    // found: return the name
+    Builder.SetInsertPoint(FoundBB);
+    Builder.CreateRet(Builder.CreateLoad(
+        PtrTy, Builder.CreateInBoundsGEP(
+                   TableTy, Table,
+                   {Builder.getInt64(0), I, Builder.getInt32(1)})));
+
+    // loop.latch: move to the next function
+    Builder.SetInsertPoint(LatchBB);
+    Value *NextI = Builder.CreateNUWAdd(I, Builder.getInt64(1), "i.next");
+    I->addIncoming(NextI, LatchBB);
+    Builder.CreateCondBr(
+        Builder.CreateICmpEQ(NextI, Builder.getInt64(Targets.size())),
+        UnknownBB, LoopBB);
+  }
+
+  // unknown: the target is not in the table
+  Builder.SetInsertPoint(UnknownBB);
+  Builder.CreateRet(Unknown);
+
+  return LookupF;
+}
+
+//-----------------------------------------------------------------------------
+// IndirectCallProfiler implementation
+//-----------------------------------------------------------------------------
+bool IndirectCallProfiler::runOnModule(Module &M) {
+  auto &CTX = M.getContext();
+
+  // STEP 1: Collect the indirect call sites
+  // ---------------------------------------
+  std::vector<FunctionRecord> Records;
+  unsigned NumSites = 0;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    FunctionRecord R{&F, CFGSpanningTree::getStructuralHash(F),
+                     getIndirectCallSites(F)};
+    if (R.Sites.empty())
+      continue;
+    NumSites += R.Sites.size();
+    Records.push_back(std::move(R));
+  }
+
+  // Stop here if there are no indirect calls in this module
+  if (Records.empty())
+    return false;
+
+  // The functions that may be called indirectly, i.e. the potential targets
+  SmallVector<Function *, 32> Targets;
+  for (Function &F : M)
+    if (!F.isIntrinsic() && (!F.hasLocalLinkage() || F.hasAddressTaken()))
+      Targets.push_back(&F);
+  NumKnownTargets += Targets.size();
+
+  // STEP 2: Define the tables and the runtime functions
+  // ---------------------------------------------------
+  ArrayType *SitesTy = ArrayType::get(getSiteTy(CTX), NumSites);
+  auto *Sites = new GlobalVariable(M, SitesTy, /*isConstant=*/false,
+                                   GlobalValue::InternalLinkage,
+                                   Constant::getNullValue(SitesTy),
+                                   "ICallProfSites");
+  Sites->setAlignment(Align(8));
+
+  Function *RecordF = createRecord(M, Sites);
+  Function *LookupF = createLookup(M, Targets);
+
+  // STEP 3: Record the called pointer before every indirect call
+  // ------------------------------------------------------------
+  unsigned SiteIdx = 0;
+  for (FunctionRecord &R : Records) {
+    for (CallBase *CB : R.Sites) {
+      IRBuilder<> Builder(CB);
+      // The calls inside a funclet must name the funclet
+      SmallVector<OperandBundleDef, 1> Bundles;
+      if (auto Funclet = CB->getOperandBundle(LLVMContext::OB_funclet))
+        Bundles.emplace_back(*Funclet);
+      Builder.CreateCall(RecordF,
+                         {Builder.getInt32(SiteIdx++), CB->getCalledOperand()},
+                         Bundles);
+    }
+    NumInstrumentedSites += R.Sites.size();
+    LLVM_DEBUG(dbgs() << " Instrumented: " << R.F->getName() << " ("
+                      << R.Sites.size() << " sites)\n");
+  }
+
+  // STEP 4: Inject the table of sites
+  // ---------------------------------
+  // One {caller name, CFG hash, position of the site in the caller} record
+  // per site
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *RecordTy = StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty});
+
+  std::vector<Constant *> Entries;
+  for (FunctionRecord &R : Records) {
+    Constant *Name = createGlobalString(M, R.F->getName(), "icallprof.caller");
+    for (unsigned Idx = 0, E = R.Sites.size(); Idx != E; ++Idx)
+      Entries.push_back(ConstantStruct::get(
+          RecordTy, {Name, ConstantInt::get(Int64Ty, R.Hash),
+                     ConstantInt::get(Int32Ty, Idx)}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "ICallProfTable");
+
+  // STEP 5: Define the function that writes the profile
+  // ---------------------------------------------------
+  // See createTextProfileDump. Every site is printed as follows (including
+  // the sites that were never executed, so that IndirectCallPromotion can
+  // tell if the number of sites has changed):
+  // ```
+  //    fprintf(File, "%s %llu %u %llu", Table[i].Caller, Table[i].Hash,
+  //            Table[i].Site, Sites[i].Total);
+  //    for (uint64_t j = 0; j != NumTargets; j++)
+  //      if (Sites[i].Slots[j].Target)
+  //        fprintf(File, " %s %llu",
+  //                icallprof_lookup(Sites[i].Slots[j].Target),
+  //                Sites[i].Slots[j].Count);
+  //    fprintf(File, "\n");
+  // ```
+  Constant *SiteFmt =
+      createGlobalString(M, "%s %llu %u %llu", "icallprof.site_fmt");
+  Constant *TargetFmt =
+      createGlobalString(M, " %s %llu", "icallprof.target_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "icallprof.newline");
+
+  createTextProfileDump(
+      M, "icallprof", ICALL_PROF_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumSitesVal = Builder.getInt64(NumSites);
+        emitLoop(Builder, NumSitesVal, "site", [&](Value *Idx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), Idx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Caller = LoadField(0, PtrTy, "caller");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *Site = LoadField(2, Int32Ty, "site");
+          Value *Total = Builder.CreateLoad(
+              Int64Ty,
+              Builder.CreateInBoundsGEP(
+                  SitesTy, Sites,
+                  {Builder.getInt64(0), Idx, Builder.getInt32(0)}),
+              "total");
+          Builder.CreateCall(Fprintf,
+                             {File, SiteFmt, Caller, Hash, Site, Total});
+
+          // Skip the free slots
+          Value *NumSlots = Builder.getInt64(getNumTargets());
+          emitLoop(Builder, NumSlots, "target", [&](Value *Slot) {
+            auto GetSlotField = [&](unsigned Field) {
+              return Builder.CreateInBoundsGEP(
+                  SitesTy, Sites,
+                  {Builder.getInt64(0), Idx, Builder.getInt32(1), Slot,
+                   Builder.getInt32(Field)});
+            };
+            Function *DumpF = Builder.GetInsertBlock()->getParent();
+            BasicBlock *PrintBB =
+                BasicBlock::Create(CTX, "target.print", DumpF);
+            BasicBlock *LatchBB =
+                BasicBlock::Create(CTX, "target.latch", DumpF);
+            Value *Target =
+                Builder.CreateLoad(PtrTy, GetSlotField(0), "target");
+            Builder.CreateCondBr(Builder.CreateIsNull(Target), LatchBB,
+                                 PrintBB);
+
+            // target.print: print the name of the target and the # of calls
+            Builder.SetInsertPoint(PrintBB);
+            Value *TargetName = Builder.CreateCall(LookupF, {Target}, "name");
+            Value *Count =
+                Builder.CreateLoad(Int64Ty, GetSlotField(1), "count");
+            Builder.CreateCall(Fprintf, {File, TargetFmt, TargetName, Count});
+            Builder.CreateBr(LatchBB);
+
+            Builder.SetInsertPoint(LatchBB);
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses IndirectCallProfiler::run(llvm::Module &M,
+                                            llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getIndirectCallProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "icall-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "icall-prof") {
+                    MPM.addPass(IndirectCallProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getIndirectCallProfilerPluginInfo();
+}
@@ -0,0 +1,268 @@
+//========================================================================
+// FILE:
+//    IndirectCallPromotion.cpp
+//
+// DESCRIPTION:
+//    Promotes the hot indirect calls to direct calls, using the profile
+//    written by IndirectCallProfiler (`-icall-promote-profile`). Every
+//    indirect call with a dominant target is guarded by a comparison with the
+//    target:
+//    ```IR
+//      %r = call i32 %fptr(i32 %x)
+//    ```
+//    becomes:
+//    ```IR
+//      %1 = icmp eq ptr %fptr, @inc
+//      br i1 %1, label %if.true.direct_targ, label %if.false.orig_indirect,
+//         !prof !0
+//    if.true.direct_targ:
+//      %2 = call i32 @inc(i32 %x)
+//      br label %if.end.icp
+//    if.false.orig_indirect:
+//      %r = call i32 %fptr(i32 %x)
+//      br label %if.end.icp
+//    if.end.icp:
+//      %3 = phi i32 [ %r, %if.false.orig_indirect ], [ %2, %if.true.direct_targ ]
+//    ```
+//    The direct call can then be inlined (and optimised with the caller). The
+//    branch weights come from the profile.
+//
+//    The targets of a site are considered from the most frequent one. A target
+//    is promoted if it was called at least `-icall-promote-min-count` times
+//    and if it takes at least `-icall-promote-min-percent`% of the calls that
+//    are left (i.e. that were not promoted yet). At most
+//    `-icall-promote-max-targets` targets are promoted per site. The targets
+//    must be defined in (or declared by) the module and the signatures must
+//    match (see isLegalToPromote).
+//
+//    The sites are matched by the position in the function (see
+//    getIndirectCallSites). Like in ProfileUse, the profile of a function is
+//    ignored (with a warning) if the CFG hash doesn't match the module or if
+//    the function doesn't have as many indirect call sites as the profile.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libIndirectCallProfiler.so `\`
+//        -passes="icall-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libIndirectCallPromotion.so `\`
+//        -passes="icall-promote,inline" -icall-promote-profile=default.icallprof `\`
+//        <input-llvm-file> -o optimised.bin
+//
+// License: MIT
+//========================================================================
+#include "IndirectCallPromotion.h"
+#include "CFGSpanningTree.h"
+#include "IndirectCallProfiler.h"
+#include "InstrumentationUtils.h"
+#include "ProfileReader.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/CallPromotionUtils.h"
+
+#include <limits>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "icall-promote"
+
+STATISTIC(NumPromotedSites, "The # of indirect call sites promoted");
+STATISTIC(NumPromotedTargets, "The # of direct calls created");
+STATISTIC(NumIllegalTargets, "The # of hot targets that can't be promoted");
+STATISTIC(NumStaleProfiles, "The # of functions with a stale profile");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string>
+    ProfileFile("icall-promote-profile",
+                cl::desc("The profile written by IndirectCallProfiler"),
+                cl::init(""));
+
+static cl::opt<uint64_t>
+    MinCount("icall-promote-min-count",
+             cl::desc("The minimum # of calls to a promoted target"),
+             cl::init(1000));
+
+static cl::opt<unsigned> MinPercent(
+    "icall-promote-min-percent",
+    cl::desc("The minimum share (in %) of the calls left at a site that go "
+             "to a promoted target"),
+    cl::init(30));
+
+static cl::opt<unsigned>
+    MaxTargets("icall-promote-max-targets",
+               cl::desc("The maximum # of targets promoted per site"),
+               cl::init(2));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Returns the branch weights for a promoted target (scaled down to 32 bits if
+// required)
+static MDNode *createBranchWeights(LLVMContext &CTX, uint64_t TrueCount,
+                                   uint64_t FalseCount) {
+  uint64_t Scale =
+      std::max(TrueCount, FalseCount) / std::numeric_limits<uint32_t>::max() +
+      1;
+  return MDBuilder(CTX).createBranchWeights(TrueCount / Scale,
+                                            FalseCount / Scale);
+}
+
+// Promotes the hot targets of CB. Returns the number of promoted targets.
+static unsigned promoteSite(Module &M, CallBase &CB,
+                            const ICallSiteProfile &P) {
+  // The most frequent targets first (and then by name, to be deterministic)
+  std::vector<std::pair<StringRef, uint64_t>> Targets;
+  for (const auto &Target : P.Targets)
+    Targets.emplace_back(Target.getKey(), Target.getValue());
+  llvm::sort(Targets, [](const auto &A, const auto &B) {
+    return A.second != B.second ? A.second > B.second : A.first < B.first;
+  });
+
+  uint64_t Remaining = P.Total;
+  unsigned NumPromoted = 0;
+  for (const auto &[Name, Count] : Targets) {
+    if (NumPromoted == MaxTargets || Count < MinCount ||
+        Count * 100 < Remaining * MinPercent)
+      break;
+
+    Function *Callee = M.getFunction(Name);
+    const char *Reason = nullptr;
+    if (!Callee || !isLegalToPromote(CB, Callee, &Reason)) {
+      LLVM_DEBUG(dbgs() << "Can't promote " << Name << " in "
+                        << CB.getFunction()->getName() << ": "
+                        << (Callee ? Reason : "not in the module") << "\n");
+      NumIllegalTargets++;
+      continue;
+    }
+
+    // The counts of the targets are never overestimated, but the calls that
+    // were evicted from the table of the site are only in the total
+    uint64_t Others = Remaining - std::min(Count, Remaining);
+    promoteCallWithIfThenElse(
+        CB, Callee, createBranchWeights(M.getContext(), Count, Others));
+    Remaining = Others;
+    NumPromoted++;
+  }
+
+  // What's left goes through the indirect call
+  if (NumPromoted)
+    CB.setMetadata(LLVMContext::MD_prof,
+                   MDBuilder(M.getContext())
+                       .createBranchWeights(
+                           {static_cast<uint32_t>(std::min<uint64_t>(
+                               Remaining,
+                               std::numeric_limits<uint32_t>::max()))}));
+  return NumPromoted;
+}
+
+//-----------------------------------------------------------------------------
+// IndirectCallPromotion implementation
+//-----------------------------------------------------------------------------
+bool IndirectCallPromotion::runOnModule(Module &M) {
+  // STEP 1: Read the profile
+  // ------------------------
+  if (ProfileFile.empty()) {
+    diagnose(M, "", "no profile to use (see -icall-promote-profile)",
+             DS_Error);
+    return false;
+  }
+
+  StringMap<ICallProfile> Profiles;
+  std::string Err = readICallProfile(ProfileFile, Profiles);
+  if (!Err.empty()) {
+    diagnose(M, ProfileFile, Err, DS_Error);
+    return false;
+  }
+
+  // STEP 2: Match the sites with the profile
+  // ----------------------------------------
+  // This is done before any call is promoted - the promotion changes the CFG
+  // (and hence the hash) of the callers
+  std::vector<std::pair<CallBase *, const ICallSiteProfile *>> Sites;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    auto It = Profiles.find(F.getName());
+    if (It == Profiles.end())
+      continue;
+
+    const ICallProfile &P = It->second;
+    SmallVector<CallBase *, 8> CallSites = getIndirectCallSites(F);
+    if (P.Hash != CFGSpanningTree::getStructuralHash(F)) {
+      diagnose(M, ProfileFile,
+               "the profile for " + F.getName() +
+                   " does not match the module (CFG hash mismatch), "
+                   "ignoring it",
+               DS_Warning);
+      NumStaleProfiles++;
+      continue;
+    }
+    // The profile has a line for every site, so the sites can only be
+    // matched by position if there are as many of them
+    if (P.Sites.size() != CallSites.size()) {
+      diagnose(M, ProfileFile,
+               "the profile for " + F.getName() + " has " +
+                   Twine(P.Sites.size()) + " indirect call sites, the "
+                   "function has " + Twine(CallSites.size()) +
+                   ", ignoring it",
+               DS_Warning);
+      NumStaleProfiles++;
+      continue;
+    }
+
+    for (unsigned Idx = 0, E = P.Sites.size(); Idx != E; ++Idx)
+      if (P.Sites[Idx].Total)
+        Sites.emplace_back(CallSites[Idx], &P.Sites[Idx]);
+  }
+
+  // STEP 3: Promote the hot targets
+  // -------------------------------
+  bool Changed = false;
+  for (auto &[CB, P] : Sites) {
+    unsigned NumPromoted = promoteSite(M, *CB, *P);
+    if (!NumPromoted)
+      continue;
+    NumPromotedSites++;
+    NumPromotedTargets += NumPromoted;
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+PreservedAnalyses IndirectCallPromotion::run(llvm::Module &M,
+                                             llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getIndirectCallPromotionPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "icall-promote", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "icall-promote") {
+                    MPM.addPass(IndirectCallPromotion());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getIndirectCallPromotionPluginInfo();
+}
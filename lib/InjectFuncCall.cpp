@@ -20,6 +20,13 @@
 //    (llvm-tutor)   number of arguments: 3
 //    ```
 //
+//    Calls to small leaf functions (e.g. getters) flood the output.
+//    `-inject-func-call-allowlist=<file>` and `-inject-func-call-denylist=<file>`
+//    select the functions by name and `-inject-func-call-skip-leaf-insts=N`
+//    skips the leaf functions with at most N instructions (see
+//    InstrumentationFilter.h). The number of instrumented and skipped
+//    functions is printed to stderr.
+//
 // USAGE:
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libInjectFunctCall.so `\`
 //        -passes=-"inject-func-call" <bitcode-file>
@@ -27,15 +34,49 @@
 // License: MIT
 //========================================================================
 #include "InjectFuncCall.h"
+#include "InstrumentationFilter.h"
 
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "inject-func-call"
 
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumSkippedFunctions, "The # of functions skipped by the filters");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string> AllowList(
+    "inject-func-call-allowlist",
+    cl::desc("Only instrument the functions that match the patterns in this "
+             "file"),
+    cl::init(""));
+
+static cl::opt<std::string> DenyList(
+    "inject-func-call-denylist",
+    cl::desc("Don't instrument the functions that match the patterns in this "
+             "file"),
+    cl::init(""));
+
+static cl::opt<unsigned> SkipLeafInsts(
+    "inject-func-call-skip-leaf-insts",
+    cl::desc("Don't instrument the leaf functions with at most this many "
+             "instructions (0 to instrument all of them)"),
+    cl::init(0));
+
+static cl::opt<unsigned> SkipLeafDepth(
+    "inject-func-call-skip-leaf-depth",
+    cl::desc("With -inject-func-call-skip-leaf-insts, also skip the small "
+             "functions that only call such functions, up to this many "
+             "levels deep"),
+    cl::init(0));
+
 //-----------------------------------------------------------------------------
 // InjectFuncCall implementation
 //-----------------------------------------------------------------------------
@@ -43,6 +84,27 @@ bool InjectFuncCall::runOnModule(Module &M) {
   bool InsertedAtLeastOnePrintf = false;
 
   auto &CTX = M.getContext();
+
+  // Select the functions to instrument (before any calls are injected, which
+  // would make every function a non-leaf)
+  InstrumentationFilter Filter;
+  std::string Err = Filter.init(
+      {AllowList, DenyList, SkipLeafInsts.getValue(), SkipLeafDepth.getValue()});
+  if (!Err.empty()) {
+    CTX.emitError("inject-func-call: " + Err);
+    return false;
+  }
+
+  SmallVector<Function *, 32> Functions;
+  for (auto &F : M)
+    if (!F.isDeclaration() && Filter.shouldInstrument(F))
+      Functions.push_back(&F);
+
+  NumInstrumentedFunctions += Filter.getNumInstrumented();
+  NumSkippedFunctions += Filter.getNumSkipped();
+  if (Filter.isActive())
+    Filter.printSummary(errs(), "inject-func-call");
+
   PointerType *PrintfArgTy = PointerType::getUnqual(Type::getInt8Ty(CTX));
 
   // STEP 1: Inject the declaration of printf
@@ -75,17 +137,14 @@ bool InjectFuncCall::runOnModule(Module &M) {
       M.getOrInsertGlobal("PrintfFormatStr", PrintfFormatStr->getType());
   dyn_cast<GlobalVariable>(PrintfFormatStrVar)->setInitializer(PrintfFormatStr);
 
-  // STEP 3: For each function in the module, inject a call to printf
-  // ----------------------------------------------------------------
-  for (auto &F : M) {
-    if (F.isDeclaration())
-      continue;
-
+  // STEP 3: For each selected function, inject a call to printf
+  // ------------------------------------------------------------
+  for (Function *F : Functions) {
     // Get an IR builder. Sets the insertion point to the top of the function
-    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
 
     // Inject a global variable that contains the function name
-    auto FuncName = Builder.CreateGlobalStringPtr(F.getName());
+    auto FuncName = Builder.CreateGlobalStringPtr(F->getName());
 
     // Printf requires i8*, but PrintfFormatStrVar is an array: [n x i8]. Add
     // a cast: [n x i8] -> i8*
@@ -94,12 +153,12 @@ bool InjectFuncCall::runOnModule(Module &M) {
 
     // The following is visible only if you pass -debug on the command line
     // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << " Injecting call to printf inside " << F.getName()
+    LLVM_DEBUG(dbgs() << " Injecting call to printf inside " << F->getName()
                       << "\n");
 
     // Finally, inject a call to printf
     Builder.CreateCall(
-        Printf, {FormatStrPtr, FuncName, Builder.getInt32(F.arg_size())});
+        Printf, {FormatStrPtr, FuncName, Builder.getInt32(F->arg_size())});
 
     InsertedAtLeastOnePrintf = true;
   }
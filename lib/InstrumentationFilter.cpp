@@ -0,0 +1,161 @@
+//==============================================================================
+// FILE:
+//    InstrumentationFilter.cpp
+//
+// DESCRIPTION:
+//    Selects the functions to instrument. See InstrumentationFilter.h for an
+//    overview.
+//
+// License: MIT
+//==============================================================================
+#include "InstrumentationFilter.h"
+
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "instr-filter"
+
+//------------------------------------------------------------------------------
+// Allow and deny lists
+//------------------------------------------------------------------------------
+bool InstrumentationFilter::Pattern::match(StringRef Name) const {
+  return Glob ? Glob->match(Name) : Re->match(Name);
+}
+
+std::string InstrumentationFilter::readList(StringRef Path, PatternList &List) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return (Path + ": can't read the file (" +
+            BufferOrErr.getError().message() + ")")
+        .str();
+
+  // Skips empty lines and `#` comments
+  for (line_iterator Line(**BufferOrErr, /*SkipBlanks=*/true, '#');
+       !Line.is_at_end(); ++Line) {
+    StringRef Text = Line->trim();
+    if (Text.empty())
+      continue;
+
+    Pattern P;
+    if (Text.consume_front("re:")) {
+      P.Re = std::make_unique<Regex>(Text);
+      std::string Err;
+      if (!P.Re->isValid(Err))
+        return (Path + ":" + Twine(Line.line_number()) +
+                ": invalid regular expression (" + Err + ")")
+            .str();
+    } else {
+      auto GlobOrErr = GlobPattern::create(Text);
+      if (!GlobOrErr)
+        return (Path + ":" + Twine(Line.line_number()) + ": invalid glob (" +
+                toString(GlobOrErr.takeError()) + ")")
+            .str();
+      P.Glob = std::make_unique<GlobPattern>(std::move(*GlobOrErr));
+    }
+    List.push_back(std::move(P));
+  }
+
+  return "";
+}
+
+bool InstrumentationFilter::matches(const PatternList &List, StringRef Name) {
+  return any_of(List, [Name](const Pattern &P) { return P.match(Name); });
+}
+
+std::string
+InstrumentationFilter::init(const InstrumentationFilterOptions &Options) {
+  Opts = Options;
+  if (!Opts.AllowList.empty()) {
+    std::string Err = readList(Opts.AllowList, Allow);
+    if (!Err.empty())
+      return Err;
+    // An empty allow list allows nothing (rather than everything)
+    if (Allow.empty())
+      return Opts.AllowList + ": the allow list is empty";
+  }
+  if (!Opts.DenyList.empty())
+    return readList(Opts.DenyList, Deny);
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// Trivial functions
+//------------------------------------------------------------------------------
+int InstrumentationFilter::getTrivialHeight(const Function &F) {
+  auto It = TrivialHeights.find(&F);
+  if (It != TrivialHeights.end())
+    return It->second;
+
+  // Recursive functions are not trivial (this is what the recursive calls see)
+  TrivialHeights[&F] = -1;
+  if (F.isDeclaration() || F.getInstructionCount() > Opts.LeafInsts)
+    return -1;
+
+  int Height = 0;
+  for (const Instruction &I : instructions(F)) {
+    const auto *CB = dyn_cast<CallBase>(&I);
+    if (!CB || isa<IntrinsicInst>(CB))
+      continue;
+
+    const Function *Callee = CB->getCalledFunction();
+    int CalleeHeight = Callee ? getTrivialHeight(*Callee) : -1;
+    if (CalleeHeight < 0 ||
+        static_cast<unsigned>(CalleeHeight) + 1 > Opts.LeafDepth)
+      return -1;
+    Height = std::max(Height, CalleeHeight + 1);
+  }
+
+  TrivialHeights[&F] = Height;
+  return Height;
+}
+
+//------------------------------------------------------------------------------
+// InstrumentationFilter implementation
+//------------------------------------------------------------------------------
+InstrumentationFilter::Decision
+InstrumentationFilter::classify(const Function &F) {
+  Decision D = Decision::Instrument;
+  if (!Allow.empty() && !matches(Allow, F.getName()))
+    D = Decision::NotAllowed;
+  else if (matches(Deny, F.getName()))
+    D = Decision::Denied;
+  else if (Opts.LeafInsts && getTrivialHeight(F) >= 0)
+    D = Decision::Trivial;
+
+  switch (D) {
+  case Decision::Instrument:
+    NumInstrumented++;
+    break;
+  case Decision::NotAllowed:
+    LLVM_DEBUG(dbgs() << " Skipped (not allowed): " << F.getName() << "\n");
+    NumNotAllowed++;
+    break;
+  case Decision::Denied:
+    LLVM_DEBUG(dbgs() << " Skipped (denied): " << F.getName() << "\n");
+    NumDenied++;
+    break;
+  case Decision::Trivial:
+    LLVM_DEBUG(dbgs() << " Skipped (trivial): " << F.getName() << "\n");
+    NumTrivial++;
+    break;
+  }
+  return D;
+}
+
+void InstrumentationFilter::printSummary(raw_ostream &OS,
+                                         StringRef PassName) const {
+  OS << PassName << ": instrumented " << NumInstrumented << " of "
+     << NumInstrumented + getNumSkipped() << " functions (skipped: "
+     << NumNotAllowed << " not allowed, " << NumDenied << " denied, "
+     << NumTrivial << " trivial)\n";
+}
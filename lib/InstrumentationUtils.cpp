@@ -0,0 +1,147 @@
+//==============================================================================
+// FILE:
+//    InstrumentationUtils.cpp
+//
+// DESCRIPTION:
+//    The IR building blocks shared by the instrumentation passes. See
+//    InstrumentationUtils.h for an overview.
+//
+// License: MIT
+//==============================================================================
+#include "InstrumentationUtils.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+//------------------------------------------------------------------------------
+// Constants and counters
+//------------------------------------------------------------------------------
+Constant *createGlobalString(Module &M, StringRef Str, const Twine &Name) {
+  Constant *Init = ConstantDataArray::getString(M.getContext(), Str);
+  auto *GV = new GlobalVariable(M, Init->getType(), /*isConstant=*/true,
+                                GlobalValue::PrivateLinkage, Init, Name);
+  GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  GV->setAlignment(Align(1));
+  return GV;
+}
+
+void incrementCounter(IRBuilder<> &Builder, Value *Ptr) {
+  LoadInst *Load = Builder.CreateLoad(Builder.getInt64Ty(), Ptr);
+  Value *Inc = Builder.CreateAdd(Builder.getInt64(1), Load);
+  Builder.CreateStore(Inc, Ptr);
+}
+
+void incrementCounter(Instruction *InsertPt, GlobalVariable *Counters,
+                      uint64_t Idx) {
+  IRBuilder<> Builder(InsertPt);
+  incrementCounter(Builder, Builder.CreateConstInBoundsGEP2_64(
+                                Counters->getValueType(), Counters, 0, Idx));
+}
+
+//------------------------------------------------------------------------------
+// Control flow
+//------------------------------------------------------------------------------
+Instruction *getInsertionPointAfterCall(CallBase &CB, const Twine &Suffix) {
+  auto *II = dyn_cast<InvokeInst>(&CB);
+  if (!II)
+    return CB.getNextNode();
+
+  BasicBlock *Normal = II->getNormalDest();
+  if (Normal->getSinglePredecessor())
+    return &*Normal->getFirstInsertionPt();
+
+  // The normal destination is shared, give this invoke a block of its own
+  BasicBlock *Src = II->getParent();
+  BasicBlock *NewBB = BasicBlock::Create(
+      CB.getContext(), Src->getName() + "." + Suffix, Src->getParent(), Normal);
+  BranchInst *Br = BranchInst::Create(Normal, NewBB);
+  II->setNormalDest(NewBB);
+  Normal->replacePhiUsesWith(Src, NewBB);
+  return Br;
+}
+
+void emitLoop(IRBuilder<> &Builder, Value *N, const Twine &Name,
+              function_ref<void(Value *)> Body) {
+  BasicBlock *PreheaderBB = Builder.GetInsertBlock();
+  Function *F = PreheaderBB->getParent();
+  BasicBlock *LoopBB = BasicBlock::Create(F->getContext(), Name, F);
+  Builder.CreateBr(LoopBB);
+
+  Builder.SetInsertPoint(LoopBB);
+  PHINode *Idx = Builder.CreatePHI(Builder.getInt64Ty(), 2, Name + ".idx");
+  Idx->addIncoming(Builder.getInt64(0), PreheaderBB);
+  Body(Idx);
+
+  BasicBlock *ExitBB = BasicBlock::Create(F->getContext(), Name + ".exit", F);
+  Value *NextIdx =
+      Builder.CreateNUWAdd(Idx, Builder.getInt64(1), Name + ".idx.next");
+  Idx->addIncoming(NextIdx, Builder.GetInsertBlock());
+  Builder.CreateCondBr(Builder.CreateICmpEQ(NextIdx, N), ExitBB, LoopBB);
+  Builder.SetInsertPoint(ExitBB);
+}
+
+//------------------------------------------------------------------------------
+// Text profiles
+//------------------------------------------------------------------------------
+Function *createTextProfileDump(
+    Module &M, StringRef Prefix, StringRef EnvVar, StringRef DefaultPath,
+    function_ref<void(IRBuilder<> &, FunctionCallee, Value *)> PrintProfile) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+
+  // The libc functions used by the dump
+  FunctionCallee Getenv = M.getOrInsertFunction(
+      "getenv", FunctionType::get(PtrTy, {PtrTy}, /*IsVarArgs=*/false));
+  FunctionCallee Fopen = M.getOrInsertFunction(
+      "fopen", FunctionType::get(PtrTy, {PtrTy, PtrTy}, /*IsVarArgs=*/false));
+  FunctionCallee Fprintf = M.getOrInsertFunction(
+      "fprintf",
+      FunctionType::get(Int32Ty, {PtrTy, PtrTy}, /*IsVarArgs=*/true));
+  FunctionCallee Fclose = M.getOrInsertFunction(
+      "fclose", FunctionType::get(Int32Ty, {PtrTy}, /*IsVarArgs=*/false));
+
+  Constant *EnvVarStr = createGlobalString(M, EnvVar, Prefix + ".env");
+  Constant *DefaultPathStr =
+      createGlobalString(M, DefaultPath, Prefix + ".default_path");
+  Constant *AppendMode = createGlobalString(M, "a", Prefix + ".append");
+
+  Function *DumpF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, Prefix + "_dump", M);
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", DumpF);
+  BasicBlock *OpenedBB = BasicBlock::Create(CTX, "opened", DumpF);
+  BasicBlock *ExitBB = BasicBlock::Create(CTX, "exit", DumpF);
+
+  // entry: open the profile file
+  IRBuilder<> Builder(EntryBB);
+  Value *EnvPath = Builder.CreateCall(Getenv, {EnvVarStr}, "env");
+  Value *Path = Builder.CreateSelect(Builder.CreateIsNotNull(EnvPath), EnvPath,
+                                     DefaultPathStr, "path");
+  Value *File = Builder.CreateCall(Fopen, {Path, AppendMode}, "file");
+  Builder.CreateCondBr(Builder.CreateIsNotNull(File), OpenedBB, ExitBB);
+
+  // opened: print the profile and close the file
+  Builder.SetInsertPoint(OpenedBB);
+  PrintProfile(Builder, Fprintf, File);
+  Builder.CreateCall(Fclose, {File});
+  Builder.CreateBr(ExitBB);
+
+  ExitBB->moveAfter(&DumpF->back());
+  Builder.SetInsertPoint(ExitBB);
+  Builder.CreateRetVoid();
+
+  appendToGlobalDtors(M, DumpF, /*Priority=*/0);
+  return DumpF;
+}
+
+//------------------------------------------------------------------------------
+// Diagnostics
+//------------------------------------------------------------------------------
+void diagnose(Module &M, StringRef File, const Twine &Msg,
+              DiagnosticSeverity Severity) {
+  M.getContext().diagnose(DiagnosticInfoPGOProfile(
+      File.empty() ? nullptr : File.data(), Msg, Severity));
+}
@@ -0,0 +1,366 @@
+//========================================================================
+// FILE:
+//    LoopProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to record how many iterations every loop runs each
+//    time it's entered. The average is not enough to decide whether a loop is
+//    worth vectorising or unrolling (a loop that runs 3 iterations 99 times
+//    and 10000 iterations once has a decent average), so for every loop this
+//    pass records a histogram with log2 buckets (see LoopProfiler.h).
+//
+//    The loops are the loops from LoopInfo, numbered in preorder (i.e. the
+//    outer loops before the inner ones). Every loop gets a local trip
+//    counter:
+//      * the preheader sets it to 0 (a preheader is inserted if required),
+//      * the header increments it, i.e. the trip count is the number of times
+//        that the header runs per entry into the loop,
+//      * every exit edge adds it to the total number of iterations and
+//        increments the bucket for it, i.e.
+//        `++Counters[Loop][1 + min(log2(Trips), 31)]`.
+//    The exits are instrumented at the beginning of the exit block (if the
+//    exiting block is its only predecessor), at the end of the exiting block
+//    (if the exit block is its only successor) or in a new block that splits
+//    the edge. Loops that are left by returning from the function (or by
+//    unwinding) are not recorded.
+//
+//    The trip counters are allocas, so that `mem2reg` turns them into
+//    registers. The histograms are stored in one array, `LoopProfCounters`.
+//    When the program exits, the histograms are appended to the profile file
+//    (`-loop-prof-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_LOOPPROF_FILE environment variable). There's one line per
+//    loop:
+//      <function> <CFG hash> <loop> <#iterations> <#buckets> <bucket 0> ...
+//    Use the `loopprof` tool to read it and ProfileUse (`-prof-use-loops`) to
+//    attach the trip counts to the loops.
+//
+//    Functions with exception handling or indirect branches are skipped.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libLoopProfiler.so `\`
+//        -passes="loop-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/loopprof <input-llvm-file> default.loopprof
+//
+// License: MIT
+//========================================================================
+#include "LoopProfiler.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "loop-prof"
+
+// The counters of every loop: the total # of iterations and the histogram
+static constexpr unsigned CountersPerLoop = 1 + LOOP_PROF_NUM_BUCKETS;
+
+STATISTIC(NumInstrumentedLoops, "The # of instrumented loops");
+STATISTIC(NumSkippedFunctions, "The # of functions with loops that were not "
+                               "instrumented (unsupported CFG)");
+STATISTIC(NumSplitEdges, "The # of exit edges split to record a trip count");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string>
+    OutputFile("loop-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " LOOP_PROFILER_FILE_ENV_VAR ")"),
+               cl::init("default.loopprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Returns the point where the trip count for the exit edge {From, To} should
+// be recorded (splits the edge if required)
+static Instruction *getExitInsertionPoint(BasicBlock *From, BasicBlock *To,
+                                          DominatorTree &DT, LoopInfo &LI) {
+  if (To->getUniquePredecessor() == From)
+    return &*To->getFirstInsertionPt();
+  if (From->getUniqueSuccessor() == To)
+    return From->getTerminator();
+
+  // A critical edge. All the edges from From to To are redirected to the new
+  // block.
+  Instruction *Term = From->getTerminator();
+  unsigned SuccNum = 0;
+  while (Term->getSuccessor(SuccNum) != To)
+    SuccNum++;
+  BasicBlock *NewBB = SplitCriticalEdge(
+      Term, SuccNum,
+      CriticalEdgeSplittingOptions(&DT, &LI).setMergeIdenticalEdges());
+  assert(NewBB && "Failed to split a critical edge");
+  NumSplitEdges++;
+  return NewBB->getTerminator();
+}
+
+// Inserts the update of the histogram of the loop with the counters starting
+// at FirstCounter (the trip count is in TripCounter) before InsertPt
+static void recordTripCount(Instruction *InsertPt, AllocaInst *TripCounter,
+                            GlobalVariable *Counters, unsigned FirstCounter) {
+  IRBuilder<> Builder(InsertPt);
+  Type *Int64Ty = Builder.getInt64Ty();
+  Value *Trips = Builder.CreateLoad(Int64Ty, TripCounter, "loop.trips");
+
+  // The total # of iterations
+  Value *TotalPtr = Builder.CreateConstInBoundsGEP2_64(
+      Counters->getValueType(), Counters, 0, FirstCounter);
+  Value *Total = Builder.CreateLoad(Int64Ty, TotalPtr);
+  Builder.CreateStore(Builder.CreateAdd(Total, Trips), TotalPtr);
+
+  // The bucket: min(log2(Trips), 31). Trips is never 0 (the header runs
+  // before any exit), the `or` only keeps ctlz well-defined.
+  Value *LeadingZeros = Builder.CreateBinaryIntrinsic(
+      Intrinsic::ctlz, Builder.CreateOr(Trips, 1), Builder.getFalse());
+  Value *Log2 = Builder.CreateSub(Builder.getInt64(63), LeadingZeros);
+  Value *Bucket = Builder.CreateBinaryIntrinsic(
+      Intrinsic::umin, Log2, Builder.getInt64(LOOP_PROF_NUM_BUCKETS - 1),
+      /*FMFSource=*/nullptr, "loop.bucket");
+  Value *Idx = Builder.CreateAdd(Bucket, Builder.getInt64(FirstCounter + 1));
+  Value *BucketPtr = Builder.CreateInBoundsGEP(
+      Counters->getValueType(), Counters, {Builder.getInt64(0), Idx});
+  Value *Count = Builder.CreateLoad(Int64Ty, BucketPtr);
+  Builder.CreateStore(Builder.CreateAdd(Count, Builder.getInt64(1)),
+                      BucketPtr);
+}
+
+namespace {
+// The counters of one instrumented loop
+struct LoopRecord {
+  Function *F;
+  uint64_t Hash;
+  unsigned LoopIdx;
+  unsigned FirstCounter;
+};
+} // namespace
+
+//-----------------------------------------------------------------------------
+// LoopProfiler implementation
+//-----------------------------------------------------------------------------
+bool LoopProfiler::runOnModule(Module &M, ModuleAnalysisManager &MAM) {
+  auto &CTX = M.getContext();
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // STEP 1: Number the loops
+  // ------------------------
+  // The array of counters has to exist before the loops are instrumented, so
+  // the loops are counted first
+  std::vector<LoopRecord> Records;
+  std::vector<Function *> Functions;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+    if (LI.empty())
+      continue;
+    if (!CFGSpanningTree::isSupported(F)) {
+      LLVM_DEBUG(dbgs() << "Skipping: " << F.getName() << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    uint64_t Hash = CFGSpanningTree::getStructuralHash(F);
+    unsigned NumLoops = LI.getLoopsInPreorder().size();
+    for (unsigned Idx = 0; Idx != NumLoops; ++Idx)
+      Records.push_back({&F, Hash, Idx, unsigned(Records.size()) *
+                                            CountersPerLoop});
+    Functions.push_back(&F);
+  }
+
+  if (Records.empty())
+    return false;
+
+  ArrayType *CountersTy = ArrayType::get(Type::getInt64Ty(CTX),
+                                         Records.size() * CountersPerLoop);
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "LoopProfCounters");
+  Counters->setAlignment(Align(8));
+
+  // STEP 2: Instrument the loops
+  // ----------------------------
+  unsigned FirstRecord = 0;
+  for (Function *F : Functions) {
+    auto &LI = FAM.getResult<LoopAnalysis>(*F);
+    auto &DT = FAM.getResult<DominatorTreeAnalysis>(*F);
+    SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+
+    // The trip counters, set to 0 on entry and incremented in the header
+    IRBuilder<> AllocaBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+    SmallVector<AllocaInst *, 8> TripCounters;
+    for (Loop *L : Loops) {
+      AllocaInst *TripCounter = AllocaBuilder.CreateAlloca(
+          AllocaBuilder.getInt64Ty(), nullptr, "loop.trips.addr");
+      TripCounters.push_back(TripCounter);
+
+      BasicBlock *Preheader = L->getLoopPreheader();
+      if (!Preheader)
+        Preheader = InsertPreheaderForLoop(L, &DT, &LI, /*MSSAU=*/nullptr,
+                                           /*PreserveLCSSA=*/false);
+      IRBuilder<> Builder(Preheader->getTerminator());
+      Builder.CreateStore(Builder.getInt64(0), TripCounter);
+
+      Builder.SetInsertPoint(&*L->getHeader()->getFirstInsertionPt());
+      Value *Trips = Builder.CreateLoad(Builder.getInt64Ty(), TripCounter);
+      Builder.CreateStore(Builder.CreateAdd(Trips, Builder.getInt64(1)),
+                          TripCounter);
+    }
+
+    // Collect the exit edges (after the preheaders were inserted, as these
+    // may split exit edges, and before any exit edge is split). An edge can
+    // leave more than one loop.
+    MapVector<std::pair<BasicBlock *, BasicBlock *>, SmallVector<unsigned, 2>>
+        ExitEdges;
+    for (unsigned Idx = 0, E = Loops.size(); Idx != E; ++Idx) {
+      SmallVector<Loop::Edge, 4> Edges;
+      Loops[Idx]->getExitEdges(Edges);
+      for (const Loop::Edge &Edge : Edges) {
+        auto &LoopIdxs = ExitEdges[{Edge.first, Edge.second}];
+        if (!is_contained(LoopIdxs, Idx))
+          LoopIdxs.push_back(Idx);
+      }
+    }
+
+    for (auto &[Edge, LoopIdxs] : ExitEdges) {
+      Instruction *InsertPt =
+          getExitInsertionPoint(Edge.first, Edge.second, DT, LI);
+      for (unsigned Idx : LoopIdxs)
+        recordTripCount(InsertPt, TripCounters[Idx], Counters,
+                        Records[FirstRecord + Idx].FirstCounter);
+    }
+
+    LLVM_DEBUG(dbgs() << "Instrumented: " << F->getName() << " ("
+                      << Loops.size() << " loops)\n");
+    NumInstrumentedLoops += Loops.size();
+    FirstRecord += Loops.size();
+    FAM.invalidate(*F, PreservedAnalyses::none());
+  }
+
+  // STEP 3: Inject the table of instrumented loops
+  // ----------------------------------------------
+  // One {function name, CFG hash, loop, counters} record per loop
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  StructType *RecordTy =
+      StructType::get(CTX, {PtrTy, Int64Ty, Int32Ty, PtrTy});
+
+  std::vector<Constant *> Entries;
+  DenseMap<Function *, Constant *> Names;
+  for (const LoopRecord &R : Records) {
+    Constant *&Name = Names[R.F];
+    if (!Name)
+      Name = createGlobalString(M, R.F->getName(), "loopprof.name");
+    Constant *FirstCounter = ConstantExpr::getInBoundsGetElementPtr(
+        CountersTy, Counters,
+        ArrayRef<Constant *>{ConstantInt::get(Int64Ty, 0),
+                             ConstantInt::get(Int64Ty, R.FirstCounter)});
+    Entries.push_back(ConstantStruct::get(
+        RecordTy, {Name, ConstantInt::get(Int64Ty, R.Hash),
+                   ConstantInt::get(Int32Ty, R.LoopIdx), FirstCounter}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "LoopProfTable");
+
+  // STEP 4: Define the function that writes the profile
+  // ---------------------------------------------------
+  // See createTextProfileDump. Every record is printed as follows:
+  // ```
+  //    fprintf(File, "%s %llu %u %llu 32", Table[i].Name, Table[i].Hash,
+  //            Table[i].Loop, Table[i].Counters[0]);
+  //    for (uint64_t j = 1; j != 33; j++)
+  //      fprintf(File, " %llu", Table[i].Counters[j]);
+  //    fprintf(File, "\n");
+  // ```
+  Constant *RecordFmt = createGlobalString(
+      M, "%s %llu %u %llu " + std::to_string(LOOP_PROF_NUM_BUCKETS),
+      "loopprof.record_fmt");
+  Constant *CounterFmt = createGlobalString(M, " %llu", "loopprof.counter_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "loopprof.newline");
+
+  createTextProfileDump(
+      M, "loopprof", LOOP_PROFILER_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumRecords = Builder.getInt64(Records.size());
+        emitLoop(Builder, NumRecords, "record", [&](Value *RecordIdx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), RecordIdx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Name = LoadField(0, PtrTy, "name");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *LoopIdx = LoadField(2, Int32Ty, "loop");
+          Value *CountersPtr = LoadField(3, PtrTy, "counters");
+          Value *Iterations =
+              Builder.CreateLoad(Int64Ty, CountersPtr, "iterations");
+          Builder.CreateCall(
+              Fprintf, {File, RecordFmt, Name, Hash, LoopIdx, Iterations});
+
+          // The histogram follows the # of iterations
+          Value *Histogram = Builder.CreateConstInBoundsGEP1_64(
+              Int64Ty, CountersPtr, 1, "histogram");
+          Value *NumBuckets = Builder.getInt64(LOOP_PROF_NUM_BUCKETS);
+          emitLoop(Builder, NumBuckets, "bucket", [&](Value *BucketIdx) {
+            Value *Count = Builder.CreateLoad(
+                Int64Ty,
+                Builder.CreateInBoundsGEP(Int64Ty, Histogram, BucketIdx),
+                "count");
+            Builder.CreateCall(Fprintf, {File, CounterFmt, Count});
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses LoopProfiler::run(llvm::Module &M,
+                                    llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getLoopProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "loop-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "loop-prof") {
+                    MPM.addPass(LoopProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getLoopProfilerPluginInfo();
+}
@@ -0,0 +1,82 @@
+//==============================================================================
+// FILE:
+//    MBA.cpp
+//
+// DESCRIPTION:
+//    Applies all Mixed Boolean Arithmetic rewrite rules (see MBAUtils.h) in a
+//    single traversal of every basic block. The result is identical to
+//    running MBAAdd and MBASub one after another, but every instruction is
+//    visited only once: PeepholeRewriter dispatches it through a jump table
+//    indexed by opcode straight to the rules that may apply. Adding another
+//    rule to MBARules does not add another traversal.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBA.so `\`
+//        -passes=-"mba" <bitcode-file>
+//
+// License: MIT
+//==============================================================================
+#include "MBA.h"
+#include "MBAUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "mba"
+
+STATISTIC(SubstCount, "The # of substituted instructions");
+STATISTIC(SkippedLoopCount, "The # of instructions skipped to keep the "
+                            "enclosing loop vectorizable");
+
+//-----------------------------------------------------------------------------
+// MBA Implementation
+//-----------------------------------------------------------------------------
+PreservedAnalyses MBA::run(llvm::Function &F,
+                           llvm::FunctionAnalysisManager &FAM) {
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+
+  unsigned NumSubsts = 0;
+  for (auto &BB : F) {
+    NumSubsts += rewriteBasicBlock(
+        BB, MBARules, MBADispatchTable, AllMBARules,
+        [&](const RewriteRule &, Instruction &Inst) {
+          // Keep the loop vectorizable
+          if (isVectorizationCritical(Inst, LI, SE)) {
+            ++SkippedLoopCount;
+            return false;
+          }
+          return true;
+        });
+  }
+
+  SubstCount += NumSubsts;
+  return (NumSubsts != 0 ? llvm::PreservedAnalyses::none()
+                         : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getMBAPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "mba", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "mba") {
+                    FPM.addPass(MBA());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getMBAPluginInfo();
+}
@@ -3,123 +3,212 @@
 //    MBAAdd.cpp
 //
 // DESCRIPTION:
-//    This pass performs a substitution for 8-bit integer add
-//    instruction based on this Mixed Boolean-Airthmetic expression:
+//    This pass performs a substitution for integer add instructions based on
+//    this Mixed Boolean-Airthmetic expression (valid for 8-bit integers):
 //      a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * 151 + 111
-//    See formula (3) in [1].
+//    See formula (3) in [1]. 151 is the multiplicative inverse of 39 modulo
+//    2^8 and 111 == -23 * 151 (mod 2^8). For N-bit integers the same identity
+//    holds with the inverse of 39 and -23 * inverse(39) computed modulo 2^N,
+//    so any integer width is supported. Vector adds (fixed and scalable) are
+//    substituted element-wise using splatted constants.
+//
+//    Adds that the loop vectorizer has to recognise (induction variable
+//    updates, reductions and affine index computations) are left intact, so
+//    loops containing obfuscated adds can still be vectorized.
 //
 // USAGE:
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBAAdd.so `\`
 //        -passes=-"mba-add" <bitcode-file>
-//      The command line option is not available for the new PM
 //
-//  
+//    Cold-path-only mode (the options have to follow -load-pass-plugin):
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBAAdd.so `\`
+//        -passes=-"mba-add" -mba-add-cold-only `\`
+//        [-mba-add-cold-threshold=<freq>] [-mba-add-max-loop-depth=<depth>] `\`
+//        [-mba-add-cycle-budget=<cycles>] <bitcode-file>
+//    Every substitution turns one add into eight instructions, which is
+//    expensive on a hot path. In this mode only adds in blocks whose
+//    frequency (relative to the entry block, as estimated by
+//    BlockFrequencyInfo) is below the threshold and that are not nested in
+//    loops (LoopInfo) are substituted, coldest blocks first. The extra
+//    latency of every substitution (TargetTransformInfo) is weighted by the
+//    block frequency and the total per function is capped by the budget. The
+//    estimated dynamic overhead is printed to stderr for every function.
+//
 // [1] "Defeating MBA-based Obfuscation" Ninon Eyrolles, Louis Goubin, Marion
 //     Videau
 //
 // License: MIT
 //==============================================================================
 #include "MBAAdd.h"
+#include "MBAUtils.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Statistic.h"
-#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
-
-#include <random>
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "mba-add"
 
 STATISTIC(SubstCount, "The # of substituted instructions");
+STATISTIC(SkippedHotCount, "The # of adds skipped because they are hot");
+STATISTIC(SkippedLoopCount,
+          "The # of adds skipped to keep the enclosing loop vectorizable");
+STATISTIC(SkippedBudgetCount,
+          "The # of adds skipped because the cycle budget was exhausted");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<bool>
+    ColdOnly("mba-add-cold-only", cl::init(false),
+             cl::desc("Only substitute adds in cold basic blocks (requires "
+                      "BlockFrequencyInfo and LoopInfo)"));
+
+static cl::opt<double> ColdThreshold(
+    "mba-add-cold-threshold", cl::init(0.1),
+    cl::desc("A basic block is cold if its frequency relative to the entry "
+             "block does not exceed this value (default 0.1)"));
+
+static cl::opt<unsigned> MaxLoopDepth(
+    "mba-add-max-loop-depth", cl::init(0),
+    cl::desc("Never substitute adds in blocks nested deeper than this "
+             "(default 0, i.e. blocks inside loops are left alone)"));
+
+static cl::opt<double> CycleBudget(
+    "mba-add-cycle-budget", cl::init(50.0),
+    cl::desc("Maximum estimated number of extra cycles per function "
+             "invocation that the cold-only mode may introduce (default 50)"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Estimates the number of extra cycles (latency) that a single substitution
+// adds: the MBA expression (1 xor, 1 and, 3 mul, 3 add) replaces one add.
+static double getSubstitutionCost(const TargetTransformInfo &TTI, Type *Ty) {
+  auto CostOf = [&](unsigned Opcode) -> double {
+    InstructionCost Cost = TTI.getArithmeticInstrCost(
+        Opcode, Ty, TargetTransformInfo::TCK_Latency);
+    return Cost.isValid() ? *Cost.getValue() : 1.0;
+  };
+
+  return CostOf(Instruction::Xor) + CostOf(Instruction::And) +
+         3 * CostOf(Instruction::Mul) + 2 * CostOf(Instruction::Add);
+}
 
 //-----------------------------------------------------------------------------
 // MBAAdd Implementation
 //-----------------------------------------------------------------------------
-bool MBAAdd::runOnBasicBlock(BasicBlock &BB) {
-  bool Changed = false;
-  
-  // Loop over all instructions in the block. Replacing instructions requires
-  // iterators, hence a for-range loop wouldn't be suitable
-  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
-    // Skip non-binary (e.g. unary or compare) instructions
-    auto *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (!BinOp)
-      continue;
+bool MBAAdd::runOnBasicBlock(BasicBlock &BB, const LoopInfo &LI,
+                             ScalarEvolution &SE) {
+  // Replace `(a + b)` (original instructions) with `(((a ^ b) + 2 * (a & b))
+  // * 39 + 23) * 151 + 111` (the new instruction). The substitution itself is
+  // implemented by the mba-add rule from MBAUtils.cpp.
+  unsigned NumSubsts = rewriteBasicBlock(
+      BB, MBARules, MBADispatchTable, MBAAddRule,
+      [&](const RewriteRule &, Instruction &Inst) {
+        // Keep the loop vectorizable
+        if (isVectorizationCritical(Inst, LI, SE)) {
+          ++SkippedLoopCount;
+          return false;
+        }
+        return true;
+      });
+
+  // Update the statistics
+  SubstCount += NumSubsts;
+  return NumSubsts != 0;
+}
 
-    // Skip instructions other than add
-    if (BinOp->getOpcode() != Instruction::Add)
+bool MBAAdd::runOnColdBlocks(Function &F, FunctionAnalysisManager &FAM) {
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &TTI = FAM.getResult<TargetIRAnalysis>(F);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+
+  // STEP 1: Split the blocks that contain eligible adds into hot and cold
+  // ---------------------------------------------------------------------
+  double EntryFreq = BFI.getEntryFreq().getFrequency();
+  SmallVector<std::pair<double, BasicBlock *>, 16> ColdBlocks;
+  unsigned NumHotAdds = 0;
+  for (auto &BB : F) {
+    unsigned NumAdds = count_if(BB, matchMBAAdd);
+    if (0 == NumAdds)
       continue;
 
-    // Skip if the result is not 8-bit wide (this implies that the operands are
-    // also 8-bit wide)
-    if (!BinOp->getType()->isIntegerTy() ||
-        !(BinOp->getType()->getIntegerBitWidth() == 8))
+    double RelFreq = BFI.getBlockFreq(&BB).getFrequency() / EntryFreq;
+    if (RelFreq > ColdThreshold || LI.getLoopDepth(&BB) > MaxLoopDepth) {
+      NumHotAdds += NumAdds;
       continue;
+    }
+    ColdBlocks.emplace_back(RelFreq, &BB);
+  }
 
-    // A uniform API for creating instructions and inserting
-    // them into basic blocks
-    IRBuilder<> Builder(BinOp);
-
-    // Constants used in building the instruction for substitution
-    auto Val39 = ConstantInt::get(BinOp->getType(), 39);
-    auto Val151 = ConstantInt::get(BinOp->getType(), 151);
-    auto Val23 = ConstantInt::get(BinOp->getType(), 23);
-    auto Val2 = ConstantInt::get(BinOp->getType(), 2);
-    auto Val111 = ConstantInt::get(BinOp->getType(), 111);
-
-    // Build an instruction representing `(((a ^ b) + 2 * (a & b)) * 39 + 23) *
-    // 151 + 111`
-    Instruction *NewInst =
-        // E = e5 + 111
-        BinaryOperator::CreateAdd(
-            Val111,
-            // e5 = e4 * 151
-            Builder.CreateMul(
-                Val151,
-                // e4 = e2 + 23
-                Builder.CreateAdd(
-                    Val23,
-                    // e3 = e2 * 39
-                    Builder.CreateMul(
-                        Val39,
-                        // e2 = e0 + e1
-                        Builder.CreateAdd(
-                            // e0 = a ^ b
-                            Builder.CreateXor(BinOp->getOperand(0),
-                                              BinOp->getOperand(1)),
-                            // e1 = 2 * (a & b)
-                            Builder.CreateMul(
-                                Val2, Builder.CreateAnd(BinOp->getOperand(0),
-                                                        BinOp->getOperand(1))))
-                    ) // e3 = e2 * 39
-                ) // e4 = e2 + 23
-            ) // e5 = e4 * 151
-        ); // E = e5 + 111
-
-    // The following is visible only if you pass -debug on the command line
-    // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewInst << "\n");
-
-    // Replace `(a + b)` (original instructions) with `(((a ^ b) + 2 * (a & b))
-    // * 39 + 23) * 151 + 111` (the new instruction)
-    ReplaceInstWithInst(&BB, Inst, NewInst);
-    Changed = true;
-
-    // Update the statistics
-    ++SubstCount;
+  // STEP 2: Substitute, coldest blocks first, until the budget is spent
+  // -------------------------------------------------------------------
+  llvm::stable_sort(ColdBlocks, less_first());
+
+  double Overhead = 0.0;
+  unsigned NumSubsts = 0, NumOverBudget = 0;
+  for (auto &ColdBB : ColdBlocks) {
+    double RelFreq = ColdBB.first;
+    NumSubsts += rewriteBasicBlock(
+        *ColdBB.second, MBARules, MBADispatchTable, MBAAddRule,
+        [&](const RewriteRule &, Instruction &Inst) {
+          if (isVectorizationCritical(Inst, LI, SE)) {
+            ++SkippedLoopCount;
+            return false;
+          }
+
+          // The cost of one substitution, weighted by how often this block
+          // runs per invocation of F
+          double Cost = getSubstitutionCost(TTI, Inst.getType()) * RelFreq;
+          if (Overhead + Cost > CycleBudget) {
+            ++NumOverBudget;
+            return false;
+          }
+
+          Overhead += Cost;
+          return true;
+        });
   }
-  return Changed;
+  SubstCount += NumSubsts;
+
+  SkippedHotCount += NumHotAdds;
+  SkippedBudgetCount += NumOverBudget;
+
+  // STEP 3: Report the estimated dynamic overhead
+  // ---------------------------------------------
+  if (NumSubsts + NumHotAdds + NumOverBudget != 0)
+    errs() << format("mba-add: %-20s substituted %u, skipped hot %u, "
+                     "skipped over budget %u, est. overhead %.2f/%.2f "
+                     "cycles per call\n",
+                     F.getName().str().c_str(), NumSubsts, NumHotAdds,
+                     NumOverBudget, Overhead, (double)CycleBudget);
+
+  return NumSubsts != 0;
 }
 
 PreservedAnalyses MBAAdd::run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
+                              llvm::FunctionAnalysisManager &FAM) {
+  if (ColdOnly)
+    return (runOnColdBlocks(F, FAM) ? llvm::PreservedAnalyses::none()
+                                    : llvm::PreservedAnalyses::all());
+
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+
   bool Changed = false;
 
   for (auto &BB : F) {
-    Changed |= runOnBasicBlock(BB);
+    Changed |= runOnBasicBlock(BB, LI, SE);
   }
   return (Changed ? llvm::PreservedAnalyses::none()
                   : llvm::PreservedAnalyses::all());
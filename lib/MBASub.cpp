@@ -9,6 +9,12 @@
 //      a - b == (a + ~b) + 1
 //    See formula 2.2 (j) in [1].
 //
+//    The identity holds for any bit width, so all integer subs are
+//    substituted, including fixed and scalable integer vectors (the constant
+//    is splatted). Subs that the loop vectorizer has to recognise (induction
+//    variable updates, reductions and affine index computations) are left
+//    intact, so loops containing obfuscated subs can still be vectorized.
+//
 // USAGE:
 //      $ opt -load-pass-plugin <BUILD_DIR>/lib/libMBASub.so `\`
 //        -passes=-"mba-sub" <bitcode-file>
@@ -18,72 +24,53 @@
 // License: MIT
 //==============================================================================
 #include "MBASub.h"
+#include "MBAUtils.h"
 
 #include "llvm/ADT/Statistic.h"
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
-
-#include <random>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "mba-sub"
 
 STATISTIC(SubstCount, "The # of substituted instructions");
+STATISTIC(SkippedLoopCount,
+          "The # of subs skipped to keep the enclosing loop vectorizable");
 
 //-----------------------------------------------------------------------------
 // MBASub Implementaion
 //-----------------------------------------------------------------------------
-bool MBASub::runOnBasicBlock(BasicBlock &BB) {
-  bool Changed = false;
-
-  // Loop over all instructions in the block. Replacing instructions requires
-  // iterators, hence a for-range loop wouldn't be suitable.
-  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
-
-    // Skip non-binary (e.g. unary or compare) instruction.
-    auto *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (!BinOp)
-      continue;
-
-    /// Skip instructions other than integer sub.
-    unsigned Opcode = BinOp->getOpcode();
-    if (Opcode != Instruction::Sub || !BinOp->getType()->isIntegerTy())
-      continue;
-
-    // A uniform API for creating instructions and inserting
-    // them into basic blocks.
-    IRBuilder<> Builder(BinOp);
-
-    // Create an instruction representing (a + ~b) + 1
-    Instruction *NewValue = BinaryOperator::CreateAdd(
-        Builder.CreateAdd(BinOp->getOperand(0),
-                          Builder.CreateNot(BinOp->getOperand(1))),
-        ConstantInt::get(BinOp->getType(), 1));
-
-    // The following is visible only if you pass -debug on the command line
-    // *and* you have an assert build.
-    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewValue << "\n");
-
-    // Replace `(a - b)` (original instructions) with `(a + ~b) + 1`
-    // (the new instruction)
-    ReplaceInstWithInst(&BB, Inst, NewValue);
-    Changed = true;
-
-    // Update the statistics
-    ++SubstCount;
-  }
-  return Changed;
+bool MBASub::runOnBasicBlock(BasicBlock &BB, const LoopInfo &LI,
+                             ScalarEvolution &SE) {
+  // Replace `(a - b)` (original instructions) with `(a + ~b) + 1` (the new
+  // instruction). The substitution itself is implemented by the mba-sub rule
+  // from MBAUtils.cpp.
+  unsigned NumSubsts = rewriteBasicBlock(
+      BB, MBARules, MBADispatchTable, MBASubRule,
+      [&](const RewriteRule &, Instruction &Inst) {
+        // Keep the loop vectorizable
+        if (isVectorizationCritical(Inst, LI, SE)) {
+          ++SkippedLoopCount;
+          return false;
+        }
+        return true;
+      });
+
+  // Update the statistics
+  SubstCount += NumSubsts;
+  return NumSubsts != 0;
 }
 
 PreservedAnalyses MBASub::run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
+                              llvm::FunctionAnalysisManager &FAM) {
+  auto &LI = FAM.getResult<LoopAnalysis>(F);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+
   bool Changed = false;
 
   for (auto &BB : F) {
-    Changed |= runOnBasicBlock(BB);
+    Changed |= runOnBasicBlock(BB, LI, SE);
   }
   return (Changed ? llvm::PreservedAnalyses::none()
                   : llvm::PreservedAnalyses::all());
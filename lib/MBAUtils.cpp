@@ -0,0 +1,138 @@
+//==============================================================================
+// FILE:
+//    MBAUtils.cpp
+//
+// DESCRIPTION:
+//    The Mixed Boolean Arithmetic rewrite rules and helper functions shared by
+//    the MBA passes. This file is compiled into every MBA plugin.
+//
+// License: MIT
+//==============================================================================
+#include "MBAUtils.h"
+
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+APInt getMBAMultiplicativeInverse(const APInt &A) {
+  assert(A[0] && "Only odd values are invertible modulo 2^N");
+
+  // Newton's iteration: for odd A, A * A == 1 (mod 8), so A is its own
+  // inverse modulo 2^3. Every step, Inv = Inv * (2 - A * Inv), doubles the
+  // number of correct bits.
+  APInt Inv = A;
+  while (!(A * Inv).isOne())
+    Inv = Inv + Inv - A * Inv * Inv;
+
+  return Inv;
+}
+
+bool isVectorizationCritical(const Instruction &Inst, const LoopInfo &LI,
+                             ScalarEvolution &SE) {
+  const Loop *L = LI.getLoopFor(Inst.getParent());
+  if (!L)
+    return false;
+
+  // Induction variable updates and reductions feed back into a PHI node in the
+  // loop header
+  for (const User *U : Inst.users())
+    if (auto *Phi = dyn_cast<PHINode>(U))
+      if (Phi->getParent() == L->getHeader())
+        return true;
+
+  // Affine functions of induction variables (e.g. `%idx = add i64 %iv, 1`)
+  // are used to prove that memory accesses are consecutive
+  if (!SE.isSCEVable(Inst.getType()))
+    return false;
+
+  return isa<SCEVAddRecExpr>(SE.getSCEV(const_cast<Instruction *>(&Inst)));
+}
+
+//------------------------------------------------------------------------------
+// MBA rewrite rules
+//------------------------------------------------------------------------------
+bool matchMBAAdd(Instruction &Inst) {
+  // Skip non-binary (e.g. unary or compare) instructions
+  auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+  if (!BinOp)
+    return false;
+
+  // Skip instructions other than add
+  if (BinOp->getOpcode() != Instruction::Add)
+    return false;
+
+  // Skip non-integer (e.g. floating point) adds. Integer vectors are fine.
+  return BinOp->getType()->isIntOrIntVectorTy();
+}
+
+Instruction *buildMBAAdd(IRBuilder<> &Builder, Instruction &Inst) {
+  auto *BinOp = cast<BinaryOperator>(&Inst);
+
+  // Constants used in building the instruction for substitution. For vector
+  // types, ConstantInt::get creates splats.
+  Type *Ty = BinOp->getType();
+  unsigned BitWidth = Ty->getScalarSizeInBits();
+  APInt C39 = APInt(64, 39).zextOrTrunc(BitWidth);
+  APInt C23 = APInt(64, 23).zextOrTrunc(BitWidth);
+  APInt C151 = getMBAMultiplicativeInverse(C39);
+
+  auto Val39 = ConstantInt::get(Ty, C39);
+  auto Val151 = ConstantInt::get(Ty, C151);
+  auto Val23 = ConstantInt::get(Ty, C23);
+  auto Val2 = ConstantInt::get(Ty, APInt(64, 2).zextOrTrunc(BitWidth));
+  auto Val111 = ConstantInt::get(Ty, -(C23 * C151));
+
+  // Build an instruction representing `(((a ^ b) + 2 * (a & b)) * 39 + 23) *
+  // 151 + 111`
+  return
+      // E = e5 + 111
+      BinaryOperator::CreateAdd(
+          Val111,
+          // e5 = e4 * 151
+          Builder.CreateMul(
+              Val151,
+              // e4 = e2 + 23
+              Builder.CreateAdd(
+                  Val23,
+                  // e3 = e2 * 39
+                  Builder.CreateMul(
+                      Val39,
+                      // e2 = e0 + e1
+                      Builder.CreateAdd(
+                          // e0 = a ^ b
+                          Builder.CreateXor(BinOp->getOperand(0),
+                                            BinOp->getOperand(1)),
+                          // e1 = 2 * (a & b)
+                          Builder.CreateMul(
+                              Val2, Builder.CreateAnd(BinOp->getOperand(0),
+                                                      BinOp->getOperand(1))))
+                  ) // e3 = e2 * 39
+              ) // e4 = e2 + 23
+          ) // e5 = e4 * 151
+      ); // E = e5 + 111
+}
+
+bool matchMBASub(Instruction &Inst) {
+  // Skip non-binary (e.g. unary or compare) instruction.
+  auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+  if (!BinOp)
+    return false;
+
+  /// Skip instructions other than integer (or integer vector) sub.
+  return BinOp->getOpcode() == Instruction::Sub &&
+         BinOp->getType()->isIntOrIntVectorTy();
+}
+
+Instruction *buildMBASub(IRBuilder<> &Builder, Instruction &Inst) {
+  auto *BinOp = cast<BinaryOperator>(&Inst);
+
+  // Create an instruction representing (a + ~b) + 1 (for vector types,
+  // ConstantInt::get creates a splat)
+  return BinaryOperator::CreateAdd(
+      Builder.CreateAdd(BinOp->getOperand(0),
+                        Builder.CreateNot(BinOp->getOperand(1))),
+      ConstantInt::get(BinOp->getType(), 1));
+}
@@ -0,0 +1,527 @@
+//========================================================================
+// FILE:
+//    PathProfiler.cpp
+//
+// DESCRIPTION:
+//    Instruments a module to collect Ball-Larus path profiles, i.e. how many
+//    times every acyclic path through every function is executed. Unlike
+//    EdgeProfiler, this reveals the correlation between branches (e.g. that
+//    the `then` block of one `if` is always followed by the `else` block of
+//    the next one).
+//
+//    The acyclic paths in every function are numbered as described in
+//    BallLarus.h. The number of the path that is being executed is
+//    accumulated in a single register:
+//      * it is set to 0 on entry to the function,
+//      * it is incremented by Val(e) on every edge e with Val(e) != 0 (edges
+//        are split when required, see getInsertionPoint),
+//      * on every exit from the function, the counter for the path is
+//        incremented,
+//      * on every back edge v -> w, the counter for the path that ends at v
+//        is incremented and the register is reset to Val(ENTRY -> w), i.e.
+//        to the first path that starts at w.
+//    The register is an `alloca` that is promoted to SSA values once the
+//    function is instrumented.
+//
+//    For functions with at most `-path-prof-max-array-paths` paths, there's
+//    one 64-bit counter per path (in the `PathProfCounters` array). For
+//    functions with more paths, only a handful of them are typically
+//    executed. These functions get an open addressing hash table instead
+//    (with `-path-prof-hash-size` slots, i.e. {path ID + 1, count} pairs),
+//    updated with `pathprof_hash_inc`. Paths that don't fit into the table
+//    are counted as "lost".
+//
+//    When the program exits, the counters are appended to the profile file
+//    (`-path-prof-output`, which can be overridden at run-time with the
+//    LLVM_TUTOR_PATHPROF_FILE environment variable). There's one line per
+//    instrumented function:
+//      <function> <hash> <#paths> <#lost> <path ID>:<count> ...
+//    Only the paths that were executed are listed. The `pathprof` tool maps
+//    the path IDs back to the sequences of basic blocks.
+//
+//    Functions with exception handling or indirect branches (and functions
+//    with more than 2^62 paths) are skipped. Paths that end with a call to a
+//    function that doesn't return (e.g. `exit`) are not counted.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libPathProfiler.so `\`
+//        -passes="path-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD_DIR>/bin/pathprof <input-llvm-file> default.pathprof
+//
+// License: MIT
+//========================================================================
+#include "PathProfiler.h"
+#include "BallLarus.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "path-prof"
+
+STATISTIC(NumInstrumentedFunctions, "The # of instrumented functions");
+STATISTIC(NumHashedFunctions, "The # of functions that use a hash table");
+STATISTIC(NumSkippedFunctions, "The # of functions that were not "
+                               "instrumented (unsupported CFG)");
+STATISTIC(NumSplitEdges, "The # of edges split to update the path register");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<unsigned> MaxArrayPaths(
+    "path-prof-max-array-paths",
+    cl::desc("Functions with more paths than this use a hash table rather "
+             "than an array of counters"),
+    cl::init(4096));
+
+static cl::opt<unsigned>
+    HashTableSize("path-prof-hash-size",
+                  cl::desc("The number of slots in every hash table (rounded "
+                           "up to a power of 2)"),
+                  cl::init(1024));
+
+static cl::opt<std::string>
+    OutputFile("path-prof-output",
+               cl::desc("The file to append the profile to (can be "
+                        "overridden with " PATH_PROFILER_FILE_ENV_VAR ")"),
+               cl::init("default.pathprof"));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Returns the point where the code for the edge Src -> Dst should be
+// inserted (splits the edge if required)
+static Instruction *getInsertionPoint(BasicBlock *Src, BasicBlock *Dst) {
+  // The only successor
+  Instruction *Term = Src->getTerminator();
+  if (Src->getUniqueSuccessor())
+    return Term;
+
+  // The only predecessor
+  if (Dst->getUniquePredecessor())
+    return &*Dst->getFirstInsertionPt();
+
+  // A critical edge. Note that all the edges from Src to Dst are numbered as
+  // one, so all of them are redirected to the new block.
+  unsigned SuccNum = 0;
+  while (Term->getSuccessor(SuccNum) != Dst)
+    SuccNum++;
+  BasicBlock *NewBB = SplitCriticalEdge(
+      Term, SuccNum, CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+  assert(NewBB && "Failed to split a critical edge");
+  NumSplitEdges++;
+  return NewBB->getTerminator();
+}
+
+// Defines the function that counts a path in a hash table. It is equivalent
+// to the following C function:
+// ```
+//    static void pathprof_hash_inc(uint64_t *Table, uint64_t *Lost,
+//                                  uint64_t Id) {
+//      uint64_t Slot = ((Id * 0x9E3779B97F4A7C15) >> 32) & (Size - 1);
+//      for (uint64_t i = 0; i != Size; i++) {
+//        if (Table[2 * Slot] == 0)
+//          Table[2 * Slot] = Id + 1;
+//        if (Table[2 * Slot] == Id + 1) {
+//          Table[2 * Slot + 1]++;
+//          return;
+//        }
+//        Slot = (Slot + 1) & (Size - 1);
+//      }
+//      (*Lost)++;
+//    }
+// ```
+static Function *createHashIncFunction(Module &M, uint64_t Size) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  Function *HashIncF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {PtrTy, PtrTy, Int64Ty},
+                        /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, "pathprof_hash_inc", M);
+  Argument *Table = HashIncF->getArg(0);
+  Argument *Lost = HashIncF->getArg(1);
+  Argument *Id = HashIncF->getArg(2);
+  Table->setName("table");
+  Lost->setName("lost");
+  Id->setName("id");
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", HashIncF);
+  BasicBlock *ProbeBB = BasicBlock::Create(CTX, "probe", HashIncF);
+  BasicBlock *EmptyBB = BasicBlock::Create(CTX, "probe.empty", HashIncF);
+  BasicBlock *ClaimBB = BasicBlock::Create(CTX, "claim", HashIncF);
+  BasicBlock *HitBB = BasicBlock::Create(CTX, "hit", HashIncF);
+  BasicBlock *NextBB = BasicBlock::Create(CTX, "probe.next", HashIncF);
+  BasicBlock *OverflowBB = BasicBlock::Create(CTX, "overflow", HashIncF);
+  Constant *Mask = ConstantInt::get(Int64Ty, Size - 1);
+
+  // entry: hash the path ID (Fibonacci hashing)
+  IRBuilder<> Builder(EntryBB);
+  Value *Key = Builder.CreateAdd(Id, Builder.getInt64(1), "key");
+  Value *Hash = Builder.CreateMul(Id, Builder.getInt64(0x9E3779B97F4A7C15ULL));
+  Value *Start =
+      Builder.CreateAnd(Builder.CreateLShr(Hash, 32), Mask, "start");
+  Builder.CreateBr(ProbeBB);
+
+  // probe: is this the slot for the path?
+  Builder.SetInsertPoint(ProbeBB);
+  PHINode *Slot = Builder.CreatePHI(Int64Ty, 2, "slot");
+  Slot->addIncoming(Start, EntryBB);
+  PHINode *NumProbes = Builder.CreatePHI(Int64Ty, 2, "n");
+  NumProbes->addIncoming(Builder.getInt64(0), EntryBB);
+  Value *KeyPtr = Builder.CreateInBoundsGEP(
+      Int64Ty, Table, Builder.CreateShl(Slot, 1), "key.ptr");
+  Value *SlotKey = Builder.CreateLoad(Int64Ty, KeyPtr, "slot.key");
+  Builder.CreateCondBr(Builder.CreateICmpEQ(SlotKey, Key), HitBB, EmptyBB);
+
+  // probe.empty: is the slot free?
+  Builder.SetInsertPoint(EmptyBB);
+  Builder.CreateCondBr(Builder.CreateIsNull(SlotKey), ClaimBB, NextBB);
+
+  // claim: take the free slot
+  Builder.SetInsertPoint(ClaimBB);
+  Builder.CreateStore(Key, KeyPtr);
+  Builder.CreateBr(HitBB);
+
+  // hit: increment the counter
+  Builder.SetInsertPoint(HitBB);
+  incrementCounter(Builder, Builder.CreateConstInBoundsGEP1_64(
+                                Int64Ty, KeyPtr, 1, "count.ptr"));
+  Builder.CreateRetVoid();
+
+  // probe.next: try the next slot (linear probing)
+  Builder.SetInsertPoint(NextBB);
+  Value *NextSlot = Builder.CreateAnd(
+      Builder.CreateAdd(Slot, Builder.getInt64(1)), Mask, "slot.next");
+  Slot->addIncoming(NextSlot, NextBB);
+  Value *NextNumProbes =
+      Builder.CreateNUWAdd(NumProbes, Builder.getInt64(1), "n.next");
+  NumProbes->addIncoming(NextNumProbes, NextBB);
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(NextNumProbes, Builder.getInt64(Size)), OverflowBB,
+      ProbeBB);
+
+  // overflow: the table is full
+  Builder.SetInsertPoint(OverflowBB);
+  incrementCounter(Builder, Lost);
+  Builder.CreateRetVoid();
+
+  return HashIncF;
+}
+
+namespace {
+// The counters of one instrumented function
+struct FunctionRecord {
+  Function *F;
+  uint64_t Hash;
+  uint64_t NumPaths;
+  bool Hashed;
+  // The # of counters (array) or slots (hash table)
+  uint64_t NumEntries;
+  // The index of the first counter/slot in `PathProfCounters`
+  uint64_t FirstCounter;
+};
+} // namespace
+
+//-----------------------------------------------------------------------------
+// PathProfiler implementation
+//-----------------------------------------------------------------------------
+bool PathProfiler::runOnModule(Module &M) {
+  auto &CTX = M.getContext();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *Int64Ty = Type::getInt64Ty(CTX);
+  uint64_t HashSize = PowerOf2Ceil(std::max(HashTableSize.getValue(), 1U));
+
+  // STEP 1: Number the paths
+  // ------------------------
+  std::vector<FunctionRecord> Records;
+  std::vector<std::unique_ptr<BallLarusDAG>> DAGs;
+  uint64_t TotalCounters = 0;
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    // The same restrictions as for the edge counters apply (the critical
+    // edges are split)
+    if (!CFGSpanningTree::isSupported(F)) {
+      LLVM_DEBUG(dbgs() << "Skipping: " << F.getName() << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    auto DAG = std::make_unique<BallLarusDAG>(F);
+    if (!DAG->isValid()) {
+      LLVM_DEBUG(dbgs() << "Skipping (too many paths): " << F.getName()
+                        << "\n");
+      NumSkippedFunctions++;
+      continue;
+    }
+
+    bool Hashed = DAG->getNumPaths() > MaxArrayPaths;
+    uint64_t NumEntries = Hashed ? HashSize : DAG->getNumPaths();
+    Records.push_back({&F, DAG->getHash(), DAG->getNumPaths(), Hashed,
+                       NumEntries, TotalCounters});
+    DAGs.push_back(std::move(DAG));
+    // Every slot in a hash table is a {key, count} pair
+    TotalCounters += Hashed ? 2 * NumEntries : NumEntries;
+  }
+
+  if (Records.empty())
+    return false;
+
+  // STEP 2: Inject the global variables
+  // -----------------------------------
+  ArrayType *CountersTy = ArrayType::get(Int64Ty, TotalCounters);
+  auto *Counters = new GlobalVariable(
+      M, CountersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(CountersTy), "PathProfCounters");
+  Counters->setAlignment(Align(8));
+
+  // The # of paths that didn't fit into the hash table (one per function)
+  ArrayType *LostTy = ArrayType::get(Int64Ty, Records.size());
+  auto *Lost = new GlobalVariable(
+      M, LostTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Constant::getNullValue(LostTy), "PathProfLost");
+  Lost->setAlignment(Align(8));
+
+  auto GetElementPtr = [&](GlobalVariable *GV, uint64_t Idx) {
+    Constant *Indices[] = {ConstantInt::get(Int64Ty, 0),
+                           ConstantInt::get(Int64Ty, Idx)};
+    return ConstantExpr::getInBoundsGetElementPtr(GV->getValueType(), GV,
+                                                  Indices);
+  };
+
+  Function *HashIncF = nullptr;
+  for (const FunctionRecord &R : Records)
+    if (R.Hashed && !HashIncF)
+      HashIncF = createHashIncFunction(M, HashSize);
+
+  // STEP 3: Instrument the functions
+  // --------------------------------
+  for (unsigned Idx = 0, E = Records.size(); Idx != E; ++Idx) {
+    const FunctionRecord &R = Records[Idx];
+    const BallLarusDAG &DAG = *DAGs[Idx];
+    Constant *FuncCounters = GetElementPtr(Counters, R.FirstCounter);
+    Constant *FuncLost = GetElementPtr(Lost, Idx);
+
+    // The path register, initialised to Val(ENTRY -> entry block) = 0
+    BasicBlock &EntryBB = R.F->getEntryBlock();
+    IRBuilder<> Builder(&*EntryBB.getFirstInsertionPt());
+    AllocaInst *PathReg = Builder.CreateAlloca(Int64Ty, nullptr, "path.reg");
+    Builder.CreateStore(Builder.getInt64(0), PathReg);
+    // The updates of the path register (folded once it's promoted)
+    SmallVector<Value *, 16> Updates;
+
+    // Inserts `++Counters[PathReg + Val]` at the current insertion point
+    auto CountPath = [&](uint64_t Val) {
+      Value *PathId = Builder.CreateLoad(Int64Ty, PathReg, "path.id");
+      if (Val != 0) {
+        PathId = Builder.CreateAdd(PathId, Builder.getInt64(Val));
+        Updates.push_back(PathId);
+      }
+      if (R.Hashed) {
+        Builder.CreateCall(HashIncF, {FuncCounters, FuncLost, PathId});
+        return;
+      }
+      incrementCounter(Builder, Builder.CreateInBoundsGEP(
+                                    Int64Ty, FuncCounters, PathId));
+    };
+
+    for (const BLEdge &Edge : DAG.edges()) {
+      switch (Edge.Kind) {
+      case BLEdge::Normal:
+        if (Edge.Val == 0)
+          break;
+        Builder.SetInsertPoint(getInsertionPoint(Edge.Src, Edge.Dst));
+        Updates.push_back(
+            Builder.CreateAdd(Builder.CreateLoad(Int64Ty, PathReg),
+                              Builder.getInt64(Edge.Val), "path.reg.inc"));
+        Builder.CreateStore(Updates.back(), PathReg);
+        break;
+      case BLEdge::FunctionExit:
+        Builder.SetInsertPoint(Edge.Src->getTerminator());
+        CountPath(Edge.Val);
+        break;
+      default:
+        // The dummy edges are handled below (with the back edges)
+        break;
+      }
+    }
+
+    for (const BLBackEdge &BE : DAG.backEdges()) {
+      Builder.SetInsertPoint(getInsertionPoint(BE.Src, BE.Dst));
+      CountPath(BE.ExitVal);
+      Builder.CreateStore(Builder.getInt64(BE.EntryVal), PathReg);
+    }
+
+    // Turn the path register into SSA values
+    DominatorTree DT(*R.F);
+    PromoteMemToReg({PathReg}, DT);
+
+    // The register is often a constant (e.g. on the edges out of the entry
+    // block), fold these updates
+    for (Value *V : Updates) {
+      auto *I = cast<Instruction>(V);
+      if (Constant *C = ConstantFoldInstruction(I, M.getDataLayout())) {
+        I->replaceAllUsesWith(C);
+        I->eraseFromParent();
+      }
+    }
+
+    LLVM_DEBUG(dbgs() << "Instrumented: " << R.F->getName() << " ("
+                      << R.NumPaths << " paths)\n");
+    NumInstrumentedFunctions++;
+    if (R.Hashed)
+      NumHashedFunctions++;
+  }
+
+  // STEP 4: Inject the table of instrumented functions
+  // --------------------------------------------------
+  // One {name, hash, #paths, is hashed, #entries, first counter} record per
+  // function
+  StructType *RecordTy = StructType::get(
+      CTX, {PtrTy, Int64Ty, Int64Ty, Int32Ty, Int64Ty, PtrTy});
+
+  std::vector<Constant *> Entries;
+  for (const FunctionRecord &R : Records) {
+    Entries.push_back(ConstantStruct::get(
+        RecordTy, {createGlobalString(M, R.F->getName(), "pathprof.name"),
+                   ConstantInt::get(Int64Ty, R.Hash),
+                   ConstantInt::get(Int64Ty, R.NumPaths),
+                   ConstantInt::get(Int32Ty, R.Hashed),
+                   ConstantInt::get(Int64Ty, R.NumEntries),
+                   GetElementPtr(Counters, R.FirstCounter)}));
+  }
+
+  ArrayType *TableTy = ArrayType::get(RecordTy, Entries.size());
+  auto *Table = new GlobalVariable(M, TableTy, /*isConstant=*/true,
+                                   GlobalValue::PrivateLinkage,
+                                   ConstantArray::get(TableTy, Entries),
+                                   "PathProfTable");
+
+  // STEP 5: Define the function that writes the profile
+  // ---------------------------------------------------
+  // See createTextProfileDump. Every record is printed as follows:
+  // ```
+  //    fprintf(File, "%s %llu %llu %llu", Table[i].Name, Table[i].Hash,
+  //            Table[i].NumPaths, Lost[i]);
+  //    uint64_t Hashed = Table[i].Hashed;
+  //    for (uint64_t j = 0; j != Table[i].NumEntries; j++) {
+  //      uint64_t *Entry = &Table[i].Counters[j * (Hashed + 1)];
+  //      uint64_t Id = Hashed ? Entry[0] - 1 : j;
+  //      uint64_t Count = Entry[Hashed];
+  //      if (Count != 0)
+  //        fprintf(File, " %llu:%llu", Id, Count);
+  //    }
+  //    fprintf(File, "\n");
+  // ```
+  Constant *RecordFmt =
+      createGlobalString(M, "%s %llu %llu %llu", "pathprof.record_fmt");
+  Constant *PathFmt = createGlobalString(M, " %llu:%llu", "pathprof.path_fmt");
+  Constant *NewLine = createGlobalString(M, "\n", "pathprof.newline");
+
+  createTextProfileDump(
+      M, "pathprof", PATH_PROFILER_FILE_ENV_VAR, OutputFile,
+      [&](IRBuilder<> &Builder, FunctionCallee Fprintf, Value *File) {
+        Value *NumRecords = Builder.getInt64(Records.size());
+        emitLoop(Builder, NumRecords, "record", [&](Value *RecordIdx) {
+          auto LoadField = [&](unsigned Field, Type *Ty, const Twine &Name) {
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                TableTy, Table,
+                {Builder.getInt64(0), RecordIdx, Builder.getInt32(Field)});
+            return Builder.CreateLoad(Ty, Ptr, Name);
+          };
+          Value *Name = LoadField(0, PtrTy, "name");
+          Value *Hash = LoadField(1, Int64Ty, "hash");
+          Value *NumPaths = LoadField(2, Int64Ty, "num_paths");
+          Value *Hashed =
+              Builder.CreateZExt(LoadField(3, Int32Ty, "hashed"), Int64Ty);
+          Value *NumEntries = LoadField(4, Int64Ty, "num_entries");
+          Value *CountersPtr = LoadField(5, PtrTy, "counters");
+          Value *NumLost = Builder.CreateLoad(
+              Int64Ty,
+              Builder.CreateInBoundsGEP(LostTy, Lost,
+                                        {Builder.getInt64(0), RecordIdx}),
+              "lost");
+          Builder.CreateCall(Fprintf,
+                             {File, RecordFmt, Name, Hash, NumPaths, NumLost});
+          Value *Stride =
+              Builder.CreateAdd(Hashed, Builder.getInt64(1), "stride");
+
+          // There's always at least one counter
+          emitLoop(Builder, NumEntries, "paths", [&](Value *EntryIdx) {
+            Function *DumpF = Builder.GetInsertBlock()->getParent();
+            BasicBlock *PrintBB = BasicBlock::Create(CTX, "path.print", DumpF);
+            BasicBlock *LatchBB = BasicBlock::Create(CTX, "path.latch", DumpF);
+
+            Value *EntryPtr = Builder.CreateInBoundsGEP(
+                Int64Ty, CountersPtr, Builder.CreateMul(EntryIdx, Stride),
+                "entry.ptr");
+            Value *Key = Builder.CreateLoad(Int64Ty, EntryPtr, "key");
+            Value *PathId = Builder.CreateSelect(
+                Builder.CreateIsNotNull(Hashed),
+                Builder.CreateSub(Key, Builder.getInt64(1)), EntryIdx,
+                "path.id");
+            Value *Count = Builder.CreateLoad(
+                Int64Ty, Builder.CreateInBoundsGEP(Int64Ty, EntryPtr, Hashed),
+                "count");
+            Builder.CreateCondBr(Builder.CreateIsNotNull(Count), PrintBB,
+                                 LatchBB);
+
+            // path.print: print the ID and the count of an executed path
+            Builder.SetInsertPoint(PrintBB);
+            Builder.CreateCall(Fprintf, {File, PathFmt, PathId, Count});
+            Builder.CreateBr(LatchBB);
+
+            Builder.SetInsertPoint(LatchBB);
+          });
+          Builder.CreateCall(Fprintf, {File, NewLine});
+        });
+      });
+
+  return true;
+}
+
+PreservedAnalyses PathProfiler::run(llvm::Module &M,
+                                    llvm::ModuleAnalysisManager &) {
+  bool Changed = runOnModule(M);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getPathProfilerPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "path-prof", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "path-prof") {
+                    MPM.addPass(PathProfiler());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getPathProfilerPluginInfo();
+}
@@ -0,0 +1,54 @@
+//==============================================================================
+// FILE:
+//    PeepholeRewriter.cpp
+//
+// DESCRIPTION:
+//    The single-traversal peephole rewrite engine (see PeepholeRewriter.h).
+//    Every instruction costs one lookup in the dispatch table, regardless of
+//    how many rules there are. Only the rules registered for the
+//    corresponding opcode (and enabled by the caller) are then tried.
+//
+// License: MIT
+//==============================================================================
+#include "PeepholeRewriter.h"
+
+#include "llvm/ADT/bit.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "peephole-rewriter"
+
+unsigned rewriteBasicBlock(BasicBlock &BB, ArrayRef<RewriteRule> Rules,
+                           const DispatchTable &Table, RuleMask Enabled,
+                           RewriteFilter Filter) {
+  unsigned NumRewrites = 0;
+
+  // Loop over all instructions in the block. Replacing instructions requires
+  // iterators, hence a for-range loop wouldn't be suitable
+  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
+    // The candidate rules for this instruction, lowest index first
+    for (RuleMask Candidates = Table[Inst->getOpcode()] & Enabled; Candidates;
+         Candidates &= Candidates - 1) {
+      const RewriteRule &Rule = Rules[llvm::countr_zero(Candidates)];
+      if (!Rule.Match(*Inst) || !Filter(Rule, *Inst))
+        continue;
+
+      IRBuilder<> Builder(&*Inst);
+      Instruction *NewInst = Rule.Build(Builder, *Inst);
+
+      // The following is visible only if you pass -debug on the command line
+      // *and* you have an assert build.
+      LLVM_DEBUG(dbgs() << "[" << Rule.Name << "] " << *Inst << " -> "
+                        << *NewInst << "\n");
+
+      // Inst is updated to point to NewInst, which won't be visited again
+      ReplaceInstWithInst(&BB, Inst, NewInst);
+      ++NumRewrites;
+      break;
+    }
+  }
+
+  return NumRewrites;
+}
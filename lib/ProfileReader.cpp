@@ -0,0 +1,483 @@
+//==============================================================================
+// FILE:
+//    ProfileReader.cpp
+//
+// DESCRIPTION:
+//    The readers for the profiles written by EdgeProfiler, Coverage,
+//    IndirectCallProfiler, DynamicCallGraph, LoopProfiler, BranchProfiler,
+//    HeapProfiler and DynamicCallCounter, shared by the tools and the
+//    ProfileUse pass. See ProfileReader.h for an overview.
+//
+// License: MIT
+//==============================================================================
+#include "ProfileReader.h"
+#include "DynamicCallGraph.h"
+#include "LoopProfiler.h"
+#include "TutorHeapProf.h"
+#include "TutorProfile.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SwapByteOrder.h"
+
+#include <cstddef>
+#include <cstring>
+
+using namespace llvm;
+
+//------------------------------------------------------------------------------
+// EdgeProfiler
+//------------------------------------------------------------------------------
+std::string readEdgeProfile(StringRef Path, StringMap<EdgeProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 16> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, NumCounters = 0;
+    if (Fields.size() < 4 || Fields[2].getAsInteger(10, Hash) ||
+        Fields[3].getAsInteger(10, NumCounters) ||
+        Fields.size() != 4 + NumCounters)
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    EdgeProfile &P = Profiles[Fields[0]];
+    if (P.Counters.empty()) {
+      P.Mode = Fields[1].str();
+      P.Hash = Hash;
+      P.Counters.resize(NumCounters);
+    } else if (P.Mode != Fields[1] || P.Hash != Hash ||
+               P.Counters.size() != NumCounters) {
+      return ("line " + Twine(Line.line_number()) + ": the profiles for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+    }
+
+    for (uint64_t Idx = 0; Idx != NumCounters; ++Idx) {
+      uint64_t Count = 0;
+      if (Fields[4 + Idx].getAsInteger(10, Count))
+        return ("line " + Twine(Line.line_number()) + ": malformed record")
+            .str();
+      P.Counters[Idx] += Count;
+    }
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// Coverage
+//------------------------------------------------------------------------------
+std::string readCoverageMap(StringRef Path,
+                            StringMap<CoverageProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 5> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, NumSites = 0;
+    if (Fields.size() != 5 || Fields[2].getAsInteger(10, Hash) ||
+        Fields[3].getAsInteger(10, NumSites) || NumSites == 0 ||
+        Fields[4].size() != (NumSites + 7) / 8 * 2)
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    CoverageProfile &P = Profiles[Fields[0]];
+    if (P.Covered.empty()) {
+      P.Level = Fields[1].str();
+      P.Hash = Hash;
+      P.Covered.resize(NumSites);
+    } else if (P.Level != Fields[1] || P.Hash != Hash ||
+               P.Covered.size() != NumSites) {
+      return ("line " + Twine(Line.line_number()) + ": the coverage maps for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+    }
+
+    // Two hex digits per 8 sites, the lowest bit first
+    for (uint64_t Idx = 0; Idx < NumSites; Idx += 8) {
+      unsigned Byte = 0;
+      if (Fields[4].substr(Idx / 4, 2).getAsInteger(16, Byte))
+        return ("line " + Twine(Line.line_number()) + ": malformed record")
+            .str();
+      for (uint64_t Bit = 0; Bit != 8 && Idx + Bit != NumSites; ++Bit)
+        if (Byte & (1U << Bit))
+          P.Covered.set(Idx + Bit);
+    }
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// IndirectCallProfiler
+//------------------------------------------------------------------------------
+// The site indices above this are rejected, otherwise a corrupt record could
+// make the table of sites arbitrarily large
+static constexpr uint64_t MaxICallSite = 1 << 20;
+
+std::string readICallProfile(StringRef Path,
+                             StringMap<ICallProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 16> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, Site = 0, Total = 0;
+    if (Fields.size() < 4 || Fields.size() % 2 != 0 ||
+        Fields[1].getAsInteger(10, Hash) || Fields[2].getAsInteger(10, Site) ||
+        Fields[3].getAsInteger(10, Total) || Site > MaxICallSite)
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    ICallProfile &P = Profiles[Fields[0]];
+    if (P.Sites.empty())
+      P.Hash = Hash;
+    else if (P.Hash != Hash)
+      return ("line " + Twine(Line.line_number()) + ": the profiles for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+    if (Site >= P.Sites.size())
+      P.Sites.resize(Site + 1);
+
+    ICallSiteProfile &S = P.Sites[Site];
+    S.Total += Total;
+    for (size_t Idx = 4, E = Fields.size(); Idx != E; Idx += 2) {
+      uint64_t Count = 0;
+      if (Fields[Idx + 1].getAsInteger(10, Count))
+        return ("line " + Twine(Line.line_number()) + ": malformed record")
+            .str();
+      S.Targets[Fields[Idx]] += Count;
+    }
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// DynamicCallGraph
+//------------------------------------------------------------------------------
+std::string readCallGraphProfile(StringRef Path, CallGraphProfile &Graph,
+                                 uint64_t &Lost) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 3> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Count = 0;
+    if (Fields.size() != 3 || Fields[2].getAsInteger(10, Count))
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    if (Fields[0] == DYNAMIC_CG_LOST_NODE) {
+      Lost += Count;
+      continue;
+    }
+    Graph[{Fields[0].str(), Fields[1].str()}] += Count;
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// LoopProfiler
+//------------------------------------------------------------------------------
+std::string readLoopProfile(StringRef Path, StringMap<LoopProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 5 + LOOP_PROF_NUM_BUCKETS> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, LoopIdx = 0, Iterations = 0, NumBuckets = 0;
+    if (Fields.size() < 5 || Fields[1].getAsInteger(10, Hash) ||
+        Fields[2].getAsInteger(10, LoopIdx) ||
+        Fields[3].getAsInteger(10, Iterations) ||
+        Fields[4].getAsInteger(10, NumBuckets) ||
+        NumBuckets != LOOP_PROF_NUM_BUCKETS ||
+        Fields.size() != 5 + NumBuckets)
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    LoopProfile &P = Profiles[Fields[0]];
+    if (P.Loops.empty())
+      P.Hash = Hash;
+    else if (P.Hash != Hash)
+      return ("line " + Twine(Line.line_number()) + ": the profiles for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+    if (LoopIdx >= P.Loops.size())
+      P.Loops.resize(LoopIdx + 1);
+
+    LoopTripProfile &Loop = P.Loops[LoopIdx];
+    Loop.Iterations += Iterations;
+    Loop.Buckets.resize(NumBuckets);
+    for (uint64_t Idx = 0; Idx != NumBuckets; ++Idx) {
+      uint64_t Count = 0;
+      if (Fields[5 + Idx].getAsInteger(10, Count))
+        return ("line " + Twine(Line.line_number()) + ": malformed record")
+            .str();
+      Loop.Buckets[Idx] += Count;
+    }
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// BranchProfiler
+//------------------------------------------------------------------------------
+std::string readBranchProfile(StringRef Path,
+                              StringMap<BranchProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 16> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, NumCounters = 0;
+    if (Fields.size() < 4 || Fields[1].getAsInteger(10, Hash) ||
+        Fields[2].getAsInteger(10, NumCounters) ||
+        Fields.size() != 3 + NumCounters)
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    BranchProfile &P = Profiles[Fields[0]];
+    if (P.Counters.empty()) {
+      P.Hash = Hash;
+      P.Counters.resize(NumCounters);
+    } else if (P.Hash != Hash || P.Counters.size() != NumCounters) {
+      return ("line " + Twine(Line.line_number()) + ": the profiles for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+    }
+
+    for (uint64_t Idx = 0; Idx != NumCounters; ++Idx) {
+      uint64_t Count = 0;
+      if (Fields[3 + Idx].getAsInteger(10, Count))
+        return ("line " + Twine(Line.line_number()) + ": malformed record")
+            .str();
+      P.Counters[Idx] += Count;
+    }
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// HeapProfiler
+//------------------------------------------------------------------------------
+// Reads the histogram that starts at Fields[Pos] (the # of buckets, then the
+// buckets) into Buckets and moves Pos past it. Returns false if it's malformed.
+static bool readHeapHistogram(ArrayRef<StringRef> Fields, size_t &Pos,
+                              uint64_t ExpectedBuckets,
+                              std::vector<uint64_t> &Buckets) {
+  uint64_t NumBuckets = 0;
+  if (Pos >= Fields.size() || Fields[Pos].getAsInteger(10, NumBuckets) ||
+      NumBuckets != ExpectedBuckets || Fields.size() - Pos - 1 < NumBuckets)
+    return false;
+  ++Pos;
+  Buckets.resize(NumBuckets);
+  for (uint64_t Idx = 0; Idx != NumBuckets; ++Idx, ++Pos) {
+    uint64_t Count = 0;
+    if (Fields[Pos].getAsInteger(10, Count))
+      return false;
+    Buckets[Idx] += Count;
+  }
+  return true;
+}
+
+std::string readHeapProfile(StringRef Path, StringMap<HeapProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 10 + TUTOR_HEAP_NUM_SIZE_BUCKETS +
+                               TUTOR_HEAP_NUM_LIFETIME_BUCKETS>
+        Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, SiteIdx = 0, Allocs = 0, Frees = 0, Bytes = 0;
+    if (Fields.size() < 8 || Fields[1].getAsInteger(10, Hash) ||
+        Fields[2].getAsInteger(10, SiteIdx) || SiteIdx > UINT32_MAX ||
+        Fields[5].getAsInteger(10, Allocs) ||
+        Fields[6].getAsInteger(10, Frees) || Fields[7].getAsInteger(10, Bytes))
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+
+    HeapProfile &P = Profiles[Fields[0]];
+    if (P.Sites.empty())
+      P.Hash = Hash;
+    else if (P.Hash != Hash)
+      return ("line " + Twine(Line.line_number()) + ": the profiles for " +
+              Fields[0] + " come from different versions of the module")
+          .str();
+
+    HeapSiteProfile &Site = P.Sites[SiteIdx];
+    if (Site.Kind.empty()) {
+      Site.Kind = Fields[3].str();
+      Site.Location = Fields[4].str();
+    }
+    Site.Allocs += Allocs;
+    Site.Frees += Frees;
+    Site.Bytes += Bytes;
+
+    size_t Pos = 8;
+    if (!readHeapHistogram(Fields, Pos, TUTOR_HEAP_NUM_SIZE_BUCKETS,
+                           Site.Sizes) ||
+        !readHeapHistogram(Fields, Pos, TUTOR_HEAP_NUM_LIFETIME_BUCKETS,
+                           Site.Lifetimes) ||
+        Pos != Fields.size())
+      return ("line " + Twine(Line.line_number()) + ": malformed record").str();
+  }
+
+  return "";
+}
+
+//------------------------------------------------------------------------------
+// Binary profiles
+//------------------------------------------------------------------------------
+namespace {
+// Reads the integers from a profile in the byte order of the profile
+class ProfileDataReader {
+public:
+  ProfileDataReader(StringRef Data, bool NeedsSwap)
+      : Data(Data), NeedsSwap(NeedsSwap) {}
+
+  template <typename T> T read(uint64_t Offset) const {
+    T Value;
+    std::memcpy(&Value, Data.data() + Offset, sizeof(T));
+    return NeedsSwap ? sys::getSwappedBytes(Value) : Value;
+  }
+
+private:
+  StringRef Data;
+  bool NeedsSwap;
+};
+} // namespace
+
+std::string mergeTutorProfFunction(StringRef Name, TutorProfFunction &Dst,
+                                   const TutorProfFunction &Src) {
+  if (Dst.Counters.empty()) {
+    Dst = Src;
+    return "";
+  }
+  if (Dst.Hash != Src.Hash || Dst.Counters.size() != Src.Counters.size())
+    return ("the profiles for " + Name +
+            " come from different versions of the program")
+        .str();
+  for (size_t Idx = 0, E = Src.Counters.size(); Idx != E; ++Idx)
+    Dst.Counters[Idx] += Src.Counters[Idx];
+  return "";
+}
+
+std::string mergeTutorProfData(TutorProfData &Dst, TutorProfData &Src) {
+  // Nothing to merge (e.g. a thread that didn't get any files)
+  if (Src.Kind == 0)
+    return "";
+  if (Dst.Kind == 0)
+    Dst.Kind = Src.Kind;
+  if (Dst.Kind != Src.Kind)
+    return "the profiles are of different kinds";
+  for (auto &F : Src.Functions) {
+    std::string Err =
+        mergeTutorProfFunction(F.first(), Dst.Functions[F.first()], F.second);
+    if (!Err.empty())
+      return Err;
+  }
+  return "";
+}
+
+std::string readTutorProfile(StringRef Path, TutorProfData &P,
+                             bool &Incomplete) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!BufferOrErr)
+    return "can't read the file (" + BufferOrErr.getError().message() + ")";
+  StringRef Data = (*BufferOrErr)->getBuffer();
+
+  if (Data.size() < sizeof(TutorProfHeader))
+    return "not a profile (the file is too small)";
+  uint64_t Magic;
+  std::memcpy(&Magic, Data.data(), sizeof(Magic));
+  bool NeedsSwap = Magic == sys::getSwappedBytes(TUTOR_PROF_MAGIC);
+  if (Magic != TUTOR_PROF_MAGIC && !NeedsSwap)
+    return "not a profile (wrong magic number)";
+
+  ProfileDataReader R(Data, NeedsSwap);
+  if (R.read<uint32_t>(offsetof(TutorProfHeader, Version)) !=
+      TUTOR_PROF_VERSION)
+    return "unsupported version";
+
+  TutorProfData Src;
+  Src.Kind = R.read<uint32_t>(offsetof(TutorProfHeader, Kind));
+  uint32_t Flags = R.read<uint32_t>(offsetof(TutorProfHeader, Flags));
+  uint32_t NumRecords = R.read<uint32_t>(offsetof(TutorProfHeader, NumRecords));
+  uint32_t CounterSize =
+      R.read<uint32_t>(offsetof(TutorProfHeader, CounterSize));
+  uint32_t CounterStride =
+      R.read<uint32_t>(offsetof(TutorProfHeader, CounterStride));
+  uint64_t RecordsOffset =
+      R.read<uint64_t>(offsetof(TutorProfHeader, RecordsOffset));
+  uint64_t NamesOffset =
+      R.read<uint64_t>(offsetof(TutorProfHeader, NamesOffset));
+  uint64_t CountersOffset =
+      R.read<uint64_t>(offsetof(TutorProfHeader, CountersOffset));
+
+  if ((CounterSize != 4 && CounterSize != 8) || CounterStride < CounterSize ||
+      RecordsOffset + uint64_t(NumRecords) * sizeof(TutorProfRecord) >
+          Data.size() ||
+      NamesOffset > Data.size() || CountersOffset > Data.size())
+    return "malformed profile";
+
+  // The counters that are missing (i.e. the file was truncated) count as 0
+  Incomplete = !(Flags & TUTOR_PROF_FLAG_COMPLETE);
+  auto ReadCounter = [&](uint64_t Idx) -> uint64_t {
+    uint64_t Offset = CountersOffset + Idx * CounterStride;
+    if (Offset + CounterSize > Data.size()) {
+      Incomplete = true;
+      return 0;
+    }
+    return CounterSize == 8 ? R.read<uint64_t>(Offset)
+                            : R.read<uint32_t>(Offset);
+  };
+
+  for (uint32_t Idx = 0; Idx != NumRecords; ++Idx) {
+    uint64_t Record = RecordsOffset + Idx * sizeof(TutorProfRecord);
+    uint64_t NameOffset =
+        NamesOffset + R.read<uint64_t>(Record + offsetof(TutorProfRecord,
+                                                         NameOffset));
+    uint32_t NameSize =
+        R.read<uint32_t>(Record + offsetof(TutorProfRecord, NameSize));
+    if (NameOffset + NameSize > Data.size())
+      return "malformed profile";
+
+    TutorProfFunction F;
+    F.Hash = R.read<uint64_t>(Record + offsetof(TutorProfRecord, Hash));
+    uint32_t NumCounters =
+        R.read<uint32_t>(Record + offsetof(TutorProfRecord, NumCounters));
+    uint64_t FirstCounter =
+        R.read<uint64_t>(Record + offsetof(TutorProfRecord, FirstCounter));
+    for (uint32_t C = 0; C != NumCounters; ++C)
+      F.Counters.push_back(ReadCounter(FirstCounter + C));
+
+    StringRef Name = Data.substr(NameOffset, NameSize);
+    std::string Err = mergeTutorProfFunction(Name, Src.Functions[Name], F);
+    if (!Err.empty())
+      return Err;
+  }
+
+  return mergeTutorProfData(P, Src);
+}
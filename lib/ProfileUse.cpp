@@ -0,0 +1,449 @@
+//========================================================================
+// FILE:
+//    ProfileUse.cpp
+//
+// DESCRIPTION:
+//    Annotates a module with the profiles collected by the instrumentation
+//    passes, so that the optimisations in LLVM can use them (e.g. the inliner,
+//    basic block placement and hot/cold splitting):
+//      * `!prof !{!"function_entry_count", i64 N}` on every function,
+//      * `!prof !{!"branch_weights", i32 A, i32 B, ...}` on every conditional
+//        branch and `switch`,
+//      * the profile summary (`!llvm.module.flags`), which tells how hot
+//        "hot" is in this program,
+//      * `!{!"llvm.loop.estimated_trip_count", i32 N}` on every loop that
+//        ran (with `-prof-use-loops`).
+//    Four kinds of profiles are supported:
+//      * `-prof-use-edges=<file>`, the profile written by EdgeProfiler. The
+//        block and edge counts are reconstructed exactly like in the
+//        `edgeprof` tool. With `-edge-prof-mode=blocks`, the weights are only
+//        known for the branches to blocks with one predecessor.
+//      * `-prof-use-branches=<file>`, the profile written by BranchProfiler.
+//        The entry counts and the counts of every successor of every branch
+//        are recorded directly. Used for the functions that are not in the
+//        edge profile.
+//      * `-prof-use-calls=<file>`, the binary profile written by
+//        DynamicCallCounter (or merged with `tutor-profdata merge`). Only the
+//        entry counts are known. Used for the functions that are not in the
+//        edge or branch profiles.
+//      * `-prof-use-loops=<file>`, the profile written by LoopProfiler. The
+//        average trip count of every loop is attached to its `llvm.loop`
+//        metadata. LLVM estimates the trip counts from the branch weights of
+//        the latches (see getLoopEstimatedTripCount), so the latches without
+//        branch weights (e.g. without an edge profile) get weights that give
+//        the same trip count.
+//    The functions are matched by name and the profile of a function is only
+//    used if the CFG hash recorded by the instrumentation matches the module.
+//    Otherwise, the function has changed since it was instrumented (i.e. the
+//    profile is stale) - there's a warning and the profile is ignored. Note
+//    that the CFG hash of EdgeProfiler depends on the branch probabilities, so
+//    the module must be annotated before it's optimised (i.e. it must be the
+//    same module that was instrumented).
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libEdgeProfiler.so `\`
+//        -passes="edge-prof" <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libProfileUse.so `\`
+//        -passes="prof-use,default<O2>" -prof-use-edges=default.edgeprof `\`
+//        <input-llvm-file> -o optimised.bin
+//
+// License: MIT
+//========================================================================
+#include "ProfileUse.h"
+#include "BranchProfiler.h"
+#include "CFGSpanningTree.h"
+#include "InstrumentationUtils.h"
+#include "ProfileReader.h"
+#include "TutorProfile.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ProfileSummary.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "prof-use"
+
+STATISTIC(NumAnnotatedFunctions, "The # of functions with an entry count");
+STATISTIC(NumAnnotatedBranches, "The # of branches with branch weights");
+STATISTIC(NumAnnotatedLoops, "The # of loops with an estimated trip count");
+STATISTIC(NumStaleProfiles, "The # of functions with a stale profile");
+
+//-----------------------------------------------------------------------------
+// Command line options
+//-----------------------------------------------------------------------------
+static cl::opt<std::string>
+    EdgeProfileFile("prof-use-edges",
+                    cl::desc("The profile written by EdgeProfiler"),
+                    cl::init(""));
+
+static cl::opt<std::string>
+    BranchProfileFile("prof-use-branches",
+                      cl::desc("The profile written by BranchProfiler"),
+                      cl::init(""));
+
+static cl::opt<std::string> CallProfileFile(
+    "prof-use-calls",
+    cl::desc("The binary profile written by DynamicCallCounter (or merged "
+             "with tutor-profdata)"),
+    cl::init(""));
+
+static cl::opt<std::string>
+    LoopProfileFile("prof-use-loops",
+                    cl::desc("The profile written by LoopProfiler"),
+                    cl::init(""));
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+static void warnStale(Module &M, StringRef File, const Function &F) {
+  diagnose(M, File,
+           "the profile for " + F.getName() +
+               " does not match the module (CFG hash mismatch), ignoring it",
+           DS_Warning);
+  NumStaleProfiles++;
+}
+
+// Attaches Counts (one per successor of Term) as branch weights (scaled down
+// to 32 bits if required)
+static bool setBranchWeights(Instruction *Term, ArrayRef<uint64_t> Counts) {
+  // Nothing to go by
+  uint64_t MaxCount = *std::max_element(Counts.begin(), Counts.end());
+  if (MaxCount == 0)
+    return false;
+
+  uint64_t Scale = MaxCount / std::numeric_limits<uint32_t>::max() + 1;
+  SmallVector<uint32_t, 4> Weights;
+  for (uint64_t Count : Counts)
+    Weights.push_back(Count / Scale);
+
+  Term->setMetadata(LLVMContext::MD_prof,
+                    MDBuilder(Term->getContext()).createBranchWeights(Weights));
+  NumAnnotatedBranches++;
+  return true;
+}
+
+// Attaches the counts of the edges out of Term as branch weights. Multiple
+// edges to the same successor are counted once, i.e. the weight goes to the
+// first one.
+static bool setBranchWeights(Instruction *Term,
+                             function_ref<std::optional<uint64_t>(
+                                 BasicBlock *Src, BasicBlock *Dst)>
+                                 GetEdgeCount) {
+  SmallVector<uint64_t, 4> Counts;
+  SmallPtrSet<BasicBlock *, 4> Visited;
+  for (BasicBlock *Succ : successors(Term->getParent())) {
+    if (!Visited.insert(Succ).second) {
+      Counts.push_back(0);
+      continue;
+    }
+    std::optional<uint64_t> Count = GetEdgeCount(Term->getParent(), Succ);
+    if (!Count)
+      return false;
+    Counts.push_back(*Count);
+  }
+
+  return setBranchWeights(Term, Counts);
+}
+
+// Annotates F with the profile from EdgeProfiler. Returns the block counts
+// (entry block first) or nothing if the profile is stale.
+static std::optional<std::vector<uint64_t>>
+annotateFromEdgeProfile(Function &F, const EdgeProfile &P,
+                        FunctionAnalysisManager &FAM) {
+  CFGSpanningTree Tree(F, FAM.getResult<BlockFrequencyAnalysis>(F),
+                       FAM.getResult<BranchProbabilityAnalysis>(F));
+  bool HasEdges = P.Mode == "tree";
+  unsigned NumCounters =
+      HasEdges ? Tree.getNumCounters() : Tree.blocks().size();
+  if (P.Hash != Tree.getCFGHash() || P.Counters.size() != NumCounters)
+    return std::nullopt;
+
+  // STEP 1: Reconstruct the block (and edge) counts
+  // -----------------------------------------------
+  DenseMap<const BasicBlock *, uint64_t> BlockCounts;
+  DenseMap<std::pair<BasicBlock *, BasicBlock *>, uint64_t> EdgeCounts;
+  if (HasEdges) {
+    std::vector<uint64_t> Counts;
+    if (!Tree.computeEdgeCounts(P.Counters, Counts))
+      LLVM_DEBUG(dbgs() << "The flow is not conserved in " << F.getName()
+                        << ", the counts are approximate\n");
+    Tree.computeBlockCounts(Counts, BlockCounts);
+    for (unsigned Idx = 0, E = Counts.size(); Idx != E; ++Idx) {
+      const CFGEdge &Edge = Tree.edges()[Idx];
+      if (Edge.Src && Edge.Dst)
+        EdgeCounts[{Edge.Src, Edge.Dst}] = Counts[Idx];
+    }
+  } else {
+    for (unsigned Idx = 0, E = Tree.blocks().size(); Idx != E; ++Idx)
+      BlockCounts[Tree.blocks()[Idx]] = P.Counters[Idx];
+  }
+
+  // In the `blocks` mode, an edge count is only known if the edge is the
+  // only way into its destination
+  auto GetEdgeCount = [&](BasicBlock *Src,
+                          BasicBlock *Dst) -> std::optional<uint64_t> {
+    if (HasEdges)
+      return EdgeCounts.lookup({Src, Dst});
+    if (Dst->getUniquePredecessor() == Src)
+      return BlockCounts.lookup(Dst);
+    return std::nullopt;
+  };
+
+  // STEP 2: Attach the metadata
+  // ---------------------------
+  std::vector<uint64_t> Counts;
+  for (BasicBlock *BB : Tree.blocks()) {
+    Counts.push_back(BlockCounts.lookup(BB));
+
+    Instruction *Term = BB->getTerminator();
+    if (Term->getNumSuccessors() > 1 &&
+        (isa<BranchInst>(Term) || isa<SwitchInst>(Term)))
+      setBranchWeights(Term, GetEdgeCount);
+  }
+
+  F.setEntryCount(Function::ProfileCount(Counts.front(), Function::PCT_Real));
+  return Counts;
+}
+
+// Annotates F with the profile from BranchProfiler. Returns false if the
+// profile is stale.
+static bool annotateFromBranchProfile(Function &F, const BranchProfile &P) {
+  unsigned NumCounters = 1;
+  for (BasicBlock &BB : F)
+    if (isProfiledBranch(*BB.getTerminator()))
+      NumCounters += BB.getTerminator()->getNumSuccessors();
+  if (P.Hash != CFGSpanningTree::getStructuralHash(F) ||
+      P.Counters.size() != NumCounters)
+    return false;
+
+  ArrayRef<uint64_t> Counts(P.Counters);
+  F.setEntryCount(Function::ProfileCount(Counts.front(), Function::PCT_Real));
+  Counts = Counts.drop_front();
+  for (BasicBlock &BB : F) {
+    Instruction *Term = BB.getTerminator();
+    if (!isProfiledBranch(*Term))
+      continue;
+    setBranchWeights(Term, Counts.take_front(Term->getNumSuccessors()));
+    Counts = Counts.drop_front(Term->getNumSuccessors());
+  }
+  return true;
+}
+
+// Attaches the average trip counts from the profile written by LoopProfiler
+// to the loops of F. Returns false if the profile is stale.
+static bool annotateLoops(Function &F, const LoopProfile &P,
+                          FunctionAnalysisManager &FAM) {
+  SmallVector<Loop *, 8> Loops =
+      FAM.getResult<LoopAnalysis>(F).getLoopsInPreorder();
+  if (P.Hash != CFGSpanningTree::getStructuralHash(F) ||
+      P.Loops.size() > Loops.size())
+    return false;
+
+  for (unsigned Idx = 0, E = P.Loops.size(); Idx != E; ++Idx) {
+    uint64_t Entries = 0;
+    for (uint64_t Count : P.Loops[Idx].Buckets)
+      Entries += Count;
+    if (!Entries)
+      continue;
+
+    // Rounded to the nearest integer (the trip count of a loop that ran is
+    // at least 1)
+    uint64_t TripCount = (P.Loops[Idx].Iterations + Entries / 2) / Entries;
+    unsigned Clamped = std::clamp<uint64_t>(
+        TripCount, 1, std::numeric_limits<uint32_t>::max());
+    Loop *L = Loops[Idx];
+    addStringMetadataToLoop(L, "llvm.loop.estimated_trip_count", Clamped);
+
+    // Don't override the weights from the edge profile
+    BasicBlock *Latch = L->getLoopLatch();
+    if (Latch && !Latch->getTerminator()->getMetadata(LLVMContext::MD_prof))
+      setLoopEstimatedTripCount(
+          L, Clamped,
+          std::min<uint64_t>(Entries, std::numeric_limits<uint32_t>::max()));
+    NumAnnotatedLoops++;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// ProfileUse implementation
+//-----------------------------------------------------------------------------
+bool ProfileUse::runOnModule(Module &M, ModuleAnalysisManager &MAM) {
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // STEP 1: Read the profiles
+  // -------------------------
+  if (EdgeProfileFile.empty() && BranchProfileFile.empty() &&
+      CallProfileFile.empty() && LoopProfileFile.empty()) {
+    diagnose(M, "", "no profile to use (see -prof-use-edges, "
+                    "-prof-use-branches, -prof-use-calls and "
+                    "-prof-use-loops)", DS_Error);
+    return false;
+  }
+
+  StringMap<EdgeProfile> EdgeProfiles;
+  if (!EdgeProfileFile.empty()) {
+    std::string Err = readEdgeProfile(EdgeProfileFile, EdgeProfiles);
+    if (!Err.empty()) {
+      diagnose(M, EdgeProfileFile, Err, DS_Error);
+      return false;
+    }
+  }
+
+  StringMap<BranchProfile> BranchProfiles;
+  if (!BranchProfileFile.empty()) {
+    std::string Err = readBranchProfile(BranchProfileFile, BranchProfiles);
+    if (!Err.empty()) {
+      diagnose(M, BranchProfileFile, Err, DS_Error);
+      return false;
+    }
+  }
+
+  TutorProfData CallProfile;
+  if (!CallProfileFile.empty()) {
+    bool Incomplete = false;
+    std::string Err = readTutorProfile(CallProfileFile, CallProfile, Incomplete);
+    if (Err.empty() && CallProfile.Kind != TUTOR_PROF_KIND_CALL_COUNTS)
+      Err = "not a DynamicCallCounter profile";
+    if (!Err.empty()) {
+      diagnose(M, CallProfileFile, Err, DS_Error);
+      return false;
+    }
+    if (Incomplete)
+      diagnose(M, CallProfileFile,
+               "the profile is incomplete (did the process crash?)",
+               DS_Warning);
+  }
+
+  StringMap<LoopProfile> LoopProfiles;
+  if (!LoopProfileFile.empty()) {
+    std::string Err = readLoopProfile(LoopProfileFile, LoopProfiles);
+    if (!Err.empty()) {
+      diagnose(M, LoopProfileFile, Err, DS_Error);
+      return false;
+    }
+  }
+
+  // STEP 2: Annotate the functions
+  // ------------------------------
+  // All the counts go into the profile summary too (the first count of every
+  // record is the entry count)
+  InstrProfSummaryBuilder Summary(ProfileSummaryBuilder::DefaultCutoffs);
+  bool Changed = false;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    auto EdgeIt = EdgeProfiles.find(F.getName());
+    if (EdgeIt != EdgeProfiles.end() && CFGSpanningTree::isSupported(F)) {
+      auto Counts = annotateFromEdgeProfile(F, EdgeIt->second, FAM);
+      if (Counts) {
+        Summary.addRecord(InstrProfRecord(std::move(*Counts)));
+        NumAnnotatedFunctions++;
+        Changed = true;
+        continue;
+      }
+      // Fall back to the other profiles (if there are any)
+      warnStale(M, EdgeProfileFile, F);
+    }
+
+    auto BranchIt = BranchProfiles.find(F.getName());
+    if (BranchIt != BranchProfiles.end()) {
+      if (annotateFromBranchProfile(F, BranchIt->second)) {
+        Summary.addRecord(InstrProfRecord(BranchIt->second.Counters));
+        NumAnnotatedFunctions++;
+        Changed = true;
+        continue;
+      }
+      warnStale(M, BranchProfileFile, F);
+    }
+
+    // The runtime library records the local functions as `<source
+    // file>:<name>` (see TutorRuntime.h)
+    auto CallIt = CallProfile.Functions.find(F.getName());
+    if (CallIt == CallProfile.Functions.end() && F.hasLocalLinkage())
+      CallIt = CallProfile.Functions.find(
+          (M.getSourceFileName() + ":" + F.getName()).str());
+    if (CallIt != CallProfile.Functions.end()) {
+      const TutorProfFunction &P = CallIt->second;
+      if (P.Hash != CFGSpanningTree::getStructuralHash(F) ||
+          P.Counters.size() != 1) {
+        warnStale(M, CallProfileFile, F);
+        continue;
+      }
+      F.setEntryCount(
+          Function::ProfileCount(P.Counters[0], Function::PCT_Real));
+      Summary.addRecord(InstrProfRecord(P.Counters));
+      NumAnnotatedFunctions++;
+      Changed = true;
+    }
+  }
+
+  // STEP 3: Annotate the loops
+  // --------------------------
+  // After the branch weights from the edge profile, so that these are kept
+  for (Function &F : M) {
+    auto It = LoopProfiles.find(F.getName());
+    if (It == LoopProfiles.end() || F.isDeclaration())
+      continue;
+    if (!annotateLoops(F, It->second, FAM)) {
+      warnStale(M, LoopProfileFile, F);
+      continue;
+    }
+    Changed = true;
+  }
+
+  // STEP 4: Attach the profile summary
+  // ----------------------------------
+  // Without it, ProfileSummaryInfo (used e.g. by the inliner and by hot/cold
+  // splitting) ignores the profile
+  if (Changed)
+    M.setProfileSummary(Summary.getSummary()->getMD(M.getContext()),
+                        ProfileSummary::PSK_Instr);
+
+  return Changed;
+}
+
+PreservedAnalyses ProfileUse::run(llvm::Module &M,
+                                  llvm::ModuleAnalysisManager &MAM) {
+  bool Changed = runOnModule(M, MAM);
+
+  return (Changed ? llvm::PreservedAnalyses::none()
+                  : llvm::PreservedAnalyses::all());
+}
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getProfileUsePluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "prof-use", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "prof-use") {
+                    MPM.addPass(ProfileUse());
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getProfileUsePluginInfo();
+}
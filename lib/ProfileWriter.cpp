@@ -0,0 +1,395 @@
+//==============================================================================
+// FILE:
+//    ProfileWriter.cpp
+//
+// DESCRIPTION:
+//    Generates the code that writes the binary profiles (see TutorProfile.h).
+//    The file is created, resized and mapped into memory when the program
+//    starts and the header and the function names (precomputed at
+//    compile-time) are copied into it with `memcpy`. The pages that hold the
+//    counters are then replaced with the pages of the file (with
+//    mmap(MAP_FIXED)), so the counters are updated in place. When the program
+//    exits, the profile is marked as complete.
+//
+// License: MIT
+//==============================================================================
+#include "ProfileWriter.h"
+#include "TutorProfile.h"
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+// Appends V to Buf (Size bytes, in the byte order of the target)
+static void appendInt(std::string &Buf, uint64_t V, unsigned Size,
+                      bool IsLittleEndian) {
+  for (unsigned I = 0; I != Size; ++I) {
+    unsigned Byte = IsLittleEndian ? I : Size - 1 - I;
+    Buf.push_back(char((V >> (8 * Byte)) & 0xff));
+  }
+}
+
+// Turns the file name into a format string for `snprintf`, i.e. the first
+// `%p` becomes `%d` (for the process ID, the only argument) and any other `%`
+// is escaped.
+static std::string getPathFormat(StringRef Path) {
+  std::string Format;
+  bool HasPid = false;
+  for (size_t Idx = 0, E = Path.size(); Idx != E; ++Idx) {
+    if (!HasPid && Path[Idx] == '%' && Idx + 1 != E && Path[Idx + 1] == 'p') {
+      Format += "%d";
+      HasPid = true;
+      Idx++;
+      continue;
+    }
+    Format += Path[Idx];
+    if (Path[Idx] == '%')
+      Format += '%';
+  }
+  return Format;
+}
+
+//-----------------------------------------------------------------------------
+// The libc constants
+//-----------------------------------------------------------------------------
+std::optional<TargetLibcConstants> getTargetLibcConstants(const Module &M) {
+  Triple T(M.getTargetTriple());
+  if (T.getTriple().empty())
+    T = Triple(sys::getProcessTriple());
+
+  // The memory protections and the flags of `mmap` are the same everywhere
+  TargetLibcConstants C;
+  C.ORdWr = 2;
+  C.ProtRead = 1;
+  C.ProtWrite = 2;
+  C.MapShared = 1;
+  C.MapFixed = 0x10;
+  C.OffTBits = 64;
+
+  if (T.isOSLinux()) {
+    // The generic values, except for the architectures that kept the values
+    // of the systems they were ported from
+    if (T.isMIPS()) {
+      C.OCreat = 0x100;
+      C.OTrunc = 0x200;
+    } else if (T.getArch() == Triple::sparc ||
+               T.getArch() == Triple::sparcv9) {
+      C.OCreat = 0x200;
+      C.OTrunc = 0x400;
+    } else {
+      C.OCreat = 0x40;
+      C.OTrunc = 0x200;
+    }
+    C.ClockMonotonic = 1;
+    // On 32-bit targets, `ftruncate` and `mmap` take a 32-bit `off_t` in glibc
+    // (and bionic), the 64-bit versions are `ftruncate64` and `mmap64`. musl
+    // only has the 64-bit `off_t`.
+    if (T.isArch32Bit() && !T.isMusl())
+      C.OffTBits = 32;
+    return C;
+  }
+
+  // The BSDs (and Darwin) share the flags of `open`
+  C.OCreat = 0x200;
+  C.OTrunc = 0x400;
+  if (T.isOSDarwin())
+    C.ClockMonotonic = 6;
+  else if (T.isOSFreeBSD() || T.isOSDragonFly())
+    C.ClockMonotonic = 4;
+  else if (T.isOSNetBSD() || T.isOSOpenBSD())
+    C.ClockMonotonic = 3;
+  else
+    return std::nullopt;
+  return C;
+}
+
+//-----------------------------------------------------------------------------
+// The profile writer
+//-----------------------------------------------------------------------------
+// The writer is equivalent to the following C code:
+// ```
+//    static char *Mapping;
+//    static int OwnerPid;
+//
+//    // Called from the global constructors
+//    static void <Prefix>_open_profile() {
+//      char Buf[PATH_MAX];
+//      int Pid = getpid();
+//      snprintf(Buf, PATH_MAX, PathFormat, Pid);
+//      const char *Env = getenv("LLVM_TUTOR_PROFILE_FILE");
+//      int Fd = open(Env ? Env : Buf, O_RDWR | O_CREAT | O_TRUNC, 0644);
+//      if (Fd < 0)
+//        return;
+//      if (ftruncate(Fd, FileSize) == 0) {
+//        char *Map = mmap(NULL, FileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+//                         Fd, 0);
+//        if (Map != MAP_FAILED) {
+//          memcpy(Map, Image, sizeof(Image));
+//          // Only if the counters are alone in their pages
+//          memcpy(Map + CountersOffset, Counters, sizeof(Counters));
+//          mmap(Counters, sizeof(Counters), PROT_READ | PROT_WRITE,
+//               MAP_SHARED | MAP_FIXED, Fd, CountersOffset);
+//          Mapping = Map;
+//          OwnerPid = Pid;
+//        }
+//      }
+//      close(Fd);
+//    }
+//
+//    static void <Prefix>_write_profile() {
+//      if (!Mapping || getpid() != OwnerPid)
+//        return;
+//      memcpy(Mapping + CountersOffset, Counters, sizeof(Counters));
+//      FixupCounters(Mapping + CountersOffset);
+//      ((TutorProfHeader *)Mapping)->Flags = TUTOR_PROF_FLAG_COMPLETE;
+//      munmap(Mapping, FileSize);
+//      Mapping = NULL;
+//    }
+// ```
+Function *createProfileWriter(
+    Module &M, const TargetLibcConstants &Libc, uint32_t Kind,
+    ArrayRef<ProfileWriterRecord> Records, GlobalVariable *Counters,
+    unsigned CounterSize, StringRef Path, StringRef Prefix, StringRef ImageName,
+    function_ref<void(IRBuilder<> &, Value *)> FixupCounters) {
+  auto &CTX = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  bool IsLittleEndian = DL.isLittleEndian();
+  PointerType *PtrTy = PointerType::getUnqual(CTX);
+  Type *Int32Ty = Type::getInt32Ty(CTX);
+  Type *SizeTy = DL.getIntPtrType(CTX);
+  Type *OffTy = Type::getIntNTy(CTX, Libc.OffTBits);
+  auto *CountersTy = cast<ArrayType>(Counters->getValueType());
+
+  // STEP 1: Lay out the file
+  // ------------------------
+  // The counters can only be moved into the file if they don't share any
+  // pages with other data (the file offset must be a multiple of the page
+  // size, too)
+  uint64_t CountersSize = DL.getTypeAllocSize(CountersTy);
+  bool Movable = Counters->getAlign().valueOrOne() >= ProfileWriterPageSize &&
+                 CountersSize % ProfileWriterPageSize == 0;
+
+  uint64_t NamesSize = 0;
+  for (const ProfileWriterRecord &R : Records)
+    NamesSize += R.Name.size();
+
+  uint64_t RecordsOffset = sizeof(TutorProfHeader);
+  uint64_t NamesOffset =
+      RecordsOffset + Records.size() * sizeof(TutorProfRecord);
+  uint64_t CountersOffset = alignTo(NamesOffset + NamesSize,
+                                    Movable ? ProfileWriterPageSize : 8);
+  uint64_t FileSize = CountersOffset + CountersSize;
+
+  // STEP 2: Generate the image of everything but the counters
+  // ---------------------------------------------------------
+  std::string Image;
+  appendInt(Image, TUTOR_PROF_MAGIC, 8, IsLittleEndian);
+  appendInt(Image, TUTOR_PROF_VERSION, 4, IsLittleEndian);
+  appendInt(Image, Kind, 4, IsLittleEndian);
+  // The flags are set once the counters are written
+  appendInt(Image, 0, 4, IsLittleEndian);
+  appendInt(Image, Records.size(), 4, IsLittleEndian);
+  appendInt(Image, CounterSize, 4, IsLittleEndian);
+  appendInt(Image, DL.getTypeAllocSize(CountersTy->getElementType()), 4,
+            IsLittleEndian);
+  appendInt(Image, RecordsOffset, 8, IsLittleEndian);
+  appendInt(Image, NamesOffset, 8, IsLittleEndian);
+  appendInt(Image, CountersOffset, 8, IsLittleEndian);
+  appendInt(Image, FileSize, 8, IsLittleEndian);
+  assert(Image.size() == RecordsOffset && "Unexpected header size");
+
+  uint64_t NameOffset = 0, FirstCounter = 0;
+  for (const ProfileWriterRecord &R : Records) {
+    appendInt(Image, NameOffset, 8, IsLittleEndian);
+    appendInt(Image, R.Name.size(), 4, IsLittleEndian);
+    appendInt(Image, R.NumCounters, 4, IsLittleEndian);
+    appendInt(Image, R.Hash, 8, IsLittleEndian);
+    appendInt(Image, FirstCounter, 8, IsLittleEndian);
+    NameOffset += R.Name.size();
+    FirstCounter += R.NumCounters;
+  }
+  // The counters can be padded (see ProfileWriterPageSize)
+  assert(FirstCounter <= CountersTy->getNumElements() &&
+         "The records don't match the counters");
+  for (const ProfileWriterRecord &R : Records)
+    Image += R.Name;
+  assert(Image.size() == NamesOffset + NamesSize && "Unexpected image size");
+
+  Constant *ImageInit = ConstantDataArray::getString(CTX, Image,
+                                                     /*AddNull=*/false);
+  auto *ImageVar = new GlobalVariable(M, ImageInit->getType(),
+                                      /*isConstant=*/true,
+                                      GlobalValue::PrivateLinkage, ImageInit,
+                                      ImageName);
+  ImageVar->setAlignment(Align(8));
+
+  // STEP 3: Inject the declarations of the libc functions used by the writer
+  // ------------------------------------------------------------------------
+  FunctionCallee Getenv = M.getOrInsertFunction(
+      "getenv", FunctionType::get(PtrTy, {PtrTy}, /*IsVarArgs=*/false));
+  FunctionCallee Getpid = M.getOrInsertFunction(
+      "getpid", FunctionType::get(Int32Ty, {}, /*IsVarArgs=*/false));
+  FunctionCallee Snprintf = M.getOrInsertFunction(
+      "snprintf",
+      FunctionType::get(Int32Ty, {PtrTy, SizeTy, PtrTy}, /*IsVarArgs=*/true));
+  FunctionCallee Open = M.getOrInsertFunction(
+      "open", FunctionType::get(Int32Ty, {PtrTy, Int32Ty}, /*IsVarArgs=*/true));
+  FunctionCallee Ftruncate = M.getOrInsertFunction(
+      "ftruncate",
+      FunctionType::get(Int32Ty, {Int32Ty, OffTy}, /*IsVarArgs=*/false));
+  FunctionCallee Mmap = M.getOrInsertFunction(
+      "mmap", FunctionType::get(
+                  PtrTy, {PtrTy, SizeTy, Int32Ty, Int32Ty, Int32Ty, OffTy},
+                  /*IsVarArgs=*/false));
+  FunctionCallee Munmap = M.getOrInsertFunction(
+      "munmap",
+      FunctionType::get(Int32Ty, {PtrTy, SizeTy}, /*IsVarArgs=*/false));
+  FunctionCallee Close = M.getOrInsertFunction(
+      "close", FunctionType::get(Int32Ty, {Int32Ty}, /*IsVarArgs=*/false));
+
+  IRBuilder<> Builder(CTX);
+  Constant *EnvVar = Builder.CreateGlobalStringPtr(
+      TUTOR_PROF_FILE_ENV_VAR, (Prefix + ".env").str(), /*AddressSpace=*/0,
+      &M);
+  Constant *PathFormat = Builder.CreateGlobalStringPtr(
+      getPathFormat(Path), (Prefix + ".path_fmt").str(), /*AddressSpace=*/0,
+      &M);
+
+  // STEP 4: Define the opener (run from the global constructors)
+  // ------------------------------------------------------------
+  auto *MappingVar = new GlobalVariable(
+      M, PtrTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantPointerNull::get(PtrTy), Prefix + ".mapping");
+  auto *OwnerPidVar = new GlobalVariable(
+      M, Int32Ty, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Builder.getInt32(0), Prefix + ".owner_pid");
+
+  Function *OpenF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, Prefix + "_open_profile", M);
+
+  BasicBlock *EntryBB = BasicBlock::Create(CTX, "entry", OpenF);
+  BasicBlock *ResizeBB = BasicBlock::Create(CTX, "resize", OpenF);
+  BasicBlock *MapBB = BasicBlock::Create(CTX, "map", OpenF);
+  BasicBlock *CopyBB = BasicBlock::Create(CTX, "copy", OpenF);
+  BasicBlock *CloseBB = BasicBlock::Create(CTX, "close", OpenF);
+  BasicBlock *ExitBB = BasicBlock::Create(CTX, "exit", OpenF);
+  const unsigned PathMax = 4096;
+
+  // entry: open the profile file
+  Builder.SetInsertPoint(EntryBB);
+  Value *Buf = Builder.CreateAlloca(
+      ArrayType::get(Builder.getInt8Ty(), PathMax), nullptr, "path.buf");
+  Value *Pid = Builder.CreateCall(Getpid, {}, "pid");
+  Builder.CreateCall(Snprintf,
+                     {Buf, ConstantInt::get(SizeTy, PathMax), PathFormat, Pid});
+  Value *EnvPath = Builder.CreateCall(Getenv, {EnvVar}, "env");
+  Value *FilePath = Builder.CreateSelect(Builder.CreateIsNotNull(EnvPath),
+                                         EnvPath, Buf, "path");
+  Value *Fd = Builder.CreateCall(
+      Open,
+      {FilePath, Builder.getInt32(Libc.ORdWr | Libc.OCreat | Libc.OTrunc),
+       Builder.getInt32(0644)},
+      "fd");
+  Builder.CreateCondBr(Builder.CreateICmpSLT(Fd, Builder.getInt32(0)), ExitBB,
+                       ResizeBB);
+
+  // resize: make room for the whole profile
+  Builder.SetInsertPoint(ResizeBB);
+  Value *Resized =
+      Builder.CreateCall(Ftruncate, {Fd, ConstantInt::get(OffTy, FileSize)});
+  Builder.CreateCondBr(Builder.CreateIsNull(Resized), MapBB, CloseBB);
+
+  // map: map the file into memory
+  Builder.SetInsertPoint(MapBB);
+  Value *Map = Builder.CreateCall(
+      Mmap,
+      {ConstantPointerNull::get(PtrTy), ConstantInt::get(SizeTy, FileSize),
+       Builder.getInt32(Libc.ProtRead | Libc.ProtWrite),
+       Builder.getInt32(Libc.MapShared),
+       Fd, ConstantInt::get(OffTy, 0)},
+      "mapping");
+  Value *MapFailed = ConstantExpr::getIntToPtr(
+      ConstantInt::getAllOnesValue(SizeTy), PtrTy);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(Map, MapFailed), CloseBB, CopyBB);
+
+  // copy: copy the image (the profile stays incomplete until the writer is
+  // done) and move the counters into the file, so that they survive a crash.
+  // If that fails, the counters stay where they are and are copied by the
+  // writer.
+  Builder.SetInsertPoint(CopyBB);
+  Builder.CreateMemCpy(Map, Align(8), ImageVar, Align(8), Image.size());
+  if (Movable) {
+    Value *MappedCounters = Builder.CreateConstInBoundsGEP1_64(
+        Builder.getInt8Ty(), Map, CountersOffset, "mapped.counters");
+    Builder.CreateMemCpy(MappedCounters, Align(8), Counters,
+                         Counters->getAlign(), CountersSize);
+    Builder.CreateCall(
+        Mmap, {Counters, ConstantInt::get(SizeTy, CountersSize),
+               Builder.getInt32(Libc.ProtRead | Libc.ProtWrite),
+               Builder.getInt32(Libc.MapShared | Libc.MapFixed), Fd,
+               ConstantInt::get(OffTy, CountersOffset)});
+  }
+  Builder.CreateStore(Map, MappingVar);
+  Builder.CreateStore(Pid, OwnerPidVar);
+  Builder.CreateBr(CloseBB);
+
+  // close: the mapping outlives the file descriptor
+  Builder.SetInsertPoint(CloseBB);
+  Builder.CreateCall(Close, {Fd});
+  Builder.CreateBr(ExitBB);
+
+  Builder.SetInsertPoint(ExitBB);
+  Builder.CreateRetVoid();
+
+  appendToGlobalCtors(M, OpenF, /*Priority=*/0);
+
+  // STEP 5: Define the writer
+  // -------------------------
+  Function *WriterF = Function::Create(
+      FunctionType::get(Type::getVoidTy(CTX), {}, /*IsVarArgs=*/false),
+      GlobalValue::InternalLinkage, Prefix + "_write_profile", M);
+
+  EntryBB = BasicBlock::Create(CTX, "entry", WriterF);
+  BasicBlock *WriteBB = BasicBlock::Create(CTX, "write", WriterF);
+  ExitBB = BasicBlock::Create(CTX, "exit", WriterF);
+
+  // entry: was the file opened (by this process, rather than by the parent of
+  // a forked child)?
+  Builder.SetInsertPoint(EntryBB);
+  Map = Builder.CreateLoad(PtrTy, MappingVar, "mapping");
+  Value *Opened = Builder.CreateAnd(
+      Builder.CreateIsNotNull(Map),
+      Builder.CreateICmpEQ(Builder.CreateCall(Getpid, {}, "pid"),
+                           Builder.CreateLoad(Int32Ty, OwnerPidVar)));
+  Builder.CreateCondBr(Opened, WriteBB, ExitBB);
+
+  // write: copy the counters (unless they were moved into the file), then
+  // mark the profile as complete
+  Builder.SetInsertPoint(WriteBB);
+  Value *MappedCounters = Builder.CreateConstInBoundsGEP1_64(
+      Builder.getInt8Ty(), Map, CountersOffset, "mapped.counters");
+  // When the counters were moved, both sides are the same pages of the file
+  // (mapped twice), i.e. this doesn't change anything
+  Builder.CreateMemCpy(MappedCounters, Align(8), Counters,
+                       Counters->getAlign(), CountersSize);
+  if (FixupCounters)
+    FixupCounters(Builder, MappedCounters);
+  Builder.CreateStore(Builder.getInt32(TUTOR_PROF_FLAG_COMPLETE),
+                      Builder.CreateConstInBoundsGEP1_64(
+                          Builder.getInt8Ty(), Map, TUTOR_PROF_FLAGS_OFFSET));
+  Builder.CreateCall(Munmap, {Map, ConstantInt::get(SizeTy, FileSize)});
+  Builder.CreateStore(ConstantPointerNull::get(PtrTy), MappingVar);
+  Builder.CreateBr(ExitBB);
+
+  Builder.SetInsertPoint(ExitBB);
+  Builder.CreateRetVoid();
+
+  return WriterF;
+}
@@ -0,0 +1,417 @@
+//==============================================================================
+// FILE:
+//    TutorHeapProf.cpp
+//
+// DESCRIPTION:
+//    The heap profiling part of the instrumentation runtime: records the
+//    allocations and deallocations reported by the modules instrumented with
+//    the HeapProfiler pass and writes the statistics of every allocation site
+//    when the program exits (see TutorHeapProf.h).
+//
+//    The hooks run on every allocation, from every thread, so they never take
+//    a lock:
+//      * The statistics are kept in a table per thread (allocated on the
+//        first event of the thread, never freed), an open-addressing hash
+//        table keyed by the address of the site descriptor. Only the owning
+//        thread updates it. The tables are linked into a global list (with a
+//        CAS) so that they can be merged at exit, which is why all the
+//        counters are updated with (relaxed) atomic stores.
+//      * The live blocks are kept in one global open-addressing hash table,
+//        keyed by the address of the block. Every slot is claimed with a CAS
+//        (empty or deleted -> busy), filled in and then published with a
+//        release store of the key. A deallocation looks the block up,
+//        retires the slot with a CAS (-> deleted) and records the lifetime
+//        with the site of the block, in the table of the thread that frees
+//        it. The probing is bounded (see MaxProbes), a block that doesn't fit
+//        is counted but its lifetime is not recorded.
+//    The tables are allocated with mmap, so the hooks never call back into
+//    malloc.
+//
+//    This is linked into the instrumented programs, so it only depends on
+//    libc (no LLVM, no C++ standard library, no exceptions).
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libHeapProfiler.so `\`
+//        -passes="heap-prof" input.ll -o input.bc
+//      $ clang input.bc <BUILD_DIR>/lib/libTutorRuntime.a -lpthread -o prog
+//      $ ./prog
+//      $ <BUILD_DIR>/bin/tutor-heap default.heapprof
+//
+// License: MIT
+//==============================================================================
+#include "TutorHeapProf.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+namespace {
+// The statistics of one site in one thread
+struct SiteStats {
+  const TutorHeapSite *Site;
+  uint64_t Allocs;
+  uint64_t Frees;
+  uint64_t Bytes;
+  uint64_t Sizes[TUTOR_HEAP_NUM_SIZE_BUCKETS];
+  uint64_t Lifetimes[TUTOR_HEAP_NUM_LIFETIME_BUCKETS];
+};
+
+// The # of sites per thread (a power of 2)
+constexpr uint64_t ThreadTableSize = 4096;
+
+struct ThreadTable {
+  ThreadTable *Next;
+  SiteStats Sites[ThreadTableSize];
+};
+
+// One live block. Key is the address of the block, or one of the states
+// below (no block lives at these addresses).
+struct LiveBlock {
+  uint64_t Key;
+  const TutorHeapSite *Site;
+  uint64_t Time;
+};
+
+constexpr uint64_t SlotEmpty = 0;
+constexpr uint64_t SlotDeleted = 1;
+constexpr uint64_t SlotBusy = 2;
+
+// The bound on the probing in both tables
+constexpr unsigned MaxProbes = 64;
+
+constexpr uint64_t DefaultLiveSlots = uint64_t(1) << 20;
+
+pthread_once_t InitOnce = PTHREAD_ONCE_INIT;
+pthread_key_t TableKey;
+bool HaveTableKey = false;
+
+// The list of the tables of all the threads
+ThreadTable *Tables = nullptr;
+
+LiveBlock *Live = nullptr;
+uint64_t LiveMask = 0;
+
+// The events that were not recorded
+uint64_t NumUntracked = 0;
+uint64_t NumDropped = 0;
+
+// Registration is rare, it takes a lock
+pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned NumModules = 0;
+char *OutputPath = nullptr;
+} // namespace
+
+//------------------------------------------------------------------------------
+// Helper functions
+//------------------------------------------------------------------------------
+static uint64_t hashPointer(const void *Ptr) {
+  return (uint64_t(Ptr) * 0x9e3779b97f4a7c15ULL) >> 20;
+}
+
+static uint64_t now() {
+  struct timespec TS;
+  clock_gettime(CLOCK_MONOTONIC, &TS);
+  return uint64_t(TS.tv_sec) * 1000000000ULL + uint64_t(TS.tv_nsec);
+}
+
+// Only the owning thread updates the statistics, so there's no need for an
+// atomic read-modify-write
+static void bump(uint64_t &Counter, uint64_t Value) {
+  uint64_t Old = __atomic_load_n(&Counter, __ATOMIC_RELAXED);
+  __atomic_store_n(&Counter, Old + Value, __ATOMIC_RELAXED);
+}
+
+static void initialize() {
+  HaveTableKey = pthread_key_create(&TableKey, nullptr) == 0;
+
+  uint64_t Slots = DefaultLiveSlots;
+  if (const char *Env = getenv(TUTOR_HEAP_LIVE_SLOTS_ENV_VAR)) {
+    char *End = nullptr;
+    unsigned long long Value = strtoull(Env, &End, 10);
+    if (*Env && !*End && Value)
+      Slots = Value;
+    else
+      fprintf(stderr, "LLVM-TUTOR: invalid %s: %s\n",
+              TUTOR_HEAP_LIVE_SLOTS_ENV_VAR, Env);
+  }
+  uint64_t Size = MaxProbes;
+  while (Size < Slots && Size < (uint64_t(1) << 40))
+    Size *= 2;
+
+  void *Mem = mmap(nullptr, Size * sizeof(LiveBlock), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Mem == MAP_FAILED) {
+    fprintf(stderr,
+            "LLVM-TUTOR: can't allocate the table of live blocks, the "
+            "lifetimes are not recorded\n");
+    return;
+  }
+  Live = static_cast<LiveBlock *>(Mem);
+  LiveMask = Size - 1;
+}
+
+// Returns the table of the calling thread (a new one on the first call), or
+// null if out of memory
+static ThreadTable *getThreadTable() {
+  if (!HaveTableKey)
+    return nullptr;
+  auto *T = static_cast<ThreadTable *>(pthread_getspecific(TableKey));
+  if (T)
+    return T;
+
+  void *Mem = mmap(nullptr, sizeof(ThreadTable), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Mem == MAP_FAILED)
+    return nullptr;
+  T = static_cast<ThreadTable *>(Mem);
+  T->Next = __atomic_load_n(&Tables, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&Tables, &T->Next, T, /*weak=*/true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  pthread_setspecific(TableKey, T);
+  return T;
+}
+
+// Returns the statistics of Site in T (new ones for a new site), or null if
+// there's no room left
+static SiteStats *getSiteStats(ThreadTable *T, const TutorHeapSite *Site) {
+  uint64_t Hash = hashPointer(Site);
+  for (unsigned Probe = 0; Probe != MaxProbes; ++Probe) {
+    SiteStats &S = T->Sites[(Hash + Probe) & (ThreadTableSize - 1)];
+    const TutorHeapSite *Key = __atomic_load_n(&S.Site, __ATOMIC_RELAXED);
+    if (Key == Site)
+      return &S;
+    if (!Key) {
+      // The counters are zero, the readers may see them right away
+      __atomic_store_n(&S.Site, Site, __ATOMIC_RELEASE);
+      return &S;
+    }
+  }
+  __atomic_fetch_add(&NumDropped, 1, __ATOMIC_RELAXED);
+  return nullptr;
+}
+
+static bool insertLive(void *Ptr, const TutorHeapSite *Site, uint64_t Time) {
+  uint64_t Hash = hashPointer(Ptr);
+  for (unsigned Probe = 0; Probe != MaxProbes; ++Probe) {
+    LiveBlock &B = Live[(Hash + Probe) & LiveMask];
+    uint64_t Key = __atomic_load_n(&B.Key, __ATOMIC_RELAXED);
+    if (Key != SlotEmpty && Key != SlotDeleted)
+      continue;
+    if (!__atomic_compare_exchange_n(&B.Key, &Key, SlotBusy, /*weak=*/false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      continue;
+    B.Site = Site;
+    B.Time = Time;
+    __atomic_store_n(&B.Key, uint64_t(Ptr), __ATOMIC_RELEASE);
+    return true;
+  }
+  return false;
+}
+
+// Removes Ptr from the table of live blocks. Returns false if it's not there
+// (e.g. it was allocated by code that's not instrumented).
+static bool removeLive(void *Ptr, const TutorHeapSite *&Site, uint64_t &Time) {
+  uint64_t Hash = hashPointer(Ptr);
+  for (unsigned Probe = 0; Probe != MaxProbes; ++Probe) {
+    LiveBlock &B = Live[(Hash + Probe) & LiveMask];
+    uint64_t Key = __atomic_load_n(&B.Key, __ATOMIC_ACQUIRE);
+    // The slots are never emptied again, so Ptr can't be further away
+    if (Key == SlotEmpty)
+      return false;
+    if (Key != uint64_t(Ptr))
+      continue;
+    Site = B.Site;
+    Time = B.Time;
+    // Only the thread that frees Ptr retires its slot
+    return __atomic_compare_exchange_n(&B.Key, &Key, SlotDeleted,
+                                       /*weak=*/false, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED);
+  }
+  return false;
+}
+
+static void recordAlloc(void *Ptr, uint64_t Size, const TutorHeapSite *Site) {
+  ThreadTable *T = getThreadTable();
+  SiteStats *S = T ? getSiteStats(T, Site) : nullptr;
+  if (!S)
+    return;
+  bump(S->Allocs, 1);
+  bump(S->Bytes, Size);
+  bump(S->Sizes[getHeapSizeBucket(Size)], 1);
+
+  if (!Live || !insertLive(Ptr, Site, now()))
+    __atomic_fetch_add(&NumUntracked, 1, __ATOMIC_RELAXED);
+}
+
+static void recordFree(void *Ptr) {
+  const TutorHeapSite *Site = nullptr;
+  uint64_t Time = 0;
+  if (!Live || !removeLive(Ptr, Site, Time))
+    return;
+  uint64_t Lifetime = now() - Time;
+
+  ThreadTable *T = getThreadTable();
+  SiteStats *S = T ? getSiteStats(T, Site) : nullptr;
+  if (!S)
+    return;
+  bump(S->Frees, 1);
+  bump(S->Lifetimes[getHeapLifetimeBucket(Lifetime)], 1);
+}
+
+//------------------------------------------------------------------------------
+// The profile
+//------------------------------------------------------------------------------
+// Orders the statistics by function and site, so that the profile is stable
+static int compareStats(const void *LHS, const void *RHS) {
+  const TutorHeapSite *A = (*static_cast<SiteStats *const *>(LHS))->Site;
+  const TutorHeapSite *B = (*static_cast<SiteStats *const *>(RHS))->Site;
+  if (int Cmp = strcmp(A->Function, B->Function))
+    return Cmp;
+  if (A->Index != B->Index)
+    return A->Index < B->Index ? -1 : 1;
+  return A < B ? -1 : (A > B ? 1 : 0);
+}
+
+// Adds the statistics in Src to Dst
+static void mergeStats(SiteStats &Dst, const SiteStats &Src) {
+  auto Add = [](uint64_t &D, const uint64_t &S) {
+    D += __atomic_load_n(&S, __ATOMIC_RELAXED);
+  };
+  Add(Dst.Allocs, Src.Allocs);
+  Add(Dst.Frees, Src.Frees);
+  Add(Dst.Bytes, Src.Bytes);
+  for (unsigned Idx = 0; Idx != TUTOR_HEAP_NUM_SIZE_BUCKETS; ++Idx)
+    Add(Dst.Sizes[Idx], Src.Sizes[Idx]);
+  for (unsigned Idx = 0; Idx != TUTOR_HEAP_NUM_LIFETIME_BUCKETS; ++Idx)
+    Add(Dst.Lifetimes[Idx], Src.Lifetimes[Idx]);
+}
+
+static void printStats(FILE *File, const SiteStats &S) {
+  const TutorHeapSite *Site = S.Site;
+  fprintf(File, "%s %llu %u %s %s %llu %llu %llu %u", Site->Function,
+          (unsigned long long)Site->Hash, Site->Index,
+          getHeapAllocKindName(Site->Kind), Site->Location,
+          (unsigned long long)S.Allocs, (unsigned long long)S.Frees,
+          (unsigned long long)S.Bytes, TUTOR_HEAP_NUM_SIZE_BUCKETS);
+  for (unsigned Idx = 0; Idx != TUTOR_HEAP_NUM_SIZE_BUCKETS; ++Idx)
+    fprintf(File, " %llu", (unsigned long long)S.Sizes[Idx]);
+  fprintf(File, " %u", TUTOR_HEAP_NUM_LIFETIME_BUCKETS);
+  for (unsigned Idx = 0; Idx != TUTOR_HEAP_NUM_LIFETIME_BUCKETS; ++Idx)
+    fprintf(File, " %llu", (unsigned long long)S.Lifetimes[Idx]);
+  fprintf(File, "\n");
+}
+
+// Merges the tables of all the threads and appends one line per site to the
+// profile
+static void writeProfile() {
+  const char *Env = getenv(TUTOR_HEAP_FILE_ENV_VAR);
+  const char *Path = Env && *Env ? Env : OutputPath;
+  if (!Path)
+    return;
+
+  ThreadTable *Head = __atomic_load_n(&Tables, __ATOMIC_ACQUIRE);
+  uint64_t NumStats = 0;
+  for (ThreadTable *T = Head; T; T = T->Next)
+    for (uint64_t Idx = 0; Idx != ThreadTableSize; ++Idx)
+      if (__atomic_load_n(&T->Sites[Idx].Site, __ATOMIC_ACQUIRE))
+        ++NumStats;
+
+  auto **Stats =
+      static_cast<SiteStats **>(malloc((NumStats + 1) * sizeof(SiteStats *)));
+  if (!Stats) {
+    fprintf(stderr, "LLVM-TUTOR: out of memory, the heap profile is lost\n");
+    return;
+  }
+  // The other threads may still add sites, only take the ones counted above
+  uint64_t Num = 0;
+  for (ThreadTable *T = Head; T && Num != NumStats; T = T->Next)
+    for (uint64_t Idx = 0; Idx != ThreadTableSize && Num != NumStats; ++Idx)
+      if (__atomic_load_n(&T->Sites[Idx].Site, __ATOMIC_ACQUIRE))
+        Stats[Num++] = &T->Sites[Idx];
+  qsort(Stats, Num, sizeof(SiteStats *), compareStats);
+
+  FILE *File = fopen(Path, "a");
+  if (!File) {
+    fprintf(stderr, "LLVM-TUTOR: can't write the heap profile to %s\n", Path);
+    free(Stats);
+    return;
+  }
+  for (uint64_t Idx = 0; Idx != Num;) {
+    SiteStats Sum;
+    memset(&Sum, 0, sizeof(Sum));
+    Sum.Site = Stats[Idx]->Site;
+    for (; Idx != Num && Stats[Idx]->Site == Sum.Site; ++Idx)
+      mergeStats(Sum, *Stats[Idx]);
+    printStats(File, Sum);
+  }
+  fclose(File);
+  free(Stats);
+
+  uint64_t Untracked = __atomic_load_n(&NumUntracked, __ATOMIC_RELAXED);
+  if (Untracked)
+    fprintf(stderr,
+            "LLVM-TUTOR: %llu allocations didn't fit in the table of live "
+            "blocks, their lifetimes are not recorded (see %s)\n",
+            (unsigned long long)Untracked, TUTOR_HEAP_LIVE_SLOTS_ENV_VAR);
+  uint64_t Dropped = __atomic_load_n(&NumDropped, __ATOMIC_RELAXED);
+  if (Dropped)
+    fprintf(stderr,
+            "LLVM-TUTOR: %llu heap events were not recorded (too many "
+            "allocation sites)\n",
+            (unsigned long long)Dropped);
+}
+
+//------------------------------------------------------------------------------
+// The interface of the runtime
+//------------------------------------------------------------------------------
+extern "C" void __tutor_heap_register(const char *DefaultPath) {
+  pthread_once(&InitOnce, initialize);
+
+  pthread_mutex_lock(&Lock);
+  ++NumModules;
+  if (!OutputPath && DefaultPath)
+    OutputPath = strdup(DefaultPath);
+  pthread_mutex_unlock(&Lock);
+}
+
+extern "C" void __tutor_heap_unregister() {
+  pthread_mutex_lock(&Lock);
+  if (NumModules && --NumModules == 0)
+    writeProfile();
+  pthread_mutex_unlock(&Lock);
+}
+
+extern "C" void __tutor_heap_alloc(void *Ptr, uint64_t Size,
+                                   const TutorHeapSite *Site) {
+  if (!Ptr)
+    return;
+  pthread_once(&InitOnce, initialize);
+  recordAlloc(Ptr, Size, Site);
+}
+
+extern "C" void __tutor_heap_free(void *Ptr) {
+  if (!Ptr)
+    return;
+  pthread_once(&InitOnce, initialize);
+  recordFree(Ptr);
+}
+
+// A successful realloc ends the lifetime of the old block and starts the one
+// of the new block (even if it's the same). Note that the old block is only
+// removed from the table after the call, so if another thread gets the same
+// address in the meantime, the lifetimes of the two blocks may be swapped.
+extern "C" void __tutor_heap_realloc(void *OldPtr, void *NewPtr, uint64_t Size,
+                                     const TutorHeapSite *Site) {
+  // Failed, the old block is still there
+  if (!NewPtr && Size)
+    return;
+  pthread_once(&InitOnce, initialize);
+  if (OldPtr)
+    recordFree(OldPtr);
+  if (NewPtr)
+    recordAlloc(NewPtr, Size, Site);
+}
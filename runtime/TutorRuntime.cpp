@@ -0,0 +1,806 @@
+//==============================================================================
+// FILE:
+//    TutorRuntime.cpp
+//
+// DESCRIPTION:
+//    The instrumentation runtime: collects the counters of all the registered
+//    modules and writes them, once, when the program exits (see
+//    TutorRuntime.h). The results are either printed to stdout (in the same
+//    format as DynamicCallCounter) or written to a binary profile (see
+//    TutorProfile.h), which `tutor-profdata` reads.
+//
+//    The results are kept in one table, owned by the runtime. Every module is
+//    added to the table when it's unregistered, i.e. when the counters are
+//    final. The table is written once the last module is gone.
+//
+//    Snapshots (see TutorRuntime.h) are written by a background thread, which
+//    wakes up either when the interval expires or when the signal handler
+//    writes a byte to a pipe (write is async-signal-safe, unlike pretty much
+//    everything else). The thread only reads the counters of the live modules,
+//    with relaxed atomic loads, so the instrumented code keeps running while
+//    a snapshot is written. The snapshots are written with plain
+//    open/write/rename (no stdio, no malloc), so the writer is safe even in a
+//    process that's in the middle of a malloc when the snapshot is due. Every
+//    snapshot goes to a temporary file first and is then renamed, so a reader
+//    never sees a partial one.
+//
+//    With LLVM_TUTOR_SHM_NAME, the counters of every module are moved to a
+//    shared memory segment when the module is registered (see TutorShm.h).
+//    The counters stay where they are in the address space of the program
+//    (only the pages behind them change), so the instrumented code (and the
+//    rest of the runtime) doesn't know the difference.
+//
+//    This is linked into the instrumented programs, so it only depends on
+//    libc (no LLVM, no C++ standard library, no exceptions).
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes="dynamic-cc" -dynamic-cc-runtime a.ll -o a.bc
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes="dynamic-cc" -dynamic-cc-runtime b.ll -o b.bc
+//      $ clang a.bc b.bc <BUILD_DIR>/lib/libTutorRuntime.a -lpthread -o prog
+//      $ LLVM_TUTOR_SNAPSHOT_SIGNAL=SIGUSR2 ./prog &
+//      $ kill -USR2 $!
+//
+// License: MIT
+//==============================================================================
+#include "TutorProfile.h"
+#include "TutorRuntime.h"
+#include "TutorShm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+// The merged results of one function
+struct Result {
+  char *Name;
+  uint64_t Hash;
+  uint32_t NumCounters;
+  uint64_t *Counters;
+};
+
+// A registered module
+struct LiveModule {
+  const TutorRtModule *Desc;
+  // The (scaled) counters at the previous snapshot, in the delta mode
+  uint64_t *Last;
+  // The entry in the shared memory segment (or -1)
+  int32_t ShmIdx;
+  LiveModule *Next;
+};
+
+pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+LiveModule *LiveModules = nullptr;
+uint32_t Kind = 0;
+char *OutputPath = nullptr;
+
+Result *Results = nullptr;
+uint32_t NumResults = 0;
+uint32_t ResultsCapacity = 0;
+
+// Set once the environment variables have been read
+bool Configured = false;
+
+// The snapshots (see TutorRuntime.h)
+bool SnapshotDelta = false;
+unsigned SnapshotInterval = 0;
+const char *SnapshotPath = "snapshot.%p.%n.tutorprof";
+uint64_t SnapshotSeq = 0;
+// The signal handler writes to [1], the snapshot thread polls [0]
+int SnapshotPipe[2] = {-1, -1};
+
+// The shared memory segment (see TutorShm.h)
+char *ShmName = nullptr;
+int ShmFd = -1;
+TutorShmHeader *Shm = nullptr;
+uint64_t ShmUsed = 0;
+} // namespace
+
+//------------------------------------------------------------------------------
+// Helper functions
+//------------------------------------------------------------------------------
+// The counters may be updated by other threads while they are read (e.g. for
+// a snapshot), hence the atomic loads. The counters are naturally aligned.
+static uint64_t readCounter(const TutorRtModule *M, uint64_t Idx) {
+  const char *Ptr =
+      static_cast<const char *>(M->Counters) + Idx * M->CounterStride;
+  if (M->CounterSize == 4)
+    return __atomic_load_n(reinterpret_cast<const uint32_t *>(Ptr),
+                           __ATOMIC_RELAXED);
+  return __atomic_load_n(reinterpret_cast<const uint64_t *>(Ptr),
+                         __ATOMIC_RELAXED);
+}
+
+// Returns the result for Name (a new one if there's none yet), or null if
+// out of memory
+static Result *getResult(const char *Name, uint64_t Hash,
+                         uint32_t NumCounters) {
+  for (uint32_t Idx = 0; Idx != NumResults; ++Idx)
+    if (strcmp(Results[Idx].Name, Name) == 0 &&
+        Results[Idx].NumCounters == NumCounters)
+      return &Results[Idx];
+
+  if (NumResults == ResultsCapacity) {
+    uint32_t Capacity = ResultsCapacity ? 2 * ResultsCapacity : 64;
+    auto *NewResults =
+        static_cast<Result *>(realloc(Results, Capacity * sizeof(Result)));
+    if (!NewResults)
+      return nullptr;
+    Results = NewResults;
+    ResultsCapacity = Capacity;
+  }
+
+  Result &R = Results[NumResults];
+  R.Name = strdup(Name);
+  R.Hash = Hash;
+  R.NumCounters = NumCounters;
+  R.Counters = static_cast<uint64_t *>(calloc(NumCounters, sizeof(uint64_t)));
+  if (!R.Name || !R.Counters) {
+    free(R.Name);
+    free(R.Counters);
+    return nullptr;
+  }
+  NumResults++;
+  return &R;
+}
+
+// Adds the counters of M to the results
+static void collect(const TutorRtModule *M) {
+  for (uint32_t F = 0; F != M->NumFunctions; ++F) {
+    const TutorRtFunction &Fn = M->Functions[F];
+    Result *R = getResult(Fn.Name, Fn.Hash, M->NumCountersPerFunction);
+    if (!R) {
+      fprintf(stderr, "LLVM-TUTOR: out of memory, %s is not recorded\n",
+              Fn.Name);
+      continue;
+    }
+    for (uint32_t C = 0; C != M->NumCountersPerFunction; ++C)
+      R->Counters[C] +=
+          readCounter(M, uint64_t(F) * M->NumCountersPerFunction + C) *
+          M->Scale;
+  }
+}
+
+static void printResults() {
+  printf("=================================================\n");
+  printf("LLVM-TUTOR: dynamic analysis results\n");
+  printf("=================================================\n");
+  printf("NAME                 #N DIRECT CALLS\n");
+  printf("-------------------------------------------------\n");
+  for (uint32_t Idx = 0; Idx != NumResults; ++Idx) {
+    printf("%-20s", Results[Idx].Name);
+    for (uint32_t C = 0; C != Results[Idx].NumCounters; ++C)
+      printf(" %-10llu", (unsigned long long)Results[Idx].Counters[C]);
+    printf("\n");
+  }
+  fflush(stdout);
+}
+
+// Writes the results to a binary profile at Path. The layout is the same as
+// the profiles written by the instrumentation itself, with 64-bit counters.
+static void writeProfile(const char *Path) {
+  uint64_t NumCounters = 0, NamesSize = 0;
+  for (uint32_t Idx = 0; Idx != NumResults; ++Idx) {
+    NumCounters += Results[Idx].NumCounters;
+    NamesSize += strlen(Results[Idx].Name);
+  }
+
+  TutorProfHeader Header;
+  memset(&Header, 0, sizeof(Header));
+  Header.Magic = TUTOR_PROF_MAGIC;
+  Header.Version = TUTOR_PROF_VERSION;
+  Header.Kind = Kind;
+  Header.NumRecords = NumResults;
+  Header.CounterSize = sizeof(uint64_t);
+  Header.CounterStride = sizeof(uint64_t);
+  Header.RecordsOffset = sizeof(TutorProfHeader);
+  Header.NamesOffset =
+      Header.RecordsOffset + uint64_t(NumResults) * sizeof(TutorProfRecord);
+  Header.CountersOffset = (Header.NamesOffset + NamesSize + 7) / 8 * 8;
+  Header.FileSize = Header.CountersOffset + NumCounters * sizeof(uint64_t);
+
+  FILE *File = fopen(Path, "wb");
+  if (!File) {
+    fprintf(stderr, "LLVM-TUTOR: can't write the profile to %s\n", Path);
+    return;
+  }
+
+  // The header first (without TUTOR_PROF_FLAG_COMPLETE) ...
+  bool OK = fwrite(&Header, sizeof(Header), 1, File) == 1;
+
+  // ... then the records, the names and the counters ...
+  uint64_t NameOffset = 0, FirstCounter = 0;
+  for (uint32_t Idx = 0; OK && Idx != NumResults; ++Idx) {
+    TutorProfRecord Record;
+    Record.NameOffset = NameOffset;
+    Record.NameSize = strlen(Results[Idx].Name);
+    Record.NumCounters = Results[Idx].NumCounters;
+    Record.Hash = Results[Idx].Hash;
+    Record.FirstCounter = FirstCounter;
+    OK = fwrite(&Record, sizeof(Record), 1, File) == 1;
+    NameOffset += Record.NameSize;
+    FirstCounter += Record.NumCounters;
+  }
+  for (uint32_t Idx = 0; OK && Idx != NumResults; ++Idx)
+    OK = fputs(Results[Idx].Name, File) >= 0;
+  static const char Padding[8] = {0};
+  uint64_t PaddingSize = Header.CountersOffset - Header.NamesOffset - NamesSize;
+  if (OK && PaddingSize)
+    OK = fwrite(Padding, PaddingSize, 1, File) == 1;
+  for (uint32_t Idx = 0; OK && Idx != NumResults; ++Idx)
+    OK = fwrite(Results[Idx].Counters, sizeof(uint64_t),
+                Results[Idx].NumCounters,
+                File) == Results[Idx].NumCounters;
+
+  // ... and finally mark the profile as complete
+  uint32_t Flags = TUTOR_PROF_FLAG_COMPLETE;
+  if (OK)
+    OK = fseek(File, TUTOR_PROF_FLAGS_OFFSET, SEEK_SET) == 0 &&
+         fwrite(&Flags, sizeof(Flags), 1, File) == 1;
+  if (fclose(File) != 0 || !OK)
+    fprintf(stderr, "LLVM-TUTOR: can't write the profile to %s\n", Path);
+}
+
+// Writes the results, either to the binary profile (if there's one) or to
+// stdout
+static void writeResults() {
+  const char *Env = getenv(TUTOR_PROF_FILE_ENV_VAR);
+  if (Env && *Env) {
+    writeProfile(Env);
+    return;
+  }
+  if (!OutputPath) {
+    printResults();
+    return;
+  }
+
+  // Replace `%p` with the process ID
+  char Path[4096];
+  size_t Len = 0;
+  for (const char *C = OutputPath; *C && Len + 1 < sizeof(Path); ++C) {
+    if (C[0] == '%' && C[1] == 'p') {
+      Len += snprintf(Path + Len, sizeof(Path) - Len, "%d", (int)getpid());
+      Len = Len < sizeof(Path) ? Len : sizeof(Path) - 1;
+      ++C;
+      continue;
+    }
+    Path[Len++] = *C;
+  }
+  Path[Len] = '\0';
+  writeProfile(Path);
+}
+
+//------------------------------------------------------------------------------
+// Snapshots
+//------------------------------------------------------------------------------
+namespace {
+// Buffers the writes to a file descriptor. Only uses async-signal-safe calls.
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(int Fd) : Fd(Fd) {}
+
+  void write(const void *Data, size_t Size) {
+    const char *Bytes = static_cast<const char *>(Data);
+    while (Size) {
+      if (Len == sizeof(Buffer))
+        flush();
+      size_t Chunk = sizeof(Buffer) - Len < Size ? sizeof(Buffer) - Len : Size;
+      memcpy(Buffer + Len, Bytes, Chunk);
+      Len += Chunk;
+      Bytes += Chunk;
+      Size -= Chunk;
+    }
+  }
+
+  // Returns false if any of the writes failed
+  bool flush() {
+    for (size_t Done = 0; OK && Done != Len;) {
+      ssize_t Res = ::write(Fd, Buffer + Done, Len - Done);
+      if (Res < 0 && errno == EINTR)
+        continue;
+      if (Res <= 0)
+        OK = false;
+      else
+        Done += Res;
+    }
+    Len = 0;
+    return OK;
+  }
+
+private:
+  int Fd;
+  bool OK = true;
+  size_t Len = 0;
+  char Buffer[4096];
+};
+} // namespace
+
+// Appends the decimal representation of Value to Buf (no snprintf, it's not
+// async-signal-safe)
+static size_t appendNumber(char *Buf, size_t Len, size_t Size, uint64_t Value) {
+  char Digits[20];
+  size_t NumDigits = 0;
+  do {
+    Digits[NumDigits++] = '0' + Value % 10;
+    Value /= 10;
+  } while (Value);
+  while (NumDigits && Len + 1 < Size)
+    Buf[Len++] = Digits[--NumDigits];
+  return Len;
+}
+
+// Expands `%p` (the process ID) and `%n` (Seq) in Pattern
+static void expandPath(char *Buf, size_t Size, const char *Pattern,
+                       uint64_t Seq) {
+  size_t Len = 0;
+  for (const char *C = Pattern; *C && Len + 1 < Size; ++C) {
+    if (C[0] == '%' && (C[1] == 'p' || C[1] == 'n')) {
+      Len = appendNumber(Buf, Len, Size, C[1] == 'p' ? getpid() : Seq);
+      ++C;
+      continue;
+    }
+    Buf[Len++] = *C;
+  }
+  Buf[Len] = '\0';
+}
+
+static void reportSnapshotError() {
+  static const char Msg[] = "LLVM-TUTOR: can't write the snapshot\n";
+  SnapshotWriter W(STDERR_FILENO);
+  W.write(Msg, sizeof(Msg) - 1);
+  W.flush();
+}
+
+// Writes the counters of the live modules to the next snapshot. Must be
+// called with Lock held. A function that's instrumented in several modules
+// gets several records (tutor-profdata merges them).
+static void writeSnapshot() {
+  uint64_t NumRecords = 0, NumCounters = 0, NamesSize = 0;
+  for (LiveModule *L = LiveModules; L; L = L->Next) {
+    const TutorRtModule *M = L->Desc;
+    NumRecords += M->NumFunctions;
+    NumCounters += uint64_t(M->NumFunctions) * M->NumCountersPerFunction;
+    for (uint32_t F = 0; F != M->NumFunctions; ++F)
+      NamesSize += strlen(M->Functions[F].Name);
+  }
+
+  TutorProfHeader Header;
+  memset(&Header, 0, sizeof(Header));
+  Header.Magic = TUTOR_PROF_MAGIC;
+  Header.Version = TUTOR_PROF_VERSION;
+  // Nobody sees the file before it's renamed, so it's complete from the start
+  Header.Flags = TUTOR_PROF_FLAG_COMPLETE;
+  Header.Kind = Kind;
+  Header.NumRecords = NumRecords;
+  Header.CounterSize = sizeof(uint64_t);
+  Header.CounterStride = sizeof(uint64_t);
+  Header.RecordsOffset = sizeof(TutorProfHeader);
+  Header.NamesOffset =
+      Header.RecordsOffset + NumRecords * sizeof(TutorProfRecord);
+  Header.CountersOffset = (Header.NamesOffset + NamesSize + 7) / 8 * 8;
+  Header.FileSize = Header.CountersOffset + NumCounters * sizeof(uint64_t);
+
+  char Path[4096], TmpPath[4096 + 4];
+  expandPath(Path, sizeof(Path), SnapshotPath, SnapshotSeq++);
+  size_t PathLen = strlen(Path);
+  memcpy(TmpPath, Path, PathLen);
+  memcpy(TmpPath + PathLen, ".tmp", 5);
+
+  int Fd = open(TmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0) {
+    reportSnapshotError();
+    return;
+  }
+
+  SnapshotWriter W(Fd);
+  W.write(&Header, sizeof(Header));
+  uint64_t NameOffset = 0, FirstCounter = 0;
+  for (LiveModule *L = LiveModules; L; L = L->Next) {
+    const TutorRtModule *M = L->Desc;
+    for (uint32_t F = 0; F != M->NumFunctions; ++F) {
+      TutorProfRecord Record;
+      Record.NameOffset = NameOffset;
+      Record.NameSize = strlen(M->Functions[F].Name);
+      Record.NumCounters = M->NumCountersPerFunction;
+      Record.Hash = M->Functions[F].Hash;
+      Record.FirstCounter = FirstCounter;
+      W.write(&Record, sizeof(Record));
+      NameOffset += Record.NameSize;
+      FirstCounter += Record.NumCounters;
+    }
+  }
+  for (LiveModule *L = LiveModules; L; L = L->Next)
+    for (uint32_t F = 0; F != L->Desc->NumFunctions; ++F)
+      W.write(L->Desc->Functions[F].Name, strlen(L->Desc->Functions[F].Name));
+  static const char Padding[8] = {0};
+  W.write(Padding, Header.CountersOffset - Header.NamesOffset - NamesSize);
+  for (LiveModule *L = LiveModules; L; L = L->Next) {
+    const TutorRtModule *M = L->Desc;
+    uint64_t N = uint64_t(M->NumFunctions) * M->NumCountersPerFunction;
+    for (uint64_t Idx = 0; Idx != N; ++Idx) {
+      uint64_t Value = readCounter(M, Idx) * M->Scale;
+      if (L->Last) {
+        uint64_t Delta = Value - L->Last[Idx];
+        L->Last[Idx] = Value;
+        Value = Delta;
+      }
+      W.write(&Value, sizeof(Value));
+    }
+  }
+
+  bool OK = W.flush();
+  if (close(Fd) != 0)
+    OK = false;
+  if (OK && rename(TmpPath, Path) == 0)
+    return;
+  unlink(TmpPath);
+  reportSnapshotError();
+}
+
+// Requests a snapshot, the snapshot thread does the rest. Both ends of the
+// pipe are non-blocking: if it's full, a request is pending anyway.
+static void snapshotSignalHandler(int) {
+  int SavedErrno = errno;
+  char Byte = 0;
+  (void)!write(SnapshotPipe[1], &Byte, 1);
+  errno = SavedErrno;
+}
+
+// The time until Next in milliseconds (rounded up, so that the deadline has
+// passed when poll times out)
+static int millisecondsUntil(const timespec &Next) {
+  timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  int64_t Ms = (int64_t(Next.tv_sec) - Now.tv_sec) * 1000 +
+               (Next.tv_nsec - Now.tv_nsec + 999999) / 1000000;
+  if (Ms < 0)
+    return 0;
+  return Ms > INT_MAX ? INT_MAX : int(Ms);
+}
+
+static void *snapshotThread(void *) {
+  timespec Next;
+  clock_gettime(CLOCK_MONOTONIC, &Next);
+  Next.tv_sec += SnapshotInterval;
+
+  for (;;) {
+    pollfd Request = {SnapshotPipe[0], POLLIN, 0};
+    int Res;
+    do
+      Res = poll(&Request, 1,
+                 SnapshotInterval ? millisecondsUntil(Next) : -1);
+    while (Res < 0 && errno == EINTR);
+
+    // Keep the period regular, whatever the signals. A timeout before the
+    // deadline (INT_MAX milliseconds at most) just goes round again.
+    if (Res == 0) {
+      if (millisecondsUntil(Next) != 0)
+        continue;
+      Next.tv_sec += SnapshotInterval;
+    }
+    // Signals that arrive while a snapshot is pending share it
+    char Bytes[64];
+    while (read(SnapshotPipe[0], Bytes, sizeof(Bytes)) > 0)
+      ;
+
+    pthread_mutex_lock(&Lock);
+    // Once the last module is gone, the results at exit cover everything
+    if (LiveModules)
+      writeSnapshot();
+    pthread_mutex_unlock(&Lock);
+  }
+  return nullptr;
+}
+
+// Parses e.g. "SIGUSR2", "USR2" or "12". Returns 0 if Name is not a signal.
+static int parseSignal(const char *Name) {
+  if (*Name >= '0' && *Name <= '9')
+    return atoi(Name);
+  if (strncmp(Name, "SIG", 3) == 0)
+    Name += 3;
+  static const struct {
+    const char *Name;
+    int Signal;
+  } Signals[] = {{"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"HUP", SIGHUP},
+                 {"PROF", SIGPROF}, {"ALRM", SIGALRM}, {"URG", SIGURG}};
+  for (const auto &S : Signals)
+    if (strcmp(Name, S.Name) == 0)
+      return S.Signal;
+  return 0;
+}
+
+// Reads the configuration of the snapshots and starts the snapshot thread
+// (if there's anything to do). Must be called with Lock held.
+static void configureSnapshots() {
+  const char *Mode = getenv(TUTOR_RT_SNAPSHOT_MODE_ENV_VAR);
+  if (Mode && strcmp(Mode, "delta") == 0)
+    SnapshotDelta = true;
+  else if (Mode && *Mode && strcmp(Mode, "cumulative") != 0)
+    fprintf(stderr, "LLVM-TUTOR: unknown snapshot mode %s, using cumulative\n",
+            Mode);
+  const char *Path = getenv(TUTOR_RT_SNAPSHOT_FILE_ENV_VAR);
+  if (Path && *Path)
+    SnapshotPath = Path;
+
+  const char *Interval = getenv(TUTOR_RT_SNAPSHOT_INTERVAL_ENV_VAR);
+  if (Interval && *Interval)
+    SnapshotInterval = strtoul(Interval, nullptr, 10);
+  int Signal = 0;
+  const char *SignalName = getenv(TUTOR_RT_SNAPSHOT_SIGNAL_ENV_VAR);
+  if (SignalName && *SignalName) {
+    Signal = parseSignal(SignalName);
+    if (!Signal)
+      fprintf(stderr, "LLVM-TUTOR: unknown snapshot signal %s\n", SignalName);
+  }
+  if (!SnapshotInterval && !Signal)
+    return;
+
+  pthread_t Thread;
+  pthread_attr_t Attr;
+  if (pipe(SnapshotPipe) != 0 || pthread_attr_init(&Attr) != 0) {
+    fprintf(stderr, "LLVM-TUTOR: can't start the snapshot thread\n");
+    return;
+  }
+  for (int Fd : SnapshotPipe) {
+    fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK);
+    fcntl(Fd, F_SETFD, FD_CLOEXEC);
+  }
+  pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+  // Block all the signals in the snapshot thread, so that they go to the
+  // program's own threads (poll would return EINTR anyway)
+  sigset_t All, Old;
+  sigfillset(&All);
+  pthread_sigmask(SIG_SETMASK, &All, &Old);
+  int Res = pthread_create(&Thread, &Attr, snapshotThread, nullptr);
+  pthread_sigmask(SIG_SETMASK, &Old, nullptr);
+  pthread_attr_destroy(&Attr);
+  if (Res != 0) {
+    fprintf(stderr, "LLVM-TUTOR: can't start the snapshot thread\n");
+    return;
+  }
+
+  if (Signal) {
+    struct sigaction Action;
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = snapshotSignalHandler;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    if (sigaction(Signal, &Action, nullptr) != 0)
+      fprintf(stderr, "LLVM-TUTOR: can't install the snapshot signal handler\n");
+  }
+}
+
+//------------------------------------------------------------------------------
+// Shared memory export
+//------------------------------------------------------------------------------
+static uint64_t alignTo(uint64_t Value, uint64_t Align) {
+  return (Value + Align - 1) / Align * Align;
+}
+
+// Creates the shared memory segment (if asked to). Must be called with Lock
+// held.
+static void configureShm() {
+  const char *Pattern = getenv(TUTOR_SHM_NAME_ENV_VAR);
+  if (!Pattern || !*Pattern)
+    return;
+  char Name[256];
+  expandPath(Name, sizeof(Name), Pattern, 0);
+
+  uint64_t Size = 64;
+  const char *SizeInMiB = getenv(TUTOR_SHM_SIZE_ENV_VAR);
+  if (SizeInMiB && *SizeInMiB)
+    Size = strtoull(SizeInMiB, nullptr, 10);
+  Size <<= 20;
+  if (Size < alignTo(sizeof(TutorShmHeader), TUTOR_SHM_PAGE_SIZE)) {
+    fprintf(stderr, "LLVM-TUTOR: the shared memory segment is too small\n");
+    return;
+  }
+
+  int Fd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (Fd < 0) {
+    fprintf(stderr, "LLVM-TUTOR: can't create the shared memory segment %s (%s)\n",
+            Name, strerror(errno));
+    return;
+  }
+  void *Base = MAP_FAILED;
+  if (ftruncate(Fd, Size) == 0)
+    Base = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  if (Base == MAP_FAILED) {
+    fprintf(stderr, "LLVM-TUTOR: can't map the shared memory segment %s (%s)\n",
+            Name, strerror(errno));
+    close(Fd);
+    shm_unlink(Name);
+    return;
+  }
+
+  Shm = static_cast<TutorShmHeader *>(Base);
+  Shm->Version = TUTOR_SHM_VERSION;
+  Shm->Kind = Kind;
+  Shm->Size = Size;
+  Shm->Pid = getpid();
+  Shm->NumModules = 0;
+  // The readers check the magic number first
+  __atomic_store_n(&Shm->Magic, TUTOR_SHM_MAGIC, __ATOMIC_RELEASE);
+  ShmUsed = alignTo(sizeof(TutorShmHeader), TUTOR_SHM_PAGE_SIZE);
+  ShmName = strdup(Name);
+  ShmFd = Fd;
+}
+
+// Adds M to the shared memory segment and moves its counters there (if they
+// are alone in their pages). Returns the index of the entry, or -1. Must be
+// called with Lock held, before any of the counters of M are updated by other
+// threads (the updates in between the copy and the remapping would be lost).
+static int32_t exportModule(const TutorRtModule *M) {
+  if (!Shm)
+    return -1;
+  uint32_t Idx = Shm->NumModules;
+  if (Idx == TUTOR_SHM_MAX_MODULES) {
+    fprintf(stderr, "LLVM-TUTOR: too many modules, the counters of some of "
+                    "them are not exported\n");
+    return -1;
+  }
+
+  uint64_t NamesSize = 0;
+  for (uint32_t F = 0; F != M->NumFunctions; ++F)
+    NamesSize += strlen(M->Functions[F].Name) + 1;
+  uint64_t PageSize = sysconf(_SC_PAGESIZE);
+  uint64_t CountersSize = uint64_t(M->NumFunctions) *
+                          M->NumCountersPerFunction * M->CounterStride;
+  uint64_t Addr = reinterpret_cast<uintptr_t>(M->Counters);
+  bool Movable = M->CountersSize && M->CountersSize >= CountersSize &&
+                 M->CountersSize % PageSize == 0 && Addr % PageSize == 0;
+
+  uint64_t NamesOffset = ShmUsed;
+  uint64_t CountersOffset =
+      alignTo(NamesOffset + NamesSize, TUTOR_SHM_PAGE_SIZE);
+  uint64_t End =
+      Movable ? CountersOffset + M->CountersSize : NamesOffset + NamesSize;
+  if (End > Shm->Size) {
+    fprintf(stderr, "LLVM-TUTOR: the shared memory segment is full, increase "
+                    "%s\n",
+            TUTOR_SHM_SIZE_ENV_VAR);
+    return -1;
+  }
+
+  char *Base = reinterpret_cast<char *>(Shm);
+  char *Names = Base + NamesOffset;
+  for (uint32_t F = 0; F != M->NumFunctions; ++F) {
+    size_t Len = strlen(M->Functions[F].Name) + 1;
+    memcpy(Names, M->Functions[F].Name, Len);
+    Names += Len;
+  }
+
+  if (Movable) {
+    void *Counters = const_cast<void *>(M->Counters);
+    memcpy(Base + CountersOffset, Counters, M->CountersSize);
+    Movable = mmap(Counters, M->CountersSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, ShmFd, CountersOffset) != MAP_FAILED;
+  }
+  if (!Movable)
+    fprintf(stderr, "LLVM-TUTOR: the counters of a module are not exported "
+                    "(instrument it with -dynamic-cc-shm)\n");
+
+  TutorShmModule &Entry = Shm->Modules[Idx];
+  Entry.ModuleId = M->ModuleId;
+  Entry.State =
+      Movable ? TUTOR_SHM_MODULE_LIVE : TUTOR_SHM_MODULE_NOT_EXPORTED;
+  Entry.NumFunctions = M->NumFunctions;
+  Entry.NumCountersPerFunction = M->NumCountersPerFunction;
+  Entry.CounterSize = M->CounterSize;
+  Entry.CounterStride = M->CounterStride;
+  Entry.Reserved = 0;
+  Entry.Scale = M->Scale;
+  Entry.NamesOffset = NamesOffset;
+  Entry.CountersOffset = Movable ? CountersOffset : 0;
+  ShmUsed = alignTo(Movable ? End : NamesOffset + NamesSize, 8);
+  // Publish the entry
+  __atomic_store_n(&Shm->NumModules, Idx + 1, __ATOMIC_RELEASE);
+  return Idx;
+}
+
+// Marks the entry of a module as final and, once there are no modules left,
+// removes the segment. Must be called with Lock held.
+static void unexportModule(int32_t Idx) {
+  if (!Shm)
+    return;
+  if (Idx >= 0 && Shm->Modules[Idx].State == TUTOR_SHM_MODULE_LIVE)
+    __atomic_store_n(&Shm->Modules[Idx].State, TUTOR_SHM_MODULE_GONE,
+                     __ATOMIC_RELEASE);
+  if (LiveModules)
+    return;
+
+  // The segment stays mapped (the counters of the modules that are still
+  // around, e.g. in shared libraries that are never unloaded, live there)
+  shm_unlink(ShmName);
+  close(ShmFd);
+  ShmFd = -1;
+}
+
+//------------------------------------------------------------------------------
+// The interface of the runtime
+//------------------------------------------------------------------------------
+extern "C" void __tutor_rt_register_module(const TutorRtModule *M) {
+  if (M->Version != TUTOR_RT_VERSION) {
+    fprintf(stderr,
+            "LLVM-TUTOR: the module was instrumented for version %u of the "
+            "runtime (this is version %u), ignoring it\n",
+            M->Version, TUTOR_RT_VERSION);
+    return;
+  }
+
+  pthread_mutex_lock(&Lock);
+  if (Kind && M->Kind != Kind) {
+    fprintf(stderr,
+            "LLVM-TUTOR: the module records a different kind of profile, "
+            "ignoring it\n");
+    pthread_mutex_unlock(&Lock);
+    return;
+  }
+  Kind = M->Kind;
+  if (!Configured) {
+    Configured = true;
+    configureSnapshots();
+    configureShm();
+  }
+  if (!OutputPath && M->OutputPath)
+    OutputPath = strdup(M->OutputPath);
+
+  for (LiveModule *L = LiveModules; L; L = L->Next)
+    if (L->Desc->ModuleId == M->ModuleId && L->Desc != M)
+      fprintf(stderr,
+              "LLVM-TUTOR: two modules built from the same source file, the "
+              "results for their local functions are merged\n");
+
+  auto *L = static_cast<LiveModule *>(malloc(sizeof(LiveModule)));
+  if (L) {
+    L->Desc = M;
+    // Zeros, i.e. the first delta covers everything up to that snapshot
+    L->Last = SnapshotDelta
+                  ? static_cast<uint64_t *>(
+                        calloc(uint64_t(M->NumFunctions) *
+                                       M->NumCountersPerFunction +
+                                   1,
+                               sizeof(uint64_t)))
+                  : nullptr;
+    L->ShmIdx = exportModule(M);
+    L->Next = LiveModules;
+    LiveModules = L;
+  }
+  pthread_mutex_unlock(&Lock);
+}
+
+extern "C" void __tutor_rt_unregister_module(const TutorRtModule *M) {
+  pthread_mutex_lock(&Lock);
+  LiveModule **Link = &LiveModules;
+  while (*Link && (*Link)->Desc != M)
+    Link = &(*Link)->Next;
+  // Not registered (e.g. a different version of the runtime)
+  if (!*Link) {
+    pthread_mutex_unlock(&Lock);
+    return;
+  }
+
+  LiveModule *L = *Link;
+  *Link = L->Next;
+  int32_t ShmIdx = L->ShmIdx;
+  free(L->Last);
+  free(L);
+
+  // The counters are final, copy them before the module goes away
+  collect(M);
+  unexportModule(ShmIdx);
+  if (!LiveModules)
+    writeResults();
+  pthread_mutex_unlock(&Lock);
+}
@@ -0,0 +1,128 @@
+; RUN: opt -load-pass-plugin %shlibdir/libBranchProfiler%shlibext \
+; RUN:   -passes="branch-prof" %s -o %t.bin
+; RUN: rm -f %t.branchprof
+; RUN: env LLVM_TUTOR_BRANCHPROF_FILE=%t.branchprof lli %t.bin
+; RUN: FileCheck %s --input-file=%t.branchprof --check-prefix=PROFILE
+
+; Annotate the module with the profile and lay it out (the output must not
+; change, i.e. @main still returns 0)
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libBlockLayout%shlibext \
+; RUN:   -passes="prof-use,block-layout,verify" -prof-use-branches=%t.branchprof \
+; RUN:   -block-layout-report -S %s -o %t.ll 2>%t.report
+; RUN: FileCheck %s --input-file=%t.ll
+; RUN: FileCheck %s --input-file=%t.report --check-prefix=REPORT
+; RUN: lli %t.ll
+
+; Without peeling, the switch stays as it is
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libBlockLayout%shlibext \
+; RUN:   -passes="prof-use,block-layout" -prof-use-branches=%t.branchprof \
+; RUN:   -block-layout-switch-bias=101 -S %s | FileCheck %s --check-prefix=NO-PEEL
+
+; Instrument this file with BranchProfiler, run it, then use the profile to
+; reorder the blocks. @main calls both functions 100 times with x = 0..9:
+;  * in @classify, %rare runs 10 times and %common 90 times, so %common is
+;    moved after %entry (and %rare to the end),
+;  * in @dispatch, case 0 (that goes straight to %done) takes 90% of the
+;    executions, so it's peeled off the switch.
+
+; The entry count first, then one counter per successor
+; PROFILE: classify {{[0-9]+}} 3 100 10 90
+; PROFILE: dispatch {{[0-9]+}} 5 100 0 10 90 0
+; PROFILE: main {{[0-9]+}} 5 1 99 1 1 0
+
+; CHECK-LABEL: @classify(
+; CHECK-NEXT:  entry:
+; CHECK:         br i1 %is.rare, label %rare, label %common, !prof
+; CHECK:       common:
+; CHECK:       merge:
+; CHECK:       rare:
+; CHECK-NEXT:    %r = mul i32 %x, 3
+; CHECK-NEXT:    br label %merge
+; CHECK-NEXT:  }
+
+; CHECK-LABEL: @dispatch(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    %switch.hot = icmp eq i32 %op, 0
+; CHECK-NEXT:    br i1 %switch.hot, label %done, label %entry.switch, !prof [[HOT:![0-9]+]]
+; CHECK:       done:
+; CHECK-NEXT:    %v = phi i32 [ %s, %sub ], [ %a, %entry.switch ], [ 0, %other ], [ %a, %entry ]
+; CHECK:       entry.switch:
+; CHECK-NEXT:    switch i32 %op, label %other [
+; CHECK-NEXT:      i32 1, label %sub
+; CHECK-NEXT:      i32 2, label %done
+; CHECK-NEXT:    ], !prof [[COLD:![0-9]+]]
+
+; CHECK-DAG: [[HOT]] = !{!"branch_weights", i32 90, i32 10}
+; CHECK-DAG: [[COLD]] = !{!"branch_weights", i32 0, i32 10, i32 0}
+
+; The branches that ran 100 times may be reported as 99: the counts are
+; estimated from the block frequencies (BFI rounds them when converting to
+; counts) and the edge probabilities (31-bit fixed-point values that
+; BranchProbability::scale rounds down). Either rounding is accepted.
+; REPORT:      FUNCTION             BEFORE         AFTER          CHANGE
+; REPORT:      classify             {{99|100}} 20 {{-79.8|-80.0}}%
+; REPORT-NEXT: dispatch             {{99|100}} 20 {{-79.8|-80.0}}%
+; REPORT-NEXT:   peeled switches: 1
+; REPORT:      total
+
+; NO-PEEL-LABEL: @dispatch(
+; NO-PEEL-NEXT:  entry:
+; NO-PEEL-NEXT:    switch i32 %op, label %other [
+
+define i32 @classify(i32 %x) {
+entry:
+  %is.rare = icmp eq i32 %x, 7
+  br i1 %is.rare, label %rare, label %common
+rare:
+  %r = mul i32 %x, 3
+  br label %merge
+common:
+  %c = add i32 %x, 1
+  br label %merge
+merge:
+  %v = phi i32 [%r, %rare], [%c, %common]
+  ret i32 %v
+}
+
+define i32 @dispatch(i32 %op, i32 %a) {
+entry:
+  switch i32 %op, label %other [ i32 1, label %sub
+                                 i32 0, label %done
+                                 i32 2, label %done ]
+sub:
+  %s = sub i32 %a, 1
+  br label %done
+other:
+  br label %done
+done:
+  %v = phi i32 [%s, %sub], [%a, %entry], [%a, %entry], [0, %other]
+  ret i32 %v
+}
+
+; Returns 0 if the sum of the results is right
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %sum = phi i32 [0, %entry], [%sum.next, %loop]
+  %x = urem i32 %i, 10
+  %r1 = call i32 @classify(i32 %x)
+  %is.sub = icmp eq i32 %x, 3
+  %op = zext i1 %is.sub to i32
+  %r2 = call i32 @dispatch(i32 %op, i32 %x)
+  %r = add i32 %r1, %r2
+  %sum.next = add i32 %sum, %r
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, 100
+  br i1 %c, label %loop, label %exit
+exit:
+  %ok = icmp eq i32 %sum.next, 1120
+  br i1 %ok, label %pass, label %fail
+pass:
+  ret i32 0
+fail:
+  ret i32 1
+}
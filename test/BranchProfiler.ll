@@ -0,0 +1,69 @@
+; RUN: opt -load-pass-plugin %shlibdir/libBranchProfiler%shlibext \
+; RUN:   -passes="branch-prof,verify" -S %s | FileCheck %s
+
+; Verify the counters injected by BranchProfiler. Every function has an entry
+; counter, followed by a counter for every successor of every conditional
+; branch and switch. The counter of a conditional branch is selected on its
+; condition, every edge out of a switch gets a new block (with an entry of
+; its own in the PHIs, even if it shares the destination with other edges).
+
+; CHECK: @BranchProfCounters = internal global [7 x i64] zeroinitializer
+; CHECK: @BranchProfTable = private constant [2 x { ptr, i64, i32, ptr }]
+; CHECK-SAME: i32 3, ptr @BranchProfCounters
+; CHECK-SAME: i32 4, ptr getelementptr inbounds ([7 x i64], ptr @BranchProfCounters, i64 0, i64 3)
+; CHECK: @llvm.global_dtors = appending global
+; CHECK-SAME: @branchprof_dump
+
+define i32 @diamond(i1 %c) {
+; CHECK-LABEL: @diamond(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    [[ENTRY:%.*]] = load i64, ptr @BranchProfCounters
+; CHECK-NEXT:    [[ENTRY_INC:%.*]] = add i64 1, [[ENTRY]]
+; CHECK-NEXT:    store i64 [[ENTRY_INC]], ptr @BranchProfCounters
+; CHECK-NEXT:    %branch.counter = select i1 %c, i64 1, i64 2
+; CHECK-NEXT:    [[PTR:%.*]] = getelementptr inbounds [7 x i64], ptr @BranchProfCounters, i64 0, i64 %branch.counter
+; CHECK-NEXT:    [[COUNT:%.*]] = load i64, ptr [[PTR]]
+; CHECK-NEXT:    [[INC:%.*]] = add i64 1, [[COUNT]]
+; CHECK-NEXT:    store i64 [[INC]], ptr [[PTR]]
+; CHECK-NEXT:    br i1 %c, label %then, label %merge
+entry:
+  br i1 %c, label %then, label %merge
+then:
+  br label %merge
+merge:
+  %r = phi i32 [1, %then], [0, %entry]
+  ret i32 %r
+}
+
+define i32 @dispatch(i32 %op) {
+; CHECK-LABEL: @dispatch(
+; CHECK:         switch i32 %op, label %entry.prof [
+; CHECK-NEXT:      i32 0, label %entry.prof1
+; CHECK-NEXT:      i32 1, label %entry.prof2
+; CHECK-NEXT:    ]
+; CHECK:       entry.prof1:
+; CHECK-NEXT:    load i64, ptr getelementptr inbounds ([7 x i64], ptr @BranchProfCounters, i64 0, i64 5)
+; CHECK:         br label %zero
+; CHECK:       entry.prof:
+; CHECK-NEXT:    load i64, ptr getelementptr inbounds ([7 x i64], ptr @BranchProfCounters, i64 0, i64 4)
+; CHECK:         br label %merge
+; CHECK:       entry.prof2:
+; CHECK-NEXT:    load i64, ptr getelementptr inbounds ([7 x i64], ptr @BranchProfCounters, i64 0, i64 6)
+; CHECK:         br label %merge
+; CHECK:       merge:
+; CHECK-NEXT:    %r = phi i32 [ 2, %entry.prof ], [ 2, %entry.prof2 ], [ 4, %zero ]
+entry:
+  switch i32 %op, label %merge [ i32 0, label %zero
+                                 i32 1, label %merge ]
+zero:
+  br label %merge
+merge:
+  %r = phi i32 [2, %entry], [2, %entry], [4, %zero]
+  ret i32 %r
+}
+
+; CHECK-LABEL: define internal void @branchprof_dump()
+; CHECK:         call ptr @getenv(ptr @branchprof.env)
+; CHECK:         call ptr @fopen(
+; CHECK:         call i32 (ptr, ptr, ...) @fprintf(ptr %file, ptr @branchprof.record_fmt
+; CHECK:         call i32 @fclose(ptr %file)
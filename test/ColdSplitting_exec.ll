@@ -0,0 +1,112 @@
+; Instrument with EdgeProfiler, run, annotate the uninstrumented module and
+; split off the cold regions
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" %s -o %t.bin
+; RUN: rm -f %t.edgeprof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.edgeprof lli %t.bin
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libColdSplitting%shlibext \
+; RUN:   -passes="prof-use,cold-split" -prof-use-edges=%t.edgeprof \
+; RUN:   -cold-split-report -S %s -o %t.ll 2>%t.report
+; RUN: FileCheck %s < %t.ll
+; RUN: FileCheck %s --input-file=%t.report --check-prefix=REPORT
+
+; The program still works (it returns 0)
+; RUN: lli %t.ll
+
+; Nothing is worth splitting with a higher threshold
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libColdSplitting%shlibext \
+; RUN:   -passes="prof-use,cold-split" -prof-use-edges=%t.edgeprof \
+; RUN:   -cold-split-threshold=100 -S %s | FileCheck %s --check-prefix=NOSPLIT
+
+; @main calls @checked and @tiny with 0, 1, ..., 9. The error path in
+; @checked never runs and is split off. The rare path in @tiny never runs
+; either, but it's too small to be worth a call.
+
+; CHECK-LABEL: define i32 @checked(i32 %x)
+; CHECK:         br i1 %bad, label %codeRepl, label %ok
+; CHECK:       ok:
+; CHECK:       exit:
+; CHECK-NEXT:    %r = phi i32 [ %g.reload, %codeRepl ], [ %h, %ok ]
+; The call is at the end of the function
+; CHECK:       codeRepl:
+; CHECK:         call void @checked.cold(i32 %x, ptr %g.loc)
+; CHECK:         %g.reload = load i32, ptr %g.loc
+; CHECK:         br label %exit
+; CHECK-NEXT:  }
+
+; CHECK-LABEL: define i32 @tiny(i32 %x)
+; CHECK:       rare:
+; CHECK-NEXT:    %y = shl i32 %x, 1
+
+; CHECK:       ; Function Attrs: cold minsize noinline
+; CHECK-NEXT:  define internal void @checked.cold(i32 %x, ptr %g.out) #[[ATTRS:[0-9]+]] section ".text.unlikely.checked.cold"
+; CHECK:         %g = or i32 %f, 1
+; CHECK-NEXT:    store i32 %g, ptr %g.out
+; CHECK:       attributes #[[ATTRS]] = { cold minsize noinline }
+
+; REPORT:      FUNCTION             #REGIONS   SIZE MOVED
+; REPORT-NEXT: -------------------------------------------------
+; REPORT-NEXT: checked              1          {{[0-9]+}} ({{[0-9.]+}}%)
+; REPORT-NEXT: -------------------------------------------------
+
+; NOSPLIT-NOT: .cold
+
+define i32 @checked(i32 %x) {
+entry:
+  %bad = icmp slt i32 %x, 0
+  br i1 %bad, label %error, label %ok
+
+error:
+  %a = mul i32 %x, %x
+  %b = add i32 %a, 7
+  %c = xor i32 %b, 12345
+  %d = mul i32 %c, %x
+  %e = sub i32 0, %d
+  %f = udiv i32 %e, 3
+  %g = or i32 %f, 1
+  br label %exit
+
+ok:
+  %h = add i32 %x, 1
+  br label %exit
+
+exit:
+  %r = phi i32 [ %g, %error ], [ %h, %ok ]
+  ret i32 %r
+}
+
+define i32 @tiny(i32 %x) {
+entry:
+  %big = icmp eq i32 %x, 1000
+  br i1 %big, label %rare, label %exit
+
+rare:
+  %y = shl i32 %x, 1
+  br label %exit
+
+exit:
+  %r = phi i32 [ %y, %rare ], [ %x, %entry ]
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %loop ]
+  %a = call i32 @checked(i32 %i)
+  %b = call i32 @tiny(i32 %i)
+  %ab = add i32 %a, %b
+  %sum.next = add i32 %sum, %ab
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %r = sub i32 %sum.next, 100
+  ret i32 %r
+}
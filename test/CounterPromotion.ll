@@ -0,0 +1,117 @@
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libCounterPromotion%shlibext \
+; RUN:   -passes="edge-prof,promote-counters" -edge-prof-mode=blocks -S %s \
+; RUN:   | FileCheck %s
+
+; Instrument every basic block with EdgeProfiler and verify that the counter
+; updates in loops are kept in registers and flushed when the loops are left.
+
+; CHECK: @EdgeProfCounters = internal global [14 x i64] zeroinitializer, align 8, !llvm-tutor.counters
+
+declare void @ext(i32)
+
+; Two exits: the loop ends, or an element is negative
+; CHECK-LABEL: define i32 @find
+; CHECK:      header:
+; CHECK-NOT:    EdgeProfCounters
+; CHECK:        [[HEADER_NEXT:%.*]] = add i64 1, {{%.*}}
+; CHECK:      body:
+; CHECK-NEXT:   [[BODY_NEXT:%.*]] = add i64 1, {{%.*}}
+; CHECK-NOT:    EdgeProfCounters
+; CHECK:      found:
+; CHECK-NEXT:   [[C1:%.*]] = load i64, ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; CHECK-NEXT:   [[S1:%.*]] = add i64 [[C1]], [[HEADER_NEXT]]
+; CHECK-NEXT:   store i64 [[S1]], ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; CHECK-NEXT:   [[C2:%.*]] = load i64, ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+; CHECK-NEXT:   [[S2:%.*]] = add i64 [[C2]], [[BODY_NEXT]]
+; CHECK-NEXT:   store i64 [[S2]], ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+; CHECK:      not.found:
+; CHECK-NEXT:   [[C1:%.*]] = load i64, ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; CHECK-NEXT:   [[S1:%.*]] = add i64 [[C1]], [[HEADER_NEXT]]
+; CHECK-NEXT:   store i64 [[S1]], ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+define i32 @find(ptr %a, i32 %n) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %done = icmp sge i32 %i, %n
+  br i1 %done, label %not.found, label %body
+
+body:
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %v = load i32, ptr %p
+  %neg = icmp slt i32 %v, 0
+  br i1 %neg, label %found, label %latch
+
+latch:
+  %i.next = add i32 %i, 1
+  br label %header
+
+found:
+  ret i32 %i
+
+not.found:
+  ret i32 -1
+}
+
+; Nested loops: the flush after the inner loop is promoted in the outer loop
+; CHECK-LABEL: define i32 @nested
+; CHECK:      inner:
+; CHECK-NEXT:   [[INNER:%.*]] = phi i64 [ 0, %outer ], [ [[INNER_NEXT:%.*]], %inner ]
+; CHECK:        [[INNER_NEXT]] = add i64 1, [[INNER]]
+; CHECK:      outer.latch:
+; CHECK-NEXT:   [[OUTER_NEXT:%.*]] = add i64 {{%.*}}, [[INNER_NEXT]]
+; CHECK-NOT:    EdgeProfCounters
+; CHECK:      exit:
+; CHECK:        [[C8:%.*]] = load i64, ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 8)
+; CHECK-NEXT:   [[S8:%.*]] = add i64 [[C8]], [[OUTER_NEXT]]
+; CHECK-NEXT:   store i64 [[S8]], ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 8)
+define i32 @nested(i32 %n) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %s = phi i32 [ 0, %entry ], [ %s.inner, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner ]
+  %s.inner = phi i32 [ %s, %outer ], [ %s.next, %inner ]
+  %s.next = add i32 %s.inner, %j
+  %j.next = add i32 %j, 1
+  %inner.done = icmp eq i32 %j.next, %n
+  br i1 %inner.done, label %outer.latch, label %inner
+
+outer.latch:
+  %i.next = add i32 %i, 1
+  %outer.done = icmp eq i32 %i.next, %n
+  br i1 %outer.done, label %exit, label %outer
+
+exit:
+  ret i32 %s.next
+}
+
+; A call that may read the counters (e.g. `exit`), nothing is promoted
+; CHECK-LABEL: define void @calls
+; CHECK:      loop:
+; CHECK-NEXT:   %i = phi i32
+; CHECK-NEXT:   [[C12:%.*]] = load i64, ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 12)
+; CHECK-NEXT:   [[S12:%.*]] = add i64 1, [[C12]]
+; CHECK-NEXT:   store i64 [[S12]], ptr getelementptr inbounds ([14 x i64], ptr @EdgeProfCounters, i64 0, i64 12)
+; CHECK-NEXT:   call void @ext(i32 %i)
+define void @calls(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  call void @ext(i32 %i)
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
@@ -0,0 +1,87 @@
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" -edge-prof-mode=blocks %s -o %t.bin
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libCounterPromotion%shlibext \
+; RUN:   -passes="edge-prof,promote-counters" -edge-prof-mode=blocks %s \
+; RUN:   -o %t.promoted.bin
+; RUN: rm -f %t.prof %t.promoted.prof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.prof lli %t.bin
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.promoted.prof lli %t.promoted.bin
+; RUN: ../bin/edgeprof %s %t.promoted.prof | FileCheck %s
+
+; The promoted counters must add up to exactly the same profile
+; RUN: diff %t.prof %t.promoted.prof
+
+; Instrument this file with and without CounterPromotion, run both and verify
+; that the profiles are identical (for loops with multiple exits and nested
+; loops).
+
+@Data = internal constant [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 -6, i32 7, i32 8]
+
+; Two exits: the loop ends, or an element is negative
+define i32 @find(ptr %a, i32 %n) {
+entry:
+  br label %header
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %done = icmp sge i32 %i, %n
+  br i1 %done, label %not.found, label %body
+body:
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %v = load i32, ptr %p
+  %neg = icmp slt i32 %v, 0
+  br i1 %neg, label %found, label %latch
+latch:
+  %i.next = add i32 %i, 1
+  br label %header
+found:
+  ret i32 %i
+not.found:
+  ret i32 -1
+}
+
+define i32 @nested(i32 %n) {
+entry:
+  br label %outer
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %s = phi i32 [ 0, %entry ], [ %s.inner, %outer.latch ]
+  br label %inner
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner ]
+  %s.inner = phi i32 [ %s, %outer ], [ %s.next, %inner ]
+  %s.next = add i32 %s.inner, %j
+  %j.next = add i32 %j, 1
+  %inner.done = icmp eq i32 %j.next, %n
+  br i1 %inner.done, label %outer.latch, label %inner
+outer.latch:
+  %i.next = add i32 %i, 1
+  %outer.done = icmp eq i32 %i.next, %n
+  br i1 %outer.done, label %exit, label %outer
+exit:
+  ret i32 %s.next
+}
+
+define i32 @main() {
+entry:
+  %found = call i32 @find(ptr @Data, i32 8)
+  %not.found = call i32 @find(ptr @Data, i32 4)
+  %sum = call i32 @nested(i32 3)
+  ret i32 0
+}
+
+; CHECK: Function: find (entry count: 2)
+; CHECK: BLOCK COUNT
+; CHECK-NEXT: %entry 2
+; CHECK-NEXT: %header 11
+; CHECK-NEXT: %body 10
+; CHECK-NEXT: %latch 9
+; CHECK-NEXT: %found 1
+; CHECK-NEXT: %not.found 1
+; CHECK: Function: nested (entry count: 1)
+; CHECK: BLOCK COUNT
+; CHECK-NEXT: %entry 1
+; CHECK-NEXT: %outer 3
+; CHECK-NEXT: %inner 9
+; CHECK-NEXT: %outer.latch 3
+; CHECK-NEXT: %exit 1
@@ -0,0 +1,90 @@
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage,verify" -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage,verify" -coverage-update=test-and-store -S %s \
+; RUN:   | FileCheck %s --check-prefix=TEST
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage,verify" -coverage-level=function -S %s \
+; RUN:   | FileCheck %s --check-prefix=FUNCTION
+
+; Verify the flags injected by Coverage. By default every basic block gets a
+; one-byte flag that's set with a plain store. With test-and-store, the flag
+; is only stored if it's not set yet. With -coverage-level=function, only the
+; entry blocks are instrumented. The static allocas stay in the entry block
+; (test-and-store splits it).
+
+; CHECK: @CoverageFlags = internal global [6 x i8] zeroinitializer
+; CHECK: @CoverageTable = private constant [3 x { ptr, i64, i32, ptr }]
+; CHECK: @llvm.global_dtors = appending global
+; CHECK-SAME: @coverage_dump
+
+; FUNCTION: @CoverageFlags = internal global [3 x i8] zeroinitializer
+
+define i32 @diamond(i1 %c) {
+; CHECK-LABEL: @diamond(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    store atomic i8 1, ptr @CoverageFlags monotonic, align 1
+; CHECK-NEXT:    br i1 %c, label %then, label %else
+; CHECK:       then:
+; CHECK-NEXT:    store atomic i8 1, ptr getelementptr inbounds ([6 x i8], ptr @CoverageFlags, i64 0, i64 1) monotonic, align 1
+; CHECK-NEXT:    br label %merge
+; CHECK:       else:
+; CHECK-NEXT:    store atomic i8 1, ptr getelementptr inbounds ([6 x i8], ptr @CoverageFlags, i64 0, i64 2) monotonic, align 1
+; CHECK-NEXT:    br label %merge
+; CHECK:       merge:
+; CHECK-NEXT:    %r = phi i32
+; CHECK-NEXT:    store atomic i8 1, ptr getelementptr inbounds ([6 x i8], ptr @CoverageFlags, i64 0, i64 3) monotonic, align 1
+; CHECK-NEXT:    ret i32 %r
+
+; TEST-LABEL: @diamond(
+; TEST-NEXT:  entry:
+; TEST-NEXT:    %cov.flag = load atomic i8, ptr @CoverageFlags monotonic, align 1
+; TEST-NEXT:    %cov.unset = icmp eq i8 %cov.flag, 0
+; TEST-NEXT:    br i1 %cov.unset, label %cov.set, label %cov.cont, !prof [[WEIGHTS:![0-9]+]]
+; TEST:       cov.set:
+; TEST-NEXT:    store atomic i8 1, ptr @CoverageFlags monotonic, align 1
+; TEST-NEXT:    br label %cov.cont
+; TEST:       cov.cont:
+; TEST-NEXT:    br i1 %c, label %then, label %else
+
+; FUNCTION-LABEL: @diamond(
+; FUNCTION-NEXT:  entry:
+; FUNCTION-NEXT:    store atomic i8 1, ptr @CoverageFlags monotonic, align 1
+; FUNCTION-NOT:     store
+; FUNCTION:         ret i32 %r
+entry:
+  br i1 %c, label %then, label %else
+then:
+  br label %merge
+else:
+  br label %merge
+merge:
+  %r = phi i32 [1, %then], [2, %else]
+  ret i32 %r
+}
+
+define void @leaf() {
+; CHECK-LABEL: @leaf(
+; CHECK-NEXT:    store atomic i8 1, ptr getelementptr inbounds ([6 x i8], ptr @CoverageFlags, i64 0, i64 4) monotonic, align 1
+; CHECK-NEXT:    ret void
+
+; FUNCTION-LABEL: @leaf(
+; FUNCTION-NEXT:    store atomic i8 1, ptr getelementptr inbounds ([3 x i8], ptr @CoverageFlags, i64 0, i64 1) monotonic, align 1
+  ret void
+}
+
+define i32 @with_alloca(i32 %x) {
+; TEST-LABEL: @with_alloca(
+; TEST-NEXT:  entry:
+; TEST-NEXT:    %slot = alloca i32, align 4
+; TEST-NEXT:    %cov.flag = load atomic i8, ptr getelementptr inbounds ([6 x i8], ptr @CoverageFlags, i64 0, i64 5) monotonic, align 1
+; TEST:       cov.cont:
+; TEST-NEXT:    store i32 %x, ptr %slot, align 4
+entry:
+  %slot = alloca i32, align 4
+  store i32 %x, ptr %slot, align 4
+  %v = load i32, ptr %slot, align 4
+  ret i32 %v
+}
+
+; TEST: [[WEIGHTS]] = !{!"branch_weights", i32 1, i32 1048575}
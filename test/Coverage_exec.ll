@@ -0,0 +1,92 @@
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage" %s -o %t.bin
+; RUN: rm -f %t.covmap
+; RUN: env LLVM_TUTOR_COVERAGE_FILE=%t.covmap lli %t.bin
+; RUN: FileCheck %s --input-file=%t.covmap --check-prefix=MAP
+; RUN: ../bin/tutor-cov -show-uncovered %s %t.covmap | FileCheck %s
+
+; Every run appends to the map, tutor-cov merges the runs (one more argument
+; takes the `big` path)
+; RUN: env LLVM_TUTOR_COVERAGE_FILE=%t.covmap lli %t.bin extra
+; RUN: ../bin/tutor-cov %s %t.covmap | FileCheck %s --check-prefix=MERGED
+
+; With test-and-store (the same map format)
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage" -coverage-update=test-and-store %s -o %t.test.bin
+; RUN: rm -f %t.test.covmap
+; RUN: env LLVM_TUTOR_COVERAGE_FILE=%t.test.covmap lli %t.test.bin
+; RUN: ../bin/tutor-cov %s %t.test.covmap | FileCheck %s --check-prefix=SUMMARY
+
+; With -coverage-level=function
+; RUN: opt -load-pass-plugin %shlibdir/libCoverage%shlibext \
+; RUN:   -passes="coverage" -coverage-level=function %s -o %t.fn.bin
+; RUN: rm -f %t.fn.covmap
+; RUN: env LLVM_TUTOR_COVERAGE_FILE=%t.fn.covmap lli %t.fn.bin
+; RUN: ../bin/tutor-cov %s %t.fn.covmap | FileCheck %s --check-prefix=FUNCTION
+
+; Instrument this file with Coverage, run it and verify the coverage map and
+; the report. @classify has 4 blocks (only 3 run), @unused (9 blocks, so that
+; the bitmap spans two bytes) never runs.
+
+; MAP: classify block {{[0-9]+}} 4 0b
+; MAP: unused block {{[0-9]+}} 9 0000
+; MAP: main block {{[0-9]+}} 1 01
+
+; CHECK:      classify             3/4 (75.0%)
+; CHECK-NEXT:   never ran: %big
+; CHECK-NEXT: unused               0/9 (0.0%)
+; CHECK-NEXT:   never ran: %entry
+; CHECK:      main                 1/1 (100.0%)
+; CHECK:      functions: 2/3 (66.7%)
+; CHECK-NEXT: blocks: 4/14 (28.6%)
+
+; MERGED:     classify             4/4 (100.0%)
+; MERGED:     blocks: 5/14 (35.7%)
+
+; SUMMARY:    functions: 2/3 (66.7%)
+; SUMMARY-NEXT: blocks: 4/14 (28.6%)
+
+; FUNCTION:      classify             1/1 (100.0%)
+; FUNCTION-NEXT: unused               0/1 (0.0%)
+; FUNCTION-NEXT: main                 1/1 (100.0%)
+; FUNCTION:      functions: 2/3 (66.7%)
+; FUNCTION-NOT:  blocks:
+
+define i32 @classify(i32 %x) {
+entry:
+  %c = icmp slt i32 %x, 2
+  br i1 %c, label %small, label %big
+small:
+  br label %merge
+big:
+  br label %merge
+merge:
+  %r = phi i32 [1, %small], [2, %big]
+  ret i32 %r
+}
+
+define i32 @unused(i32 %x) {
+entry:
+  br label %b1
+b1:
+  br label %b2
+b2:
+  br label %b3
+b3:
+  br label %b4
+b4:
+  br label %b5
+b5:
+  br label %b6
+b6:
+  br label %b7
+b7:
+  br label %b8
+b8:
+  ret i32 %x
+}
+
+define i32 @main(i32 %argc, ptr %argv) {
+  %r = call i32 @classify(i32 %argc)
+  ret i32 0
+}
@@ -4,19 +4,33 @@
 ; is correct.
 
 ; The global variables inserted by the pass
-; CHECK: @CounterFor_foo = common global i32 0, align 4
+; CHECK: @CallCounters = internal global [2 x i32] zeroinitializer, align 4
 ; CHECK-NEXT: @0 = private unnamed_addr constant [4 x i8] c"foo\00", align 1
-; CHECK-NEXT: @ResultFormatStrIR = global [14 x i8]
+; CHECK-NEXT: @1 = private unnamed_addr constant [4 x i8] c"bar\00", align 1
+; CHECK-NEXT: @ResultFormatStrIR = global [15 x i8]
 ; CHECK-NEXT: @ResultHeaderStrIR = global [225 x i8]
-; CHECK-NEXT: @llvm.global_dtors = appending global
+; CHECK-NEXT: @CallCounterTable = private constant [2 x { ptr, ptr }]
+; CHECK-DAG: { ptr @0, ptr @CallCounters }
+; CHECK-DAG: { ptr @1, ptr getelementptr inbounds ([2 x i32], ptr @CallCounters, i64 0, i64 1) }
+; CHECK: @llvm.global_dtors = appending global
 ; CHECK-SAME: @printf_wrapper
 
 define void @foo() {
 ; CHECK-LABEL: @foo(
 ; Call-counting instructions inserted by the pass
-; CHECK-NEXT:    [[TMP1:%.*]] = load i32, ptr @CounterFor_foo
+; CHECK-NEXT:    [[TMP1:%.*]] = load i32, ptr @CallCounters
 ; CHECK-NEXT:    [[TMP2:%.*]] = add i32 1, [[TMP1]]
-; CHECK-NEXT:    store i32 [[TMP2]], ptr @CounterFor_foo
+; CHECK-NEXT:    store i32 [[TMP2]], ptr @CallCounters
+; CHECK-NEXT:    ret void
+;
+  ret void
+}
+
+define void @bar() {
+; CHECK-LABEL: @bar(
+; CHECK-NEXT:    [[TMP1:%.*]] = load i32, ptr getelementptr inbounds ([2 x i32], ptr @CallCounters, i64 0, i64 1)
+; CHECK-NEXT:    [[TMP2:%.*]] = add i32 1, [[TMP1]]
+; CHECK-NEXT:    store i32 [[TMP2]], ptr getelementptr inbounds ([2 x i32], ptr @CallCounters, i64 0, i64 1)
 ; CHECK-NEXT:    ret void
 ;
   ret void
@@ -25,13 +39,25 @@ define void @foo() {
 ; Declaration of `printf` inserted by the pass
 ; CHECK: declare i32 @printf(ptr nocapture readonly, ...) #0
 
-; Definition of `printf_wrapper` inserted by the pass
+; Definition of `printf_wrapper` inserted by the pass. Regardless of the number
+; of instrumented functions, this is a single loop over @CallCounterTable.
 ; CHECK: define void @printf_wrapper() {
 ; CHECK-NEXT: enter:
 ; CHECK-NEXT:  %0 = call i32 (ptr, ...) @printf
 ; CHECK-SAME: @ResultHeaderStrIR
-; CHECK-NEXT:  %1 = load i32, ptr @CounterFor_foo
-; CHECK-NEXT:  %2 = call i32 (ptr, ...) @printf
-; CHECK-SAME: @ResultFormatStrIR
+; CHECK-NEXT:  br label %loop
+; CHECK: loop:
+; CHECK-NEXT:  %idx = phi i64 [ 0, %enter ], [ %idx.next, %loop ]
+; CHECK-NEXT:  [[NAME_PTR:%.*]] = getelementptr inbounds [2 x { ptr, ptr }], ptr @CallCounterTable, i64 0, i64 %idx, i32 0
+; CHECK-NEXT:  %name = load ptr, ptr [[NAME_PTR]]
+; CHECK-NEXT:  [[COUNTER_PTR:%.*]] = getelementptr inbounds [2 x { ptr, ptr }], ptr @CallCounterTable, i64 0, i64 %idx, i32 1
+; CHECK-NEXT:  %counter = load ptr, ptr [[COUNTER_PTR]]
+; CHECK-NEXT:  [[COUNT:%.*]] = load i32, ptr %counter
+; CHECK-NEXT:  [[COUNT_EXT:%.*]] = zext i32 [[COUNT]] to i64
+; CHECK-NEXT:  {{%.*}} = call i32 (ptr, ...) @printf(ptr @ResultFormatStrIR, ptr %name, i64 [[COUNT_EXT]])
+; CHECK-NEXT:  %idx.next = add nuw i64 %idx, 1
+; CHECK-NEXT:  [[DONE:%.*]] = icmp eq i64 %idx.next, 2
+; CHECK-NEXT:  br i1 [[DONE]], label %exit, label %loop
+; CHECK: exit:
 ; CHECK-NEXT:  ret void
 ; CHECK-NEXT: }
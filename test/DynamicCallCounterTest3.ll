@@ -2,9 +2,10 @@
 
 declare void @foo()
 
-; CHECK-NOT: @CounterFor_foo
-; CHECK-NOT: @ResultFormatStrIR = global [14 x i8]
+; CHECK-NOT: @CallCounters
+; CHECK-NOT: @ResultFormatStrIR = global [15 x i8]
 ; CHECK-NOT: @ResultHeaderStrIR = global [225 x i8]
+; CHECK-NOT: @CallCounterTable
 
 ; CHECK: declare void @foo()
 
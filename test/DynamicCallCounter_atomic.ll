@@ -0,0 +1,41 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=atomic -S %s \
+; RUN:   | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=atomic \
+; RUN:   -dynamic-cc-cache-line-size=128 -S %s | FileCheck %s --check-prefix=PAD128
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=atomic \
+; RUN:   -dynamic-cc-cache-line-size=0 -S %s | FileCheck %s --check-prefix=NOPAD
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=atomic \
+; RUN:   %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: lli %t.bin | FileCheck %s --check-prefix=EXEC
+
+; Verify that with -dynamic-cc-counters=atomic the call counters are 64-bit
+; wide, padded to a cache line each and incremented atomically.
+
+; CHECK: @CallCounters = internal global [1 x { i64, [56 x i8] }] zeroinitializer, align 64
+; PAD128: @CallCounters = internal global [1 x { i64, [120 x i8] }] zeroinitializer, align 128
+; NOPAD: @CallCounters = internal global [1 x i64] zeroinitializer, align 8
+
+define void @foo() {
+; CHECK-LABEL: @foo(
+; CHECK-NEXT:    {{%.*}} = atomicrmw add ptr @CallCounters, i64 1 monotonic, align 64
+; CHECK-NEXT:    ret void
+; NOPAD-LABEL: @foo(
+; NOPAD-NEXT:    {{%.*}} = atomicrmw add ptr @CallCounters, i64 1 monotonic, align 8
+; NOPAD-NEXT:    ret void
+  ret void
+}
+
+; CHECK: define void @printf_wrapper() {
+; CHECK:       %counter = load ptr
+; CHECK-NEXT:  [[COUNT:%.*]] = load atomic i64, ptr %counter monotonic, align 64
+; CHECK-NEXT:  {{%.*}} = call i32 (ptr, ...) @printf(ptr @ResultFormatStrIR, ptr %name, i64 [[COUNT]])
+
+; EXEC: bar                  2
+; EXEC-NEXT: main                 1
+; EXEC-NEXT: foo                  13
+; EXEC-NEXT: fez                  1
@@ -0,0 +1,141 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -S %s | FileCheck %s
+
+; Only the first `%p` is replaced with the process ID
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-output=%%p.%%p.%%d.tutorprof \
+; RUN:   -S %s | FileCheck %s --check-prefix=PATH
+
+; The flags passed to `open` and `mmap` depend on the target OS
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -mtriple=x86_64-unknown-linux-gnu -S %s \
+; RUN:   | FileCheck %s --check-prefix=LINUX
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -mtriple=arm64-apple-macosx -S %s | FileCheck %s --check-prefix=DARWIN
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -mtriple=i686-unknown-linux-gnu -S %s | FileCheck %s --check-prefix=ILP32
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -mtriple=i686-unknown-linux-musl -S %s | FileCheck %s --check-prefix=MUSL
+; RUN: not opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-output=calls.%%p.tutorprof \
+; RUN:   -mtriple=x86_64-pc-windows-msvc -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=UNSUPPORTED
+
+; Run the instrumented CallCounterInput.ll twice (one profile per process) and
+; merge the profiles
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-output=%t.run.%%p.tutorprof \
+; RUN:   %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: rm -f %t.run.*.tutorprof
+; RUN: lli %t.bin
+; RUN: lli %t.bin
+; RUN: ../bin/tutor-profdata merge -format=text %t.run.*.tutorprof \
+; RUN:   | FileCheck %s --check-prefix=TEXT
+
+; Atomic (i.e. 64-bit and padded) counters, the file name set at run-time
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-counters=atomic \
+; RUN:   -dynamic-cc-output=unused.tutorprof %S/Inputs/CallCounterInput.ll \
+; RUN:   -o %t.atomic.bin
+; RUN: env LLVM_TUTOR_PROFILE_FILE=%t.atomic.tutorprof lli %t.atomic.bin
+; RUN: ../bin/tutor-profdata merge -format=json %t.atomic.tutorprof \
+; RUN:   | FileCheck %s --check-prefix=JSON
+
+; Merged profiles can be merged again
+; RUN: ../bin/tutor-profdata merge %t.run.*.tutorprof -o %t.merged
+; RUN: ../bin/tutor-profdata merge -format=text %t.merged %t.atomic.tutorprof \
+; RUN:   | FileCheck %s --check-prefix=REMERGED
+
+; A truncated profile can still be read
+; RUN: head -c 224 %t.merged > %t.truncated
+; RUN: ../bin/tutor-profdata merge -format=text %t.truncated 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=TRUNCATED
+
+; Verify that with -dynamic-cc-output the call counters are moved into a
+; binary profile by `dynamic_cc_open_profile` (they are padded to 64 KiB for
+; that) and that the profile is completed by `dynamic_cc_write_profile` (rather
+; than printed).
+
+; CHECK: @CallCounters = internal global [16384 x i32] zeroinitializer, align 65536
+; CHECK: @CallCounterProfileImage = private constant [135 x i8] c"TUTRPROF\01\00\00\00\01\00\00\00\00
+; CHECK-SAME: foomain", align 8
+; CHECK: @dynamic_cc.path_fmt = {{.*}} c"calls.%d.tutorprof\00"
+; CHECK: @llvm.global_ctors = {{.*}} @dynamic_cc_open_profile
+; CHECK: @llvm.global_dtors = {{.*}} @dynamic_cc_write_profile
+; CHECK-NOT: printf_wrapper
+
+; CHECK-LABEL: define internal void @dynamic_cc_open_profile()
+; CHECK:         %fd = call i32 (ptr, i32, ...) @open(ptr %path,
+; CHECK:         call i32 @ftruncate(i32 %fd, i64 131072)
+; CHECK:         %mapping = call ptr @mmap(ptr null, i64 131072,
+; CHECK:       copy:
+; CHECK-NEXT:    call void @llvm.memcpy.p0.p0.i64(ptr align 8 %mapping, ptr align 8 @CallCounterProfileImage, i64 135, i1 false)
+; CHECK-NEXT:    [[COUNTERS:%.*]] = getelementptr inbounds i8, ptr %mapping, i64 65536
+; CHECK-NEXT:    call void @llvm.memcpy.p0.p0.i64(ptr align 8 [[COUNTERS]], ptr align 65536 @CallCounters, i64 65536, i1 false)
+; CHECK-NEXT:    call ptr @mmap(ptr @CallCounters, i64 65536, i32 3, i32 17, i32 %fd, i64 65536)
+; CHECK-NEXT:    store ptr %mapping, ptr @dynamic_cc.mapping
+; CHECK-LABEL: define internal void @dynamic_cc_write_profile()
+; CHECK:         %mapping = load ptr, ptr @dynamic_cc.mapping
+; CHECK:       write:
+; CHECK-NEXT:    [[COUNTERS:%.*]] = getelementptr inbounds i8, ptr %mapping, i64 65536
+; CHECK-NEXT:    call void @llvm.memcpy.p0.p0.i64(ptr align 8 [[COUNTERS]], ptr align 65536 @CallCounters, i64 65536, i1 false)
+; CHECK-NEXT:    [[FLAGS:%.*]] = getelementptr inbounds i8, ptr %mapping, i64 16
+; CHECK-NEXT:    store i32 1, ptr [[FLAGS]]
+; CHECK-NEXT:    call i32 @munmap(ptr %mapping, i64 131072)
+
+; TEXT:      LLVM-TUTOR: merged profile (call-counts)
+; TEXT:      NAME                 #N DIRECT CALLS
+; TEXT-NEXT: -------------------------------------------------
+; TEXT-NEXT: bar 4
+; TEXT-NEXT: fez 2
+; TEXT-NEXT: foo 26
+; TEXT-NEXT: main 2
+
+; JSON:      "kind": "call-counts",
+; JSON:      "name": "bar",
+; JSON-NEXT: "hash": "{{[0-9]+}}",
+; JSON-NEXT: "counters": [
+; JSON-NEXT:   2
+; JSON:      "name": "foo",
+; JSON-NEXT: "hash": "{{[0-9]+}}",
+; JSON-NEXT: "counters": [
+; JSON-NEXT:   13
+
+; REMERGED:      bar 6
+; REMERGED-NEXT: fez 3
+; REMERGED-NEXT: foo 39
+; REMERGED-NEXT: main 3
+
+; TRUNCATED: Warning: {{.*}}: the profile is incomplete
+; TRUNCATED: bar 4
+; TRUNCATED: foo 0
+; TRUNCATED: main 0
+
+; PATH: @dynamic_cc.path_fmt = {{.*}} c"%d.%%p.%%d.tutorprof\00"
+
+; LINUX:  %fd = call i32 (ptr, i32, ...) @open(ptr %path, i32 578, i32 420)
+; LINUX:  %mapping = call ptr @mmap(ptr null, i64 131072, i32 3, i32 1, i32 %fd, i64 0)
+; DARWIN: %fd = call i32 (ptr, i32, ...) @open(ptr %path, i32 1538, i32 420)
+; DARWIN: %mapping = call ptr @mmap(ptr null, i64 131072, i32 3, i32 1, i32 %fd, i64 0)
+
+; The 32-bit `off_t` of glibc (musl only has the 64-bit one)
+; ILP32: call i32 @ftruncate(i32 %fd, i32 131072)
+; ILP32: %mapping = call ptr @mmap({{.*}}, i32 %fd, i32 0)
+; MUSL:  call i32 @ftruncate(i32 %fd, i64 131072)
+; MUSL:  %mapping = call ptr @mmap({{.*}}, i32 %fd, i64 0)
+
+; UNSUPPORTED: error: dynamic-cc: -dynamic-cc-output is not supported for x86_64-pc-windows-msvc
+
+define void @foo() {
+  ret void
+}
+
+define i32 @main() {
+  call void @foo()
+  ret i32 0
+}
@@ -0,0 +1,27 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-output=%t.tutorprof %s -o %t.bin
+; RUN: rm -f %t.tutorprof
+; RUN: not --crash lli %t.bin
+; RUN: ../bin/tutor-profdata merge -format=text %t.tutorprof 2>&1 | FileCheck %s
+
+; Verify that a process that crashes still leaves a profile behind. The
+; counters are moved into the file when the program starts, so the profile
+; holds the counts up to the crash (it's only marked as incomplete).
+
+; CHECK: Warning: {{.*}}: the profile is incomplete
+; CHECK: foo 3
+; CHECK: main 1
+
+declare void @abort()
+
+define void @foo() {
+  ret void
+}
+
+define i32 @main() {
+  call void @foo()
+  call void @foo()
+  call void @foo()
+  call void @abort()
+  unreachable
+}
@@ -0,0 +1,84 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-skip-leaf-insts=4 %s \
+; RUN:   -o %t.leaf.bin 2>&1 | FileCheck %s --check-prefix=LEAF-SUMMARY
+; RUN: lli %t.leaf.bin | FileCheck %s --check-prefix=LEAF
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-skip-leaf-insts=4 \
+; RUN:   -dynamic-cc-skip-leaf-depth=1 %s -o %t.depth.bin 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=DEPTH-SUMMARY
+; RUN: lli %t.depth.bin | FileCheck %s --check-prefix=DEPTH
+
+; RUN: echo "# The interesting functions" > %t.allow
+; RUN: echo "re:^(main|get_)" >> %t.allow
+; RUN: echo "compute" >> %t.allow
+; RUN: echo "get_?" > %t.deny
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-allowlist=%t.allow \
+; RUN:   -dynamic-cc-denylist=%t.deny %s -o %t.lists.bin 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=LISTS-SUMMARY
+; RUN: lli %t.lists.bin | FileCheck %s --check-prefix=LISTS
+
+; RUN: not opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-denylist=%t.missing %s \
+; RUN:   -o /dev/null 2>&1 | FileCheck %s --check-prefix=MISSING
+
+; Verify that the functions are selected with the allow and deny lists and
+; that the small leaf functions (get_x) and, with a depth of 1, the small
+; functions that only call them (get_xy) are skipped. Only the instrumented
+; functions are in the results.
+
+; LEAF-SUMMARY: dynamic-cc: instrumented 3 of 4 functions (skipped: 0 not allowed, 0 denied, 1 trivial)
+; LEAF:      get_xy               10
+; LEAF-NEXT: main                 1
+; LEAF-NEXT: compute              1
+; LEAF-NOT:  get_x
+
+; DEPTH-SUMMARY: dynamic-cc: instrumented 2 of 4 functions (skipped: 0 not allowed, 0 denied, 2 trivial)
+; DEPTH:     main                 1
+; DEPTH-NEXT: compute              1
+; DEPTH-NOT: get_
+
+; LISTS-SUMMARY: dynamic-cc: instrumented 3 of 4 functions (skipped: 0 not allowed, 1 denied, 0 trivial)
+; LISTS:      get_xy               10
+; LISTS-NEXT: main                 1
+; LISTS-NEXT: compute              1
+; LISTS-NOT:  get_x
+
+; MISSING: error: dynamic-cc: {{.*}}.missing: can't read the file
+
+@point = internal global [2 x i32] [i32 3, i32 4]
+
+define i32 @get_x() {
+  %x = load i32, ptr @point
+  ret i32 %x
+}
+
+define i32 @get_xy() {
+  %x = call i32 @get_x()
+  %y = load i32, ptr getelementptr inbounds ([2 x i32], ptr @point, i64 0, i64 1)
+  %r = add i32 %x, %y
+  ret i32 %r
+}
+
+define i32 @compute(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %sum = phi i32 [0, %entry], [%sum.next, %loop]
+  %xy = call i32 @get_xy()
+  %sum.next = add i32 %sum, %xy
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %sum.next
+}
+
+define i32 @main() {
+  %r = call i32 @compute(i32 10)
+  ret i32 0
+}
@@ -0,0 +1,71 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-runtime -S %s \
+; RUN:   | FileCheck %s --check-prefix=IR
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-runtime %s -o %t.a.bin
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-runtime \
+; RUN:   %S/Inputs/CallCounterRuntimeInput.ll -o %t.b.bin
+; RUN: lli -extra-module=%t.b.bin -extra-archive=%shlibdir/libTutorRuntime.a \
+; RUN:   %t.a.bin | FileCheck %s
+
+; With a binary profile
+; RUN: env LLVM_TUTOR_PROFILE_FILE=%t.tutorprof lli -extra-module=%t.b.bin \
+; RUN:   -extra-archive=%shlibdir/libTutorRuntime.a %t.a.bin
+; RUN: ../bin/tutor-profdata merge -format=text %t.tutorprof \
+; RUN:   | FileCheck %s --check-prefix=PROFILE
+
+; Verify that the instrumented modules register their counters with the
+; runtime (instead of printing them), that the results of both modules are
+; printed once and that the local functions with the same name (`helper`) are
+; kept apart.
+
+; IR: @tutor_rt.name = private unnamed_addr constant [11 x i8] c"a.c:helper\00"
+; IR: @tutor_rt.name.1 = private unnamed_addr constant [7 x i8] c"shared\00"
+; IR: @tutor_rt.name.2 = private unnamed_addr constant [5 x i8] c"main\00"
+; IR: @tutor_rt.functions = private constant [3 x { ptr, i64 }]
+; IR: @tutor_rt.module = private constant { i32, i32, i64, i32, i32, i32, i32, i64, ptr, ptr, ptr, i64 } { i32 2, i32 1, i64 {{-?[0-9]+}}, i32 3, i32 1, i32 4, i32 4, i64 1, ptr @tutor_rt.functions, ptr @CallCounters, ptr null, i64 12 }, align 8
+; IR: @llvm.global_ctors = {{.*}} @tutor_rt.register
+; IR: @llvm.global_dtors = {{.*}} @tutor_rt.unregister
+; IR-NOT: printf_wrapper
+; IR-LABEL: define internal void @tutor_rt.register()
+; IR-NEXT:  entry:
+; IR-NEXT:    call void @__tutor_rt_register_module(ptr @tutor_rt.module)
+; IR-LABEL: define internal void @tutor_rt.unregister()
+; IR-NEXT:  entry:
+; IR-NEXT:    call void @__tutor_rt_unregister_module(ptr @tutor_rt.module)
+
+; CHECK:      LLVM-TUTOR: dynamic analysis results
+; CHECK-NOT:  LLVM-TUTOR
+; CHECK-DAG:  main                 1
+; CHECK-DAG:  a.c:helper           2
+; CHECK-DAG:  shared               8
+; CHECK-DAG:  b.c:helper           5
+; CHECK-DAG:  from_b               1
+; CHECK-NOT:  LLVM-TUTOR
+
+; PROFILE-DAG: a.c:helper           2
+; PROFILE-DAG: b.c:helper           5
+; PROFILE-DAG: shared               8
+
+source_filename = "a.c"
+
+declare void @from_b(i32)
+
+define internal void @helper() {
+  ret void
+}
+
+define linkonce_odr void @shared() {
+  ret void
+}
+
+define i32 @main() {
+  call void @helper()
+  call void @helper()
+  call void @shared()
+  call void @shared()
+  call void @shared()
+  call void @from_b(i32 5)
+  ret i32 0
+}
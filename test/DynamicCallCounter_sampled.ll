@@ -0,0 +1,65 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=sampled \
+; RUN:   -dynamic-cc-sample-period=100 -S %s | FileCheck %s
+
+; With the period of 1 every call is sampled, i.e. the estimates are exact
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=sampled \
+; RUN:   -dynamic-cc-sample-period=1 %S/Inputs/CallCounterInput.ll -o %t.bin
+; RUN: lli %t.bin | FileCheck %s --check-prefix=EXACT
+
+; With longer periods the calls are estimated
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-counters=sampled \
+; RUN:   -dynamic-cc-sample-period=4 %S/Inputs/CallCounterInput.ll -o %t.4.bin
+; RUN: lli %t.4.bin | FileCheck %s --check-prefix=PERIOD4
+
+; Verify that with -dynamic-cc-counters=sampled every function only decrements
+; and tests the per-thread countdown, and that the samples are recorded
+; out-of-line by `dynamic_cc_sample`.
+
+; CHECK: @CallCounters = internal global [1 x i64] zeroinitializer, align 8
+; CHECK: @dynamic_cc.countdown = internal thread_local global i32 100, align 4
+; CHECK: @dynamic_cc.rng = internal thread_local global i64 0, align 8
+
+define void @foo() {
+; CHECK-LABEL: @foo(
+; CHECK-NEXT:    %local = alloca i32, align 4
+; CHECK-NEXT:    [[CD_ADDR:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cc.countdown)
+; CHECK-NEXT:    %cd = load i32, ptr [[CD_ADDR]], align 4
+; CHECK-NEXT:    %cd.next = sub i32 %cd, 1
+; CHECK-NEXT:    store i32 %cd.next, ptr [[CD_ADDR]], align 4
+; CHECK-NEXT:    %expired = icmp sle i32 %cd.next, 0
+; CHECK-NEXT:    br i1 %expired, label %sample, label %continue, !prof [[PROF:![0-9]+]]
+; CHECK:       sample:
+; CHECK-NEXT:    call void @dynamic_cc_sample(i32 0)
+; CHECK-NEXT:    br label %continue
+; CHECK:       continue:
+; CHECK-NEXT:    store i32 0, ptr %local, align 4
+; CHECK-NEXT:    ret void
+  %local = alloca i32, align 4
+  store i32 0, ptr %local, align 4
+  ret void
+}
+
+; CHECK-LABEL: define internal void @dynamic_cc_sample(i32 %idx)
+; CHECK:         atomicrmw add ptr {{%.*}}, i64 1 monotonic, align 8
+; CHECK:         urem i64 %state.next, 199
+; CHECK:         store i32 {{%.*}}, ptr {{%.*}}, align 4
+; CHECK-NEXT:    ret void
+
+; CHECK: define void @printf_wrapper() {
+; CHECK:       [[COUNT:%.*]] = load atomic i64, ptr %counter monotonic, align 8
+; CHECK-NEXT:  %est = mul i64 [[COUNT]], 100
+
+; CHECK: [[PROF]] = !{!"branch_weights", i32 1, i32 99}
+
+; EXACT:      NAME                 ~#N CALLS  ERROR      SAMPLES
+; EXACT-DAG:  bar                  2          +/-  0.0%  2
+; EXACT-DAG:  main                 1          +/-  0.0%  1
+; EXACT-DAG:  foo                  13         +/-  0.0%  13
+; EXACT-DAG:  fez                  1          +/-  0.0%  1
+; EXACT:      17 samples (one in 1 calls on average)
+
+; PERIOD4: foo                  {{[0-9]+}} {{ *}}+/-
+; PERIOD4: {{[0-9]+}} samples (one in 4 calls on average)
@@ -0,0 +1,71 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc,verify" -dynamic-cc-runtime -dynamic-cc-shm -S %s \
+; RUN:   | FileCheck %s --check-prefix=IR
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-runtime -dynamic-cc-shm %s -o %t.bin
+; RUN: env LLVM_TUTOR_SHM_NAME=/llvm-tutor-shm-test \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin \
+; RUN:   "../bin/tutor-top -iterations=1 /llvm-tutor-shm-test" | FileCheck %s
+
+; Without -dynamic-cc-shm the counters share their pages with other data, so
+; they are not exported
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-runtime %s -o %t.noshm.bin
+; RUN: env LLVM_TUTOR_SHM_NAME=/llvm-tutor-shm-test \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.noshm.bin \
+; RUN:   "../bin/tutor-top -iterations=1 /llvm-tutor-shm-test" 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=NOSHM
+
+; -dynamic-cc-shm only makes sense with the runtime
+; RUN: not opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-shm %s -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+
+; The program calls `foo` 3 times and `bar` once, then runs `tutor-top`
+; (which reads the counters from the shared memory segment) and then calls
+; `foo` 2 more times (the runtime still sees the counters).
+
+; The counters are aligned and padded to TUTOR_SHM_PAGE_SIZE
+; IR: @CallCounters = internal global [16384 x i32] zeroinitializer, align 65536
+; IR: @tutor_rt.module = {{.*}}, i64 65536 }, align 8
+
+; CHECK:      LLVM-TUTOR: /llvm-tutor-shm-test (pid {{[0-9]+}}, 3 functions)
+; CHECK-NEXT: ====
+; CHECK-NEXT: NAME                 CALLS/S      #N DIRECT CALLS
+; CHECK-NEXT: ----
+; CHECK-NEXT: foo                  -            3
+; CHECK-NEXT: bar                  -            1
+; CHECK-NEXT: main                 -            1
+; CHECK:      LLVM-TUTOR: dynamic analysis results
+; CHECK-DAG:  foo                  5
+; CHECK-DAG:  bar                  1
+; CHECK-DAG:  main                 1
+
+; NOSHM:      LLVM-TUTOR: the counters of a module are not exported (instrument it with -dynamic-cc-shm)
+; NOSHM:      LLVM-TUTOR: /llvm-tutor-shm-test (pid {{[0-9]+}}, 0 functions)
+; NOSHM-NEXT: (the counters of 1 modules are not exported)
+
+; ERROR: dynamic-cc: -dynamic-cc-shm requires -dynamic-cc-runtime
+
+declare i32 @system(ptr)
+
+define void @foo() {
+  ret void
+}
+
+define void @bar() {
+  ret void
+}
+
+define i32 @main(i32 %argc, ptr %argv) {
+  call void @foo()
+  call void @foo()
+  call void @foo()
+  call void @bar()
+  %cmd.ptr = getelementptr ptr, ptr %argv, i64 1
+  %cmd = load ptr, ptr %cmd.ptr
+  call i32 @system(ptr %cmd)
+  call void @foo()
+  call void @foo()
+  ret i32 0
+}
@@ -0,0 +1,101 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-runtime %s -o %t.bin
+
+; Signal-triggered snapshots, cumulative (the default) ...
+; RUN: rm -f %t.cumulative.*
+; RUN: env LLVM_TUTOR_SNAPSHOT_SIGNAL=SIGHUP \
+; RUN:   LLVM_TUTOR_SNAPSHOT_FILE=%t.cumulative.%n \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin signal \
+; RUN:   %t.cumulative.0 %t.cumulative.1 | FileCheck %s
+; RUN: ../bin/tutor-profdata merge -format=text %t.cumulative.0 \
+; RUN:   | FileCheck %s --check-prefix=FIRST
+; RUN: ../bin/tutor-profdata merge -format=text %t.cumulative.1 \
+; RUN:   | FileCheck %s --check-prefix=TOTAL
+
+; ... and delta
+; RUN: rm -f %t.delta.*
+; RUN: env LLVM_TUTOR_SNAPSHOT_SIGNAL=SIGHUP LLVM_TUTOR_SNAPSHOT_MODE=delta \
+; RUN:   LLVM_TUTOR_SNAPSHOT_FILE=%t.delta.%n \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin signal \
+; RUN:   %t.delta.0 %t.delta.1 | FileCheck %s
+; RUN: ../bin/tutor-profdata merge -format=text %t.delta.0 \
+; RUN:   | FileCheck %s --check-prefix=FIRST
+; RUN: ../bin/tutor-profdata merge -format=text %t.delta.1 \
+; RUN:   | FileCheck %s --check-prefix=SECOND
+; RUN: ../bin/tutor-profdata merge -format=text %t.delta.0 %t.delta.1 \
+; RUN:   | FileCheck %s --check-prefix=TOTAL
+
+; Periodic snapshots
+; RUN: rm -f %t.periodic.*
+; RUN: env LLVM_TUTOR_SNAPSHOT_INTERVAL=1 \
+; RUN:   LLVM_TUTOR_SNAPSHOT_FILE=%t.periodic.%n \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin wait \
+; RUN:   %t.periodic.0 %t.periodic.1 | FileCheck %s
+; RUN: ../bin/tutor-profdata merge -format=text %t.periodic.1 \
+; RUN:   | FileCheck %s --check-prefix=TOTAL
+
+; The program calls `foo` 3 times, asks for a snapshot (by raising SIGHUP,
+; unless it's run with `wait`) and waits until it's written, then calls `foo`
+; 2 more times and does the same again. The results at exit are always
+; cumulative.
+
+; CHECK:      LLVM-TUTOR: dynamic analysis results
+; CHECK-DAG:  foo                  5
+; CHECK-DAG:  main                 1
+
+; FIRST:  foo                  3
+; SECOND: foo                  2
+; TOTAL:  foo                  5
+
+declare i32 @raise(i32)
+declare i32 @access(ptr, i32)
+declare i32 @usleep(i32)
+
+define void @foo() {
+  ret void
+}
+
+; Raises SIGHUP (if asked to) and waits (for up to 10s) until Path exists
+define internal void @snapshot(i1 %signal, ptr %path) {
+entry:
+  br i1 %signal, label %raise, label %loop
+
+raise:
+  call i32 @raise(i32 1)
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %entry], [0, %raise], [%i.next, %sleep]
+  %res = call i32 @access(ptr %path, i32 0)
+  %found = icmp eq i32 %res, 0
+  br i1 %found, label %exit, label %sleep
+
+sleep:
+  call i32 @usleep(i32 1000)
+  %i.next = add i32 %i, 1
+  %timeout = icmp eq i32 %i.next, 10000
+  br i1 %timeout, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+define i32 @main(i32 %argc, ptr %argv) {
+  %mode.ptr = getelementptr ptr, ptr %argv, i64 1
+  %mode = load ptr, ptr %mode.ptr
+  %mode.char = load i8, ptr %mode
+  %signal = icmp eq i8 %mode.char, 115
+  %first.ptr = getelementptr ptr, ptr %argv, i64 2
+  %first = load ptr, ptr %first.ptr
+  %second.ptr = getelementptr ptr, ptr %argv, i64 3
+  %second = load ptr, ptr %second.ptr
+
+  call void @foo()
+  call void @foo()
+  call void @foo()
+  call void @snapshot(i1 %signal, ptr %first)
+  call void @foo()
+  call void @foo()
+  call void @snapshot(i1 %signal, ptr %second)
+  ret i32 0
+}
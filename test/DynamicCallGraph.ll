@@ -0,0 +1,73 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg,verify" -S %s | FileCheck %s
+
+; Verify the code injected by DynamicCallGraph:
+;   * the direct calls increment the counter for their {caller, callee} edge
+;     (both calls to @leaf from @caller share one counter, @main -> @caller
+;     is the 3rd edge),
+;   * the indirect call stores the ID of the caller (@caller is node 2) in the
+;     caller slot and checks whether the callee consumed it,
+;   * @leaf (node 1, address taken) checks the caller slot on entry, @helper
+;     (internal, only called directly) does not.
+
+; CHECK: @DynamicCGNames = private constant [5 x ptr]
+; CHECK: @DynamicCGCounters = internal global [3 x i64] zeroinitializer, align 8
+; CHECK: @DynamicCGEdges = private constant [3 x { i32, i32 }] [{ i32, i32 } { i32 2, i32 1 }, { i32, i32 } { i32 2, i32 3 }, { i32, i32 } { i32 4, i32 2 }]
+; CHECK: @dynamic_cg.caller = internal thread_local global i32 0, align 4
+; CHECK: @DynamicCGIndirect = internal global [2048 x i64] zeroinitializer, align 8
+; CHECK: @DynamicCGLost = internal global i64 0, align 8
+; CHECK: @llvm.global_dtors = {{.*}} @dynamic_cg_dump
+
+define internal void @leaf() {
+; CHECK-LABEL: define internal void @leaf()
+; CHECK-NEXT:    [[SLOT:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cg.caller)
+; CHECK-NEXT:    %caller = load i32, ptr [[SLOT]], align 4
+; CHECK-NEXT:    %indirect = icmp ne i32 %caller, 0
+; CHECK-NEXT:    br i1 %indirect, label %indirect.call, label %continue
+; CHECK:       indirect.call:
+; CHECK-NEXT:    store i32 0, ptr [[SLOT]], align 4
+; CHECK-NEXT:    call void @dynamic_cg_record(i32 %caller, i32 1)
+; CHECK-NEXT:    br label %continue
+; CHECK:       continue:
+; CHECK-NEXT:    ret void
+  ret void
+}
+
+define internal void @caller(ptr %fptr) {
+; CHECK-LABEL: define internal void @caller(ptr %fptr)
+; CHECK-NOT:     @dynamic_cg.caller
+; CHECK:         [[C0:%.*]] = load i64, ptr @DynamicCGCounters
+; CHECK-NEXT:    [[C1:%.*]] = add i64 1, [[C0]]
+; CHECK-NEXT:    store i64 [[C1]], ptr @DynamicCGCounters
+; CHECK-NEXT:    call void @leaf()
+; CHECK:         store i64 {{%.*}}, ptr @DynamicCGCounters
+; CHECK-NEXT:    call void @leaf()
+; CHECK:         store i64 {{%.*}}, ptr getelementptr inbounds ([3 x i64], ptr @DynamicCGCounters, i64 0, i64 1)
+; CHECK-NEXT:    call void @helper()
+; CHECK-NEXT:    [[SLOT:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cg.caller)
+; CHECK-NEXT:    store i32 2, ptr [[SLOT]], align 4
+; CHECK-NEXT:    call void %fptr()
+; CHECK-NEXT:    [[SLOT2:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cg.caller)
+; CHECK-NEXT:    %caller = load i32, ptr [[SLOT2]], align 4
+; CHECK-NEXT:    %external = icmp ne i32 %caller, 0
+; CHECK-NEXT:    br i1 %external, label %external.call, label %continue
+; CHECK:       external.call:
+; CHECK-NEXT:    store i32 0, ptr [[SLOT2]], align 4
+; CHECK-NEXT:    call void @dynamic_cg_record(i32 %caller, i32 0)
+  call void @leaf()
+  call void @leaf()
+  call void @helper()
+  call void %fptr()
+  ret void
+}
+
+define internal void @helper() {
+; CHECK-LABEL: define internal void @helper()
+; CHECK-NEXT:    ret void
+  ret void
+}
+
+define void @main() {
+  call void @caller(ptr @leaf)
+  ret void
+}
@@ -0,0 +1,83 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg" %s -o %t.bin
+; RUN: rm -f %t.callgraph
+; RUN: env LLVM_TUTOR_CALLGRAPH_FILE=%t.callgraph lli %t.bin
+; RUN: ../bin/callgraph %t.callgraph | FileCheck %s
+
+; Every run appends to the profile, callgraph sums the counts
+; RUN: env LLVM_TUTOR_CALLGRAPH_FILE=%t.callgraph lli %t.bin
+; RUN: ../bin/callgraph -format=dot %t.callgraph | FileCheck %s --check-prefix=DOT
+
+; With only 1 slot in the hash table, only one of the 3 indirect edges is kept
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg" -dynamic-cg-hash-size=1 %s -o %t.small.bin
+; RUN: rm -f %t.small.callgraph
+; RUN: env LLVM_TUTOR_CALLGRAPH_FILE=%t.small.callgraph lli %t.small.bin
+; RUN: ../bin/callgraph %t.small.callgraph 2>&1 | FileCheck %s --check-prefix=LOST
+
+; Instrument this file with DynamicCallGraph, run it and verify the call graph.
+; For i = 0, 1, ..., 9, @main calls @inc directly and @apply with either
+; @twice or @square, which @apply calls indirectly. Finally, @main passes @abs
+; (not instrumented) to @apply.
+
+; CHECK:      CALLER               CALLEE               #CALLS
+; CHECK-NEXT: -------------------------------------------------
+; CHECK-NEXT: main                 apply                11
+; CHECK-NEXT: main                 inc                  10
+; CHECK-NEXT: apply                square               5
+; CHECK-NEXT: apply                twice                5
+; CHECK-NEXT: apply                <external>           1
+; CHECK-NOT:  {{.}}
+
+; DOT:      digraph "dynamic call graph" {
+; DOT:        "main" -> "apply" [label="22", penwidth=5.00];
+; DOT-NEXT:   "main" -> "inc" [label="20", penwidth=4.64];
+; DOT-NEXT:   "apply" -> "square" [label="10", penwidth=2.82];
+; DOT-NEXT:   "apply" -> "twice" [label="10", penwidth=2.82];
+; DOT-NEXT:   "apply" -> "<external>" [label="2", penwidth=1.36];
+; DOT-NEXT: }
+
+; LOST: Warning: {{[0-9]+}} indirect calls did not fit into the hash table
+; LOST: main                 apply                11
+; LOST: main                 inc                  10
+
+define internal i32 @twice(i32 %x) {
+  %r = mul i32 %x, 2
+  ret i32 %r
+}
+
+define internal i32 @square(i32 %x) {
+  %r = mul i32 %x, %x
+  ret i32 %r
+}
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define i32 @apply(ptr %f, i32 %x) {
+  %r = call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+declare i32 @abs(i32)
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %odd = trunc i32 %i to i1
+  %f = select i1 %odd, ptr @twice, ptr @square
+  %a = call i32 @apply(ptr %f, i32 %i)
+  %b = call i32 @inc(i32 %i)
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %c = call i32 @apply(ptr @abs, i32 -3)
+  ret i32 0
+}
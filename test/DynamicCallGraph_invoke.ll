@@ -0,0 +1,77 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg" %s -o %t.bin
+; RUN: rm -f %t.callgraph
+; RUN: env LLVM_TUTOR_CALLGRAPH_FILE=%t.callgraph lli %t.bin
+; RUN: ../bin/callgraph %t.callgraph | FileCheck %s
+
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg" %s -S | FileCheck %s --check-prefix=IR
+
+; Instrument this file with DynamicCallGraph, run it and verify that the slot
+; set for an indirect `invoke` is checked in its normal destination. @main
+; invokes @abs (not instrumented) through a pointer and then calls @inc (its
+; address is taken, so it checks the slot on entry) directly. If the slot was
+; left set by the `invoke`, the direct call would also be recorded as an
+; indirect call from @main to @inc.
+
+; CHECK:      CALLER               CALLEE               #CALLS
+; CHECK-NEXT: -------------------------------------------------
+; CHECK-NEXT: main                 <external>           1
+; CHECK-NEXT: main                 inc                  1
+; CHECK-NOT:  {{.}}
+
+; The shared normal destination is split and the landing pad clears the slot.
+; The indirect `musttail` call in @forward doesn't set the slot.
+; IR-LABEL: define i32 @main(
+; IR:       invoke i32 %f(i32 -3)
+; IR-NEXT:    to label %[[SPLIT:.*]] unwind label %lpad
+; IR:       [[SPLIT]]:
+; IR-NEXT:    [[SLOT:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cg.caller)
+; IR-NEXT:    %caller = load i32, ptr [[SLOT]], align 4
+; IR:       lpad:
+; IR-NEXT:    landingpad
+; IR-NEXT:    cleanup
+; IR-NEXT:    [[SLOT:%.*]] = call ptr @llvm.threadlocal.address.p0(ptr @dynamic_cg.caller)
+; IR-NEXT:    store i32 0, ptr [[SLOT]], align 4
+; IR-LABEL: define i32 @forward(
+; IR-NOT:     store i32 {{[1-9]}}
+; IR:         musttail call i32 %f(ptr %f, i32 %x)
+
+@fptr = global ptr @abs
+@iptr = global ptr @inc
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+declare i32 @abs(i32)
+
+declare i32 @__gxx_personality_v0(...)
+
+define i32 @main() personality ptr @__gxx_personality_v0 {
+entry:
+  %f = load ptr, ptr @fptr
+  %cond = icmp eq ptr %f, null
+  br i1 %cond, label %cont, label %call
+
+call:
+  %a = invoke i32 %f(i32 -3)
+          to label %cont unwind label %lpad
+
+cont:
+  %v = phi i32 [ 0, %entry ], [ %a, %call ]
+  %b = call i32 @inc(i32 %v)
+  ret i32 0
+
+lpad:
+  %lp = landingpad { ptr, i32 }
+          cleanup
+  resume { ptr, i32 } %lp
+}
+
+; Only called when the module is not run
+define i32 @forward(ptr %f, i32 %x) {
+  %r = musttail call i32 %f(ptr %f, i32 %x)
+  ret i32 %r
+}
@@ -0,0 +1,93 @@
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallGraph%shlibext \
+; RUN:   -passes="dynamic-cg" %s -o %t.bin
+; RUN: rm -f %t.callgraph
+; RUN: env LLVM_TUTOR_CALLGRAPH_FILE=%t.callgraph lli %t.bin
+; RUN: ../bin/tutor-order %s %t.callgraph | FileCheck %s
+
+; Clusters that are too large are not merged
+; RUN: ../bin/tutor-order -max-cluster-size=12 -format=sections %s \
+; RUN:   %t.callgraph | FileCheck %s --check-prefix=SMALL
+
+; With every function in its own section (and in that order)
+; RUN: ../bin/tutor-order -o %t.order -sections-output=%t.ll %s %t.callgraph
+; RUN: FileCheck %s --input-file=%t.order
+; RUN: FileCheck %s --input-file=%t.ll --check-prefix=IR
+
+; Instrument this file with DynamicCallGraph, run it and verify the order.
+; @main calls @hot_a 100 times (which calls @hot_b every time), @warm 10
+; times and @cold once. @unused never runs.
+;
+; C3 appends @hot_b to @hot_a (its only caller), then @hot_a, @warm and @cold
+; to @main. With -max-cluster-size=12 only {@hot_a, @hot_b} fits into one
+; cluster, so the clusters are sorted by density instead.
+
+; CHECK:      main
+; CHECK-NEXT: hot_a
+; CHECK-NEXT: hot_b
+; CHECK-NEXT: warm
+; CHECK-NEXT: cold
+; CHECK-NOT:  {{.}}
+
+; SMALL:      .text.hot_a
+; SMALL-NEXT: .text.hot_b
+; SMALL-NEXT: .text.warm
+; SMALL-NEXT: .text.cold
+; SMALL-NEXT: .text.main
+; SMALL-NOT:  {{.}}
+
+; IR-LABEL: define i32 @main() section ".text.main"
+; IR-LABEL: define internal i32 @hot_a(i32 %x) section ".text.hot_a"
+; IR-LABEL: define internal i32 @hot_b(i32 %x) section ".text.hot_b"
+; IR-LABEL: define internal i32 @warm(i32 %x) section ".text.warm"
+; IR-LABEL: define internal i32 @cold(i32 %x) section ".text.cold"
+; IR-LABEL: define internal i32 @unused(i32 %x) {
+
+define internal i32 @cold(i32 %x) {
+  %r = sub i32 0, %x
+  ret i32 %r
+}
+
+define internal i32 @unused(i32 %x) {
+  ret i32 %x
+}
+
+define internal i32 @warm(i32 %x) {
+  %r = mul i32 %x, 3
+  ret i32 %r
+}
+
+define internal i32 @hot_b(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %a = call i32 @hot_a(i32 %i)
+  %rem = urem i32 %i, 10
+  %is.warm = icmp eq i32 %rem, 0
+  br i1 %is.warm, label %call.warm, label %latch
+
+call.warm:
+  %w = call i32 @warm(i32 %i)
+  br label %latch
+
+latch:
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 100
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %c = call i32 @cold(i32 %i)
+  ret i32 0
+}
+
+define internal i32 @hot_a(i32 %x) {
+  %b = call i32 @hot_b(i32 %x)
+  %r = shl i32 %b, 1
+  ret i32 %r
+}
@@ -0,0 +1,72 @@
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof,verify" -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof,verify" -edge-prof-mode=blocks -S %s \
+; RUN:   | FileCheck %s --check-prefix=BLOCKS
+
+; Verify the placement of the counters injected by EdgeProfiler. In the
+; default mode, only the edges outside the maximum spanning tree of the CFG
+; are instrumented: in @diamond these are the two edges from (or into) the
+; `then` and `else` blocks, in @leaf it's the edge out of the function. In the
+; `blocks` mode, every basic block gets a counter.
+
+; CHECK: @EdgeProfCounters = internal global [3 x i64] zeroinitializer, align 8
+; CHECK: @EdgeProfTable = private constant [2 x { ptr, i64, i32, ptr }]
+; CHECK: @llvm.global_dtors = appending global
+; CHECK-SAME: @edgeprof_dump
+
+; BLOCKS: @EdgeProfCounters = internal global [5 x i64] zeroinitializer, align 8
+
+define i32 @diamond(i1 %c) {
+; CHECK-LABEL: @diamond(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    br i1 %c, label %then, label %else
+; CHECK:       then:
+; CHECK-NEXT:    [[C0:%.*]] = load i64, ptr @EdgeProfCounters
+; CHECK-NEXT:    [[INC0:%.*]] = add i64 1, [[C0]]
+; CHECK-NEXT:    store i64 [[INC0]], ptr @EdgeProfCounters
+; CHECK-NEXT:    br label %merge
+; CHECK:       else:
+; CHECK-NEXT:    [[C1:%.*]] = load i64, ptr getelementptr inbounds ([3 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; CHECK-NEXT:    [[INC1:%.*]] = add i64 1, [[C1]]
+; CHECK-NEXT:    store i64 [[INC1]], ptr getelementptr inbounds ([3 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; CHECK-NEXT:    br label %merge
+; CHECK:       merge:
+; CHECK-NEXT:    %r = phi i32
+; CHECK-NEXT:    ret i32 %r
+
+; BLOCKS-LABEL: @diamond(
+; BLOCKS-NEXT:  entry:
+; BLOCKS-NEXT:    load i64, ptr @EdgeProfCounters
+; BLOCKS:       then:
+; BLOCKS-NEXT:    load i64, ptr getelementptr inbounds ([5 x i64], ptr @EdgeProfCounters, i64 0, i64 1)
+; BLOCKS:       else:
+; BLOCKS-NEXT:    load i64, ptr getelementptr inbounds ([5 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+; BLOCKS:       merge:
+; BLOCKS-NEXT:    %r = phi i32
+; BLOCKS-NEXT:    load i64, ptr getelementptr inbounds ([5 x i64], ptr @EdgeProfCounters, i64 0, i64 3)
+entry:
+  br i1 %c, label %then, label %else
+then:
+  br label %merge
+else:
+  br label %merge
+merge:
+  %r = phi i32 [1, %then], [2, %else]
+  ret i32 %r
+}
+
+define void @leaf() {
+; CHECK-LABEL: @leaf(
+; CHECK-NEXT:    [[C2:%.*]] = load i64, ptr getelementptr inbounds ([3 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+; CHECK-NEXT:    [[INC2:%.*]] = add i64 1, [[C2]]
+; CHECK-NEXT:    store i64 [[INC2]], ptr getelementptr inbounds ([3 x i64], ptr @EdgeProfCounters, i64 0, i64 2)
+; CHECK-NEXT:    ret void
+  ret void
+}
+
+; The function that writes the profile
+; CHECK: define internal void @edgeprof_dump() {
+; CHECK:   %env = call ptr @getenv(ptr @edgeprof.env)
+; CHECK:   %file = call ptr @fopen(ptr %path, ptr @edgeprof.append)
+; CHECK:   call i32 @fclose(ptr %file)
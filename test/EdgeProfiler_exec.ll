@@ -0,0 +1,82 @@
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" %s -o %t.bin
+; RUN: rm -f %t.prof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.prof lli %t.bin
+; RUN: ../bin/edgeprof %s %t.prof | FileCheck %s
+
+; Every run appends to the profile, edgeprof sums the counts
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.prof lli %t.bin
+; RUN: ../bin/edgeprof %s %t.prof | FileCheck %s --check-prefix=TWICE
+
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" -edge-prof-mode=blocks %s -o %t.blocks.bin
+; RUN: rm -f %t.blocks.prof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.blocks.prof lli %t.blocks.bin
+; RUN: ../bin/edgeprof %s %t.blocks.prof | FileCheck %s --check-prefix=BLOCKS
+
+; Instrument this file with EdgeProfiler, run it and verify that edgeprof
+; reconstructs the complete profile from the counters.
+
+define i32 @classify(i32 %x) {
+entry:
+  %c = icmp slt i32 %x, 3
+  br i1 %c, label %small, label %big
+small:
+  br label %merge
+big:
+  br label %merge
+merge:
+  %r = phi i32 [1, %small], [2, %big]
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %s = phi i32 [0, %entry], [%s.next, %loop]
+  %v = call i32 @classify(i32 %i)
+  %s.next = add i32 %s, %v
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 0
+}
+
+; CHECK: Function: classify (entry count: 10)
+; CHECK: BLOCK COUNT
+; CHECK-NEXT: %entry 10
+; CHECK-NEXT: %small 3
+; CHECK-NEXT: %big 7
+; CHECK-NEXT: %merge 10
+; CHECK: EDGE COUNT
+; CHECK-NEXT: %entry -> %small 3
+; CHECK-NEXT: %entry -> %big 7
+; CHECK-NEXT: %small -> %merge 3
+; CHECK-NEXT: %big -> %merge 7
+; CHECK: Function: main (entry count: 1)
+; CHECK: BLOCK COUNT
+; CHECK-NEXT: %entry 1
+; CHECK-NEXT: %loop 10
+; CHECK-NEXT: %exit 1
+; CHECK: EDGE COUNT
+; CHECK-NEXT: %entry -> %loop 1
+; CHECK-NEXT: %loop -> %exit 1
+; CHECK-NEXT: %loop -> %loop 9
+
+; TWICE: Function: classify (entry count: 20)
+; TWICE: %entry -> %small 6
+; TWICE-NEXT: %entry -> %big 14
+; TWICE: Function: main (entry count: 2)
+; TWICE: %loop -> %loop 18
+
+; BLOCKS: Function: classify (entry count: 10)
+; BLOCKS: BLOCK COUNT
+; BLOCKS-NEXT: %entry 10
+; BLOCKS-NEXT: %small 3
+; BLOCKS-NEXT: %big 7
+; BLOCKS-NEXT: %merge 10
+; BLOCKS-NOT: EDGE
+; BLOCKS: Function: main (entry count: 1)
@@ -0,0 +1,127 @@
+; RUN: opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer,verify" -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer,verify" -func-timer-clock=monotonic -S %s \
+; RUN:   | FileCheck %s --check-prefix=MONOTONIC
+
+; The flags passed to libc depend on the target OS
+; RUN: opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer,verify" -func-timer-clock=monotonic \
+; RUN:   -mtriple=arm64-apple-macosx -S %s | FileCheck %s --check-prefix=DARWIN
+; RUN: not opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer" -mtriple=x86_64-pc-windows-msvc \
+; RUN:   -disable-output %s 2>&1 | FileCheck %s --check-prefix=UNSUPPORTED
+
+; Verify that every function pushes a frame on entry and pops it on every
+; exit, that the frames left behind by `longjmp` and by exceptions are popped
+; when the control is back (after `setjmp` and in the landing pads) and that
+; the time-stamp counter is read on x86 (and `clock_gettime` otherwise).
+
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @setjmp(ptr) returns_twice
+declare void @may_throw()
+declare i32 @__gxx_personality_v0(...)
+
+; CHECK: @FuncTimerCounters = internal global [8192 x i64] zeroinitializer, align 65536
+; CHECK: @func_timer.stack = internal thread_local global [256 x { i64, i64, i64 }] zeroinitializer, align 8
+; CHECK: @func_timer.depth = internal thread_local global i32 0, align 4
+; CHECK: @FuncTimerProfileImage = private constant {{.*}} c"TUTRPROF\01\00\00\00\02\00\00\00
+; CHECK: @llvm.global_ctors = {{.*}} @func_timer_open_profile
+; CHECK: @llvm.global_dtors = {{.*}} @func_timer_finish
+
+; CHECK-LABEL: define i32 @two_exits(i32 %x)
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    [[FRAME:%.*]] = call i32 @func_timer_enter(i32 0)
+; CHECK:       small:
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[FRAME]])
+; CHECK-NEXT:    ret i32 0
+; CHECK:       big:
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[FRAME]])
+; CHECK-NEXT:    ret i32 1
+define i32 @two_exits(i32 %x) {
+entry:
+  %c = icmp slt i32 %x, 3
+  br i1 %c, label %small, label %big
+
+small:
+  ret i32 0
+
+big:
+  ret i32 1
+}
+
+; CHECK-LABEL: define i32 @jumps()
+; CHECK:         [[FRAME:%.*]] = call i32 @func_timer_enter(i32 1)
+; CHECK-NEXT:    %r = call i32 @setjmp(ptr null)
+; CHECK-NEXT:    [[ABOVE:%.*]] = add i32 [[FRAME]], 1
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[ABOVE]])
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[FRAME]])
+; CHECK-NEXT:    ret i32 %r
+define i32 @jumps() {
+  %r = call i32 @setjmp(ptr null) returns_twice
+  ret i32 %r
+}
+
+; CHECK-LABEL: define void @catches()
+; CHECK:         [[FRAME:%.*]] = call i32 @func_timer_enter(i32 2)
+; CHECK:       lpad:
+; CHECK-NEXT:    %lp = landingpad { ptr, i32 }
+; CHECK-NEXT:      cleanup
+; CHECK-NEXT:    [[ABOVE:%.*]] = add i32 [[FRAME]], 1
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[ABOVE]])
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[FRAME]])
+; CHECK-NEXT:    resume { ptr, i32 } %lp
+define void @catches() personality ptr @__gxx_personality_v0 {
+entry:
+  invoke void @may_throw() to label %cont unwind label %lpad
+
+cont:
+  ret void
+
+lpad:
+  %lp = landingpad { ptr, i32 } cleanup
+  resume { ptr, i32 } %lp
+}
+
+; CHECK-LABEL: define i32 @tail(i32 %x)
+; CHECK:         [[FRAME:%.*]] = call i32 @func_timer_enter(i32 3)
+; CHECK-NEXT:    call void @func_timer_exit(i32 [[FRAME]])
+; CHECK-NEXT:    %r = musttail call i32 @two_exits(i32 %x)
+; CHECK-NEXT:    ret i32 %r
+define i32 @tail(i32 %x) {
+  %r = musttail call i32 @two_exits(i32 %x)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define internal i32 @func_timer_enter(i32 %idx)
+; CHECK:         call i64 @llvm.readcyclecounter()
+; CHECK-LABEL: define internal void @func_timer_exit(i32 %frame)
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    %now = call i64 @llvm.readcyclecounter()
+; CHECK:         atomicrmw add ptr {{.*}}, i64 1 monotonic, align 8
+; CHECK:         atomicrmw add ptr {{.*}}, i64 %inclusive monotonic, align 8
+; CHECK:         atomicrmw add ptr {{.*}}, i64 %exclusive monotonic, align 8
+; CHECK-LABEL: define internal void @func_timer_open_profile()
+; CHECK:         %fd = call i32 (ptr, i32, ...) @open(ptr %path, i32 578, i32 420)
+; CHECK:         %mapping = call ptr @mmap(ptr null, i64 {{[0-9]+}}, i32 3, i32 1, i32 %fd, i64 0)
+; CHECK:         call ptr @mmap(ptr @FuncTimerCounters, i64 65536, i32 3, i32 17, i32 %fd, i64 65536)
+; CHECK-LABEL: define internal void @func_timer_write_profile()
+; CHECK-LABEL: define internal void @func_timer_finish()
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    call void @func_timer_exit(i32 0)
+; CHECK-NEXT:    call void @func_timer_write_profile()
+
+; MONOTONIC: @FuncTimerProfileImage = private constant {{.*}} c"TUTRPROF\01\00\00\00\03\00\00\00
+; MONOTONIC-LABEL: define internal void @func_timer_exit(i32 %frame)
+; MONOTONIC-NEXT:  entry:
+; MONOTONIC-NEXT:    %ts = alloca { i64, i64 }, align 8
+; MONOTONIC-NEXT:    call i32 @clock_gettime(i32 1, ptr %ts)
+; MONOTONIC-NOT:     readcyclecounter
+
+; DARWIN-LABEL: define internal void @func_timer_exit(i32 %frame)
+; DARWIN:         call i32 @clock_gettime(i32 6, ptr %ts)
+; DARWIN-LABEL: define internal void @func_timer_open_profile()
+; DARWIN:         %fd = call i32 (ptr, i32, ...) @open(ptr %path, i32 1538, i32 420)
+
+; UNSUPPORTED: error: func-timer: the instrumentation is not supported for x86_64-pc-windows-msvc
@@ -0,0 +1,95 @@
+; RUN: opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer" -func-timer-output=unused.tutorprof %s -o %t.bin
+; RUN: env LLVM_TUTOR_PROFILE_FILE=%t.tutorprof lli %t.bin
+; RUN: ../bin/tutor-profdata merge -format=text %t.tutorprof | FileCheck %s
+
+; With a shadow stack of 2 frames, only main and middle/leaf are recorded
+; RUN: opt -load-pass-plugin %shlibdir/libFunctionTimer%shlibext \
+; RUN:   -passes="func-timer" -func-timer-stack-depth=2 \
+; RUN:   -func-timer-output=unused.tutorprof %s -o %t.shallow.bin
+; RUN: env LLVM_TUTOR_PROFILE_FILE=%t.shallow.tutorprof lli %t.shallow.bin
+; RUN: ../bin/tutor-profdata merge -format=text %t.shallow.tutorprof \
+; RUN:   | FileCheck %s --check-prefix=SHALLOW
+
+; Verify the number of calls of every function, including the functions that
+; were left by `longjmp` (`thrower` and `middle`, which never return). The
+; inclusive and the exclusive times (in nanoseconds, there's no target triple)
+; depend on the machine.
+
+; CHECK:      LLVM-TUTOR: merged profile (time-ns)
+; CHECK:      NAME                 #N CALLS INCLUSIVE EXCLUSIVE
+; CHECK-NEXT: -------------------------------------------------
+; CHECK-NEXT: leaf                 10 {{[0-9]+ [0-9]+$}}
+; CHECK-NEXT: main                 1 {{[0-9]+ [0-9]+$}}
+; CHECK-NEXT: middle               1 {{[0-9]+ [0-9]+$}}
+; CHECK-NEXT: spin                 1 {{[0-9]+ [0-9]+$}}
+; CHECK-NEXT: thrower              1 {{[0-9]+ [0-9]+$}}
+
+; SHALLOW:      leaf                 10 {{[0-9]+ [0-9]+$}}
+; SHALLOW-NEXT: main                 1 {{[0-9]+ [0-9]+$}}
+; SHALLOW-NEXT: middle               1 {{[0-9]+ [0-9]+$}}
+; SHALLOW-NEXT: spin                 0 0 0
+; SHALLOW-NEXT: thrower              0 0 0
+
+@buf = internal global [64 x i64] zeroinitializer, align 16
+
+declare i32 @setjmp(ptr) returns_twice
+declare void @longjmp(ptr, i32) noreturn
+
+define void @spin(i32 %n) {
+entry:
+  %sum = alloca i32, align 4
+  store volatile i32 0, ptr %sum, align 4
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %s = load volatile i32, ptr %sum, align 4
+  %s.next = add i32 %s, %i
+  store volatile i32 %s.next, ptr %sum, align 4
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+define void @thrower() {
+  call void @spin(i32 1000)
+  call void @longjmp(ptr @buf, i32 1)
+  unreachable
+}
+
+define void @middle() {
+  call void @thrower()
+  ret void
+}
+
+define void @leaf() {
+  ret void
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @setjmp(ptr @buf) returns_twice
+  %first = icmp eq i32 %r, 0
+  br i1 %first, label %call, label %after
+
+call:
+  call void @middle()
+  br label %after
+
+after:
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %after], [%i.next, %loop]
+  call void @leaf()
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 0
+}
@@ -0,0 +1,119 @@
+; RUN: opt -load-pass-plugin %shlibdir/libHeapProfiler%shlibext \
+; RUN:   -passes="heap-prof,verify" -S %s | FileCheck %s
+
+; Verify the instrumentation injected by HeapProfiler. Every allocation site
+; gets a descriptor (function, CFG hash, index, kind and location) and is
+; followed by a call to the runtime. calloc reports the product of its
+; arguments and realloc reports both the old and the new block. The
+; deallocations are reported before the call. The invokes in @cxx_api share
+; their normal destination, so each gets a block of its own for the hook.
+
+; CHECK: @heapprof.name = private unnamed_addr constant [6 x i8] c"c_api\00"
+; CHECK: @heapprof.location = private unnamed_addr constant [10 x i8] c"alloc.c:4\00"
+; CHECK: @heapprof.site = private constant { ptr, i64, i32, i32, ptr } { ptr @heapprof.name, i64 [[HASH:-?[0-9]+]], i32 0, i32 0, ptr @heapprof.location }
+; CHECK: @heapprof.location.1 = private unnamed_addr constant [2 x i8] c"-\00"
+; CHECK: @heapprof.site.2 = {{.*}} { ptr @heapprof.name, i64 [[HASH]], i32 1, i32 1, ptr @heapprof.location.1 }
+; CHECK: @heapprof.site.3 = {{.*}} { ptr @heapprof.name, i64 [[HASH]], i32 2, i32 2, ptr @heapprof.location.1 }
+; CHECK: @heapprof.site.5 = {{.*}} i32 0, i32 3, ptr @heapprof.location.1 }
+; CHECK: @heapprof.site.6 = {{.*}} i32 1, i32 3, ptr @heapprof.location.1 }
+; CHECK: @heapprof.default_path = {{.*}} c"default.heapprof\00"
+; CHECK: @llvm.global_ctors = {{.*}} @heapprof.register
+; CHECK: @llvm.global_dtors = {{.*}} @heapprof.unregister
+
+declare ptr @malloc(i64)
+declare ptr @calloc(i64, i64)
+declare ptr @realloc(ptr, i64)
+declare void @free(ptr)
+declare ptr @_Znwm(i64)
+declare void @_ZdlPv(ptr)
+declare i32 @__gxx_personality_v0(...)
+
+; Indirect calls are not instrumented
+define ptr @indirect(ptr %fn) {
+; CHECK-LABEL: @indirect(
+; CHECK-NEXT:    %p = call ptr %fn(i64 8)
+; CHECK-NEXT:    ret ptr %p
+  %p = call ptr %fn(i64 8)
+  ret ptr %p
+}
+
+define void @c_api(i64 %n) {
+; CHECK-LABEL: @c_api(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    %a = call ptr @malloc(i64 %n)
+; CHECK-NEXT:    call void @__tutor_heap_alloc(ptr %a, i64 %n, ptr @heapprof.site)
+; CHECK-NEXT:    %b = call ptr @calloc(i64 %n, i64 4)
+; CHECK-NEXT:    %heapprof.size = mul i64 %n, 4
+; CHECK-NEXT:    call void @__tutor_heap_alloc(ptr %b, i64 %heapprof.size, ptr @heapprof.site.2)
+; CHECK-NEXT:    %c = call ptr @realloc(ptr %a, i64 64)
+; CHECK-NEXT:    call void @__tutor_heap_realloc(ptr %a, ptr %c, i64 64, ptr @heapprof.site.3)
+; CHECK-NEXT:    call void @__tutor_heap_free(ptr %b)
+; CHECK-NEXT:    call void @free(ptr %b)
+; CHECK-NEXT:    call void @__tutor_heap_free(ptr %c)
+; CHECK-NEXT:    call void @free(ptr %c)
+; CHECK-NEXT:    ret void
+entry:
+  %a = call ptr @malloc(i64 %n), !dbg !8
+  %b = call ptr @calloc(i64 %n, i64 4)
+  %c = call ptr @realloc(ptr %a, i64 64)
+  call void @free(ptr %b)
+  call void @free(ptr %c)
+  ret void
+}
+
+define ptr @cxx_api(i1 %cond) personality ptr @__gxx_personality_v0 {
+; CHECK-LABEL: @cxx_api(
+; CHECK:       left:
+; CHECK-NEXT:    %l = invoke ptr @_Znwm(i64 8)
+; CHECK-NEXT:      to label %left.heapprof unwind label %lpad
+; CHECK:       right:
+; CHECK-NEXT:    %r = invoke ptr @_Znwm(i64 16)
+; CHECK-NEXT:      to label %right.heapprof unwind label %lpad
+; CHECK:       left.heapprof:
+; CHECK-NEXT:    call void @__tutor_heap_alloc(ptr %l, i64 8, ptr @heapprof.site.5)
+; CHECK-NEXT:    br label %join
+; CHECK:       right.heapprof:
+; CHECK-NEXT:    call void @__tutor_heap_alloc(ptr %r, i64 16, ptr @heapprof.site.6)
+; CHECK-NEXT:    br label %join
+; CHECK:       join:
+; CHECK-NEXT:    %p = phi ptr [ %l, %left.heapprof ], [ %r, %right.heapprof ]
+entry:
+  br i1 %cond, label %left, label %right
+
+left:
+  %l = invoke ptr @_Znwm(i64 8)
+          to label %join unwind label %lpad
+
+right:
+  %r = invoke ptr @_Znwm(i64 16)
+          to label %join unwind label %lpad
+
+join:
+  %p = phi ptr [ %l, %left ], [ %r, %right ]
+  ret ptr %p
+
+lpad:
+  %lp = landingpad { ptr, i32 } cleanup
+  resume { ptr, i32 } %lp
+}
+
+; No allocation sites, only a deallocation
+define void @delete(ptr %p) {
+; CHECK-LABEL: @delete(
+; CHECK-NEXT:    call void @__tutor_heap_free(ptr %p)
+; CHECK-NEXT:    call void @_ZdlPv(ptr %p)
+  call void @_ZdlPv(ptr %p)
+  ret void
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "alloc.c", directory: "/tmp")
+!3 = !{i32 7, !"Dwarf Version", i32 5}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = distinct !DISubprogram(name: "c_api", scope: !1, file: !1, line: 3, type: !6, scopeLine: 3, spFlags: DISPFlagDefinition, unit: !0)
+!6 = !DISubroutineType(types: !7)
+!7 = !{null}
+!8 = !DILocation(line: 4, column: 12, scope: !5)
@@ -0,0 +1,126 @@
+; RUN: opt -load-pass-plugin %shlibdir/libHeapProfiler%shlibext \
+; RUN:   -passes="heap-prof" %s -o %t.bin
+; RUN: rm -f %t.heapprof
+; RUN: env LLVM_TUTOR_HEAPPROF_FILE=%t.heapprof \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin
+; RUN: FileCheck %s --input-file=%t.heapprof --check-prefix=PROFILE
+; RUN: ../bin/tutor-heap -short-lifetime-us=1000000 %t.heapprof | FileCheck %s
+; RUN: ../bin/tutor-heap -top=1 -histogram %t.heapprof \
+; RUN:   | FileCheck %s --check-prefix=HISTOGRAM
+
+; The table of live blocks is too small for the blocks of @nodes (rounded up
+; to 64 slots)
+; RUN: env LLVM_TUTOR_HEAPPROF_FILE=%t.small.heapprof \
+; RUN:   LLVM_TUTOR_HEAPPROF_LIVE_SLOTS=1 \
+; RUN:   lli -extra-archive=%shlibdir/libTutorRuntime.a %t.bin 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=UNTRACKED
+
+; Instrument this file with HeapProfiler, run it (with the runtime) and
+; verify the profile and the report:
+;  * @small allocates and frees 1000 blocks of 24 bytes, i.e. the blocks
+;    could live on the stack,
+;  * @nodes allocates 200 blocks of 48 bytes with `new` and never frees them,
+;    i.e. they can't live on the stack, but they are all of the same size,
+;  * @grow keeps growing one block with realloc (16 bytes, then 32, 64, 128)
+;    and @table allocates one block with calloc. These are too rare to be
+;    flagged.
+; The lifetimes depend on the speed of the machine, the report is checked
+; with a threshold of 1 s.
+
+; PROFILE-DAG: grow {{-?[0-9]+}} 0 malloc - 1 1 16 24 0 0 0 0 1 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 8
+; PROFILE-DAG: grow {{-?[0-9]+}} 1 realloc - 3 3 224 24 0 0 0 0 0 1 1 1 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 8
+; PROFILE-DAG: nodes {{-?[0-9]+}} 0 new - 200 0 9600 24 0 0 0 0 0 0 200 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 8 0 0 0 0 0 0 0 0{{$}}
+; PROFILE-DAG: small {{-?[0-9]+}} 0 malloc - 1000 1000 24000 24 0 0 0 0 0 1000 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 8
+; PROFILE-DAG: table {{-?[0-9]+}} 0 calloc - 1 1 1000 24 0 0 0 0 0 0 0 0 0 0 1 0 0 0 0 0 0 0 0 0 0 0 0 0 8
+
+; CHECK:      LLVM-TUTOR: heap allocation sites
+; CHECK:      SITE                 LOCATION       KIND    ALLOCS     AVG SIZE   TYPICAL    SHORT   LIVE
+; CHECK-NEXT: -------------------------------------------------
+; CHECK-NEXT: small#0              -              malloc  1000       24.0       17-32      100%    0        stack
+; CHECK-NEXT: nodes#0              -              new     200        48.0       33-64      0%      200      pool
+; CHECK-NEXT: grow#1               -              realloc 3          74.7       33-64      100%    0 {{$}}
+; CHECK-NEXT: table#0              -              calloc  1          1000.0     513-1024   100%    0 {{$}}
+; CHECK-NEXT: grow#0               -              malloc  1          16.0       9-16       100%    0 {{$}}
+; CHECK-NEXT: -------------------------------------------------
+
+; HISTOGRAM:      small#0
+; HISTOGRAM-NEXT:   size 17-32        1000
+; HISTOGRAM-NEXT:   life
+; HISTOGRAM-NOT:  #
+; HISTOGRAM:      -------------------------------------------------
+
+; UNTRACKED: LLVM-TUTOR: {{[0-9]+}} allocations didn't fit in the table of live blocks, their lifetimes are not recorded (see LLVM_TUTOR_HEAPPROF_LIVE_SLOTS)
+
+declare ptr @malloc(i64)
+declare ptr @calloc(i64, i64)
+declare ptr @realloc(ptr, i64)
+declare void @free(ptr)
+declare ptr @_Znwm(i64)
+
+define void @small() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = call ptr @malloc(i64 24)
+  store i32 %i, ptr %p
+  call void @free(ptr %p)
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 1000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+@Nodes = internal global [200 x ptr] zeroinitializer
+
+define void @nodes() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %p = call ptr @_Znwm(i64 48)
+  %slot = getelementptr inbounds [200 x ptr], ptr @Nodes, i64 0, i64 %i
+  store ptr %p, ptr %slot
+  %i.next = add i64 %i, 1
+  %done = icmp eq i64 %i.next, 200
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+define void @grow() {
+entry:
+  %p0 = call ptr @malloc(i64 16)
+  br label %loop
+
+loop:
+  %p = phi ptr [ %p0, %entry ], [ %q, %loop ]
+  %size = phi i64 [ 32, %entry ], [ %size.next, %loop ]
+  %q = call ptr @realloc(ptr %p, i64 %size)
+  %size.next = shl i64 %size, 1
+  %done = icmp eq i64 %size.next, 256
+  br i1 %done, label %exit, label %loop
+
+exit:
+  call void @free(ptr %q)
+  ret void
+}
+
+define void @table() {
+  %p = call ptr @calloc(i64 10, i64 100)
+  call void @free(ptr %p)
+  ret void
+}
+
+define i32 @main() {
+  call void @small()
+  call void @nodes()
+  call void @grow()
+  call void @table()
+  ret i32 0
+}
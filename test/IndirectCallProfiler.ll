@@ -0,0 +1,59 @@
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallProfiler%shlibext \
+; RUN:   -passes="icall-prof,verify" -S %s | FileCheck %s
+
+; Verify that the called pointer is recorded before every indirect call (and
+; not before the direct calls), that the sites are numbered across the module
+; and that only the functions that may be called indirectly are in the table
+; of the targets.
+
+declare i32 @external(i32)
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+; Not address-taken and internal, can't be a target
+define internal i32 @helper(i32 %x) {
+  ret i32 %x
+}
+
+; CHECK: @ICallProfSites = internal global [3 x { i64, [4 x { ptr, i64 }] }] zeroinitializer, align 8
+; CHECK: @ICallProfTargets = private constant [5 x { ptr, ptr }] [{ ptr, ptr } { ptr @external, {{.*}} }, { ptr, ptr } { ptr @inc, {{.*}} }, { ptr, ptr } { ptr @apply, {{.*}} }, { ptr, ptr } { ptr @twice, {{.*}} }, { ptr, ptr } { ptr @use, {{.*}} }]
+; CHECK: @icallprof.unknown = {{.*}} c"<unknown>\00"
+; CHECK: @ICallProfTable = private constant [3 x { ptr, i64, i32 }] [{ ptr, i64, i32 } { ptr @icallprof.caller, i64 {{[0-9]+}}, i32 0 }, { ptr, i64, i32 } { ptr @icallprof.caller.{{[0-9]+}}, i64 {{[0-9]+}}, i32 0 }, { ptr, i64, i32 } { ptr @icallprof.caller.{{[0-9]+}}, i64 {{[0-9]+}}, i32 1 }]
+; CHECK: @llvm.global_dtors = {{.*}} @icallprof_dump
+
+; CHECK-LABEL: define i32 @apply(ptr %fp, i32 %x)
+; CHECK-NEXT:    call i32 @helper(i32 %x)
+; CHECK-NEXT:    call void @icallprof_record(i32 0, ptr %fp)
+; CHECK-NEXT:    %r = call i32 %fp(i32 %x)
+define i32 @apply(ptr %fp, i32 %x) {
+  %y = call i32 @helper(i32 %x)
+  %r = call i32 %fp(i32 %x)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @twice(ptr %fp, i32 %x)
+; CHECK-NEXT:    call void @icallprof_record(i32 1, ptr %fp)
+; CHECK-NEXT:    %a = call i32 %fp(i32 %x)
+; CHECK-NEXT:    call void @icallprof_record(i32 2, ptr %fp)
+; CHECK-NEXT:    %b = call i32 %fp(i32 %a)
+; CHECK-NEXT:    %c = call i32 @inc(i32 %b)
+define i32 @twice(ptr %fp, i32 %x) {
+  %a = call i32 %fp(i32 %x)
+  %b = call i32 %fp(i32 %a)
+  %c = call i32 @inc(i32 %b)
+  ret i32 %c
+}
+
+; Takes the address of @inc
+define i32 @use() {
+  %r = call i32 @apply(ptr @inc, i32 1)
+  ret i32 %r
+}
+
+; CHECK-LABEL: define internal void @icallprof_record(i32 %idx, ptr %target)
+; CHECK:       evict:
+; CHECK-LABEL: define internal ptr @icallprof_lookup(ptr %target)
+; CHECK-LABEL: define internal void @icallprof_dump()
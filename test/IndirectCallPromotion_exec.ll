@@ -0,0 +1,143 @@
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallProfiler%shlibext \
+; RUN:   -passes="icall-prof" -icall-prof-output=unused.icallprof %s -o %t.bin
+; RUN: rm -f %t.icallprof
+; RUN: env LLVM_TUTOR_ICALLPROF_FILE=%t.icallprof lli %t.bin | FileCheck %s --check-prefix=RESULT
+; RUN: FileCheck %s --check-prefix=PROFILE --input-file=%t.icallprof
+
+; With one slot per site, only the total is exact
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallProfiler%shlibext \
+; RUN:   -passes="icall-prof" -icall-prof-targets=1 %s -o %t.one.bin
+; RUN: rm -f %t.one.icallprof
+; RUN: env LLVM_TUTOR_ICALLPROF_FILE=%t.one.icallprof lli %t.one.bin
+; RUN: FileCheck %s --check-prefix=ONE --input-file=%t.one.icallprof
+
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote,verify" -icall-promote-profile=%t.icallprof \
+; RUN:   -icall-promote-min-count=1 -S %s -o %t.ll
+; RUN: FileCheck %s --input-file=%t.ll
+; RUN: lli %t.ll | FileCheck %s --check-prefix=RESULT
+
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote" -icall-promote-profile=%t.icallprof \
+; RUN:   -icall-promote-min-count=1 -icall-promote-max-targets=1 -S %s \
+; RUN:   | FileCheck %s --check-prefix=MAX1
+
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote,inline" -icall-promote-profile=%t.icallprof \
+; RUN:   -icall-promote-min-count=1 -S %s | FileCheck %s --check-prefix=INLINE
+
+; With the default thresholds, there are not enough calls to promote
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote" -icall-promote-profile=%t.icallprof -S %s \
+; RUN:   | FileCheck %s --check-prefix=COLD
+
+; RUN: sed 's/^apply [0-9]*/apply 1/' %t.icallprof > %t.stale.icallprof
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote" -icall-promote-profile=%t.stale.icallprof \
+; RUN:   -icall-promote-min-count=1 -S %s -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=STALE
+
+; RUN: sed 's/^\(apply [0-9]*\) 0/\1 1/' %t.icallprof > %t.sites.icallprof
+; RUN: opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote" -icall-promote-profile=%t.sites.icallprof \
+; RUN:   -icall-promote-min-count=1 -S %s -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=SITES
+
+; RUN: sed 's/^\(apply [0-9]*\) 0/\1 4294967296/' %t.icallprof \
+; RUN:   > %t.bad-site.icallprof
+; RUN: not opt -load-pass-plugin %shlibdir/libIndirectCallPromotion%shlibext \
+; RUN:   -passes="icall-promote" -icall-promote-profile=%t.bad-site.icallprof \
+; RUN:   -S %s -o /dev/null 2>&1 | FileCheck %s --check-prefix=BAD-SITE
+
+; `apply` calls `inc` 8 times and `dbl` twice, `abs` (from libc) is called
+; through `apply_ext` once.
+
+; RESULT: 71
+
+; PROFILE-DAG: apply {{[0-9]+}} 0 10 inc 8 dbl 2{{$}}
+; PROFILE-DAG: apply_ext {{[0-9]+}} 0 1 abs 1{{$}}
+
+; ONE: apply {{[0-9]+}} 0 10 inc 6{{$}}
+
+; CHECK-LABEL: define i32 @apply(ptr %fp, i32 %x)
+; CHECK:         [[IS_INC:%.*]] = icmp eq ptr %fp, @inc
+; CHECK-NEXT:    br i1 [[IS_INC]], {{.*}} !prof [[INC_WEIGHTS:![0-9]+]]
+; CHECK:         call i32 @inc(i32 %x)
+; CHECK:         [[IS_DBL:%.*]] = icmp eq ptr %fp, @dbl
+; CHECK-NEXT:    br i1 [[IS_DBL]], {{.*}} !prof [[DBL_WEIGHTS:![0-9]+]]
+; CHECK:         call i32 @dbl(i32 %x)
+; CHECK:         %r = call i32 %fp(i32 %x), !prof [[REST:![0-9]+]]
+; CHECK-LABEL: define i32 @apply_ext(ptr %fp, i32 %x)
+; CHECK:         icmp eq ptr %fp, @abs
+; CHECK:         call i32 @abs(i32 %x)
+; CHECK: [[INC_WEIGHTS]] = !{!"branch_weights", i32 8, i32 2}
+; CHECK: [[DBL_WEIGHTS]] = !{!"branch_weights", i32 2, i32 0}
+; CHECK: [[REST]] = !{!"branch_weights", i32 0}
+
+; MAX1-LABEL: define i32 @apply(ptr %fp, i32 %x)
+; MAX1:         icmp eq ptr %fp, @inc
+; MAX1-NOT:     icmp eq ptr %fp, @dbl
+; MAX1:         %r = call i32 %fp(i32 %x), !prof [[REST:![0-9]+]]
+; MAX1: [[REST]] = !{!"branch_weights", i32 2}
+
+; INLINE-LABEL: define i32 @apply(ptr %fp, i32 %x)
+; INLINE-NOT:     call i32 @inc
+; INLINE-NOT:     call i32 @dbl
+; INLINE:         %r = call i32 %fp(i32 %x)
+
+; COLD-LABEL: define i32 @apply(ptr %fp, i32 %x)
+; COLD-NOT:     icmp eq ptr
+; COLD:         %r = call i32 %fp(i32 %x)
+; COLD-NOT:     !prof
+
+; STALE: warning: {{.*}}.stale.icallprof: the profile for apply does not match the module (CFG hash mismatch), ignoring it
+; SITES: warning: {{.*}}.sites.icallprof: the profile for apply has 2 indirect call sites, the function has 1, ignoring it
+
+; BAD-SITE: error: {{.*}}.bad-site.icallprof: line {{[0-9]+}}: malformed record
+
+@fmt = private constant [4 x i8] c"%d\0A\00"
+
+declare i32 @printf(ptr, ...)
+declare i32 @abs(i32)
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define internal i32 @dbl(i32 %x) {
+  %r = shl i32 %x, 1
+  ret i32 %r
+}
+
+define i32 @apply(ptr %fp, i32 %x) {
+  %r = call i32 %fp(i32 %x)
+  ret i32 %r
+}
+
+define i32 @apply_ext(ptr %fp, i32 %x) {
+  %r = call i32 %fp(i32 %x)
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %sum = phi i32 [0, %entry], [%sum.next, %loop]
+  %lo = icmp ult i32 %i, 8
+  %fp = select i1 %lo, ptr @inc, ptr @dbl
+  %r = call i32 @apply(ptr %fp, i32 %i)
+  %sum.next = add i32 %sum, %r
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %a = call i32 @apply_ext(ptr @abs, i32 -1)
+  %total = add i32 %sum.next, %a
+  call i32 (ptr, ...) @printf(ptr @fmt, i32 %total)
+  ret i32 0
+}
@@ -0,0 +1,28 @@
+; The second module for DynamicCallCounter_runtime.ll. Like the first one, it
+; defines a local `helper`.
+source_filename = "b.c"
+
+define internal void @helper() {
+  ret void
+}
+
+define void @from_b(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  call void @helper()
+  call void @shared()
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; An inline function, instrumented in both modules
+define linkonce_odr void @shared() {
+  ret void
+}
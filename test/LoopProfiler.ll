@@ -0,0 +1,94 @@
+; RUN: opt -load-pass-plugin %shlibdir/libLoopProfiler%shlibext \
+; RUN:   -passes="loop-prof,verify" -S %s | FileCheck %s
+
+; Verify the instrumentation injected by LoopProfiler. Every loop gets a trip
+; counter that's reset in the preheader and incremented in the header. The
+; trip count is recorded on every exit edge: in the exit block (@count) or in
+; a new block if the edge is critical (@search, which has no preheader
+; either). Every loop has 33 counters: the total # of iterations and 32
+; buckets.
+
+; CHECK: @LoopProfCounters = internal global [66 x i64] zeroinitializer
+; CHECK: @LoopProfTable = private constant [2 x { ptr, i64, i32, ptr }]
+; CHECK-SAME: i32 0, ptr @LoopProfCounters
+; CHECK-SAME: i32 0, ptr getelementptr inbounds ([66 x i64], ptr @LoopProfCounters, i64 0, i64 33)
+; CHECK: @llvm.global_dtors = appending global
+; CHECK-SAME: @loopprof_dump
+
+define void @count(i32 %n) {
+; CHECK-LABEL: @count(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    %loop.trips.addr = alloca i64
+; CHECK-NEXT:    store i64 0, ptr %loop.trips.addr
+; CHECK-NEXT:    br label %loop
+; CHECK:       loop:
+; CHECK-NEXT:    %i = phi
+; CHECK-NEXT:    [[TRIPS:%.*]] = load i64, ptr %loop.trips.addr
+; CHECK-NEXT:    [[INC:%.*]] = add i64 [[TRIPS]], 1
+; CHECK-NEXT:    store i64 [[INC]], ptr %loop.trips.addr
+; CHECK:       exit:
+; CHECK-NEXT:    %loop.trips = load i64, ptr %loop.trips.addr
+; CHECK-NEXT:    [[TOTAL:%.*]] = load i64, ptr @LoopProfCounters
+; CHECK-NEXT:    [[SUM:%.*]] = add i64 [[TOTAL]], %loop.trips
+; CHECK-NEXT:    store i64 [[SUM]], ptr @LoopProfCounters
+; CHECK-NEXT:    [[NONZERO:%.*]] = or i64 %loop.trips, 1
+; CHECK-NEXT:    [[CTLZ:%.*]] = call i64 @llvm.ctlz.i64(i64 [[NONZERO]], i1 false)
+; CHECK-NEXT:    [[LOG2:%.*]] = sub i64 63, [[CTLZ]]
+; CHECK-NEXT:    %loop.bucket = call i64 @llvm.umin.i64(i64 [[LOG2]], i64 31)
+; CHECK-NEXT:    [[IDX:%.*]] = add i64 %loop.bucket, 1
+; CHECK-NEXT:    [[PTR:%.*]] = getelementptr inbounds [66 x i64], ptr @LoopProfCounters, i64 0, i64 [[IDX]]
+; CHECK-NEXT:    [[COUNT:%.*]] = load i64, ptr [[PTR]]
+; CHECK-NEXT:    [[NEW:%.*]] = add i64 [[COUNT]], 1
+; CHECK-NEXT:    store i64 [[NEW]], ptr [[PTR]]
+; CHECK-NEXT:    ret void
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+define i32 @search(ptr %p, i32 %n) {
+; CHECK-LABEL: @search(
+; CHECK:       loop.preheader:
+; CHECK-NEXT:    store i64 0, ptr %loop.trips.addr
+; CHECK-NEXT:    br label %loop
+; CHECK:       loop:
+; CHECK:         br i1 %found, label %loop.done_crit_edge, label %latch
+; CHECK:       loop.done_crit_edge:
+; CHECK-NEXT:    %loop.trips = load i64, ptr %loop.trips.addr
+; CHECK:         add i64 %loop.bucket, 34
+; CHECK:         br label %done
+; CHECK:       latch:
+; CHECK:         br i1 %c, label %loop, label %latch.done_crit_edge
+; CHECK:       latch.done_crit_edge:
+; CHECK-NEXT:    %loop.trips1 = load i64, ptr %loop.trips.addr
+; CHECK:         add i64 %loop.bucket2, 34
+; CHECK:         br label %done
+entry:
+  %empty = icmp eq i32 %n, 0
+  br i1 %empty, label %done, label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %latch]
+  %ptr = getelementptr i32, ptr %p, i32 %i
+  %v = load i32, ptr %ptr
+  %found = icmp eq i32 %v, 0
+  br i1 %found, label %done, label %latch
+latch:
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %done
+done:
+  %r = phi i32 [-1, %entry], [%i, %loop], [-1, %latch]
+  ret i32 %r
+}
+
+; CHECK-LABEL: define internal void @loopprof_dump()
+; CHECK:         call ptr @getenv(ptr @loopprof.env)
+; CHECK:         call ptr @fopen(
+; CHECK:         call i32 (ptr, ptr, ...) @fprintf(ptr %file, ptr @loopprof.record_fmt
+; CHECK:         call i32 @fclose(ptr %file)
@@ -0,0 +1,131 @@
+; RUN: opt -load-pass-plugin %shlibdir/libLoopProfiler%shlibext \
+; RUN:   -passes="loop-prof" %s -o %t.bin
+; RUN: rm -f %t.loopprof
+; RUN: env LLVM_TUTOR_LOOPPROF_FILE=%t.loopprof lli %t.bin
+; RUN: FileCheck %s --input-file=%t.loopprof --check-prefix=PROFILE
+; RUN: ../bin/loopprof %s %t.loopprof | FileCheck %s
+; RUN: ../bin/loopprof -histogram %s %t.loopprof \
+; RUN:   | FileCheck %s --check-prefix=HISTOGRAM
+
+; The average trip counts are attached to the loops
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -passes="prof-use" -prof-use-loops=%t.loopprof -S %s \
+; RUN:   | FileCheck %s --check-prefix=PROF-USE
+
+; Instrument this file with LoopProfiler, run it and verify the profile and
+; the report. @main runs 100 iterations: each calls @short_loop (3
+; iterations) and every 10th calls @mid_loop (5 iterations). @long_loop
+; (1000 iterations) and @nested (10 x 8 iterations) run once.
+;  * @short_loop almost never runs a full vector iteration (4 by default),
+;  * @mid_loop leaves 1 of its 5 iterations to the remainder (27% assuming
+;    that the trip counts within the 4-7 bucket are spread evenly),
+;  * the other loops are fine.
+
+; PROFILE: short_loop {{[0-9]+}} 0 300 32 0 100 0 0
+; PROFILE: mid_loop {{[0-9]+}} 0 50 32 0 0 10 0
+; PROFILE: long_loop {{[0-9]+}} 0 1000 32 0 0 0 0 0 0 0 0 0 1 0
+; PROFILE: nested {{[0-9]+}} 0 10 32 0 0 0 1 0
+; PROFILE: nested {{[0-9]+}} 1 80 32 0 0 0 10 0
+; PROFILE: main {{[0-9]+}} 0 100 32 0 0 0 0 0 0 1 0
+
+; CHECK:      FUNCTION             LOOP         ENTRIES    AVERAGE    TYPICAL
+; CHECK:      short_loop           %loop        100        3.0        2-3        short
+; CHECK-NEXT: mid_loop             %loop        10         5.0        4-7        remainder (27%)
+; CHECK-NEXT: long_loop            %loop        1          1000.0     512-1023 {{$}}
+; CHECK-NEXT: nested               %outer       1          10.0       8-15 {{$}}
+; CHECK-NEXT: nested               %inner       10         8.0        8-15 {{$}}
+; CHECK-NEXT: main                 %loop        1          100.0      64-127 {{$}}
+
+; HISTOGRAM:      short_loop
+; HISTOGRAM-NEXT:   2-3          100
+; HISTOGRAM-NEXT: mid_loop
+
+; PROF-USE-LABEL: @short_loop(
+; PROF-USE:         br i1 %c, label %loop, label %exit, !prof [[SHORT_WEIGHTS:![0-9]+]], !llvm.loop [[SHORT_LOOP:![0-9]+]]
+; PROF-USE-LABEL: @nested(
+; PROF-USE:         br i1 %inner.c, label %inner, label %outer.latch, !prof {{![0-9]+}}, !llvm.loop [[INNER_LOOP:![0-9]+]]
+; PROF-USE:         br i1 %outer.c, label %outer, label %exit, !prof {{![0-9]+}}, !llvm.loop [[OUTER_LOOP:![0-9]+]]
+; PROF-USE-DAG: [[SHORT_WEIGHTS]] = !{!"branch_weights", i32 200, i32 100}
+; PROF-USE-DAG: [[SHORT_LOOP]] = distinct !{[[SHORT_LOOP]], [[SHORT_TRIPS:![0-9]+]]}
+; PROF-USE-DAG: [[SHORT_TRIPS]] = !{!"llvm.loop.estimated_trip_count", i32 3}
+; PROF-USE-DAG: [[INNER_LOOP]] = distinct !{[[INNER_LOOP]], [[INNER_TRIPS:![0-9]+]]}
+; PROF-USE-DAG: [[INNER_TRIPS]] = !{!"llvm.loop.estimated_trip_count", i32 8}
+; PROF-USE-DAG: [[OUTER_LOOP]] = distinct !{[[OUTER_LOOP]], [[OUTER_TRIPS:![0-9]+]]}
+; PROF-USE-DAG: [[OUTER_TRIPS]] = !{!"llvm.loop.estimated_trip_count", i32 10}
+
+define void @short_loop(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+define void @mid_loop(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+define void @long_loop(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+define void @nested(i32 %n, i32 %m) {
+entry:
+  br label %outer
+outer:
+  %i = phi i32 [0, %entry], [%i.next, %outer.latch]
+  br label %inner
+inner:
+  %j = phi i32 [0, %outer], [%j.next, %inner]
+  %j.next = add i32 %j, 1
+  %inner.c = icmp slt i32 %j.next, %m
+  br i1 %inner.c, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add i32 %i, 1
+  %outer.c = icmp slt i32 %i.next, %n
+  br i1 %outer.c, label %outer, label %exit
+exit:
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %latch]
+  call void @short_loop(i32 3)
+  %rem = urem i32 %i, 10
+  %tenth = icmp eq i32 %rem, 0
+  br i1 %tenth, label %mid, label %latch
+mid:
+  call void @mid_loop(i32 5)
+  br label %latch
+latch:
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, 100
+  br i1 %c, label %loop, label %exit
+exit:
+  call void @long_loop(i32 1000)
+  call void @nested(i32 10, i32 8)
+  ret i32 0
+}
@@ -8,11 +8,43 @@ define signext i32 @foo(i32 signext, i32 signext, i32 signext, i32 signext) {
   ret i32 %7
 }
 
-; Verify that the additions in foo are _not_ substituted (because MBAAdd
-; is only meant for 8-bit additions)
+; Verify that the additions in foo are substituted with the 32-bit variant of
+; the 8-bit formula:
+;    a + b == (((a ^ b) + 2 * (a & b)) * 39 + 23) * 151 + 111
+; 151 is replaced with the inverse of 39 modulo 2^32 (-1762037865) and 111
+; with -23 * inverse(39) modulo 2^32 (1872165231).
 
 ; CHECK-LABEL: @foo
-; CHECK-NEXT:  %5 = add i32 %1, %0
-; CHECK-NEXT:  %6 = add i32 %5, %2
-; CHECK-NEXT:  %7 = add i32 %6, %3
-; CHECK-NEXT:  ret i32 %7
+; 1st addition
+; CHECK:        {{%[0-9]+}} = xor i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = and i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = mul i32 2, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_1:%[0-9]+]] = add i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_2:%[0-9]+]] = mul i32 39, [[REG_1]]
+; CHECK-NEXT:   [[REG_3:%[0-9]+]] = add i32 23, [[REG_2]]
+; CHECK-NEXT:   [[REG_4:%[0-9]+]] = mul i32 -1762037865, [[REG_3]]
+; CHECK-NEXT:   {{%[0-9]+}} = add i32 1872165231, [[REG_4]]
+;
+; 2nd addition
+; CHECK:        {{%[0-9]+}} = xor i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = and i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = mul i32 2, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_1:%[0-9]+]] = add i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_2:%[0-9]+]] = mul i32 39, [[REG_1]]
+; CHECK-NEXT:   [[REG_3:%[0-9]+]] = add i32 23, [[REG_2]]
+; CHECK-NEXT:   [[REG_4:%[0-9]+]] = mul i32 -1762037865, [[REG_3]]
+; CHECK-NEXT:   {{%[0-9]+}} = add i32 1872165231, [[REG_4]]
+;
+; 3rd addition
+; CHECK:        {{%[0-9]+}} = xor i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = and i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   {{%[0-9]+}} = mul i32 2, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_1:%[0-9]+]] = add i32 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:   [[REG_2:%[0-9]+]] = mul i32 39, [[REG_1]]
+; CHECK-NEXT:   [[REG_3:%[0-9]+]] = add i32 23, [[REG_2]]
+; CHECK-NEXT:   [[REG_4:%[0-9]+]] = mul i32 -1762037865, [[REG_3]]
+; CHECK-NEXT:   {{%[0-9]+}} = add i32 1872165231, [[REG_4]]
+;
+; Verify that there are no more additions (obfuscated or non-obfuscated)
+; CHECK-NOT:    add
+; CHECK:        ret i32
@@ -0,0 +1,54 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext -passes="mba-add" \
+; RUN:   -mba-add-cold-only -S %s 2>%t.report | FileCheck %s
+; RUN: FileCheck --check-prefix=REPORT %s < %t.report
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext -passes="mba-add" \
+; RUN:   -mba-add-cold-only -mba-add-cycle-budget=0 -disable-output %s 2>&1 \
+; RUN:   | FileCheck --check-prefix=BUDGET %s
+
+; The `cold` block is taken roughly once in a thousand calls, whereas the entry
+; block and the loop are hot. In the cold-path-only mode only the add in
+; `cold` is substituted.
+
+define i8 @foo(i8 %a, i8 %b, i1 %c, i32 %n) {
+entry:
+  %hot = add i8 %a, %b
+  br i1 %c, label %cold, label %loop, !prof !0
+
+cold:
+  %cold.add = add i8 %a, %hot
+  ret i8 %cold.add
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i8 [ %hot, %entry ], [ %acc.next, %loop ]
+  %acc.next = add i8 %acc, %b
+  %i.next = add i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret i8 %acc.next
+}
+
+!0 = !{!"branch_weights", i32 1, i32 1000}
+
+; CHECK-LABEL: @foo
+; CHECK:       entry:
+; CHECK-NEXT:    %hot = add i8 %a, %b
+; CHECK:       cold:
+; CHECK-NEXT:    {{%[0-9]+}} = xor i8 %a, %hot
+; CHECK-NEXT:    {{%[0-9]+}} = and i8 %a, %hot
+; CHECK-NEXT:    {{%[0-9]+}} = mul i8 2, {{%[0-9]+}}
+; CHECK-NEXT:    {{%[0-9]+}} = add i8 {{%[0-9]+}}, {{%[0-9]+}}
+; CHECK-NEXT:    {{%[0-9]+}} = mul i8 39, {{%[0-9]+}}
+; CHECK-NEXT:    {{%[0-9]+}} = add i8 23, {{%[0-9]+}}
+; CHECK-NEXT:    {{%[0-9]+}} = mul i8 -105, {{%[0-9]+}}
+; CHECK-NEXT:    %cold.add = add i8 111, {{%[0-9]+}}
+; CHECK:       loop:
+; CHECK-NOT:     xor
+; CHECK:         %acc.next = add i8 %acc, %b
+
+; REPORT: mba-add: foo {{ +}}substituted 1, skipped hot 3, skipped over budget 0, est. overhead {{[0-9.]+}}/50.00 cycles per call
+
+; With no budget nothing can be substituted
+; BUDGET: mba-add: foo {{ +}}substituted 0, skipped hot 3, skipped over budget 1, est. overhead 0.00/0.00 cycles per call
@@ -0,0 +1,33 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libMBA%shlibext -passes="mba" -S %s \
+; RUN:   -o %t.engine.ll
+; RUN: FileCheck %s < %t.engine.ll
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext \
+; RUN:   -load-pass-plugin=%shlibdir/libMBASub%shlibext \
+; RUN:   -passes="mba-add,mba-sub" -S %s -o %t.separate.ll
+; RUN: diff %t.engine.ll %t.separate.ll
+
+; Verify that the MBA pass applies both the add and the sub rules in a single
+; traversal, and that the result is identical to running MBAAdd and MBASub
+; one after another.
+
+define i8 @foo(i8 %a, i8 %b, i32 %c, i32 %d) {
+  %sum = add i8 %a, %b
+  %diff = sub i32 %c, %d
+  %x = xor i8 %sum, %a
+  %diff.tr = trunc i32 %diff to i8
+  %res = sub i8 %x, %diff.tr
+  ret i8 %res
+}
+
+; CHECK-LABEL: @foo
+; CHECK:         {{%[0-9]+}} = xor i8 %a, %b
+; CHECK:         %sum = add i8 111, {{%[0-9]+}}
+; CHECK-NEXT:    [[NOT_D:%[0-9]+]] = xor i32 %d, -1
+; CHECK-NEXT:    [[ADD_D:%[0-9]+]] = add i32 %c, [[NOT_D]]
+; CHECK-NEXT:    %diff = add i32 [[ADD_D]], 1
+; CHECK-NEXT:    %x = xor i8 %sum, %a
+; CHECK-NEXT:    %diff.tr = trunc i32 %diff to i8
+; CHECK-NEXT:    [[NOT_TR:%[0-9]+]] = xor i8 %diff.tr, -1
+; CHECK-NEXT:    [[ADD_X:%[0-9]+]] = add i8 %x, [[NOT_TR]]
+; CHECK-NEXT:    %res = add i8 [[ADD_X]], 1
+; CHECK-NEXT:    ret i8 %res
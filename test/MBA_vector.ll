@@ -0,0 +1,62 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext -passes="mba-add" -S %s \
+; RUN:  | FileCheck --check-prefix=ADD %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBASub%shlibext -passes="mba-sub" -S %s \
+; RUN:  | FileCheck --check-prefix=SUB %s
+
+; Verify that fixed and scalable integer vectors are substituted element-wise,
+; with the constants splatted across all lanes.
+
+define <4 x i16> @add_v4i16(<4 x i16> %a, <4 x i16> %b) {
+  %r = add <4 x i16> %a, %b
+  ret <4 x i16> %r
+}
+
+define <vscale x 4 x i32> @add_nxv4i32(<vscale x 4 x i32> %a, <vscale x 4 x i32> %b) {
+  %r = add <vscale x 4 x i32> %a, %b
+  ret <vscale x 4 x i32> %r
+}
+
+define <8 x i8> @sub_v8i8(<8 x i8> %a, <8 x i8> %b) {
+  %r = sub <8 x i8> %a, %b
+  ret <8 x i8> %r
+}
+
+define <vscale x 2 x i64> @sub_nxv2i64(<vscale x 2 x i64> %a, <vscale x 2 x i64> %b) {
+  %r = sub <vscale x 2 x i64> %a, %b
+  ret <vscale x 2 x i64> %r
+}
+
+; For 16-bit integers, the inverse of 39 is 28567 and -23 * 28567 == -1681.
+; ADD-LABEL: @add_v4i16
+; ADD:         {{%[0-9]+}} = xor <4 x i16> %a, %b
+; ADD-NEXT:    {{%[0-9]+}} = and <4 x i16> %a, %b
+; ADD-NEXT:    {{%[0-9]+}} = mul <4 x i16> {{.*}}i16 2{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = add <4 x i16> {{%[0-9]+}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = mul <4 x i16> {{.*}}i16 39{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = add <4 x i16> {{.*}}i16 23{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = mul <4 x i16> {{.*}}i16 28567{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    %r = add <4 x i16> {{.*}}i16 -1681{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    ret <4 x i16> %r
+
+; ADD-LABEL: @add_nxv4i32
+; ADD:         {{%[0-9]+}} = xor <vscale x 4 x i32> %a, %b
+; ADD-NEXT:    {{%[0-9]+}} = and <vscale x 4 x i32> %a, %b
+; ADD-NEXT:    {{%[0-9]+}} = mul <vscale x 4 x i32>
+; ADD-NEXT:    {{%[0-9]+}} = add <vscale x 4 x i32>
+; ADD-NEXT:    {{%[0-9]+}} = mul <vscale x 4 x i32> {{.*}}i32 39{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = add <vscale x 4 x i32> {{.*}}i32 23{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    {{%[0-9]+}} = mul <vscale x 4 x i32> {{.*}}i32 -1762037865{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    %r = add <vscale x 4 x i32> {{.*}}i32 1872165231{{.*}}, {{%[0-9]+}}
+; ADD-NEXT:    ret <vscale x 4 x i32> %r
+
+; SUB-LABEL: @sub_v8i8
+; SUB:         [[NOT:%[0-9]+]] = xor <8 x i8> %b, {{.*}}i8 -1
+; SUB-NEXT:    [[ADD:%[0-9]+]] = add <8 x i8> %a, [[NOT]]
+; SUB-NEXT:    %r = add <8 x i8> [[ADD]], {{.*}}i8 1
+; SUB-NEXT:    ret <8 x i8> %r
+
+; SUB-LABEL: @sub_nxv2i64
+; SUB:         [[NOT:%[0-9]+]] = xor <vscale x 2 x i64> %b, {{.*}}i64 -1
+; SUB-NEXT:    [[ADD:%[0-9]+]] = add <vscale x 2 x i64> %a, [[NOT]]
+; SUB-NEXT:    %r = add <vscale x 2 x i64> [[ADD]], {{.*}}i64 1
+; SUB-NEXT:    ret <vscale x 2 x i64> %r
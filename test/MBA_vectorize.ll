@@ -0,0 +1,99 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext \
+; RUN:   -load-pass-plugin=%shlibdir/libMBASub%shlibext \
+; RUN:   -passes="mba-add,mba-sub" -S %s | FileCheck --check-prefix=SCALAR %s
+; RUN: opt -load-pass-plugin=%shlibdir/libMBAAdd%shlibext \
+; RUN:   -load-pass-plugin=%shlibdir/libMBASub%shlibext \
+; RUN:   -passes="mba-add,mba-sub,loop-vectorize" -force-vector-width=4 \
+; RUN:   -force-vector-interleave=1 -S %s | FileCheck --check-prefix=VEC %s
+
+; Verify that loops containing obfuscated adds/subs are still vectorized. The
+; arithmetic in the loop bodies is obfuscated, but the induction variable
+; updates and the reduction are left intact so that the loop vectorizer can
+; recognise them.
+
+; void add_sub(int *restrict a, int *restrict b, int *restrict c, long n) {
+;   for (long i = 0; i < n; i++)
+;     c[i] = (a[i] + b[i]) - a[i + 1];
+; }
+define void @add_sub(ptr noalias %a, ptr noalias %b, ptr noalias %c, i64 %n) {
+entry:
+  %cmp0 = icmp sgt i64 %n, 0
+  br i1 %cmp0, label %loop, label %exit
+
+loop:
+  %iv = phi i64 [ 0, %entry ], [ %iv.next, %loop ]
+  %pa = getelementptr inbounds i32, ptr %a, i64 %iv
+  %va = load i32, ptr %pa, align 4
+  %pb = getelementptr inbounds i32, ptr %b, i64 %iv
+  %vb = load i32, ptr %pb, align 4
+  %sum = add i32 %va, %vb
+  %iv.1 = add nuw nsw i64 %iv, 1
+  %pa.1 = getelementptr inbounds i32, ptr %a, i64 %iv.1
+  %va.1 = load i32, ptr %pa.1, align 4
+  %diff = sub i32 %sum, %va.1
+  %pc = getelementptr inbounds i32, ptr %c, i64 %iv
+  store i32 %diff, ptr %pc, align 4
+  %iv.next = add nuw nsw i64 %iv, 1
+  %done = icmp eq i64 %iv.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; int reduce(int *a, long n) {
+;   int acc = 0;
+;   for (long i = 0; i < n; i++)
+;     acc += a[i] + 7;
+;   return acc;
+; }
+define i32 @reduce(ptr %a, i64 %n) {
+entry:
+  %cmp0 = icmp sgt i64 %n, 0
+  br i1 %cmp0, label %loop, label %exit
+
+loop:
+  %iv = phi i64 [ 0, %entry ], [ %iv.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %pa = getelementptr inbounds i32, ptr %a, i64 %iv
+  %va = load i32, ptr %pa, align 4
+  %v7 = add i32 %va, 7
+  %acc.next = add i32 %acc, %v7
+  %iv.next = add nuw nsw i64 %iv, 1
+  %done = icmp eq i64 %iv.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %res = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  ret i32 %res
+}
+
+; SCALAR-LABEL: @add_sub
+; SCALAR:       loop:
+; SCALAR:         xor i32 %va, %vb
+; SCALAR:         %sum = add i32 1872165231,
+; SCALAR:         %iv.1 = add nuw nsw i64 %iv, 1
+; SCALAR:         %diff = add i32
+; SCALAR:         %iv.next = add nuw nsw i64 %iv, 1
+
+; SCALAR-LABEL: @reduce
+; SCALAR:       loop:
+; SCALAR:         %v7 = add i32 1872165231,
+; SCALAR:         %acc.next = add i32 %acc, %v7
+; SCALAR:         %iv.next = add nuw nsw i64 %iv, 1
+
+; VEC-LABEL: @add_sub
+; VEC:         vector.body:
+; VEC:           xor <4 x i32>
+; VEC:           mul <4 x i32> {{.*}}i32 39
+; VEC:           xor <4 x i32> {{.*}}i32 -1
+; VEC:           store <4 x i32>
+
+; VEC-LABEL: @reduce
+; VEC:         vector.body:
+; VEC:           [[VEC_PHI:%.*]] = phi <4 x i32>
+; VEC:           xor <4 x i32>
+; VEC:           mul <4 x i32> {{.*}}i32 39
+; VEC:           add <4 x i32> [[VEC_PHI]],
+; VEC:         middle.block:
+; VEC:           call i32 @llvm.vector.reduce.add.v4i32
@@ -0,0 +1,107 @@
+; RUN: opt -load-pass-plugin %shlibdir/libPathProfiler%shlibext \
+; RUN:   -passes="path-prof,verify" -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libPathProfiler%shlibext \
+; RUN:   -passes="path-prof,verify" -path-prof-max-array-paths=2 -S %s \
+; RUN:   | FileCheck %s --check-prefix=HASH
+
+; Verify the path register updates injected by PathProfiler. @twodiamonds
+; has 4 acyclic paths, numbered as follows:
+;   0: entry -> then1 -> mid -> then2 -> merge
+;   1: entry -> then1 -> mid -> merge
+;   2: entry -> else1 -> mid -> then2 -> merge
+;   3: entry -> else1 -> mid -> merge
+; i.e. `entry -> else1` adds 2 and `mid -> merge` adds 1 (that's a critical
+; edge, so it's split). @loop also has 4 paths: the back edge ends paths 1
+; (from entry) and 3 (from the loop header) and starts paths 2 and 3.
+; Functions with more than `-path-prof-max-array-paths` paths count the paths
+; in a hash table.
+
+; CHECK: @PathProfCounters = internal global [8 x i64] zeroinitializer, align 8
+; CHECK: @PathProfLost = internal global [2 x i64] zeroinitializer, align 8
+; CHECK: @PathProfTable = private constant [2 x { ptr, i64, i64, i32, i64, ptr }]
+; CHECK-SAME: i64 4, i32 0, i64 4, ptr @PathProfCounters
+; CHECK-SAME: i64 4, i32 0, i64 4, ptr getelementptr inbounds ([8 x i64], ptr @PathProfCounters, i64 0, i64 4)
+; CHECK: @llvm.global_dtors = appending global
+; CHECK-SAME: @pathprof_dump
+
+; 2 hash tables with 1024 {key, count} slots
+; HASH: @PathProfCounters = internal global [4096 x i64] zeroinitializer, align 8
+; HASH: @PathProfTable = private constant [2 x { ptr, i64, i64, i32, i64, ptr }]
+; HASH-SAME: i64 4, i32 1, i64 1024, ptr @PathProfCounters
+; HASH-SAME: i64 4, i32 1, i64 1024, ptr getelementptr inbounds ([4096 x i64], ptr @PathProfCounters, i64 0, i64 2048)
+
+define i32 @twodiamonds(i1 %a, i1 %b) {
+; CHECK-LABEL: @twodiamonds(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:    br i1 %a, label %then1, label %else1
+; CHECK:       mid:
+; CHECK-NEXT:    [[REG0:%.*]] = phi i64 [ 0, %then1 ], [ 2, %else1 ]
+; CHECK-NEXT:    br i1 %b, label %then2, label %mid.merge_crit_edge
+; CHECK:       mid.merge_crit_edge:
+; CHECK-NEXT:    [[INC:%.*]] = add i64 [[REG0]], 1
+; CHECK-NEXT:    br label %merge
+; CHECK:       merge:
+; CHECK-NEXT:    [[REG1:%.*]] = phi i64 [ [[REG0]], %then2 ], [ [[INC]], %mid.merge_crit_edge ]
+; CHECK-NEXT:    [[PTR:%.*]] = getelementptr inbounds i64, ptr @PathProfCounters, i64 [[REG1]]
+; CHECK-NEXT:    [[C:%.*]] = load i64, ptr [[PTR]]
+; CHECK-NEXT:    [[C1:%.*]] = add i64 1, [[C]]
+; CHECK-NEXT:    store i64 [[C1]], ptr [[PTR]]
+; CHECK-NEXT:    ret i32 0
+
+; HASH-LABEL: @twodiamonds(
+; HASH:       merge:
+; HASH-NEXT:    [[REG1:%.*]] = phi i64
+; HASH-NEXT:    call void @pathprof_hash_inc(ptr @PathProfCounters, ptr @PathProfLost, i64 [[REG1]])
+; HASH-NEXT:    ret i32 0
+entry:
+  br i1 %a, label %then1, label %else1
+then1:
+  br label %mid
+else1:
+  br label %mid
+mid:
+  br i1 %b, label %then2, label %merge
+then2:
+  br label %merge
+merge:
+  ret i32 0
+}
+
+define void @loop(i32 %n) {
+; CHECK-LABEL: @loop(
+; CHECK:       header:
+; CHECK-NEXT:    [[REG:%.*]] = phi i64 [ 0, %entry ], [ 2, %header.header_crit_edge ]
+; CHECK:         br i1 %done, label %exit, label %header.header_crit_edge
+; CHECK:       header.header_crit_edge:
+; CHECK-NEXT:    [[ID:%.*]] = add i64 [[REG]], 1
+; CHECK-NEXT:    [[PTR:%.*]] = getelementptr inbounds i64, ptr getelementptr inbounds ([8 x i64], ptr @PathProfCounters, i64 0, i64 4), i64 [[ID]]
+; CHECK-NEXT:    [[C:%.*]] = load i64, ptr [[PTR]]
+; CHECK-NEXT:    [[C1:%.*]] = add i64 1, [[C]]
+; CHECK-NEXT:    store i64 [[C1]], ptr [[PTR]]
+; CHECK-NEXT:    br label %header
+; CHECK:       exit:
+; CHECK-NEXT:    getelementptr inbounds i64, ptr getelementptr inbounds ([8 x i64], ptr @PathProfCounters, i64 0, i64 4), i64 [[REG]]
+entry:
+  br label %header
+header:
+  %i = phi i32 [0, %entry], [%i.next, %header]
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %header
+exit:
+  ret void
+}
+
+; The dump prints only the paths that were executed
+; CHECK-LABEL: define internal void @pathprof_dump()
+; CHECK:       paths:
+; CHECK:         %count = load i64
+; CHECK-NEXT:    [[EXECUTED:%.*]] = icmp ne i64 %count, 0
+; CHECK-NEXT:    br i1 [[EXECUTED]], label %path.print, label %path.latch
+; CHECK:       path.print:
+; CHECK-NEXT:    call i32 (ptr, ptr, ...) @fprintf(ptr %file, ptr @pathprof.path_fmt, i64 %path.id, i64 %count)
+
+; HASH-LABEL: define internal void @pathprof_hash_inc(ptr %table, ptr %lost, i64 %id)
+; HASH:         %start = and i64 {{%.*}}, 1023
+; HASH:       overflow:
+; HASH-NEXT:    load i64, ptr %lost
@@ -0,0 +1,80 @@
+; RUN: opt -load-pass-plugin %shlibdir/libPathProfiler%shlibext \
+; RUN:   -passes="path-prof" %s -o %t.bin
+; RUN: rm -f %t.prof
+; RUN: env LLVM_TUTOR_PATHPROF_FILE=%t.prof lli %t.bin
+; RUN: ../bin/pathprof %s %t.prof | FileCheck %s
+
+; Every run appends to the profile, pathprof sums the counts
+; RUN: env LLVM_TUTOR_PATHPROF_FILE=%t.prof lli %t.bin
+; RUN: ../bin/pathprof %s %t.prof | FileCheck %s --check-prefix=TWICE
+
+; The same profile collected with hash tables (the one with 2 slots can only
+; keep 2 out of the 4 paths in @classify)
+; RUN: opt -load-pass-plugin %shlibdir/libPathProfiler%shlibext \
+; RUN:   -passes="path-prof" -path-prof-max-array-paths=0 %s -o %t.hash.bin
+; RUN: rm -f %t.hash.prof
+; RUN: env LLVM_TUTOR_PATHPROF_FILE=%t.hash.prof lli %t.hash.bin
+; RUN: ../bin/pathprof %s %t.hash.prof | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libPathProfiler%shlibext \
+; RUN:   -passes="path-prof" -path-prof-max-array-paths=0 \
+; RUN:   -path-prof-hash-size=2 %s -o %t.small.bin
+; RUN: rm -f %t.small.prof
+; RUN: env LLVM_TUTOR_PATHPROF_FILE=%t.small.prof lli %t.small.bin
+; RUN: ../bin/pathprof %s %t.small.prof | FileCheck %s --check-prefix=LOST
+
+; Instrument this file with PathProfiler, run it and verify that pathprof maps
+; the path IDs back to the sequences of basic blocks. @classify is called for
+; 0, 1, ..., 9.
+
+define i32 @classify(i32 %x) {
+entry:
+  %c = icmp slt i32 %x, 3
+  br i1 %c, label %small, label %big
+small:
+  br label %parity
+big:
+  br label %parity
+parity:
+  %rem = and i32 %x, 1
+  %is.odd = icmp eq i32 %rem, 1
+  br i1 %is.odd, label %odd, label %merge
+odd:
+  br label %merge
+merge:
+  ret i32 %x
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %v = call i32 @classify(i32 %i)
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 0
+}
+
+; CHECK: Function: classify (paths: 4, executed: 4)
+; CHECK: PATH COUNT BLOCKS
+; CHECK-NEXT: 2 4 %entry -> %big -> %parity -> %odd -> %merge
+; CHECK-NEXT: 3 3 %entry -> %big -> %parity -> %merge
+; CHECK-NEXT: 1 2 %entry -> %small -> %parity -> %merge
+; CHECK-NEXT: 0 1 %entry -> %small -> %parity -> %odd -> %merge
+; CHECK: Function: main (paths: 4, executed: 3)
+; CHECK: PATH COUNT BLOCKS
+; CHECK-NEXT: 3 8 (back edge) %loop (back edge)
+; CHECK-NEXT: 1 1 %entry -> %loop (back edge)
+; CHECK-NEXT: 2 1 (back edge) %loop -> %exit
+
+; TWICE: Function: classify (paths: 4, executed: 4)
+; TWICE: 2 8 %entry -> %big -> %parity -> %odd -> %merge
+; TWICE: Function: main (paths: 4, executed: 3)
+; TWICE: 3 16 (back edge) %loop (back edge)
+
+; LOST: Function: classify (paths: 4, executed: 2)
+; LOST-NEXT: =====
+; LOST-NEXT: Warning: 7 path executions did not fit into the hash table
+; LOST: Function: main (paths: 4, executed: 2)
@@ -0,0 +1,127 @@
+; Instrument with EdgeProfiler, run, annotate the uninstrumented module
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" %s -o %t.bin
+; RUN: rm -f %t.edgeprof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.edgeprof lli %t.bin
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -passes="prof-use" -prof-use-edges=%t.edgeprof -S %s -o %t.ll
+; RUN: FileCheck %s < %t.ll
+
+; Rebuild: the weights are used by LLVM (and the program still works)
+; RUN: opt -passes="print<branch-prob>" -disable-output %t.ll 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=BPI
+; RUN: lli %t.ll
+
+; The same with one counter per block (only the weights of the edges to blocks
+; with one predecessor are known)
+; RUN: opt -load-pass-plugin %shlibdir/libEdgeProfiler%shlibext \
+; RUN:   -passes="edge-prof" -edge-prof-mode=blocks %s -o %t.blocks.bin
+; RUN: rm -f %t.blocks.edgeprof
+; RUN: env LLVM_TUTOR_EDGEPROF_FILE=%t.blocks.edgeprof lli %t.blocks.bin
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -passes="prof-use" -prof-use-edges=%t.blocks.edgeprof -S %s \
+; RUN:   | FileCheck %s --check-prefix=BLOCKS
+
+; Entry counts only, from DynamicCallCounter
+; RUN: opt -load-pass-plugin %shlibdir/libDynamicCallCounter%shlibext \
+; RUN:   -passes="dynamic-cc" -dynamic-cc-output=unused.tutorprof %s \
+; RUN:   -o %t.calls.bin
+; RUN: env LLVM_TUTOR_PROFILE_FILE=%t.tutorprof lli %t.calls.bin
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -passes="prof-use" -prof-use-calls=%t.tutorprof -S %s \
+; RUN:   | FileCheck %s --check-prefix=CALLS
+
+; Stale profiles: the CFG of `classify` has changed
+; RUN: sed -e 's/br i1 %c, label %lo, label %hi/br label %hi/' %s \
+; RUN:   > %t.stale.ll
+; RUN: opt -load-pass-plugin %shlibdir/libProfileUse%shlibext \
+; RUN:   -passes="prof-use" -prof-use-edges=%t.edgeprof \
+; RUN:   -prof-use-calls=%t.tutorprof -S %t.stale.ll 2>%t.stale.err \
+; RUN:   | FileCheck %s --check-prefix=STALE
+; RUN: FileCheck %s --check-prefix=STALE-WARN < %t.stale.err
+
+define i32 @classify(i32 %x) {
+entry:
+  %c = icmp slt i32 %x, 3
+  br i1 %c, label %lo, label %hi
+lo:
+  br label %merge
+hi:
+  br label %merge
+merge:
+  %r = phi i32 [1, %lo], [2, %hi]
+  ret i32 %r
+}
+
+define i32 @pick(i32 %x) {
+entry:
+  %k = srem i32 %x, 4
+  switch i32 %k, label %other [
+    i32 0, label %zero
+    i32 1, label %one
+  ]
+zero:
+  ret i32 0
+one:
+  ret i32 1
+other:
+  ret i32 2
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %s = phi i32 [0, %entry], [%s.next, %loop]
+  %v = call i32 @classify(i32 %i)
+  %w = call i32 @pick(i32 %i)
+  %vw = add i32 %v, %w
+  %s.next = add i32 %s, %vw
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 10
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 0
+}
+
+; CHECK:       define i32 @classify(i32 %x) !prof ![[CLASSIFY:[0-9]+]]
+; CHECK:         br i1 %c, label %lo, label %hi, !prof ![[CLASSIFY_BR:[0-9]+]]
+; CHECK:       define i32 @pick(i32 %x) !prof ![[CLASSIFY]]
+; CHECK:         switch i32 %k, label %other [
+; CHECK:         ], !prof ![[PICK_SW:[0-9]+]]
+; CHECK:       define i32 @main() !prof ![[MAIN:[0-9]+]]
+; CHECK:         br i1 %done, label %exit, label %loop, !prof ![[MAIN_BR:[0-9]+]]
+
+; CHECK:       !llvm.module.flags = !{![[SUMMARY:[0-9]+]]}
+; CHECK:       ![[SUMMARY]] = !{i32 1, !"ProfileSummary", !{{[0-9]+}}}
+; CHECK-DAG:   !{!"ProfileFormat", !"InstrProf"}
+; CHECK-DAG:   !{!"MaxFunctionCount", i64 10}
+; CHECK-DAG:   ![[CLASSIFY]] = !{!"function_entry_count", i64 10}
+; CHECK-DAG:   ![[CLASSIFY_BR]] = !{!"branch_weights", i32 3, i32 7}
+; CHECK-DAG:   ![[PICK_SW]] = !{!"branch_weights", i32 4, i32 3, i32 3}
+; CHECK-DAG:   ![[MAIN]] = !{!"function_entry_count", i64 1}
+; CHECK-DAG:   ![[MAIN_BR]] = !{!"branch_weights", i32 1, i32 9}
+
+; BPI-LABEL: function 'classify'
+; BPI:       edge {{%?}}entry -> {{%?}}lo probability is {{.*}} = 30.00%
+; BPI:       edge {{%?}}entry -> {{%?}}hi probability is {{.*}} = 70.00%
+
+; BLOCKS:       define i32 @classify(i32 %x) !prof ![[CLASSIFY:[0-9]+]]
+; BLOCKS:         br i1 %c, label %lo, label %hi, !prof ![[CLASSIFY_BR:[0-9]+]]
+; BLOCKS:       define i32 @main() !prof ![[MAIN:[0-9]+]]
+; BLOCKS:         br i1 %done, label %exit, label %loop{{$}}
+; BLOCKS-DAG:   ![[CLASSIFY]] = !{!"function_entry_count", i64 10}
+; BLOCKS-DAG:   ![[CLASSIFY_BR]] = !{!"branch_weights", i32 3, i32 7}
+; BLOCKS-DAG:   ![[MAIN]] = !{!"function_entry_count", i64 1}
+
+; CALLS:       define i32 @classify(i32 %x) !prof ![[CLASSIFY:[0-9]+]]
+; CALLS:         br i1 %c, label %lo, label %hi{{$}}
+; CALLS:       define i32 @main() !prof ![[MAIN:[0-9]+]]
+; CALLS-DAG:   ![[CLASSIFY]] = !{!"function_entry_count", i64 10}
+; CALLS-DAG:   ![[MAIN]] = !{!"function_entry_count", i64 1}
+
+; STALE-LABEL: define i32 @classify(i32 %x) {
+; STALE-LABEL: define i32 @pick(i32 %x) !prof
+; STALE-WARN:  warning: {{.*}}.edgeprof: the profile for classify does not match the module (CFG hash mismatch), ignoring it
+; STALE-WARN:  warning: {{.*}}.tutorprof: the profile for classify does not match the module (CFG hash mismatch), ignoring it
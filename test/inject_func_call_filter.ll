@@ -0,0 +1,48 @@
+; RUN: opt -load-pass-plugin=%shlibdir/libInjectFuncCall%shlibext \
+; RUN:   -passes="inject-func-call,verify" -inject-func-call-skip-leaf-insts=2 \
+; RUN:   -S %s -o %t.ll 2>&1 | FileCheck %s --check-prefix=SUMMARY
+; RUN: FileCheck %s --input-file=%t.ll
+
+; RUN: echo "ba?" > %t.deny
+; RUN: opt -load-pass-plugin=%shlibdir/libInjectFuncCall%shlibext \
+; RUN:   -passes="inject-func-call,verify" -inject-func-call-denylist=%t.deny \
+; RUN:   -S %s -o %t.deny.ll 2>&1 | FileCheck %s --check-prefix=DENY-SUMMARY
+; RUN: FileCheck %s --check-prefix=DENY --input-file=%t.deny.ll
+
+; Verify that printf is only injected into the selected functions: `foo` is a
+; leaf with 2 instructions, `bar` calls `foo` (so it's not a leaf) and `baz`
+; is too big.
+
+; SUMMARY: inject-func-call: instrumented 2 of 3 functions (skipped: 0 not allowed, 0 denied, 1 trivial)
+
+; CHECK-LABEL: define i32 @foo(i32 %a)
+; CHECK-NEXT:    %r = add i32 %a, 1
+; CHECK-LABEL: define i32 @bar(i32 %a)
+; CHECK-NEXT:    call i32 (ptr, ...) @printf
+; CHECK-LABEL: define i32 @baz(i32 %a, i32 %b)
+; CHECK-NEXT:    call i32 (ptr, ...) @printf
+
+; DENY-SUMMARY: inject-func-call: instrumented 1 of 3 functions (skipped: 0 not allowed, 2 denied, 0 trivial)
+
+; DENY-LABEL: define i32 @foo(i32 %a)
+; DENY-NEXT:    call i32 (ptr, ...) @printf
+; DENY-LABEL: define i32 @bar(i32 %a)
+; DENY-NEXT:    %r = call i32 @foo(i32 %a)
+; DENY-LABEL: define i32 @baz(i32 %a, i32 %b)
+; DENY-NEXT:    %x = mul i32 %a, %b
+
+define i32 @foo(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @bar(i32 %a) {
+  %r = call i32 @foo(i32 %a)
+  ret i32 %r
+}
+
+define i32 @baz(i32 %a, i32 %b) {
+  %x = mul i32 %a, %b
+  %y = add i32 %x, %b
+  ret i32 %y
+}
@@ -0,0 +1,138 @@
+//========================================================================
+// FILE:
+//    CallGraphMain.cpp
+//
+// DESCRIPTION:
+//    A command-line tool that reads the profiles generated by modules
+//    instrumented with the DynamicCallGraph pass and prints the weighted
+//    dynamic call graph, i.e. every {caller, callee} edge with the number of
+//    calls, hottest first.
+//
+//    The counts from all the input files (and from all the runs appended to
+//    one file) are summed. With `-format=dot`, the graph is printed in the
+//    Graphviz format instead (the hotter the edge, the thicker the arrow).
+//    Indirect calls to functions that were not instrumented are calls to the
+//    `<external>` node.
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallGraph.so `\`
+//        -passes="dynamic-cg" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/callgraph default.callgraph
+//      <BUILD/DIR>/bin/callgraph -format=dot default.callgraph | dot -Tsvg
+//
+// License: MIT
+//========================================================================
+#include "ProfileReader.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory CallGraphCategory{"callgraph options"};
+
+enum class OutputFormat { Text, Dot };
+
+static cl::list<std::string> ProfileFiles{cl::Positional,
+                                          cl::desc{"<profile files>"},
+                                          cl::OneOrMore,
+                                          cl::cat{CallGraphCategory}};
+
+static cl::opt<OutputFormat> Format{
+    "format", cl::desc{"Output format"},
+    cl::values(clEnumValN(OutputFormat::Text, "text",
+                          "one edge per line, hottest first (default)"),
+               clEnumValN(OutputFormat::Dot, "dot", "Graphviz")),
+    cl::init(OutputFormat::Text), cl::cat{CallGraphCategory}};
+
+static cl::opt<uint64_t> MinCount{
+    "min-count", cl::desc{"Hide the edges with fewer calls than this"},
+    cl::init(0), cl::cat{CallGraphCategory}};
+
+//===----------------------------------------------------------------------===//
+// callgraph - implementation
+//===----------------------------------------------------------------------===//
+static void printText(ArrayRef<CallGraphProfile::value_type *> Edges) {
+  outs() << "=================================================\n";
+  outs() << "LLVM-TUTOR: dynamic call graph\n";
+  outs() << "=================================================\n";
+  const char *CallerStr = "CALLER", *CalleeStr = "CALLEE", *CountStr = "#CALLS";
+  outs() << format("%-20s %-20s %s\n", CallerStr, CalleeStr, CountStr);
+  outs() << "-------------------------------------------------\n";
+  for (auto *Edge : Edges)
+    outs() << format("%-20s %-20s %llu\n", Edge->first.first.c_str(),
+                     Edge->first.second.c_str(),
+                     (unsigned long long)Edge->second);
+}
+
+static void printDot(ArrayRef<CallGraphProfile::value_type *> Edges) {
+  uint64_t MaxCount = 1;
+  for (auto *Edge : Edges)
+    MaxCount = std::max(MaxCount, Edge->second);
+
+  outs() << "digraph \"dynamic call graph\" {\n";
+  outs() << "  node [shape=box];\n";
+  for (auto *Edge : Edges) {
+    double Width = 1.0 + 4.0 * double(Edge->second) / double(MaxCount);
+    outs() << "  \"" << Edge->first.first << "\" -> \"" << Edge->first.second
+           << "\" [label=\"" << Edge->second << "\", penwidth="
+           << format("%.2f", Width) << "];\n";
+  }
+  outs() << "}\n";
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(CallGraphCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Prints the dynamic call graph recorded by the "
+                              "DynamicCallGraph instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  CallGraphProfile Graph;
+  uint64_t Lost = 0;
+  for (const std::string &Path : ProfileFiles) {
+    std::string ProfileErr = readCallGraphProfile(Path, Graph, Lost);
+    if (!ProfileErr.empty()) {
+      errs() << "Error: " << Path << ": " << ProfileErr << "\n";
+      return -1;
+    }
+  }
+
+  // The hottest edges first (the ties are sorted by name)
+  std::vector<CallGraphProfile::value_type *> Edges;
+  for (auto &Edge : Graph)
+    if (Edge.second >= MinCount)
+      Edges.push_back(&Edge);
+  std::stable_sort(Edges.begin(), Edges.end(), [](auto *A, auto *B) {
+    return A->second > B->second;
+  });
+
+  if (Lost)
+    errs() << "Warning: " << Lost
+           << " indirect calls did not fit into the hash table\n";
+
+  if (Format == OutputFormat::Dot)
+    printDot(Edges);
+  else
+    printText(Edges);
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+//========================================================================
+// FILE:
+//    CoverageMain.cpp
+//
+// DESCRIPTION:
+//    `tutor-cov` - a command-line tool that reads the coverage maps written
+//    by modules instrumented with the Coverage pass and reports the code that
+//    never ran.
+//
+//    The maps from all the input files (and from all the runs appended to one
+//    file) are merged, i.e. a site is covered if it ran in any of the runs.
+//    For every instrumented function, the tool prints the number of covered
+//    sites (basic blocks, or just the entry with `-coverage-level=function`)
+//    and, with `-show-uncovered`, the blocks that never ran. The blocks are
+//    taken from the _uninstrumented_ input module. The CFG hash stored in the
+//    map is used to verify that the module matches the map.
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libCoverage.so `\`
+//        -passes="coverage" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/tutor-cov <input-llvm-file> default.covmap
+//
+// License: MIT
+//========================================================================
+#include "CFGSpanningTree.h"
+#include "ProfileReader.h"
+
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory CoverageCategory{"tutor-cov options"};
+
+static cl::opt<std::string> InputModule{cl::Positional,
+                                        cl::desc{"<Uninstrumented module>"},
+                                        cl::value_desc{"bitcode filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{CoverageCategory}};
+
+static cl::list<std::string> CoverageMaps{cl::Positional,
+                                          cl::desc{"<coverage maps>"},
+                                          cl::OneOrMore,
+                                          cl::cat{CoverageCategory}};
+
+static cl::opt<bool> ShowUncovered{
+    "show-uncovered", cl::desc{"List the basic blocks that never ran"},
+    cl::init(false), cl::cat{CoverageCategory}};
+
+//===----------------------------------------------------------------------===//
+// tutor-cov - implementation
+//===----------------------------------------------------------------------===//
+static std::string getBlockName(const BasicBlock &BB) {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  BB.printAsOperand(OS, /*PrintType=*/false);
+  return Name;
+}
+
+static double getPercentage(uint64_t Part, uint64_t Total) {
+  return Total ? 100.0 * double(Part) / double(Total) : 0.0;
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(CoverageCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Reports the code coverage recorded by the "
+                              "Coverage instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  // Parse the IR file passed on the command line.
+  SMDiagnostic Err;
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+
+  if (!M) {
+    errs() << "Error reading bitcode file: " << InputModule << "\n";
+    Err.print(Argv[0], errs());
+    return -1;
+  }
+
+  StringMap<CoverageProfile> Profiles;
+  for (const std::string &Path : CoverageMaps) {
+    std::string MapErr = readCoverageMap(Path, Profiles);
+    if (!MapErr.empty()) {
+      errs() << "Error: " << Path << ": " << MapErr << "\n";
+      return -1;
+    }
+  }
+
+  outs() << "=================================================\n";
+  outs() << "LLVM-TUTOR: coverage\n";
+  outs() << "=================================================\n";
+  const char *NameStr = "NAME", *CoveredStr = "COVERED";
+  outs() << format("%-20s %s\n", NameStr, CoveredStr);
+  outs() << "-------------------------------------------------\n";
+
+  // Report the functions in the order of the input module
+  uint64_t NumFunctions = 0, NumCoveredFunctions = 0;
+  uint64_t NumBlocks = 0, NumCoveredBlocks = 0;
+  for (Function &F : *M) {
+    auto It = Profiles.find(F.getName());
+    if (It == Profiles.end() || F.isDeclaration())
+      continue;
+    const CoverageProfile &P = It->second;
+    if (P.Hash != CFGSpanningTree::getStructuralHash(F)) {
+      errs() << "Warning: the coverage map for " << F.getName()
+             << " does not match the input module (CFG hash mismatch)\n";
+      Profiles.erase(It);
+      continue;
+    }
+
+    // The first site is always the entry block
+    NumFunctions++;
+    NumCoveredFunctions += P.Covered.test(0);
+    uint64_t Covered = P.Covered.count();
+    outs() << format("%-20s %llu/%u (%.1f%%)\n", F.getName().str().c_str(),
+                     (unsigned long long)Covered, P.Covered.size(),
+                     getPercentage(Covered, P.Covered.size()));
+
+    if (P.Level == "block") {
+      NumBlocks += P.Covered.size();
+      NumCoveredBlocks += Covered;
+      if (ShowUncovered) {
+        unsigned Idx = 0;
+        for (const BasicBlock &BB : F)
+          if (!P.Covered.test(Idx++))
+            outs() << "  never ran: " << getBlockName(BB) << "\n";
+      }
+    }
+    Profiles.erase(It);
+  }
+
+  outs() << "-------------------------------------------------\n";
+  outs() << format("functions: %llu/%llu (%.1f%%)\n",
+                   (unsigned long long)NumCoveredFunctions,
+                   (unsigned long long)NumFunctions,
+                   getPercentage(NumCoveredFunctions, NumFunctions));
+  if (NumBlocks)
+    outs() << format("blocks: %llu/%llu (%.1f%%)\n",
+                     (unsigned long long)NumCoveredBlocks,
+                     (unsigned long long)NumBlocks,
+                     getPercentage(NumCoveredBlocks, NumBlocks));
+
+  for (auto &P : Profiles)
+    errs() << "Warning: no function " << P.first()
+           << " in the input module\n";
+
+  return 0;
+}
@@ -0,0 +1,174 @@
+//========================================================================
+// FILE:
+//    EdgeProfMain.cpp
+//
+// DESCRIPTION:
+//    A command-line tool that reads the profile generated by a module
+//    instrumented with the EdgeProfiler pass and prints the execution counts
+//    of every basic block and of every CFG edge.
+//
+//    In the default (`tree`) mode, only the edges that are not in the maximum
+//    spanning tree of the CFG are counted at run-time. This tool rebuilds the
+//    very same spanning tree from the _uninstrumented_ input module (see
+//    CFGSpanningTree.h) and reconstructs the remaining counts from the flow
+//    conservation law. The CFG hash stored in the profile is used to verify
+//    that the module matches the profile.
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libEdgeProfiler.so `\`
+//        -passes="edge-prof" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/edgeprof <input-llvm-file> default.edgeprof
+//
+// License: MIT
+//========================================================================
+#include "CFGSpanningTree.h"
+#include "ProfileReader.h"
+
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory EdgeProfCategory{"edgeprof options"};
+
+static cl::opt<std::string> InputModule{cl::Positional,
+                                        cl::desc{"<Uninstrumented module>"},
+                                        cl::value_desc{"bitcode filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{EdgeProfCategory}};
+
+static cl::opt<std::string> ProfileFile{cl::Positional,
+                                        cl::desc{"<Profile>"},
+                                        cl::value_desc{"profile filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{EdgeProfCategory}};
+
+//===----------------------------------------------------------------------===//
+// edgeprof - implementation
+//===----------------------------------------------------------------------===//
+static std::string getBlockName(const BasicBlock *BB) {
+  if (!BB)
+    return "<exit>";
+  std::string Name;
+  raw_string_ostream OS(Name);
+  BB->printAsOperand(OS, /*PrintType=*/false);
+  return Name;
+}
+
+static void printProfile(Function &F, const EdgeProfile &P,
+                         FunctionAnalysisManager &FAM) {
+  CFGSpanningTree Tree(F, FAM.getResult<BlockFrequencyAnalysis>(F),
+                       FAM.getResult<BranchProbabilityAnalysis>(F));
+  if (P.Hash != Tree.getCFGHash()) {
+    errs() << "Warning: the profile for " << F.getName()
+           << " does not match the input module (CFG hash mismatch)\n";
+    return;
+  }
+
+  DenseMap<const BasicBlock *, uint64_t> BlockCounts;
+  std::vector<uint64_t> EdgeCounts;
+  bool HasEdges = P.Mode == "tree";
+  if (HasEdges) {
+    if (!Tree.computeEdgeCounts(P.Counters, EdgeCounts))
+      errs() << "Warning: the flow is not conserved in " << F.getName()
+             << " (did the program exit from it?), the counts are "
+                "approximate\n";
+    Tree.computeBlockCounts(EdgeCounts, BlockCounts);
+  } else {
+    for (unsigned Idx = 0, E = Tree.blocks().size(); Idx != E; ++Idx)
+      BlockCounts[Tree.blocks()[Idx]] = P.Counters[Idx];
+  }
+
+  outs() << "=================================================\n";
+  outs() << "Function: " << F.getName()
+         << " (entry count: " << BlockCounts.lookup(&F.getEntryBlock())
+         << ")\n";
+  outs() << "=================================================\n";
+  const char *BlockStr = "BLOCK", *EdgeStr = "EDGE", *CountStr = "COUNT";
+  outs() << format("%-35s %s\n", BlockStr, CountStr);
+  for (BasicBlock *BB : Tree.blocks())
+    outs() << format("%-35s %llu\n", getBlockName(BB).c_str(),
+                     (unsigned long long)BlockCounts.lookup(BB));
+
+  if (!HasEdges)
+    return;
+
+  outs() << "-------------------------------------------------\n";
+  outs() << format("%-35s %s\n", EdgeStr, CountStr);
+  for (unsigned Idx = 0, NumEdges = Tree.edges().size(); Idx != NumEdges;
+       ++Idx) {
+    const CFGEdge &E = Tree.edges()[Idx];
+    // Skip the virtual edges
+    if (!E.Src || !E.Dst)
+      continue;
+    std::string Edge = getBlockName(E.Src) + " -> " + getBlockName(E.Dst);
+    outs() << format("%-35s %llu\n", Edge.c_str(),
+                     (unsigned long long)EdgeCounts[Idx]);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(EdgeProfCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Prints the block and edge counts recorded "
+                              "by the EdgeProfiler instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  // Parse the IR file passed on the command line.
+  SMDiagnostic Err;
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+
+  if (!M) {
+    errs() << "Error reading bitcode file: " << InputModule << "\n";
+    Err.print(Argv[0], errs());
+    return -1;
+  }
+
+  StringMap<EdgeProfile> Profiles;
+  std::string ProfileErr = readEdgeProfile(ProfileFile, Profiles);
+  if (!ProfileErr.empty()) {
+    errs() << "Error: " << ProfileFile << ": " << ProfileErr << "\n";
+    return -1;
+  }
+
+  // Register the analyses required to rebuild the spanning trees
+  FunctionAnalysisManager FAM;
+  PassBuilder PB;
+  PB.registerFunctionAnalyses(FAM);
+
+  // Print the profiles in the order of the functions in the input module
+  for (Function &F : *M) {
+    auto It = Profiles.find(F.getName());
+    if (It == Profiles.end() || F.isDeclaration())
+      continue;
+    printProfile(F, It->second, FAM);
+    Profiles.erase(It);
+  }
+
+  for (auto &P : Profiles)
+    errs() << "Warning: no function " << P.first()
+           << " in the input module\n";
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+//========================================================================
+// FILE:
+//    HeapMain.cpp
+//
+// DESCRIPTION:
+//    `tutor-heap` - a command-line tool that reads the heap profiles written
+//    by the programs instrumented with the HeapProfiler pass and ranks the
+//    allocation sites by the # of allocations (the hot allocators).
+//
+//    The statistics from all the input files (and from all the runs appended
+//    to one file) are summed. For every site, the tool prints the # of
+//    allocations, the average size, the typical size (the bucket of the
+//    median allocation, see TutorHeapProf.h), the share of the blocks that
+//    were freed within `-short-lifetime-us` and the # of blocks that were
+//    still live when the program exited. The profile is self-contained, so
+//    the module is not needed.
+//
+//    The sites with at least `-min-allocs` allocations are flagged as:
+//      * `stack`: no block is larger than `-stack-max-size`, none is live at
+//        exit and at least `-threshold`% of them are short-lived, i.e. the
+//        blocks could probably live on the stack of the caller (the profile
+//        doesn't know where the blocks are freed, so this is only a hint),
+//      * `pool`: at least `-threshold`% of the allocations fall into one size
+//        bucket, no larger than `-pool-max-size`, i.e. a pool (or a free
+//        list) of blocks of that size would serve most of them.
+//    With `-histogram`, the non-empty buckets of every site are printed too.
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libHeapProfiler.so `\`
+//        -passes="heap-prof" <input-llvm-file> -o instrumented.bin
+//      lli -extra-archive=<BUILD_DIR>/lib/libTutorRuntime.a instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/tutor-heap default.heapprof
+//
+// License: MIT
+//========================================================================
+#include "ProfileReader.h"
+#include "TutorHeapProf.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory HeapCategory{"tutor-heap options"};
+
+static cl::list<std::string> ProfileFiles{cl::Positional,
+                                          cl::desc{"<profiles>"},
+                                          cl::OneOrMore,
+                                          cl::cat{HeapCategory}};
+
+static cl::opt<unsigned> Top{
+    "top", cl::desc{"The # of sites to report (0 for all of them)"},
+    cl::init(20), cl::cat{HeapCategory}};
+
+static cl::opt<uint64_t> MinAllocs{
+    "min-allocs",
+    cl::desc{"Only flag the sites with at least this many allocations"},
+    cl::init(100), cl::cat{HeapCategory}};
+
+static cl::opt<unsigned> Threshold{
+    "threshold",
+    cl::desc{"The share (in %) of the allocations that must be short-lived "
+             "(stack) or of one size bucket (pool) for a site to be flagged"},
+    cl::init(90), cl::cat{HeapCategory}};
+
+static cl::opt<uint64_t> ShortLifetimeUs{
+    "short-lifetime-us",
+    cl::desc{"The blocks freed within this many microseconds are "
+             "short-lived (rounded down to a power of 10)"},
+    cl::init(10), cl::cat{HeapCategory}};
+
+static cl::opt<uint64_t> StackMaxSize{
+    "stack-max-size",
+    cl::desc{"The largest block (in bytes) that could live on the stack"},
+    cl::init(1024), cl::cat{HeapCategory}};
+
+static cl::opt<uint64_t> PoolMaxSize{
+    "pool-max-size",
+    cl::desc{"The largest block (in bytes) that's worth pooling"},
+    cl::init(4096), cl::cat{HeapCategory}};
+
+static cl::opt<bool> ShowHistogram{
+    "histogram", cl::desc{"Print the histograms of every site"},
+    cl::init(false), cl::cat{HeapCategory}};
+
+//===----------------------------------------------------------------------===//
+// tutor-heap - implementation
+//===----------------------------------------------------------------------===//
+namespace {
+struct Site {
+  std::string Name;
+  const HeapSiteProfile *P;
+};
+} // namespace
+
+static std::string getSizeBucketName(unsigned Bucket) {
+  if (Bucket == 0)
+    return "0-1";
+  uint64_t Min = getHeapSizeBucketMax(Bucket - 1) + 1;
+  if (Bucket + 1 == TUTOR_HEAP_NUM_SIZE_BUCKETS)
+    return std::to_string(Min) + "+";
+  uint64_t Max = getHeapSizeBucketMax(Bucket);
+  if (Min == Max)
+    return std::to_string(Min);
+  return std::to_string(Min) + "-" + std::to_string(Max);
+}
+
+static std::string getLifetimeBucketName(unsigned Bucket) {
+  static const char *const Names[TUTOR_HEAP_NUM_LIFETIME_BUCKETS] = {
+      "<1us", "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"};
+  return Names[Bucket];
+}
+
+// Returns the bucket of the median allocation
+static unsigned getTypicalBucket(const HeapSiteProfile &P) {
+  uint64_t Seen = 0;
+  for (unsigned Bucket = 0; Bucket != P.Sizes.size(); ++Bucket) {
+    Seen += P.Sizes[Bucket];
+    if (2 * Seen >= P.Allocs)
+      return Bucket;
+  }
+  return P.Sizes.size() - 1;
+}
+
+// Returns the # of blocks freed within -short-lifetime-us
+static uint64_t getNumShortLived(const HeapSiteProfile &P) {
+  uint64_t Count = 0;
+  for (unsigned Bucket = 0; Bucket != P.Lifetimes.size(); ++Bucket)
+    if (getHeapLifetimeBucketLimit(Bucket) <= ShortLifetimeUs * 1000)
+      Count += P.Lifetimes[Bucket];
+  return Count;
+}
+
+static bool isStackCandidate(const HeapSiteProfile &P) {
+  if (P.Kind == "realloc" || P.Frees < P.Allocs)
+    return false;
+  for (unsigned Bucket = 0; Bucket != P.Sizes.size(); ++Bucket)
+    if (P.Sizes[Bucket] && getHeapSizeBucketMax(Bucket) > StackMaxSize)
+      return false;
+  return getNumShortLived(P) * 100 >= P.Allocs * Threshold;
+}
+
+static bool isPoolCandidate(const HeapSiteProfile &P) {
+  for (unsigned Bucket = 0; Bucket != P.Sizes.size(); ++Bucket)
+    if (getHeapSizeBucketMax(Bucket) <= PoolMaxSize &&
+        P.Sizes[Bucket] * 100 >= P.Allocs * Threshold)
+      return true;
+  return false;
+}
+
+static void printSite(const Site &S) {
+  const HeapSiteProfile &P = *S.P;
+  std::string Note;
+  if (P.Allocs >= MinAllocs) {
+    if (isStackCandidate(P))
+      Note = "stack";
+    else if (isPoolCandidate(P))
+      Note = "pool";
+  }
+
+  char Short[16];
+  snprintf(Short, sizeof(Short), "%.0f%%",
+           100.0 * double(getNumShortLived(P)) / double(P.Allocs));
+  uint64_t Live = P.Allocs - std::min(P.Frees, P.Allocs);
+  outs() << format("%-20s %-14s %-7s %-10llu %-10.1f %-10s %-7s %-8llu %s\n",
+                   S.Name.c_str(), P.Location.c_str(), P.Kind.c_str(),
+                   (unsigned long long)P.Allocs,
+                   double(P.Bytes) / double(P.Allocs),
+                   getSizeBucketName(getTypicalBucket(P)).c_str(),
+                   static_cast<const char *>(Short), (unsigned long long)Live,
+                   Note.c_str());
+
+  if (!ShowHistogram)
+    return;
+  for (unsigned Bucket = 0; Bucket != P.Sizes.size(); ++Bucket)
+    if (P.Sizes[Bucket])
+      outs() << format("  size %-12s %llu\n",
+                       getSizeBucketName(Bucket).c_str(),
+                       (unsigned long long)P.Sizes[Bucket]);
+  for (unsigned Bucket = 0; Bucket != P.Lifetimes.size(); ++Bucket)
+    if (P.Lifetimes[Bucket])
+      outs() << format("  life %-12s %llu\n",
+                       getLifetimeBucketName(Bucket).c_str(),
+                       (unsigned long long)P.Lifetimes[Bucket]);
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(HeapCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Ranks the allocation sites recorded by the "
+                              "HeapProfiler instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  if (Threshold > 100) {
+    errs() << "Error: -threshold must be at most 100\n";
+    return -1;
+  }
+
+  StringMap<HeapProfile> Profiles;
+  for (const std::string &Path : ProfileFiles) {
+    std::string ProfileErr = readHeapProfile(Path, Profiles);
+    if (!ProfileErr.empty()) {
+      errs() << "Error: " << Path << ": " << ProfileErr << "\n";
+      return -1;
+    }
+  }
+
+  // The hottest sites first
+  std::vector<Site> Sites;
+  for (auto &P : Profiles)
+    for (auto &S : P.second.Sites)
+      if (S.second.Allocs)
+        Sites.push_back(
+            {(P.first() + "#" + Twine(S.first)).str(), &S.second});
+  std::sort(Sites.begin(), Sites.end(), [](const Site &A, const Site &B) {
+    if (A.P->Allocs != B.P->Allocs)
+      return A.P->Allocs > B.P->Allocs;
+    if (A.P->Bytes != B.P->Bytes)
+      return A.P->Bytes > B.P->Bytes;
+    return A.Name < B.Name;
+  });
+  if (Top && Sites.size() > Top)
+    Sites.resize(Top);
+
+  outs() << "=================================================\n";
+  outs() << "LLVM-TUTOR: heap allocation sites\n";
+  outs() << "=================================================\n";
+  const char *SiteStr = "SITE", *LocStr = "LOCATION", *KindStr = "KIND",
+             *AllocsStr = "ALLOCS", *AvgStr = "AVG SIZE",
+             *TypicalStr = "TYPICAL", *ShortStr = "SHORT", *LiveStr = "LIVE";
+  outs() << format("%-20s %-14s %-7s %-10s %-10s %-10s %-7s %s\n", SiteStr,
+                   LocStr, KindStr, AllocsStr, AvgStr, TypicalStr, ShortStr,
+                   LiveStr);
+  outs() << "-------------------------------------------------\n";
+  for (const Site &S : Sites)
+    printSite(S);
+  outs() << "-------------------------------------------------\n";
+
+  return 0;
+}
@@ -0,0 +1,254 @@
+//========================================================================
+// FILE:
+//    LoopProfMain.cpp
+//
+// DESCRIPTION:
+//    A command-line tool that reads the profiles generated by modules
+//    instrumented with the LoopProfiler pass and reports the trip counts of
+//    every loop: how many times it was entered, the average trip count and
+//    the typical one (the bucket of the median entry, see LoopProfiler.h).
+//
+//    The counts from all the input files (and from all the runs appended to
+//    one file) are summed. The loops are named after their headers, which
+//    are taken from the _uninstrumented_ input module. The CFG hash stored in
+//    the profile is used to verify that the module matches the profile.
+//
+//    Two kinds of loops are flagged as poor candidates for vectorisation:
+//      * `short`: the typical trip count is below `-vector-width`, i.e. most
+//        of the time the loop would not run a single vector iteration,
+//      * `remainder`: at least `-remainder-percent`% of the iterations would
+//        be left for the scalar remainder (epilogue) loop. The exact trip
+//        counts are not known (only the buckets), so this assumes that they
+//        are spread evenly within every bucket.
+//    With `-histogram`, the non-empty buckets of every loop are printed too.
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libLoopProfiler.so `\`
+//        -passes="loop-prof" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/loopprof <input-llvm-file> default.loopprof
+//
+// License: MIT
+//========================================================================
+#include "CFGSpanningTree.h"
+#include "LoopProfiler.h"
+#include "ProfileReader.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory LoopProfCategory{"loopprof options"};
+
+static cl::opt<std::string> InputModule{cl::Positional,
+                                        cl::desc{"<Uninstrumented module>"},
+                                        cl::value_desc{"bitcode filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{LoopProfCategory}};
+
+static cl::list<std::string> ProfileFiles{cl::Positional,
+                                          cl::desc{"<profiles>"},
+                                          cl::OneOrMore,
+                                          cl::cat{LoopProfCategory}};
+
+static cl::opt<unsigned> VectorWidth{
+    "vector-width",
+    cl::desc{"The # of iterations in one vector iteration (the vectorisation "
+             "factor times the interleave count)"},
+    cl::init(4), cl::cat{LoopProfCategory}};
+
+static cl::opt<unsigned> RemainderPercent{
+    "remainder-percent",
+    cl::desc{"Flag the loops with at least this share (in %) of the "
+             "iterations in the remainder"},
+    cl::init(25), cl::cat{LoopProfCategory}};
+
+static cl::opt<bool> ShowHistogram{
+    "histogram", cl::desc{"Print the histogram of every loop"},
+    cl::init(false), cl::cat{LoopProfCategory}};
+
+//===----------------------------------------------------------------------===//
+// loopprof - implementation
+//===----------------------------------------------------------------------===//
+static std::string getBlockName(const BasicBlock &BB) {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  BB.printAsOperand(OS, /*PrintType=*/false);
+  return Name;
+}
+
+static std::string getBucketName(unsigned Bucket) {
+  uint64_t Min = getTripCountBucketMin(Bucket);
+  uint64_t Max = getTripCountBucketMax(Bucket);
+  if (Min == Max)
+    return std::to_string(Min);
+  if (Bucket + 1 == LOOP_PROF_NUM_BUCKETS)
+    return std::to_string(Min) + "+";
+  return std::to_string(Min) + "-" + std::to_string(Max);
+}
+
+// Returns the bucket of the median entry into the loop
+static unsigned getTypicalBucket(const LoopTripProfile &P, uint64_t Entries) {
+  uint64_t Seen = 0;
+  for (unsigned Bucket = 0; Bucket != P.Buckets.size(); ++Bucket) {
+    Seen += P.Buckets[Bucket];
+    if (2 * Seen >= Entries)
+      return Bucket;
+  }
+  return P.Buckets.size() - 1;
+}
+
+// Returns the share of the iterations that would run in the remainder loop
+// with VectorWidth, assuming that the trip counts within every bucket are
+// spread evenly
+static double getRemainderShare(const LoopTripProfile &P) {
+  double Remainder = 0.0, Total = 0.0;
+  for (unsigned Bucket = 0; Bucket != P.Buckets.size(); ++Bucket) {
+    if (!P.Buckets[Bucket])
+      continue;
+    uint64_t Min = getTripCountBucketMin(Bucket);
+    uint64_t Max = std::min<uint64_t>(getTripCountBucketMax(Bucket),
+                                      2 * Min - 1);
+    // In the large buckets, every remainder is equally likely
+    double AvgRemainder = (VectorWidth - 1) / 2.0;
+    if (Max - Min < 4096) {
+      uint64_t Sum = 0;
+      for (uint64_t Trips = Min; Trips <= Max; ++Trips)
+        Sum += Trips % VectorWidth;
+      AvgRemainder = double(Sum) / double(Max - Min + 1);
+    }
+    Remainder += P.Buckets[Bucket] * AvgRemainder;
+    Total += P.Buckets[Bucket] * (double(Min) + double(Max)) / 2.0;
+  }
+  return Total ? Remainder / Total : 0.0;
+}
+
+static void printLoop(const Function &F, const Loop &L,
+                      const LoopTripProfile &P) {
+  uint64_t Entries = 0;
+  for (uint64_t Count : P.Buckets)
+    Entries += Count;
+  if (!Entries)
+    return;
+
+  unsigned Typical = getTypicalBucket(P, Entries);
+  std::string Note;
+  if (getTripCountBucketMax(Typical) < VectorWidth) {
+    Note = "short";
+  } else {
+    double Share = getRemainderShare(P);
+    if (Share * 100.0 >= RemainderPercent) {
+      char Buf[32];
+      snprintf(Buf, sizeof(Buf), "remainder (%.0f%%)", Share * 100.0);
+      Note = Buf;
+    }
+  }
+
+  outs() << format("%-20s %-12s %-10llu %-10.1f %-10s %s\n",
+                   F.getName().str().c_str(),
+                   getBlockName(*L.getHeader()).c_str(),
+                   (unsigned long long)Entries,
+                   double(P.Iterations) / double(Entries),
+                   getBucketName(Typical).c_str(), Note.c_str());
+
+  if (ShowHistogram)
+    for (unsigned Bucket = 0; Bucket != P.Buckets.size(); ++Bucket)
+      if (P.Buckets[Bucket])
+        outs() << format("  %-12s %llu\n", getBucketName(Bucket).c_str(),
+                         (unsigned long long)P.Buckets[Bucket]);
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(LoopProfCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Reports the loop trip counts recorded by the "
+                              "LoopProfiler instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  if (!VectorWidth) {
+    errs() << "Error: -vector-width must be at least 1\n";
+    return -1;
+  }
+
+  // Parse the IR file passed on the command line.
+  SMDiagnostic Err;
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+
+  if (!M) {
+    errs() << "Error reading bitcode file: " << InputModule << "\n";
+    Err.print(Argv[0], errs());
+    return -1;
+  }
+
+  StringMap<LoopProfile> Profiles;
+  for (const std::string &Path : ProfileFiles) {
+    std::string ProfileErr = readLoopProfile(Path, Profiles);
+    if (!ProfileErr.empty()) {
+      errs() << "Error: " << Path << ": " << ProfileErr << "\n";
+      return -1;
+    }
+  }
+
+  outs() << "=================================================\n";
+  outs() << "LLVM-TUTOR: loop trip counts\n";
+  outs() << "=================================================\n";
+  const char *NameStr = "FUNCTION", *LoopStr = "LOOP", *EntriesStr = "ENTRIES",
+             *AvgStr = "AVERAGE", *TypicalStr = "TYPICAL";
+  outs() << format("%-20s %-12s %-10s %-10s %s\n", NameStr, LoopStr,
+                   EntriesStr, AvgStr, TypicalStr);
+  outs() << "-------------------------------------------------\n";
+
+  // Report the loops in the order of the input module
+  for (Function &F : *M) {
+    auto It = Profiles.find(F.getName());
+    if (It == Profiles.end() || F.isDeclaration())
+      continue;
+
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+    const LoopProfile &P = It->second;
+    if (P.Hash != CFGSpanningTree::getStructuralHash(F) ||
+        P.Loops.size() > Loops.size()) {
+      errs() << "Warning: the profile for " << F.getName()
+             << " does not match the input module (CFG hash mismatch)\n";
+      Profiles.erase(It);
+      continue;
+    }
+
+    for (unsigned Idx = 0, E = P.Loops.size(); Idx != E; ++Idx)
+      printLoop(F, *Loops[Idx], P.Loops[Idx]);
+    Profiles.erase(It);
+  }
+  outs() << "-------------------------------------------------\n";
+
+  for (auto &P : Profiles)
+    errs() << "Warning: no function " << P.first()
+           << " in the input module\n";
+
+  return 0;
+}
@@ -0,0 +1,327 @@
+//========================================================================
+// FILE:
+//    OrderMain.cpp
+//
+// DESCRIPTION:
+//    `tutor-order` - a command-line tool that computes a link order for the
+//    functions of a module from the call graphs recorded by modules
+//    instrumented with the DynamicCallGraph pass. Keeping the hot functions
+//    (and the functions that call each other) together means fewer I-cache
+//    lines and iTLB entries for the hot code.
+//
+//    The order is computed with the Call-Chain Clustering (C3) heuristic from
+//    "Optimizing Function Placement for Large-Scale Data-Center
+//    Applications" (Ottoni and Maher, CGO 2017):
+//      1. Every function starts in its own cluster. The weight of a function
+//         is the number of calls to it.
+//      2. The functions are visited from the heaviest to the lightest. The
+//         cluster of every function is appended to the cluster of its most
+//         frequent caller, unless the merged cluster would be larger than
+//         `-max-cluster-size` (a page, more or less).
+//      3. The clusters are sorted by density (the weight over the size), the
+//         densest first.
+//    The size of a function is estimated as its number of IR instructions.
+//    Only the functions that are defined in the input module and appear in
+//    the call graphs are ordered, the linker places the others after them.
+//
+//    The order is printed as an ordering file for the linker. With
+//    `-format=symbols` (the default) that's one symbol per line, for lld's
+//    `--symbol-ordering-file`. With `-format=sections` that's one section per
+//    line, for gold's `--section-ordering-file`. Either needs every function
+//    in its own section: compile with `-ffunction-sections` or use
+//    `-sections-output`, which writes the input module with every ordered
+//    function in the same `.text.<function>` section that
+//    `-ffunction-sections` would use (and in the computed order, which is the
+//    order in which the compiler emits them).
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallGraph.so `\`
+//        -passes="dynamic-cg" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/tutor-order <input-llvm-file> default.callgraph `\`
+//        -o order.txt -sections-output=ordered.ll
+//      clang ordered.ll -fuse-ld=lld -Wl,--symbol-ordering-file=order.txt
+//
+// License: MIT
+//========================================================================
+#include "DynamicCallGraph.h"
+#include "ProfileReader.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory OrderCategory{"tutor-order options"};
+
+enum class OrderFormat { Symbols, Sections };
+
+static cl::opt<std::string> InputModule{cl::Positional,
+                                        cl::desc{"<Uninstrumented module>"},
+                                        cl::value_desc{"bitcode filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{OrderCategory}};
+
+static cl::list<std::string> ProfileFiles{cl::Positional,
+                                          cl::desc{"<call graph profiles>"},
+                                          cl::OneOrMore,
+                                          cl::cat{OrderCategory}};
+
+static cl::opt<std::string> OutputFile{
+    "o", cl::desc{"Where to write the ordering file"},
+    cl::value_desc{"filename"}, cl::init("-"), cl::cat{OrderCategory}};
+
+static cl::opt<OrderFormat> Format{
+    "format", cl::desc{"The format of the ordering file"},
+    cl::values(clEnumValN(OrderFormat::Symbols, "symbols",
+                          "one symbol per line, for lld's "
+                          "--symbol-ordering-file (default)"),
+               clEnumValN(OrderFormat::Sections, "sections",
+                          "one section per line, for gold's "
+                          "--section-ordering-file")),
+    cl::init(OrderFormat::Symbols), cl::cat{OrderCategory}};
+
+static cl::opt<unsigned> MaxClusterSize{
+    "max-cluster-size",
+    cl::desc{"The maximum size of a cluster, in IR instructions"},
+    cl::init(1024), cl::cat{OrderCategory}};
+
+static cl::opt<std::string> SectionsOutput{
+    "sections-output",
+    cl::desc{"Write the input module with every ordered function in its own "
+             "section (and in the computed order) to this file"},
+    cl::value_desc{"filename"}, cl::init(""), cl::cat{OrderCategory}};
+
+//===----------------------------------------------------------------------===//
+// tutor-order - implementation
+//===----------------------------------------------------------------------===//
+namespace {
+struct Cluster {
+  std::vector<Function *> Functions;
+  uint64_t Size = 0;
+  uint64_t Weight = 0;
+
+  double getDensity() const { return double(Weight) / double(Size); }
+};
+
+struct FunctionNode {
+  Function *F = nullptr;
+  // The # of calls to this function
+  uint64_t Weight = 0;
+  // The most frequent caller (and the # of calls from it)
+  Function *Caller = nullptr;
+  uint64_t CallerCount = 0;
+  // The index into the cluster list
+  unsigned ClusterIdx = 0;
+};
+} // namespace
+
+static uint64_t getSize(const Function &F) {
+  return std::max<uint64_t>(F.getInstructionCount(), 1);
+}
+
+// The section that `-ffunction-sections` puts F in
+static std::string getSectionName(const Function &F) {
+  return (".text." + F.getName()).str();
+}
+
+// Computes the order of the functions from Graph with C3 (see the top of
+// this file)
+static std::vector<Function *> computeOrder(Module &M,
+                                            const CallGraphProfile &Graph) {
+  // STEP 1: Find the nodes (the functions from the module that appear in the
+  // call graph), the weights and the most frequent callers
+  // --------------------------------------------------------------------------
+  DenseMap<Function *, FunctionNode> Nodes;
+  StringSet<> Unknown;
+  auto GetFunction = [&](StringRef Name) -> Function * {
+    Function *F = M.getFunction(Name);
+    if (!F || F->isDeclaration()) {
+      if (Name != DYNAMIC_CG_EXTERNAL_NODE)
+        Unknown.insert(Name);
+      return nullptr;
+    }
+    return F;
+  };
+  for (const auto &Edge : Graph) {
+    Function *Caller = GetFunction(Edge.first.first);
+    Function *Callee = GetFunction(Edge.first.second);
+    if (!Caller || !Callee)
+      continue;
+    Nodes[Caller].F = Caller;
+    FunctionNode &Node = Nodes[Callee];
+    Node.F = Callee;
+    // Recursive calls don't affect the order
+    if (Caller == Callee)
+      continue;
+    Node.Weight += Edge.second;
+    if (Edge.second > Node.CallerCount) {
+      Node.Caller = Caller;
+      Node.CallerCount = Edge.second;
+    }
+  }
+  if (!Unknown.empty())
+    errs() << "Warning: " << Unknown.size()
+           << " functions from the call graph are not defined in the input "
+              "module\n";
+
+  // The nodes in the order of the module, so that the ties are deterministic
+  std::vector<FunctionNode *> Sorted;
+  std::vector<Cluster> Clusters;
+  for (Function &F : M) {
+    auto It = Nodes.find(&F);
+    if (It == Nodes.end())
+      continue;
+    It->second.ClusterIdx = Clusters.size();
+    Clusters.push_back({{&F}, getSize(F), It->second.Weight});
+    Sorted.push_back(&It->second);
+  }
+
+  // STEP 2: Append the cluster of every function to the cluster of its most
+  // frequent caller, the heaviest functions first
+  // --------------------------------------------------------------------------
+  std::stable_sort(Sorted.begin(), Sorted.end(), [](auto *A, auto *B) {
+    return A->Weight > B->Weight;
+  });
+  for (FunctionNode *Node : Sorted) {
+    if (!Node->Caller)
+      continue;
+    unsigned CallerIdx = Nodes[Node->Caller].ClusterIdx;
+    unsigned CalleeIdx = Node->ClusterIdx;
+    Cluster &Into = Clusters[CallerIdx];
+    Cluster &From = Clusters[CalleeIdx];
+    if (CallerIdx == CalleeIdx || Into.Size + From.Size > MaxClusterSize)
+      continue;
+
+    for (Function *F : From.Functions) {
+      Into.Functions.push_back(F);
+      Nodes[F].ClusterIdx = CallerIdx;
+    }
+    Into.Size += From.Size;
+    Into.Weight += From.Weight;
+    From = Cluster();
+  }
+
+  // STEP 3: Sort the clusters by density
+  // --------------------------------------------------------------------------
+  Clusters.erase(std::remove_if(Clusters.begin(), Clusters.end(),
+                                [](const Cluster &C) {
+                                  return C.Functions.empty();
+                                }),
+                 Clusters.end());
+  std::stable_sort(Clusters.begin(), Clusters.end(),
+                   [](const Cluster &A, const Cluster &B) {
+                     return A.getDensity() > B.getDensity();
+                   });
+
+  std::vector<Function *> Order;
+  for (const Cluster &C : Clusters)
+    Order.insert(Order.end(), C.Functions.begin(), C.Functions.end());
+  return Order;
+}
+
+// Puts the functions from Order in their own sections and moves them to the
+// top of the module (in that order)
+static void applyOrder(Module &M, ArrayRef<Function *> Order) {
+  auto &Functions = M.getFunctionList();
+  auto InsertPt = Functions.begin();
+  for (Function *F : Order) {
+    // Don't override the sections chosen by the user
+    if (!F->hasSection())
+      F->setSection(getSectionName(*F));
+    if (F == &*InsertPt) {
+      ++InsertPt;
+      continue;
+    }
+    Functions.splice(InsertPt, Functions, F->getIterator());
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(OrderCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Computes a link order for the functions from "
+                              "the DynamicCallGraph profiles\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  // Parse the IR file passed on the command line.
+  SMDiagnostic Err;
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+
+  if (!M) {
+    errs() << "Error reading bitcode file: " << InputModule << "\n";
+    Err.print(Argv[0], errs());
+    return -1;
+  }
+
+  CallGraphProfile Graph;
+  uint64_t Lost = 0;
+  for (const std::string &Path : ProfileFiles) {
+    std::string ProfileErr = readCallGraphProfile(Path, Graph, Lost);
+    if (!ProfileErr.empty()) {
+      errs() << "Error: " << Path << ": " << ProfileErr << "\n";
+      return -1;
+    }
+  }
+  if (Lost)
+    errs() << "Warning: " << Lost
+           << " indirect calls did not fit into the hash table\n";
+
+  std::vector<Function *> Order = computeOrder(*M, Graph);
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error: " << OutputFile << ": " << EC.message() << "\n";
+    return -1;
+  }
+  for (Function *F : Order) {
+    // Sections that were set by the user are listed as they are
+    if (Format == OrderFormat::Sections)
+      Out.os() << (F->hasSection() ? F->getSection().str()
+                                   : getSectionName(*F))
+               << "\n";
+    else
+      Out.os() << F->getName() << "\n";
+  }
+  Out.keep();
+
+  if (!SectionsOutput.empty()) {
+    applyOrder(*M, Order);
+    ToolOutputFile IROut(SectionsOutput, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << SectionsOutput << ": " << EC.message() << "\n";
+      return -1;
+    }
+    M->print(IROut.os(), /*AAW=*/nullptr);
+    IROut.keep();
+  }
+
+  return 0;
+}
@@ -0,0 +1,222 @@
+//========================================================================
+// FILE:
+//    PathProfMain.cpp
+//
+// DESCRIPTION:
+//    A command-line tool that reads the profile generated by a module
+//    instrumented with the PathProfiler pass and prints the execution counts
+//    of the acyclic paths in every function, hottest first.
+//
+//    The profile only contains path IDs. This tool renumbers the paths in the
+//    _uninstrumented_ input module (see BallLarus.h) and maps every ID back
+//    to the corresponding sequence of basic blocks. The hash stored in the
+//    profile is used to verify that the module matches the profile.
+//
+//    Paths that start at a loop header (i.e. after a back edge) are printed
+//    with a leading "(back edge)", paths that end with a back edge are
+//    printed with a trailing "(back edge)".
+//
+// USAGE:
+//    # First, instrument and run the input module:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libPathProfiler.so `\`
+//        -passes="path-prof" <input-llvm-file> -o instrumented.bin
+//      lli instrumented.bin
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/pathprof <input-llvm-file> default.pathprof
+//
+// License: MIT
+//========================================================================
+#include "BallLarus.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory PathProfCategory{"pathprof options"};
+
+static cl::opt<std::string> InputModule{cl::Positional,
+                                        cl::desc{"<Uninstrumented module>"},
+                                        cl::value_desc{"bitcode filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{PathProfCategory}};
+
+static cl::opt<std::string> ProfileFile{cl::Positional,
+                                        cl::desc{"<Profile>"},
+                                        cl::value_desc{"profile filename"},
+                                        cl::init(""),
+                                        cl::Required,
+                                        cl::cat{PathProfCategory}};
+
+//===----------------------------------------------------------------------===//
+// pathprof - implementation
+//===----------------------------------------------------------------------===//
+namespace {
+// The profile of one function (summed over all the runs)
+struct FunctionProfile {
+  uint64_t Hash = 0;
+  uint64_t NumPaths = 0;
+  uint64_t Lost = 0;
+  // Path ID -> count
+  std::map<uint64_t, uint64_t> Counts;
+  bool Seen = false;
+};
+} // namespace
+
+// Reads the profile. Every line is:
+//    <function> <hash> <#paths> <#lost> <path ID>:<count> ...
+static bool readProfile(StringRef Path, StringMap<FunctionProfile> &Profiles) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  if (!BufferOrErr) {
+    errs() << "Error reading profile: " << Path << "\n";
+    return false;
+  }
+
+  for (line_iterator Line(**BufferOrErr); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 16> Fields;
+    Line->split(Fields, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+
+    uint64_t Hash = 0, NumPaths = 0, Lost = 0;
+    if (Fields.size() < 4 || Fields[1].getAsInteger(10, Hash) ||
+        Fields[2].getAsInteger(10, NumPaths) ||
+        Fields[3].getAsInteger(10, Lost)) {
+      errs() << Path << ":" << Line.line_number() << ": malformed record\n";
+      return false;
+    }
+
+    FunctionProfile &P = Profiles[Fields[0]];
+    if (!P.Seen) {
+      P.Hash = Hash;
+      P.NumPaths = NumPaths;
+      P.Seen = true;
+    } else if (P.Hash != Hash || P.NumPaths != NumPaths) {
+      errs() << Path << ":" << Line.line_number()
+             << ": the profiles for " << Fields[0]
+             << " come from different versions of the module\n";
+      return false;
+    }
+    P.Lost += Lost;
+
+    for (StringRef Field : ArrayRef<StringRef>(Fields).drop_front(4)) {
+      auto [IdStr, CountStr] = Field.split(':');
+      uint64_t Id = 0, Count = 0;
+      if (IdStr.getAsInteger(10, Id) || CountStr.getAsInteger(10, Count) ||
+          Id >= NumPaths) {
+        errs() << Path << ":" << Line.line_number() << ": malformed record\n";
+        return false;
+      }
+      P.Counts[Id] += Count;
+    }
+  }
+
+  return true;
+}
+
+static std::string getBlockName(const BasicBlock *BB) {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  BB->printAsOperand(OS, /*PrintType=*/false);
+  return Name;
+}
+
+static void printProfile(Function &F, const FunctionProfile &P) {
+  BallLarusDAG DAG(F);
+  if (!DAG.isValid() || P.Hash != DAG.getHash()) {
+    errs() << "Warning: the profile for " << F.getName()
+           << " does not match the input module (hash mismatch)\n";
+    return;
+  }
+
+  // The hottest paths first
+  std::vector<std::pair<uint64_t, uint64_t>> Paths(P.Counts.begin(),
+                                                   P.Counts.end());
+  std::stable_sort(Paths.begin(), Paths.end(), [](auto &A, auto &B) {
+    return A.second > B.second;
+  });
+
+  outs() << "=================================================\n";
+  outs() << "Function: " << F.getName() << " (paths: " << P.NumPaths
+         << ", executed: " << Paths.size() << ")\n";
+  outs() << "=================================================\n";
+  if (P.Lost)
+    outs() << "Warning: " << P.Lost
+           << " path executions did not fit into the hash table\n";
+  const char *PathStr = "PATH", *CountStr = "COUNT", *BlocksStr = "BLOCKS";
+  outs() << format("%-10s %-12s %s\n", PathStr, CountStr, BlocksStr);
+
+  SmallVector<BasicBlock *, 16> Blocks;
+  for (auto &[Id, Count] : Paths) {
+    bool StartsAtLoopHeader = false, EndsWithBackEdge = false;
+    DAG.decodePath(Id, Blocks, StartsAtLoopHeader, EndsWithBackEdge);
+
+    std::string Str = StartsAtLoopHeader ? "(back edge) " : "";
+    for (unsigned Idx = 0, E = Blocks.size(); Idx != E; ++Idx)
+      Str += (Idx ? " -> " : "") + getBlockName(Blocks[Idx]);
+    if (EndsWithBackEdge)
+      Str += " (back edge)";
+
+    outs() << format("%-10llu %-12llu %s\n", (unsigned long long)Id,
+                     (unsigned long long)Count, Str.c_str());
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(PathProfCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Prints the path counts recorded by the "
+                              "PathProfiler instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  // Parse the IR file passed on the command line.
+  SMDiagnostic Err;
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = parseIRFile(InputModule.getValue(), Err, Ctx);
+
+  if (!M) {
+    errs() << "Error reading bitcode file: " << InputModule << "\n";
+    Err.print(Argv[0], errs());
+    return -1;
+  }
+
+  StringMap<FunctionProfile> Profiles;
+  if (!readProfile(ProfileFile, Profiles))
+    return -1;
+
+  // Print the profiles in the order of the functions in the input module
+  for (Function &F : *M) {
+    auto It = Profiles.find(F.getName());
+    if (It == Profiles.end() || F.isDeclaration())
+      continue;
+    printProfile(F, It->second);
+    Profiles.erase(It);
+  }
+
+  for (auto &P : Profiles)
+    errs() << "Warning: no function " << P.first()
+           << " in the input module\n";
+
+  return 0;
+}
@@ -0,0 +1,298 @@
+//========================================================================
+// FILE:
+//    ProfDataMain.cpp
+//
+// DESCRIPTION:
+//    `tutor-profdata` - a command-line tool for the binary profiles written
+//    by the instrumented code (see TutorProfile.h), i.e. by DynamicCallCounter
+//    and FunctionTimer.
+//
+//    `tutor-profdata merge` sums any number of profiles (e.g. one per run of
+//    the instrumented program) and writes the result as:
+//      * `binary` - a binary profile (so that merged profiles can be merged
+//         again),
+//      * `text` - a table in the same format as the one printed by
+//         DynamicCallCounter (with all the counters of every function),
+//      * `json` - for scripts.
+//    The input files are read in parallel (`-j`). Profiles that were not
+//    written completely (e.g. because the process crashed) are merged with a
+//    warning. Every function is identified by its name and hash - profiles
+//    with different numbers of counters (or hashes) for the same function
+//    come from different versions of the program and can't be merged.
+//
+//    Use `@<file>` to pass a file with the list of the inputs (one per line),
+//    e.g. when merging thousands of profiles.
+//
+// USAGE:
+//      $ opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes="dynamic-cc" -dynamic-cc-output=calls.%p.tutorprof `\`
+//        <input-llvm-file> -o instrumented.bin
+//      $ lli instrumented.bin
+//      $ <BUILD/DIR>/bin/tutor-profdata merge -format=text calls.*.tutorprof
+//
+// License: MIT
+//========================================================================
+#include "ProfileReader.h"
+#include "TutorProfile.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/SwapByteOrder.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory ProfDataCategory{"tutor-profdata options"};
+
+static cl::SubCommand MergeSubcommand("merge", "Merge binary profiles");
+
+enum class OutputFormat { Binary, Text, JSON };
+
+static cl::list<std::string> InputFiles{cl::Positional,
+                                        cl::desc{"<profile files>"},
+                                        cl::OneOrMore,
+                                        cl::sub(MergeSubcommand),
+                                        cl::cat{ProfDataCategory}};
+
+static cl::opt<std::string> OutputFilename{
+    "o", cl::desc{"Output file"}, cl::value_desc{"filename"}, cl::init("-"),
+    cl::sub(MergeSubcommand), cl::cat{ProfDataCategory}};
+
+static cl::opt<OutputFormat> Format{
+    "format", cl::desc{"Output format"},
+    cl::values(clEnumValN(OutputFormat::Binary, "binary",
+                          "binary profile (default)"),
+               clEnumValN(OutputFormat::Text, "text", "human readable table"),
+               clEnumValN(OutputFormat::JSON, "json", "JSON")),
+    cl::init(OutputFormat::Binary), cl::sub(MergeSubcommand),
+    cl::cat{ProfDataCategory}};
+
+static cl::opt<unsigned> NumThreads{
+    "j", cl::desc{"The number of threads to use (0 = all the cores)"},
+    cl::init(0), cl::sub(MergeSubcommand), cl::cat{ProfDataCategory}};
+
+//===----------------------------------------------------------------------===//
+// Writing the merged profile
+//===----------------------------------------------------------------------===//
+static StringRef getKindName(uint32_t Kind) {
+  switch (Kind) {
+  case TUTOR_PROF_KIND_CALL_COUNTS:
+    return "call-counts";
+  case TUTOR_PROF_KIND_TIME_CYCLES:
+    return "time-cycles";
+  case TUTOR_PROF_KIND_TIME_NS:
+    return "time-ns";
+  default:
+    return "unknown";
+  }
+}
+
+static void writeInt(raw_ostream &OS, uint64_t V, unsigned Size) {
+  // The merged profiles are written in the byte order of the host
+  OS.write(reinterpret_cast<const char *>(&V) +
+               (sys::IsLittleEndianHost ? 0 : 8 - Size),
+           Size);
+}
+
+static void writeBinary(raw_ostream &OS, const TutorProfData &P,
+                        ArrayRef<StringRef> Names) {
+  uint64_t NamesSize = 0, NumCounters = 0;
+  for (StringRef Name : Names) {
+    NamesSize += Name.size();
+    NumCounters += P.Functions.lookup(Name).Counters.size();
+  }
+  uint64_t RecordsOffset = sizeof(TutorProfHeader);
+  uint64_t NamesOffset = RecordsOffset + Names.size() * sizeof(TutorProfRecord);
+  uint64_t CountersOffset = alignTo(NamesOffset + NamesSize, 8);
+  uint64_t FileSize = CountersOffset + NumCounters * 8;
+
+  writeInt(OS, TUTOR_PROF_MAGIC, 8);
+  writeInt(OS, TUTOR_PROF_VERSION, 4);
+  writeInt(OS, P.Kind, 4);
+  writeInt(OS, TUTOR_PROF_FLAG_COMPLETE, 4);
+  writeInt(OS, Names.size(), 4);
+  writeInt(OS, /*CounterSize=*/8, 4);
+  writeInt(OS, /*CounterStride=*/8, 4);
+  writeInt(OS, RecordsOffset, 8);
+  writeInt(OS, NamesOffset, 8);
+  writeInt(OS, CountersOffset, 8);
+  writeInt(OS, FileSize, 8);
+
+  uint64_t NameOffset = 0, FirstCounter = 0;
+  for (StringRef Name : Names) {
+    const TutorProfFunction &F = P.Functions.find(Name)->second;
+    writeInt(OS, NameOffset, 8);
+    writeInt(OS, Name.size(), 4);
+    writeInt(OS, F.Counters.size(), 4);
+    writeInt(OS, F.Hash, 8);
+    writeInt(OS, FirstCounter, 8);
+    NameOffset += Name.size();
+    FirstCounter += F.Counters.size();
+  }
+  for (StringRef Name : Names)
+    OS << Name;
+  OS.write_zeros(CountersOffset - NamesOffset - NamesSize);
+  for (StringRef Name : Names)
+    for (uint64_t Count : P.Functions.find(Name)->second.Counters)
+      writeInt(OS, Count, 8);
+}
+
+static void writeText(raw_ostream &OS, const TutorProfData &P,
+                      ArrayRef<StringRef> Names) {
+  const char *NameStr = "NAME";
+  const char *CountStr = "COUNTERS";
+  if (P.Kind == TUTOR_PROF_KIND_CALL_COUNTS)
+    CountStr = "#N DIRECT CALLS";
+  else if (P.Kind == TUTOR_PROF_KIND_TIME_CYCLES ||
+           P.Kind == TUTOR_PROF_KIND_TIME_NS)
+    CountStr = "#N CALLS INCLUSIVE EXCLUSIVE";
+  OS << "=================================================\n";
+  OS << "LLVM-TUTOR: merged profile (" << getKindName(P.Kind) << ")\n";
+  OS << "=================================================\n";
+  OS << format("%-20s %s\n", NameStr, CountStr);
+  OS << "-------------------------------------------------\n";
+  for (StringRef Name : Names) {
+    OS << format("%-20s", Name.str().c_str());
+    for (uint64_t Count : P.Functions.find(Name)->second.Counters)
+      OS << " " << Count;
+    OS << "\n";
+  }
+}
+
+static void writeJSON(raw_ostream &OS, const TutorProfData &P,
+                      ArrayRef<StringRef> Names) {
+  json::OStream J(OS, /*IndentSize=*/2);
+  J.object([&] {
+    J.attribute("version", int64_t(TUTOR_PROF_VERSION));
+    J.attribute("kind", getKindName(P.Kind));
+    J.attributeArray("functions", [&] {
+      for (StringRef Name : Names) {
+        const TutorProfFunction &F = P.Functions.find(Name)->second;
+        J.object([&] {
+          J.attribute("name", Name);
+          J.attribute("hash", std::to_string(F.Hash));
+          J.attributeArray("counters", [&] {
+            for (uint64_t Count : F.Counters)
+              J.value(Count);
+          });
+        });
+      }
+    });
+  });
+  OS << "\n";
+}
+
+//===----------------------------------------------------------------------===//
+// tutor-profdata merge
+//===----------------------------------------------------------------------===//
+static int merge() {
+  unsigned Threads = NumThreads ? NumThreads.getValue()
+                                : std::max(1U, std::thread::hardware_concurrency());
+  Threads = std::min<unsigned>(Threads, InputFiles.size());
+
+  // Every thread merges the files it takes into its own profile. The files
+  // are handed out one at a time, so that the threads are kept busy even if
+  // the files differ in size.
+  std::vector<TutorProfData> Partial(Threads);
+  std::atomic<size_t> NextFile{0};
+  std::atomic<bool> Failed{false};
+  std::mutex ErrsMutex;
+  auto Worker = [&](unsigned ThreadIdx) {
+    for (size_t Idx = NextFile++; Idx < InputFiles.size(); Idx = NextFile++) {
+      bool Incomplete = false;
+      std::string Err =
+          readTutorProfile(InputFiles[Idx], Partial[ThreadIdx], Incomplete);
+      if (Err.empty() && !Incomplete)
+        continue;
+
+      std::lock_guard<std::mutex> Lock(ErrsMutex);
+      if (!Err.empty()) {
+        errs() << "Error: " << InputFiles[Idx] << ": " << Err << "\n";
+        Failed = true;
+      } else {
+        errs() << "Warning: " << InputFiles[Idx]
+               << ": the profile is incomplete (did the process crash?)\n";
+      }
+    }
+  };
+
+  std::vector<std::thread> Pool;
+  for (unsigned Idx = 1; Idx < Threads; ++Idx)
+    Pool.emplace_back(Worker, Idx);
+  Worker(0);
+  for (std::thread &T : Pool)
+    T.join();
+  if (Failed)
+    return 1;
+
+  TutorProfData Merged = std::move(Partial[0]);
+  for (unsigned Idx = 1; Idx < Threads; ++Idx) {
+    std::string Err = mergeTutorProfData(Merged, Partial[Idx]);
+    if (!Err.empty()) {
+      errs() << "Error: " << Err << "\n";
+      return 1;
+    }
+  }
+
+  // The functions are sorted by name, so that the output does not depend on
+  // the order in which the inputs were merged
+  std::vector<StringRef> Names;
+  for (auto &F : Merged.Functions)
+    Names.push_back(F.first());
+  llvm::sort(Names);
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename, EC,
+                    Format == OutputFormat::Binary ? sys::fs::OF_None
+                                                   : sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error: " << OutputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  switch (Format) {
+  case OutputFormat::Binary:
+    writeBinary(OS, Merged, Names);
+    break;
+  case OutputFormat::Text:
+    writeText(OS, Merged, Names);
+    break;
+  case OutputFormat::JSON:
+    writeJSON(OS, Merged, Names);
+    break;
+  }
+  return 0;
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(ProfDataCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Tools for the binary profiles written by the "
+                              "llvm-tutor instrumentation\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  if (MergeSubcommand)
+    return merge();
+
+  errs() << "Error: no subcommand specified (see -help)\n";
+  return 1;
+}
@@ -0,0 +1,249 @@
+//========================================================================
+// FILE:
+//    TopMain.cpp
+//
+// DESCRIPTION:
+//    `tutor-top` - shows the functions of a running program that are called
+//    the most, live. Reads the counters that the instrumentation runtime
+//    exports through shared memory (see TutorShm.h).
+//
+//    The segment is mapped read-only, so the program doesn't even know that
+//    it's being watched. Every `-interval` seconds the counters are read and
+//    the `-n` functions with the highest rate (calls per second since the
+//    previous refresh) are printed, with their totals. The first refresh
+//    only has the totals. Functions with the same name in different modules
+//    are shown once. The screen is cleared before every refresh if the output
+//    is a terminal.
+//
+//    `tutor-top` stops after `-iterations` refreshes (if not 0) or when the
+//    program exits.
+//
+// USAGE:
+//    # First, instrument the program and run it with LLVM_TUTOR_SHM_NAME:
+//      opt -load-pass-plugin <BUILD_DIR>/lib/libDynamicCallCounter.so `\`
+//        -passes="dynamic-cc" -dynamic-cc-runtime -dynamic-cc-shm `\`
+//        <input-llvm-file> -o instrumented.bc
+//      clang instrumented.bc <BUILD_DIR>/lib/libTutorRuntime.a -o prog
+//      LLVM_TUTOR_SHM_NAME=/prog.%p ./prog &
+//    # Now you can run this tool as follows:
+//      <BUILD/DIR>/bin/tutor-top /prog.$!
+//
+// License: MIT
+//========================================================================
+#include "TutorShm.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static cl::OptionCategory TopCategory{"tutor-top options"};
+
+static cl::opt<std::string> ShmName{cl::Positional,
+                                    cl::desc{"<shared memory segment>"},
+                                    cl::Required, cl::cat{TopCategory}};
+
+static cl::opt<unsigned> NumShown{
+    "n", cl::desc{"The number of functions to show"}, cl::init(20),
+    cl::cat{TopCategory}};
+
+static cl::opt<double> Interval{
+    "interval", cl::desc{"Seconds between two refreshes"}, cl::init(1.0),
+    cl::cat{TopCategory}};
+
+static cl::opt<unsigned> Iterations{
+    "iterations",
+    cl::desc{"Stop after this many refreshes (0 to run until the program "
+             "exits)"},
+    cl::init(0), cl::cat{TopCategory}};
+
+//===----------------------------------------------------------------------===//
+// tutor-top - implementation
+//===----------------------------------------------------------------------===//
+namespace {
+struct FunctionStats {
+  uint64_t Total = 0;
+  uint64_t Previous = 0;
+  double Rate = 0.0;
+};
+} // namespace
+
+static const TutorShmHeader *attach(StringRef Name) {
+  int Fd = shm_open(Name.str().c_str(), O_RDONLY, 0);
+  if (Fd < 0) {
+    errs() << "Error: can't open " << Name << " (" << strerror(errno) << ")\n";
+    return nullptr;
+  }
+
+  struct stat Stat;
+  void *Base = MAP_FAILED;
+  if (fstat(Fd, &Stat) == 0 &&
+      static_cast<uint64_t>(Stat.st_size) >= sizeof(TutorShmHeader))
+    Base = mmap(nullptr, Stat.st_size, PROT_READ, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if (Base == MAP_FAILED) {
+    errs() << "Error: can't map " << Name << "\n";
+    return nullptr;
+  }
+
+  const auto *Header = static_cast<const TutorShmHeader *>(Base);
+  if (__atomic_load_n(&Header->Magic, __ATOMIC_ACQUIRE) != TUTOR_SHM_MAGIC ||
+      Header->Version != TUTOR_SHM_VERSION ||
+      Header->Size > static_cast<uint64_t>(Stat.st_size)) {
+    errs() << "Error: " << Name
+           << " is not an llvm-tutor segment (or it's a different version)\n";
+    return nullptr;
+  }
+  return Header;
+}
+
+// Adds the current (scaled) values of the first counter of every function to
+// Stats. Returns the number of modules whose counters are not exported.
+static unsigned readCounters(const TutorShmHeader *Header,
+                             StringMap<FunctionStats> &Stats) {
+  for (auto &Entry : Stats)
+    Entry.second.Total = 0;
+
+  const char *Base = reinterpret_cast<const char *>(Header);
+  unsigned NumModules = std::min(
+      __atomic_load_n(&Header->NumModules, __ATOMIC_ACQUIRE),
+      TUTOR_SHM_MAX_MODULES);
+  unsigned NotExported = 0;
+  for (unsigned Idx = 0; Idx != NumModules; ++Idx) {
+    const TutorShmModule &M = Header->Modules[Idx];
+    if (__atomic_load_n(&M.State, __ATOMIC_ACQUIRE) ==
+        TUTOR_SHM_MODULE_NOT_EXPORTED) {
+      NotExported++;
+      continue;
+    }
+
+    const char *Name = Base + M.NamesOffset;
+    for (uint32_t F = 0; F != M.NumFunctions; ++F) {
+      const char *Counter = Base + M.CountersOffset +
+                            uint64_t(F) * M.NumCountersPerFunction *
+                                M.CounterStride;
+      uint64_t Value =
+          M.CounterSize == 4
+              ? __atomic_load_n(reinterpret_cast<const uint32_t *>(Counter),
+                                __ATOMIC_RELAXED)
+              : __atomic_load_n(reinterpret_cast<const uint64_t *>(Counter),
+                                __ATOMIC_RELAXED);
+      Stats[Name].Total += Value * M.Scale;
+      Name += strlen(Name) + 1;
+    }
+  }
+  return NotExported;
+}
+
+static void print(StringRef Name, const TutorShmHeader *Header,
+                  StringMap<FunctionStats> &Stats, bool HasRates,
+                  unsigned NotExported) {
+  // The highest rates first (then the highest totals, then by name)
+  std::vector<StringMapEntry<FunctionStats> *> Sorted;
+  for (auto &Entry : Stats)
+    Sorted.push_back(&Entry);
+  std::sort(Sorted.begin(), Sorted.end(), [](auto *A, auto *B) {
+    if (A->second.Rate != B->second.Rate)
+      return A->second.Rate > B->second.Rate;
+    if (A->second.Total != B->second.Total)
+      return A->second.Total > B->second.Total;
+    return A->first() < B->first();
+  });
+
+  outs() << "=================================================\n";
+  outs() << "LLVM-TUTOR: " << Name << " (pid " << Header->Pid << ", "
+         << Stats.size() << " functions)\n";
+  if (NotExported)
+    outs() << "(the counters of " << NotExported
+           << " modules are not exported)\n";
+  outs() << "=================================================\n";
+  const char *NameStr = "NAME", *RateStr = "CALLS/S",
+             *TotalStr = "#N DIRECT CALLS";
+  outs() << format("%-20s %-12s %s\n", NameStr, RateStr, TotalStr);
+  outs() << "-------------------------------------------------\n";
+  for (unsigned Idx = 0, E = std::min<size_t>(NumShown, Sorted.size());
+       Idx != E; ++Idx) {
+    const FunctionStats &S = Sorted[Idx]->second;
+    char Rate[32] = "-";
+    if (HasRates)
+      snprintf(Rate, sizeof(Rate), "%.1f", S.Rate);
+    outs() << format("%-20s %-12s %llu\n", Sorted[Idx]->first().str().c_str(),
+                     static_cast<const char *>(Rate),
+                     (unsigned long long)S.Total);
+  }
+  outs().flush();
+}
+
+static bool isAlive(pid_t Pid) { return kill(Pid, 0) == 0 || errno != ESRCH; }
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int Argc, char **Argv) {
+  // Hide all options apart from the ones specific to this tool
+  cl::HideUnrelatedOptions(TopCategory);
+
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "Shows the most frequently called functions of "
+                              "a running program\n");
+
+  // Makes sure llvm_shutdown() is called (which cleans up LLVM objects)
+  //  http://llvm.org/docs/ProgrammersManual.html#ending-execution-with-llvm-shutdown
+  llvm_shutdown_obj SDO;
+
+  const TutorShmHeader *Header = attach(ShmName);
+  if (!Header)
+    return 1;
+
+  bool ClearScreen = sys::Process::StandardOutIsDisplayed();
+  StringMap<FunctionStats> Stats;
+  auto Last = std::chrono::steady_clock::now();
+  for (unsigned Iteration = 1;; ++Iteration) {
+    bool Alive = isAlive(Header->Pid);
+    unsigned NotExported = readCounters(Header, Stats);
+    auto Now = std::chrono::steady_clock::now();
+    double Elapsed = std::chrono::duration<double>(Now - Last).count();
+    Last = Now;
+    for (auto &Entry : Stats) {
+      FunctionStats &S = Entry.second;
+      S.Rate = Iteration > 1 && Elapsed > 0
+                   ? double(S.Total - S.Previous) / Elapsed
+                   : 0.0;
+      S.Previous = S.Total;
+    }
+
+    if (ClearScreen)
+      outs() << "\033[H\033[2J";
+    print(ShmName, Header, Stats, Iteration > 1, NotExported);
+
+    if (!Alive) {
+      outs() << "(the program has exited)\n";
+      break;
+    }
+    if (Iterations && Iteration == Iterations)
+      break;
+    std::this_thread::sleep_for(std::chrono::duration<double>(Interval));
+  }
+
+  return 0;
+}
@@ -0,0 +1,669 @@
+#!/usr/bin/env python3
+# === run_benchmarks.py =======================================================
+#  Measure the overhead of the llvm-tutor transformations
+#
+#  DESCRIPTION:
+#   The `runtime` suite: every benchmark kernel (benchmarks/bench_*.c) is
+#   built once without any llvm-tutor pass (the baseline) and once per
+#   transformation (obfuscation or instrumentation). All variants go through exactly the same pipeline:
+#     clang -O2 -emit-llvm -> [opt -passes=<transformation>] -> llc -O2 -> link
+#   so that the transformations are not undone by the optimiser. The binaries
+#   are then run natively and compared against the baseline:
+#     * wall-clock time (minimum and median over --repetitions runs)
+#     * retired user-space instructions (via `perf stat`, if available)
+#     * the output (every kernel prints a checksum, which must not change)
+#
+#   The `compile-time` suite measures how long the transformations themselves
+#   take. It generates a large synthetic module and compares the single
+#   traversal rewrite engine (`mba`, all rules in one pass) against one pass per
+#   rule (`mba-add,mba-sub`). It also measures the cost of the instrumentation
+#   passes (e.g. DynamicCallCounter) on a module with many small functions: the
+#   time to instrument and to compile the module, and the size of the generated
+#   code (per instrumented function).
+#
+#   The `contention` suite measures the overhead of the call counters injected
+#   by DynamicCallCounter in a multi-threaded kernel
+#   (benchmarks/contention_calls.c) with 1 to 64 threads. It compares the
+#   plain counters with atomic counters, with and without cache line padding,
+#   and verifies that the atomic counters do not lose any updates. It also
+#   measures the sampling mode (-dynamic-cc-counters=sampled) and reports the
+#   error of the estimated counts.
+#
+#   The `layout` suite measures the profile-guided block layout. Every kernel
+#   is instrumented with BranchProfiler and run once to collect a profile.
+#   The profile is then attached to the kernel (ProfileUse) and the blocks are
+#   reordered (BlockLayout). The suite reports the estimated number of taken
+#   branches before and after the layout (see -block-layout-report) and
+#   compares the run-time against the same pipeline without BlockLayout (so
+#   that both variants use the same profile).
+#
+#   The results are printed as a table and written to a JSON file that can be
+#   tracked over time.
+#
+#  USAGE:
+#    python3 utils/run_benchmarks.py --llvm-dir <installation/dir/of/llvm/19> `\`
+#      --plugin-dir <build_dir>/lib --output results.json
+#   or, from the build directory:
+#    make benchmark
+# =============================================================================
+import argparse
+import datetime
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+LLVM_TUTOR_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# Bump whenever the layout of the JSON output changes
+SCHEMA_VERSION = 5
+
+# The transformations to measure:
+#   name -> (plugins to load, -passes pipeline, extra opt flags)
+TRANSFORMS = {
+    "mba-add": (["MBAAdd"], "mba-add", []),
+    "mba-sub": (["MBASub"], "mba-sub", []),
+    "duplicate-bb": (["RIV", "DuplicateBB"], "duplicate-bb", []),
+    "edge-prof": (["EdgeProfiler"], "edge-prof", []),
+    "block-prof": (["EdgeProfiler"], "edge-prof", ["-edge-prof-mode=blocks"]),
+    "edge-prof+promote": (["EdgeProfiler", "CounterPromotion"],
+                          "edge-prof,promote-counters", []),
+    "block-prof+promote": (["EdgeProfiler", "CounterPromotion"],
+                           "edge-prof,promote-counters",
+                           ["-edge-prof-mode=blocks"]),
+    "path-prof": (["PathProfiler"], "path-prof", []),
+    "dynamic-cg": (["DynamicCallGraph"], "dynamic-cg", []),
+}
+
+# Compile-time comparisons: benchmark -> [(variant, plugins, -passes pipeline)]
+COMPILE_TIME_BENCHMARKS = {
+    "mba-rules": [
+        ("engine", ["MBA"], "mba"),
+        ("separate-passes", ["MBAAdd", "MBASub"], "mba-add,mba-sub"),
+    ],
+}
+
+# Instrumentation cost: benchmark -> (plugins, -passes pipeline, extra flags)
+INSTRUMENTATION_BENCHMARKS = {
+    "dynamic-cc": (["DynamicCallCounter"], "dynamic-cc", []),
+}
+
+# Contention suite: variant -> extra opt flags for DynamicCallCounter (None for
+# the uninstrumented baseline)
+CONTENTION_KERNEL = "contention_calls"
+CONTENTION_VARIANTS = {
+    "baseline": None,
+    "plain": ["-dynamic-cc-counters=plain"],
+    "atomic-unpadded": ["-dynamic-cc-counters=atomic",
+                        "-dynamic-cc-cache-line-size=0"],
+    "atomic": ["-dynamic-cc-counters=atomic"],
+    "sampled": ["-dynamic-cc-counters=sampled"],
+}
+
+# Layout suite: variant -> (plugins, -passes pipeline). The profile is passed
+# with -prof-use-branches.
+LAYOUT_VARIANTS = {
+    "prof-use": (["ProfileUse"], "prof-use"),
+    "block-layout": (["ProfileUse", "BlockLayout"], "prof-use,block-layout"),
+}
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Measure the overhead of llvm-tutor passes")
+    parser.add_argument("--llvm-dir", default=os.environ.get("LLVM_DIR", ""),
+                        help="LLVM installation directory (defaults to "
+                        "$LLVM_DIR, falls back to $PATH)")
+    parser.add_argument("--plugin-dir", required=True,
+                        help="directory with the llvm-tutor plugins, i.e. "
+                        "<build_dir>/lib")
+    parser.add_argument("--kernel-dir",
+                        default=os.path.join(LLVM_TUTOR_DIR, "benchmarks"),
+                        help="directory with the benchmark kernels")
+    parser.add_argument("--work-dir", default="benchmarks-work",
+                        help="directory for intermediate files")
+    parser.add_argument("--output", default="benchmarks.json",
+                        help="the JSON file to write the results to")
+    parser.add_argument("--kernels", nargs="*", default=None,
+                        help="kernels to run (e.g. bench_hash), default: all")
+    parser.add_argument("--transforms", nargs="*", default=list(TRANSFORMS),
+                        choices=list(TRANSFORMS),
+                        help="transformations to measure, default: all")
+    parser.add_argument("--repetitions", type=int, default=5,
+                        help="number of runs per binary (default 5)")
+    parser.add_argument("--suites", nargs="*",
+                        default=["runtime", "compile-time", "contention",
+                                 "layout"],
+                        choices=["runtime", "compile-time", "contention",
+                                 "layout"],
+                        help="benchmark suites to run, default: all")
+    parser.add_argument("--synthetic-functions", type=int, default=1000,
+                        help="number of functions in the synthetic module "
+                        "used by the compile-time suite (default 1000)")
+    parser.add_argument("--instrumented-functions", type=int, default=20000,
+                        help="number of functions in the synthetic module "
+                        "used to measure the instrumentation cost "
+                        "(default 20000)")
+    parser.add_argument("--threads", type=int, nargs="*",
+                        default=[1, 2, 4, 8, 16, 32, 64],
+                        help="thread counts for the contention suite "
+                        "(default 1 2 4 8 16 32 64)")
+    parser.add_argument("--calls-per-thread", type=int, default=10000000,
+                        help="calls per thread in the contention suite "
+                        "(default 10000000)")
+    return parser.parse_args()
+
+
+# === Helpers =================================================================
+def tool(args, name):
+    """Returns the path to an LLVM tool, preferring --llvm-dir"""
+    if args.llvm_dir:
+        path = os.path.join(args.llvm_dir, "bin", name)
+        if os.path.exists(path):
+            return path
+    path = shutil.which(name)
+    if path is None:
+        sys.exit("error: cannot find `%s` (set --llvm-dir)" % name)
+    return path
+
+
+def plugin(args, name):
+    ext = ".dylib" if platform.system() == "Darwin" else ".so"
+    return os.path.join(args.plugin_dir, "lib" + name + ext)
+
+
+def run(cmd, cwd=None, env=None):
+    result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                            universal_newlines=True, cwd=cwd, env=env)
+    if result.returncode != 0:
+        sys.exit("error: command failed: %s\n%s" % (" ".join(cmd),
+                                                   result.stderr))
+    return result
+
+
+def llvm_version(args):
+    out = run([tool(args, "opt"), "--version"]).stdout
+    for line in out.splitlines():
+        if "LLVM version" in line:
+            return line.split()[-1]
+    return None
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "-C", LLVM_TUTOR_DIR, "rev-parse", "HEAD"],
+                              stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                              universal_newlines=True).stdout.strip() or None
+    except OSError:
+        return None
+
+
+def delta_pct(value, base):
+    if value is None or base is None or base == 0:
+        return None
+    return round(100.0 * (value - base) / base, 2)
+
+
+# === Building ================================================================
+def build_ir(args, kernel):
+    """Compiles a kernel to optimised LLVM IR (shared by all variants)"""
+    src = os.path.join(args.kernel_dir, kernel + ".c")
+    out = os.path.join(args.work_dir, kernel + ".ll")
+    run([tool(args, "clang"), "-O2", "-S", "-emit-llvm", src, "-o", out])
+    return out
+
+
+def build_variant(args, kernel, ir, transform):
+    """Applies `transform` (None for the baseline) and builds a binary"""
+    variant = transform or "baseline"
+    stem = os.path.join(args.work_dir, kernel + "." + variant)
+
+    if transform is None:
+        return build_binary(args, ir, stem)
+    return build_binary(args, ir, stem, *TRANSFORMS[transform])
+
+
+def build_binary(args, ir, stem, plugins=None, pipeline=None, extra_flags=()):
+    """Runs `pipeline` (if any) on `ir` and builds <stem>.bin"""
+    if pipeline is not None:
+        cmd = [tool(args, "opt")]
+        for name in plugins:
+            cmd += ["-load-pass-plugin", plugin(args, name)]
+        cmd += ["-passes=" + pipeline] + list(extra_flags) + \
+            [ir, "-o", stem + ".bc"]
+        run(cmd)
+        ir = stem + ".bc"
+
+    run([tool(args, "llc"), "-O2", "-relocation-model=pic", "-filetype=obj",
+         ir, "-o", stem + ".o"])
+    run([tool(args, "clang"), "-pthread", stem + ".o", "-o", stem + ".bin"])
+    return stem + ".bin"
+
+
+# === Measuring ===============================================================
+def have_perf():
+    if shutil.which("perf") is None:
+        return False
+    # perf might be installed, but not usable (e.g. perf_event_paranoid)
+    result = subprocess.run(["perf", "stat", "-x,", "-e", "instructions:u",
+                             "true"], stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, universal_newlines=True)
+    return result.returncode == 0 and "<not" not in result.stderr
+
+
+def count_instructions(args, binary):
+    """Returns the number of retired user-space instructions (via perf)"""
+    result = subprocess.run(["perf", "stat", "-x,", "-e", "instructions:u",
+                             os.path.abspath(binary)], stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, universal_newlines=True,
+                            cwd=args.work_dir)
+    for line in result.stderr.splitlines():
+        fields = line.split(",")
+        if len(fields) > 2 and fields[2].startswith("instructions"):
+            try:
+                return int(fields[0])
+            except ValueError:
+                return None
+    return None
+
+
+def measure(args, binary, use_perf, binary_args=()):
+    # The binaries are run from the work directory, so that the files they
+    # write (e.g. profiles) end up there
+    times = []
+    output = None
+    for _ in range(args.repetitions):
+        start = time.perf_counter()
+        result = run([os.path.abspath(binary)] + list(binary_args),
+                     cwd=args.work_dir)
+        times.append(time.perf_counter() - start)
+        output = result.stdout
+
+    return {
+        "time_s": round(min(times), 6),
+        "time_median_s": round(statistics.median(times), 6),
+        "instructions": count_instructions(args, binary) if use_perf else None,
+        "output": output,
+    }
+
+
+# === Compile-time suite ======================================================
+def generate_synthetic_module(path, functions, ops_per_function):
+    """Writes a module with many straight-line functions mixing add/sub/xor"""
+    ops = ["add", "sub", "xor", "add", "mul", "sub"]
+    with open(path, "w") as f:
+        for fn in range(functions):
+            f.write("define i32 @f%d(i32 %%a, i32 %%b) {\n" % fn)
+            prev, cur = "%a", "%b"
+            for i in range(ops_per_function):
+                f.write("  %%v%d = %s i32 %s, %s\n" %
+                        (i, ops[(fn + i) % len(ops)], prev, cur))
+                prev, cur = cur, "%%v%d" % i
+            f.write("  ret i32 %s\n}\n\n" % cur)
+
+
+def timed(args, cmd):
+    """Runs cmd --repetitions times, returns the minimum and median time"""
+    times = []
+    for _ in range(args.repetitions):
+        start = time.perf_counter()
+        run(cmd)
+        times.append(time.perf_counter() - start)
+    return min(times), statistics.median(times)
+
+
+def text_size(args, obj):
+    """Returns the size of the code sections in an object file"""
+    out = run([tool(args, "llvm-size"), "--format=sysv", obj]).stdout
+    size = 0
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1].isdigit() and \
+                (fields[0].startswith(".text") or fields[0] == "__text"):
+            size += int(fields[1])
+    return size
+
+
+def run_instrumentation_benchmarks(args):
+    functions = args.instrumented_functions
+    module = os.path.join(args.work_dir, "synthetic-small.ll")
+    generate_synthetic_module(module, functions, 4)
+
+    def compile_module(ir, obj):
+        cmd = [tool(args, "llc"), "-O2", "-relocation-model=pic",
+               "-filetype=obj", ir, "-o", obj]
+        return timed(args, cmd)[0], text_size(args, obj)
+
+    base_obj = os.path.join(args.work_dir, "synthetic-small.o")
+    base_codegen, base_text = compile_module(module, base_obj)
+
+    results = []
+    for benchmark, (plugins, pipeline, extra_flags) in \
+            INSTRUMENTATION_BENCHMARKS.items():
+        stem = os.path.join(args.work_dir, "synthetic-small." + benchmark)
+        cmd = [tool(args, "opt")]
+        for name in plugins:
+            cmd += ["-load-pass-plugin", plugin(args, name)]
+        cmd += ["-passes=" + pipeline] + extra_flags + \
+            [module, "-o", stem + ".bc"]
+        opt_time, opt_median = timed(args, cmd)
+        codegen, text = compile_module(stem + ".bc", stem + ".o")
+
+        results.append({
+            "benchmark": benchmark,
+            "variant": "instrument",
+            "pipeline": pipeline,
+            "functions": functions,
+            "time_s": round(opt_time, 6),
+            "time_median_s": round(opt_median, 6),
+            "codegen_time_s": round(codegen, 6),
+            "codegen_time_delta_pct": delta_pct(codegen, base_codegen),
+            "text_bytes": text,
+            "text_bytes_per_function": round((text - base_text) / functions,
+                                             2),
+        })
+
+    print("%-16s %10s %10s %13s %9s %12s %12s" %
+          ("INSTRUMENTATION", "FUNCTIONS", "OPT [s]", "CODEGEN [s]",
+           "dCODEGEN", "TEXT", "dTEXT/FUNC"))
+    print("-" * 89)
+    for r in results:
+        print("%-16s %10d %10.4f %13.4f %+8.1f%% %12d %12.2f" %
+              (r["benchmark"], r["functions"], r["time_s"],
+               r["codegen_time_s"], r["codegen_time_delta_pct"],
+               r["text_bytes"], r["text_bytes_per_function"]))
+    print()
+    return results
+
+
+def run_compile_time_suite(args):
+    module = os.path.join(args.work_dir, "synthetic.ll")
+    generate_synthetic_module(module, args.synthetic_functions, 200)
+
+    results = []
+    for benchmark, variants in COMPILE_TIME_BENCHMARKS.items():
+        base_time = None
+        for variant, plugins, pipeline in variants:
+            cmd = [tool(args, "opt")]
+            for name in plugins:
+                cmd += ["-load-pass-plugin", plugin(args, name)]
+            cmd += ["-passes=" + pipeline, "-disable-output", module]
+            best, median = timed(args, cmd)
+
+            # The first variant is the reference
+            if base_time is None:
+                base_time = best
+            results.append({
+                "benchmark": benchmark,
+                "variant": variant,
+                "pipeline": pipeline,
+                "time_s": round(best, 6),
+                "time_median_s": round(median, 6),
+                "time_delta_pct": delta_pct(best, base_time),
+            })
+
+    print("%-16s %-18s %-20s %10s %9s" %
+          ("BENCHMARK", "VARIANT", "PIPELINE", "TIME [s]", "dTIME"))
+    print("-" * 77)
+    for r in results:
+        print("%-16s %-18s %-20s %10.4f %+8.1f%%" %
+              (r["benchmark"], r["variant"], r["pipeline"], r["time_s"],
+               r["time_delta_pct"]))
+    print()
+    return results + run_instrumentation_benchmarks(args)
+
+
+# === Run-time suite ==========================================================
+def run_runtime_suite(args):
+    kernels = args.kernels or sorted(
+        f[:-2] for f in os.listdir(args.kernel_dir)
+        if f.startswith("bench_") and f.endswith(".c"))
+    use_perf = have_perf()
+    if not use_perf:
+        print("note: `perf` is not available, instruction counts are skipped")
+
+    results = []
+    for kernel in kernels:
+        ir = build_ir(args, kernel)
+        base = measure(args, build_variant(args, kernel, ir, None), use_perf)
+
+        for transform in [None] + args.transforms:
+            m = base if transform is None else measure(
+                args, build_variant(args, kernel, ir, transform), use_perf)
+            results.append({
+                "kernel": kernel,
+                "transform": transform or "baseline",
+                "time_s": m["time_s"],
+                "time_median_s": m["time_median_s"],
+                "instructions": m["instructions"],
+                "time_delta_pct": delta_pct(m["time_s"], base["time_s"]),
+                "instructions_delta_pct": delta_pct(m["instructions"],
+                                                    base["instructions"]),
+                "output_matches_baseline": m["output"] == base["output"],
+            })
+
+    # Print a summary
+    print("%-16s %-18s %10s %9s %16s %9s %s" %
+          ("KERNEL", "TRANSFORM", "TIME [s]", "dTIME", "INSTRUCTIONS",
+           "dINSTR", "OUTPUT"))
+    print("-" * 90)
+    for r in results:
+        fmt_pct = lambda v: "-" if v is None else "%+.1f%%" % v
+        print("%-16s %-18s %10.4f %9s %16s %9s %s" %
+              (r["kernel"], r["transform"], r["time_s"],
+               fmt_pct(r["time_delta_pct"]),
+               "-" if r["instructions"] is None else r["instructions"],
+               fmt_pct(r["instructions_delta_pct"]),
+               "ok" if r["output_matches_baseline"] else "MISMATCH"))
+    print()
+    return results
+
+
+# === Contention suite ========================================================
+def count_calls(output, prefix):
+    """Sums the DynamicCallCounter counts for functions starting with prefix
+
+    In the sampling mode the count is followed by the error and the number of
+    samples, the count itself is still the second field.
+    """
+    total = 0
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(prefix) and \
+                fields[1].isdigit():
+            total += int(fields[1])
+    return total
+
+
+def run_contention_suite(args):
+    ir = build_ir(args, CONTENTION_KERNEL)
+    binaries = {}
+    for variant, flags in CONTENTION_VARIANTS.items():
+        stem = os.path.join(args.work_dir, CONTENTION_KERNEL + "." + variant)
+        if flags is None:
+            binaries[variant] = build_binary(args, ir, stem)
+        else:
+            binaries[variant] = build_binary(args, ir, stem,
+                                             ["DynamicCallCounter"],
+                                             "dynamic-cc", flags)
+
+    results = []
+    for threads in args.threads:
+        base_time = None
+        for variant, binary in binaries.items():
+            m = measure(args, binary, False,
+                        [str(threads), str(args.calls_per_thread)])
+            if base_time is None:
+                base_time = m["time_s"]
+
+            # Every thread calls its own leaf function, so the counts are
+            # only exact if no increments were lost. The sampled counts are
+            # estimates and are never expected to be exact.
+            expected = threads * args.calls_per_thread
+            counted = count_calls(m["output"], "leaf")
+            exact = None
+            error = None
+            if variant == "sampled":
+                error = delta_pct(counted, expected)
+            elif CONTENTION_VARIANTS[variant] is not None:
+                exact = counted == expected
+
+            results.append({
+                "variant": variant,
+                "threads": threads,
+                "calls_per_thread": args.calls_per_thread,
+                "time_s": m["time_s"],
+                "time_median_s": m["time_median_s"],
+                "time_delta_pct": delta_pct(m["time_s"], base_time),
+                "ns_per_call": round(1e9 * m["time_s"] / args.calls_per_thread,
+                                     3),
+                "counts_exact": exact,
+                "estimate_error_pct": error,
+            })
+
+    print("%-16s %8s %10s %9s %12s %s" %
+          ("VARIANT", "THREADS", "TIME [s]", "dTIME", "ns/CALL", "COUNTS"))
+    print("-" * 66)
+    for r in results:
+        print("%-16s %8d %10.4f %+8.1f%% %12.3f %s" %
+              (r["variant"], r["threads"], r["time_s"], r["time_delta_pct"],
+               r["ns_per_call"],
+               "%+.2f%%" % r["estimate_error_pct"]
+               if r["estimate_error_pct"] is not None else
+               "-" if r["counts_exact"] is None else
+               "exact" if r["counts_exact"] else "LOST"))
+    print()
+    return results
+
+
+# === Layout suite ============================================================
+def parse_layout_report(report):
+    """Returns the total estimated taken branches (before, after) printed by
+    -block-layout-report"""
+    for line in report.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[0] == "total":
+            return int(fields[1]), int(fields[2])
+    sys.exit("error: no summary in the BlockLayout report:\n" + report)
+
+
+def run_layout_suite(args):
+    kernels = args.kernels or sorted(
+        f[:-2] for f in os.listdir(args.kernel_dir)
+        if f.startswith("bench_") and f.endswith(".c"))
+
+    results = []
+    for kernel in kernels:
+        ir = build_ir(args, kernel)
+
+        # Collect the branch profile (from one run)
+        stem = os.path.join(args.work_dir, kernel)
+        profile = os.path.abspath(stem + ".branchprof")
+        if os.path.exists(profile):
+            os.remove(profile)
+        instrumented = build_binary(args, ir, stem + ".branch-prof",
+                                    ["BranchProfiler"], "branch-prof")
+        env = dict(os.environ, LLVM_TUTOR_BRANCHPROF_FILE=profile)
+        run([os.path.abspath(instrumented)], cwd=args.work_dir, env=env)
+
+        measurements = {}
+        for variant, (plugins, pipeline) in LAYOUT_VARIANTS.items():
+            flags = ["-prof-use-branches=" + profile]
+            if "BlockLayout" in plugins:
+                # The report goes to stderr, so run `opt` once more for it
+                cmd = [tool(args, "opt")]
+                for name in plugins:
+                    cmd += ["-load-pass-plugin", plugin(args, name)]
+                cmd += ["-passes=" + pipeline, "-block-layout-report",
+                        "-disable-output"] + flags + [ir]
+                taken_before, taken_after = \
+                    parse_layout_report(run(cmd).stderr)
+            binary = build_binary(args, ir, stem + "." + variant, plugins,
+                                  pipeline, flags)
+            measurements[variant] = measure(args, binary, False)
+
+        base = measurements["prof-use"]
+        laid_out = measurements["block-layout"]
+        results.append({
+            "kernel": kernel,
+            "taken_branches_before": taken_before,
+            "taken_branches_after": taken_after,
+            "taken_branches_delta_pct": delta_pct(taken_after, taken_before),
+            "time_s": laid_out["time_s"],
+            "time_median_s": laid_out["time_median_s"],
+            "base_time_s": base["time_s"],
+            "time_delta_pct": delta_pct(laid_out["time_s"], base["time_s"]),
+            "output_matches_baseline": laid_out["output"] == base["output"],
+        })
+
+    print("%-16s %16s %16s %9s %10s %9s %s" %
+          ("KERNEL", "TAKEN (BEFORE)", "TAKEN (AFTER)", "dTAKEN", "TIME [s]",
+           "dTIME", "OUTPUT"))
+    print("-" * 90)
+    for r in results:
+        fmt_pct = lambda v: "-" if v is None else "%+.1f%%" % v
+        print("%-16s %16d %16d %9s %10.4f %9s %s" %
+              (r["kernel"], r["taken_branches_before"],
+               r["taken_branches_after"],
+               fmt_pct(r["taken_branches_delta_pct"]), r["time_s"],
+               fmt_pct(r["time_delta_pct"]),
+               "ok" if r["output_matches_baseline"] else "MISMATCH"))
+    print()
+    return results
+
+
+# === Main ====================================================================
+def main():
+    args = parse_args()
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    results = []
+    compile_time = []
+    contention = []
+    layout = []
+    if "runtime" in args.suites:
+        results = run_runtime_suite(args)
+    if "compile-time" in args.suites:
+        compile_time = run_compile_time_suite(args)
+    if "contention" in args.suites:
+        contention = run_contention_suite(args)
+    if "layout" in args.suites:
+        layout = run_layout_suite(args)
+
+    report = {
+        "schema_version": SCHEMA_VERSION,
+        "timestamp": datetime.datetime.now(datetime.timezone.utc).isoformat(),
+        "git_revision": git_revision(),
+        "llvm_version": llvm_version(args),
+        "host": {
+            "system": platform.system(),
+            "release": platform.release(),
+            "machine": platform.machine(),
+            "cpu_count": os.cpu_count(),
+        },
+        "repetitions": args.repetitions,
+        "results": results,
+        "compile_time": compile_time,
+        "contention": contention,
+        "layout": layout,
+    }
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+    print("Results written to %s" % args.output)
+
+    mismatches = sum(not r["output_matches_baseline"]
+                     for r in results + layout)
+    if mismatches:
+        sys.exit("error: %d variant(s) changed the program output" % mismatches)
+    lost = sum(r["counts_exact"] is False and r["variant"] != "plain"
+               for r in contention)
+    if lost:
+        sys.exit("error: %d atomic variant(s) lost counter updates" % lost)
+
+
+if __name__ == "__main__":
+    main()
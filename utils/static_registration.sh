@@ -73,6 +73,10 @@ copy_mbasub_into_llvm()
   # Copy the source and test files accross to llvm-project/llvm
   cp "$LLVM_TUTOR_DIR/lib/MBASub.cpp" "$LLVM_PASS_DIR"
   cp "$LLVM_TUTOR_DIR/include/MBASub.h" "$LLVM_PASS_DIR"
+  cp "$LLVM_TUTOR_DIR/lib/MBAUtils.cpp" "$LLVM_PASS_DIR"
+  cp "$LLVM_TUTOR_DIR/include/MBAUtils.h" "$LLVM_PASS_DIR"
+  cp "$LLVM_TUTOR_DIR/lib/PeepholeRewriter.cpp" "$LLVM_PASS_DIR"
+  cp "$LLVM_TUTOR_DIR/include/PeepholeRewriter.h" "$LLVM_PASS_DIR"
   cp "$LLVM_TUTOR_DIR/test/MBA_sub.ll" "$llvm_pass_test_dir"
 }
 
@@ -101,6 +105,8 @@ add_cmake_for_mbasub()
 	if (NOT WIN32)
 		add_llvm_pass_plugin(MBASub
 			MBASub.cpp
+			MBAUtils.cpp
+			PeepholeRewriter.cpp
 			DEPENDS
 			intrinsics_gen
 			BUILDTREE_ONLY